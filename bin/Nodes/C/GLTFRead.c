@@ -9,12 +9,19 @@ typedef struct JobData_t
 {
 	char filename[1024];
 	int targetIndex;
+	unsigned int generation;
 	void *context;
 	void *scene;
 } JobData;
 
 int UploadMeshJob(JobData *data)
 {
+	// a newer read was started for this node, it takes care of the processing state
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+	{
+		FreeScene(data->scene);
+		return EVAL_OK;
+	}
 	SetEvaluationScene(data->context, data->targetIndex, data->scene);
 	SetProcessing(data->context, data->targetIndex, 0);
 	return EVAL_OK;
@@ -22,12 +29,14 @@ int UploadMeshJob(JobData *data)
 
 int ReadJob(JobData *data)
 {
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+		return EVAL_OK;
 	if (ReadGLTF(data->context, data->filename, &data->scene) == EVAL_OK)
 	{
 		JobData dataUp = *data;
 		JobMain(data->context, UploadMeshJob, &dataUp, sizeof(JobData));
 	}
-	else
+	else if (IsJobCurrent(data->context, data->targetIndex, data->generation))
 	{
 		SetProcessing(data->context, data->targetIndex, 0);
 	}
@@ -48,9 +57,9 @@ int main(GLTFRead *param, Evaluation *evaluation, void *context)
 		JobData data;
 		strcpy(data.filename, param->filename);
 		data.targetIndex = target;
+		data.generation = NewJobGeneration(context, target);
 		data.context = context;
-		ReadJob(&data);
-		//Job(context, ReadJob, &data, sizeof(JobData));
+		Job(context, ReadJob, &data, sizeof(JobData));
 	}
 
 	return EVAL_OK;
@@ -18,12 +18,19 @@ typedef struct JobData_t
 	int targetIndex;
 	int face;
 	int isCube;
+	unsigned int generation;
 	void *context;
 	Image image;
 } JobData;
 
 int UploadImageJob(JobData *data)
 {
+	// a newer read was started for this node, it takes care of the processing state
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+	{
+		FreeImage(&data->image);
+		return EVAL_OK;
+	}
 	if (data->isCube)
 	{
 		SetEvaluationImageCube(data->context, data->targetIndex, &data->image, data->face);
@@ -39,12 +46,14 @@ int UploadImageJob(JobData *data)
 
 int ReadJob(JobData *data)
 {
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+		return EVAL_OK;
 	if (ReadImage(data->context, data->filename, &data->image) == EVAL_OK)
 	{
 		JobData dataUp = *data;
 		JobMain(data->context, UploadImageJob, &dataUp, sizeof(JobData));
 	}
-	else
+	else if (IsJobCurrent(data->context, data->targetIndex, data->generation))
 		SetProcessing(data->context, data->targetIndex, 0);
 	return EVAL_OK;
 }
@@ -52,6 +61,7 @@ int ReadJob(JobData *data)
 int main(ImageRead *param, Evaluation *evaluation, void *context)
 {
 	int i;
+	unsigned int generation;
 	char *files[6] = {param->posxfile, param->negxfile, param->negyfile, param->posyfile, param->poszfile, param->negzfile};
 	
 	if (!(evaluation->dirtyFlag & DirtyParameter))
@@ -65,6 +75,7 @@ int main(ImageRead *param, Evaluation *evaluation, void *context)
 		data.targetIndex = evaluation->targetIndex;
 		data.face = 0;
 		data.isCube = 0;
+		data.generation = NewJobGeneration(context, evaluation->targetIndex);
 		data.image.bits = 0;
 		data.context = context;
 		Job(context, ReadJob, &data, sizeof(JobData));
@@ -77,6 +88,8 @@ int main(ImageRead *param, Evaluation *evaluation, void *context)
 				return EVAL_OK;
 		}
 		SetProcessing(context, evaluation->targetIndex, 1);
+		// the 6 faces are parts of the same job
+		generation = NewJobGeneration(context, evaluation->targetIndex);
 		for (i = 0;i<6;i++)
 		{
 			JobData data;
@@ -84,6 +97,7 @@ int main(ImageRead *param, Evaluation *evaluation, void *context)
 			data.targetIndex = evaluation->targetIndex;
 			data.face = CUBEMAP_POSX + i;
 			data.isCube = 1;
+			data.generation = generation;
 			data.image.bits = 0;
 			data.context = context;
 			Job(context, ReadJob, &data, sizeof(JobData));
@@ -8,6 +8,8 @@ typedef struct ImageWrite_t
 	int quality;
 	int width, height;
 	int mode;
+	int compression;
+	int mipmaps;
 }ImageWrite;
 
 int main(ImageWrite *param, Evaluation *evaluation, void *context)
@@ -47,7 +49,10 @@ int main(ImageWrite *param, Evaluation *evaluation, void *context)
 	image.bits = 0;
 	if (Evaluate(context, evaluation->inputIndices[0], param->width, param->height, &image) == EVAL_OK)
 	{
-		if (WriteImage(context, param->filename, &image, param->format, param->quality) == EVAL_OK)
+		// DDS and KTX can store mipmaps
+		if (param->mipmaps && (param->format == 5 || param->format == 6))
+			GenerateImageMips(&image, 0);
+		if (WriteImageEx(context, param->filename, &image, param->format, param->quality, param->compression) == EVAL_OK)
 		{	
 			FreeImage(&image);
 			Log("Image %s saved.\n", param->filename);
@@ -106,8 +106,23 @@ int vertexSpace_World = 1;
 
 // call FreeImage when done
 int ReadImage(void* context, char *filename, Image *image);
+// ReadImage with flags (ReadImageKeepPrecision keeps 16bits and float texels)
+// and maxSize > 0 to decode a preview no larger than maxSize
+int ReadImageKeepPrecision = (1 << 0);
+int ReadImageEx(void* context, char *filename, Image *image, int flags, int maxSize);
 // writes an allocated image
 int WriteImage(void* context, char *filename, Image *image, int format, int quality);
+// DDS and KTX formats can be block compressed. quality selects the compression speed/quality preset
+enum ImageCompression
+{
+	COMPRESSION_NONE,
+	COMPRESSION_BC1,
+	COMPRESSION_BC3,
+	COMPRESSION_BC4, // red channel
+	COMPRESSION_BC5, // red and green channels
+	COMPRESSION_BC7,
+};
+int WriteImageEx(void* context, char *filename, Image *image, int format, int quality, int compression);
 // call FreeImage when done
 int GetEvaluationImage(void* context, int target, Image *image);
 // 
@@ -117,9 +132,21 @@ int SetEvaluationImageCube(void* context, int target, Image *image, int cubeFace
 // set the bits pointer with an allocated memory
 int AllocateImage(Image *image);
 int FreeImage(Image *image);
+// parsed documents are cached, dpi 96 rasterizes at the document size
 int LoadSVG(const char *filename, Image *image, float dpi);
 
-// Image resize
+// Image processing on CPU. Images are processed in place or the destination is allocated (call FreeImage when done)
+// destination can be the source image
+int ImageFilterBox = 0;
+int ImageFilterLanczos = 1;
+int ResizeImage(Image *source, Image *destination, int width, int height, int filter);
+int ConvertImage(Image *source, Image *destination, int format);
+int FlipImage(Image *image);
+int PremultiplyImage(Image *image);
+int UnpremultiplyImage(Image *image);
+// mipCount 0 for the full mip chain
+int GenerateImageMips(Image *image, int mipCount);
+
 // Image thumbnail
 int SetThumbnailImage(void *context, Image *image);
 
@@ -138,10 +165,35 @@ int SetEvaluationSize(void *context, int target, int imageWidth, int imageHeight
 int SetEvaluationCubeSize(void *context, int target, int faceWidth, int mipmapCount);
 
 int OverrideInput(void *context, int target, int inputIndex, int newInputTarget);
+
+// Cubemap filtering on CPU, image must have 6 square faces. Filtered image keeps the format of the source.
+// faceSize 0 keeps the source face size.
+enum LightingModel
+{
+	LIGHTING_PHONG,
+	LIGHTING_PHONG_BRDF,
+	LIGHTING_BLINN,
+	LIGHTING_BLINN_BRDF,
+	LIGHTING_GGX,
+};
+// prefiltered radiance with a full mip chain. specular power is 2^(glossScale * glossiness + glossBias)
+// with glossiness from 1 (first mip) to 0 (last mip). excludeBase keeps the source in the first mip
 int CubemapFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias);
+// diffuse irradiance from spherical harmonics
+int CubemapIrradiance(Image *image, int faceSize);
 
 int Job(void *context, int(*jobFunction)(void*), void *ptr, unsigned int size);
 int JobMain(void *context, int(*jobMainFunction)(void*), void *ptr, unsigned int size);
+// a job keeps the generation returned by NewJobGeneration when it's started. Starting another job for the same target
+// supersedes it: IsJobCurrent returns 0, the job can stop early and should drop its result
+unsigned int NewJobGeneration(void *context, int target);
+int IsJobCurrent(void *context, int target, unsigned int generation);
+// data parallel loop over [0, count). parallelFunction gets ranges of at least grainSize elements (0 picks a size)
+// on all the task threads, threadIndex is for per thread buffers. Returns EVAL_ERR if any range did
+int ParallelFor(void *context, int count, int grainSize, int(*parallelFunction)(int begin, int end, int threadIndex, void *userData), void *userData);
+// same without waiting. ParallelForWait returns the result when every range is done and releases the handle
+void* ParallelForAsync(void *context, int count, int grainSize, int(*parallelFunction)(int begin, int end, int threadIndex, void *userData), void *userData);
+int ParallelForWait(void *parallelFor);
 // processing values:
 // 0 : no more processing, display node as normal
 // 1 : processing with an animation for node display
@@ -162,8 +214,11 @@ char* GetEvaluationSceneName(void *context, int target);
 int GetEvaluationRenderer(void *context, int target, void **renderer);
 int InitRenderer(void *context, int target, int mode, void *scene);
 int UpdateRenderer(void *context, int target);
+int SetRendererDenoise(void *context, int target, int iterations, float noiseThreshold);
 
 int ReadGLTF(void *evaluationContext, char *filename, void **scene);
+// releases a scene from ReadGLTF that wasn't given to SetEvaluationScene
+void FreeScene(void *scene);
 
 	
 #define EVAL_OK 0
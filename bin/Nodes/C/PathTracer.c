@@ -3,6 +3,8 @@
 typedef struct PathTracer_t
 {
 	int mode;
+	int denoise;
+	float noiseThreshold;
 } PathTracer;
 
 int main(PathTracer *param, Evaluation *evaluation, void *context)
@@ -19,9 +21,10 @@ int main(PathTracer *param, Evaluation *evaluation, void *context)
 		return EVAL_ERR;
 	if (!renderer)
 	{
-		if (InitRenderer(context, evaluation->targetIndex, 0, scene) != EVAL_OK)
+		if (InitRenderer(context, evaluation->targetIndex, param->mode, scene) != EVAL_OK)
 			return EVAL_ERR;
 	}
+	SetRendererDenoise(context, evaluation->targetIndex, param->denoise, param->noiseThreshold);
 	SetEvaluationSize(context, evaluation->targetIndex, 1024, 1024);
 	SetProcessing(context, evaluation->targetIndex, 2);
 	
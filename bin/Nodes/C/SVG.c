@@ -6,19 +6,63 @@ typedef struct SVG_t
 	float dpi;
 } SVG;
 
-int main(SVG *param, Evaluation *evaluation, void *context)
+typedef struct JobData_t
 {
+	char filename[1024];
+	float dpi;
+	int targetIndex;
+	unsigned int generation;
+	void *context;
 	Image image;
-	image.bits = 0;
+} JobData;
+
+int UploadImageJob(JobData *data)
+{
+	// a newer rasterization was started for this node, it takes care of the processing state
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+	{
+		FreeImage(&data->image);
+		return EVAL_OK;
+	}
+	SetEvaluationImage(data->context, data->targetIndex, &data->image);
+	FreeImage(&data->image);
+	SetProcessing(data->context, data->targetIndex, 0);
+	return EVAL_OK;
+}
+
+int RasterizeJob(JobData *data)
+{
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+		return EVAL_OK;
+	if (LoadSVG(data->filename, &data->image, data->dpi) == EVAL_OK)
+	{
+		JobData dataUp = *data;
+		JobMain(data->context, UploadImageJob, &dataUp, sizeof(JobData));
+	}
+	else if (IsJobCurrent(data->context, data->targetIndex, data->generation))
+		SetProcessing(data->context, data->targetIndex, 0);
+	return EVAL_OK;
+}
+
+int main(SVG *param, Evaluation *evaluation, void *context)
+{
 	if (param->dpi <= 1.f)
 		param->dpi = 96.f;
 
+	if (!(evaluation->dirtyFlag & DirtyParameter))
+		return EVAL_OK;
+
 	if (strlen(param->filename))
 	{
-		if (LoadSVG(param->filename, &image, param->dpi) == EVAL_OK)
-		{
-			SetEvaluationImage(context, evaluation->targetIndex, &image);
-		}
+		SetProcessing(context, evaluation->targetIndex, 1);
+		JobData data;
+		strcpy(data.filename, param->filename);
+		data.dpi = param->dpi;
+		data.targetIndex = evaluation->targetIndex;
+		data.generation = NewJobGeneration(context, evaluation->targetIndex);
+		data.context = context;
+		data.image.bits = 0;
+		Job(context, RasterizeJob, &data, sizeof(JobData));
 	}
 	return EVAL_OK;
 }
\ No newline at end of file
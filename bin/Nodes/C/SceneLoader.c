@@ -9,17 +9,42 @@ typedef struct JobData_t
 {
 	char filename[1024];
 	int targetIndex;
+	unsigned int generation;
 	void *context;
 } JobData;
 
-int ReadSceneJob(JobData *data)
+typedef struct SceneJobData_t
 {
 	void *scene;
-	if (LoadScene(data->filename, &scene) == EVAL_OK)
+	int targetIndex;
+	unsigned int generation;
+	void *context;
+} SceneJobData;
+
+int SetSceneJob(SceneJobData *data)
+{
+	// a newer load was started for this node, it takes care of the processing state. The scene stays in the cache
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+		return EVAL_OK;
+	SetEvaluationRTScene(data->context, data->targetIndex, data->scene);
+	SetProcessing(data->context, data->targetIndex, 0);
+	return EVAL_OK;
+}
+
+int ReadSceneJob(JobData *data)
+{
+	SceneJobData sceneData;
+	if (!IsJobCurrent(data->context, data->targetIndex, data->generation))
+		return EVAL_OK;
+	if (LoadScene(data->filename, &sceneData.scene) == EVAL_OK)
 	{
-		SetEvaluationRTScene(data->context, data->targetIndex, scene);
+		sceneData.targetIndex = data->targetIndex;
+		sceneData.generation = data->generation;
+		sceneData.context = data->context;
+		JobMain(data->context, SetSceneJob, &sceneData, sizeof(SceneJobData));
 	}
-	SetProcessing(data->context, data->targetIndex, 0);
+	else if (IsJobCurrent(data->context, data->targetIndex, data->generation))
+		SetProcessing(data->context, data->targetIndex, 0);
 	return EVAL_OK;
 }
 
@@ -31,6 +56,7 @@ int main(SceneLoader *param, Evaluation *evaluation, void *context)
 		JobData data;
 		strcpy(data.filename, param->filename);
 		data.targetIndex = evaluation->targetIndex;
+		data.generation = NewJobGeneration(context, evaluation->targetIndex);
 		data.context = context;
 		Job(context, ReadSceneJob, &data, sizeof(JobData));
 	}
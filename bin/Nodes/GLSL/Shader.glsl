@@ -37,6 +37,7 @@ layout(location = 0)in vec2 inUV;
 layout(location = 1)in vec4 inColor;
 layout(location = 2)in vec3 inPosition;
 layout(location = 3)in vec3 inNormal;
+layout(location = 4)in mat4 inModel; // per instance world transform
 
 out vec2 vUV;
 out vec3 vWorldPosition;
@@ -46,7 +47,7 @@ void main()
 {
 	if (EvaluationParam.mVertexSpace == 1)
     {
-		gl_Position = EvaluationParam.modelViewProjection * vec4(inPosition.xyz, 1.0);
+		gl_Position = EvaluationParam.viewProjection * inModel * vec4(inPosition.xyz, 1.0);
 	}
 	else
 	{
@@ -55,8 +56,8 @@ void main()
 	
 	vUV = inUV;
 	vColor = inColor;
-	vWorldNormal = (EvaluationParam.model * vec4(inNormal, 0.0)).xyz;
-	vWorldPosition = (EvaluationParam.model * vec4(inPosition, 1.0)).xyz;
+	vWorldNormal = (inModel * vec4(inNormal, 0.0)).xyz;
+	vWorldPosition = (inModel * vec4(inPosition, 1.0)).xyz;
 }
 
 #endif
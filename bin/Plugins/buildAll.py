@@ -1,13 +1,18 @@
 import Imogen
+import threading
 
 def buildAll():
 
 	libGraphs = Imogen.GetLibraryGraphs()
-	for graphName in libGraphs:
-		graph = Imogen.GetGraph(graphName)
-		graph.Build()
+	futures = [Imogen.GetGraph(graphName).BuildAsync() for graphName in libGraphs]
 
-	Imogen.Log("Build Done!\n")
+	# wait on a thread so the UI keeps running while the builder works
+	def waitBuilds():
+		for future in futures:
+			future.result()
+		Imogen.Log("Build Done!\n")
+
+	threading.Thread(target=waitBuilds).start()
 
 
 Imogen.RegisterPlugin("Build All Materials", "import Plugins.buildAll as plg\nplg.buildAll()") 
\ No newline at end of file
@@ -0,0 +1,1264 @@
+#include "Platform.h"
+#include "Config.h"
+#include "CPURenderer.h"
+#include "Camera.h"
+#include "Denoiser.h"
+#include <algorithm>
+
+extern TaskScheduler g_TS;
+
+namespace GLSLPathTracer
+{
+    static const float PI = 3.14159265358979323f;
+    static const float TWO_PI = 6.28318530717958648f;
+    static const float INFINITY_DIST = 1000000.f;
+    static const float EPS = 0.001f;
+    static const int TileSize = 16;
+    static const int StackSize = 128;
+
+    //-----------------------------------------------------------------------
+    // 4 lanes of floats. Comparisons return lane masks, only used with And, Select and Mask
+    //-----------------------------------------------------------------------
+#if IMOGEN_SSE2
+    typedef __m128 Lanes;
+
+    static inline Lanes Splat(float value) { return _mm_set1_ps(value); }
+    static inline Lanes SetLanes(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+    static inline void StoreLanes(float* values, Lanes lanes) { _mm_storeu_ps(values, lanes); }
+    static inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+    static inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+    static inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+    static inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+    static inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+    static inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+    static inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+    static inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+    static inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+    static inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static inline int Mask(Lanes mask) { return _mm_movemask_ps(mask); }
+#else
+    struct Lanes
+    {
+        float v[4];
+    };
+
+    static inline Lanes Splat(float value) { return { { value, value, value, value } }; }
+    static inline Lanes SetLanes(float a, float b, float c, float d) { return { { a, b, c, d } }; }
+    static inline void StoreLanes(float* values, Lanes lanes) { memcpy(values, lanes.v, sizeof(lanes.v)); }
+#define LANES_OP(name, expression) \
+    static inline Lanes name(Lanes a, Lanes b) \
+    { \
+        Lanes res; \
+        for (int i = 0; i < 4; i++) \
+            res.v[i] = expression; \
+        return res; \
+    }
+    LANES_OP(Add, a.v[i] + b.v[i])
+    LANES_OP(Sub, a.v[i] - b.v[i])
+    LANES_OP(Mul, a.v[i] * b.v[i])
+    LANES_OP(Div, a.v[i] / b.v[i])
+    LANES_OP(Min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+    LANES_OP(Max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+    LANES_OP(Less, a.v[i] < b.v[i] ? 1.f : 0.f)
+    LANES_OP(LessEqual, a.v[i] <= b.v[i] ? 1.f : 0.f)
+    LANES_OP(And, (a.v[i] != 0.f && b.v[i] != 0.f) ? 1.f : 0.f)
+#undef LANES_OP
+    static inline Lanes Select(Lanes mask, Lanes a, Lanes b)
+    {
+        Lanes res;
+        for (int i = 0; i < 4; i++)
+            res.v[i] = (mask.v[i] != 0.f) ? a.v[i] : b.v[i];
+        return res;
+    }
+    static inline int Mask(Lanes mask)
+    {
+        int res = 0;
+        for (int i = 0; i < 4; i++)
+            res |= (mask.v[i] != 0.f) ? (1 << i) : 0;
+        return res;
+    }
+#endif
+
+    static inline int BitCount(int mask)
+    {
+        return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+    }
+
+    struct CPURenderer::RayPacket
+    {
+        Lanes origin[3];
+        Lanes direction[3];
+        Lanes invDirection[3];
+        Lanes t; // closest hit, or maximum distance for occlusion. 0 for inactive lanes
+        Lanes u, v;
+        int triangle[4];
+    };
+
+    static void SetupPacket(CPURenderer::RayPacket& packet, const glm::vec3* origins, const glm::vec3* directions, const float* maxDist, int activeMask)
+    {
+        float values[3][3][4];
+        float t[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            bool active = (activeMask & (1 << lane)) != 0;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                // avoids 0 * inf in the slab test
+                float direction = directions[lane][axis];
+                if (fabsf(direction) < 1e-12f)
+                    direction = (direction < 0.f) ? -1e-12f : 1e-12f;
+                values[0][axis][lane] = origins[lane][axis];
+                values[1][axis][lane] = direction;
+                values[2][axis][lane] = 1.f / direction;
+            }
+            t[lane] = active ? maxDist[lane] : 0.f;
+            packet.triangle[lane] = -1;
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            packet.origin[axis] = SetLanes(values[0][axis][0], values[0][axis][1], values[0][axis][2], values[0][axis][3]);
+            packet.direction[axis] = SetLanes(values[1][axis][0], values[1][axis][1], values[1][axis][2], values[1][axis][3]);
+            packet.invDirection[axis] = SetLanes(values[2][axis][0], values[2][axis][1], values[2][axis][2], values[2][axis][3]);
+        }
+        packet.t = SetLanes(t[0], t[1], t[2], t[3]);
+        packet.u = packet.v = Splat(0.f);
+    }
+
+    static inline Lanes IntersectBox(const CPURenderer::RayPacket& packet, const glm::vec3& bboxMin, const glm::vec3& bboxMax, Lanes& nearDist)
+    {
+        Lanes nearT = Splat(0.f);
+        Lanes farT = packet.t;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            Lanes t0 = Mul(Sub(Splat(bboxMin[axis]), packet.origin[axis]), packet.invDirection[axis]);
+            Lanes t1 = Mul(Sub(Splat(bboxMax[axis]), packet.origin[axis]), packet.invDirection[axis]);
+            nearT = Max(nearT, Min(t0, t1));
+            farT = Min(farT, Max(t0, t1));
+        }
+        nearDist = nearT;
+        return LessEqual(nearT, farT);
+    }
+
+    // Moller-Trumbore, same as the shaders. Returns the lanes hit closer than packet.t
+    static inline Lanes IntersectTriangle(const CPURenderer::RayPacket& packet, const glm::vec3& v0, const glm::vec3& e0, const glm::vec3& e1, Lanes& t, Lanes& u, Lanes& v)
+    {
+        const Lanes* d = packet.direction;
+        Lanes e0x = Splat(e0.x), e0y = Splat(e0.y), e0z = Splat(e0.z);
+        Lanes e1x = Splat(e1.x), e1y = Splat(e1.y), e1z = Splat(e1.z);
+
+        Lanes pvx = Sub(Mul(d[1], e1z), Mul(d[2], e1y));
+        Lanes pvy = Sub(Mul(d[2], e1x), Mul(d[0], e1z));
+        Lanes pvz = Sub(Mul(d[0], e1y), Mul(d[1], e1x));
+        Lanes det = Add(Add(Mul(e0x, pvx), Mul(e0y, pvy)), Mul(e0z, pvz));
+        Lanes invDet = Div(Splat(1.f), det);
+
+        Lanes tvx = Sub(packet.origin[0], Splat(v0.x));
+        Lanes tvy = Sub(packet.origin[1], Splat(v0.y));
+        Lanes tvz = Sub(packet.origin[2], Splat(v0.z));
+        u = Mul(Add(Add(Mul(tvx, pvx), Mul(tvy, pvy)), Mul(tvz, pvz)), invDet);
+
+        Lanes qvx = Sub(Mul(tvy, e0z), Mul(tvz, e0y));
+        Lanes qvy = Sub(Mul(tvz, e0x), Mul(tvx, e0z));
+        Lanes qvz = Sub(Mul(tvx, e0y), Mul(tvy, e0x));
+        v = Mul(Add(Add(Mul(d[0], qvx), Mul(d[1], qvy)), Mul(d[2], qvz)), invDet);
+        t = Mul(Add(Add(Mul(e1x, qvx), Mul(e1y, qvy)), Mul(e1z, qvz)), invDet);
+
+        Lanes zero = Splat(0.f);
+        Lanes hit = And(LessEqual(zero, u), LessEqual(zero, v));
+        hit = And(hit, LessEqual(Add(u, v), Splat(1.f)));
+        hit = And(hit, Less(zero, t));
+        return And(hit, Less(t, packet.t));
+    }
+
+    void CPURenderer::intersect(RayPacket& packet) const
+    {
+        int stack[StackSize];
+        int stackSize = 0;
+        int nodeIndex = 0;
+        while (true)
+        {
+            const Node& node = nodes[nodeIndex];
+            if (node.left < 0)
+            {
+                for (int i = node.triangleStart; i < node.triangleStart + node.triangleCount; i++)
+                {
+                    const Triangle& triangle = triangles[i];
+                    Lanes t, u, v;
+                    Lanes hit = IntersectTriangle(packet, triangle.v0, triangle.e0, triangle.e1, t, u, v);
+                    int hitMask = Mask(hit);
+                    if (!hitMask)
+                        continue;
+                    packet.t = Select(hit, t, packet.t);
+                    packet.u = Select(hit, u, packet.u);
+                    packet.v = Select(hit, v, packet.v);
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        if (hitMask & (1 << lane))
+                            packet.triangle[lane] = i;
+                    }
+                }
+            }
+            else
+            {
+                const Node& left = nodes[node.left];
+                const Node& right = nodes[node.right];
+                Lanes nearLeft, nearRight;
+                Lanes hitLeft = IntersectBox(packet, left.bboxMin, left.bboxMax, nearLeft);
+                Lanes hitRight = IntersectBox(packet, right.bboxMin, right.bboxMax, nearRight);
+                int leftMask = Mask(hitLeft);
+                int rightMask = Mask(hitRight);
+                if (leftMask && rightMask)
+                {
+                    // nearest child first for most of the lanes hitting both
+                    Lanes both = And(hitLeft, hitRight);
+                    int rightFirst = Mask(And(both, Less(nearRight, nearLeft)));
+                    bool swapChildren = BitCount(rightFirst) * 2 > BitCount(Mask(both));
+                    if (stackSize < StackSize)
+                        stack[stackSize++] = swapChildren ? node.left : node.right;
+                    nodeIndex = swapChildren ? node.right : node.left;
+                    continue;
+                }
+                else if (leftMask)
+                {
+                    nodeIndex = node.left;
+                    continue;
+                }
+                else if (rightMask)
+                {
+                    nodeIndex = node.right;
+                    continue;
+                }
+            }
+            if (!stackSize)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+    }
+
+    int CPURenderer::occluded(RayPacket& packet) const
+    {
+        int activeMask = Mask(Less(Splat(0.f), packet.t));
+        int occludedMask = 0;
+        int stack[StackSize];
+        int stackSize = 0;
+        int nodeIndex = 0;
+        while (activeMask)
+        {
+            const Node& node = nodes[nodeIndex];
+            if (node.left < 0)
+            {
+                for (int i = node.triangleStart; i < node.triangleStart + node.triangleCount && activeMask; i++)
+                {
+                    const Triangle& triangle = triangles[i];
+                    Lanes t, u, v;
+                    Lanes hit = IntersectTriangle(packet, triangle.v0, triangle.e0, triangle.e1, t, u, v);
+                    int hitMask = Mask(hit);
+                    if (!hitMask)
+                        continue;
+                    // occluded lanes are done
+                    packet.t = Select(hit, Splat(0.f), packet.t);
+                    occludedMask |= hitMask;
+                    activeMask &= ~hitMask;
+                }
+            }
+            else
+            {
+                const Node& left = nodes[node.left];
+                const Node& right = nodes[node.right];
+                Lanes nearLeft, nearRight;
+                int leftMask = Mask(IntersectBox(packet, left.bboxMin, left.bboxMax, nearLeft));
+                int rightMask = Mask(IntersectBox(packet, right.bboxMin, right.bboxMax, nearRight));
+                if (leftMask && rightMask)
+                {
+                    if (stackSize < StackSize)
+                        stack[stackSize++] = node.right;
+                    nodeIndex = node.left;
+                    continue;
+                }
+                else if (leftMask)
+                {
+                    nodeIndex = node.left;
+                    continue;
+                }
+                else if (rightMask)
+                {
+                    nodeIndex = node.right;
+                    continue;
+                }
+            }
+            if (!stackSize)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+        return occludedMask;
+    }
+
+    //-----------------------------------------------------------------------
+    // Scalar shading, ported from PathTraceFrag.glsl
+    //-----------------------------------------------------------------------
+    static inline float Random(unsigned int& seed)
+    {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return float(seed >> 8) * (1.f / 16777216.f);
+    }
+
+    static inline unsigned int Hash(unsigned int value)
+    {
+        value = (value ^ 61) ^ (value >> 16);
+        value *= 9;
+        value = value ^ (value >> 4);
+        value *= 0x27d4eb2d;
+        value = value ^ (value >> 15);
+        return value ? value : 1;
+    }
+
+    struct State
+    {
+        glm::vec3 normal;
+        glm::vec3 ffnormal;
+        glm::vec3 fhp;
+        glm::vec2 texCoord;
+        glm::vec3 bary;
+        int triID;
+        int matID;
+        MaterialData mat;
+    };
+
+    struct LightSampleRec
+    {
+        glm::vec3 surfacePos;
+        glm::vec3 normal;
+        glm::vec3 emission;
+        float pdf;
+    };
+
+    static float SphereIntersect(float rad, const glm::vec3& pos, const glm::vec3& origin, const glm::vec3& direction)
+    {
+        glm::vec3 op = pos - origin;
+        float b = glm::dot(op, direction);
+        float det = b * b - glm::dot(op, op) + rad * rad;
+        if (det < 0.f)
+            return INFINITY_DIST;
+
+        det = sqrtf(det);
+        float t1 = b - det;
+        if (t1 > EPS)
+            return t1;
+
+        float t2 = b + det;
+        if (t2 > EPS)
+            return t2;
+
+        return INFINITY_DIST;
+    }
+
+    static float RectIntersect(const glm::vec3& pos, const glm::vec3& u, const glm::vec3& v, const glm::vec4& plane, const glm::vec3& origin, const glm::vec3& direction)
+    {
+        glm::vec3 n = glm::vec3(plane);
+        float dt = glm::dot(direction, n);
+        float t = (plane.w - glm::dot(n, origin)) / dt;
+        if (t > EPS)
+        {
+            glm::vec3 p = origin + direction * t;
+            glm::vec3 vi = p - pos;
+            float a1 = glm::dot(u, vi);
+            if (a1 >= 0.f && a1 <= 1.f)
+            {
+                float a2 = glm::dot(v, vi);
+                if (a2 >= 0.f && a2 <= 1.f)
+                    return t;
+            }
+        }
+        return INFINITY_DIST;
+    }
+
+    // analytic lights closer than t
+    static bool IntersectLights(const std::vector<LightData>& lights, const glm::vec3& origin, const glm::vec3& direction, float& t, LightSampleRec& lightSampleRec)
+    {
+        bool isEmitter = false;
+        for (const LightData& light : lights)
+        {
+            float d = INFINITY_DIST;
+            float pdf = 0.f;
+            if (light.radiusAreaType.z == 0.f) // Rectangular Area Light
+            {
+                glm::vec3 normal = glm::normalize(glm::cross(light.u, light.v));
+                if (glm::dot(normal, direction) > 0.f) // Hide backfacing quad light
+                    continue;
+                glm::vec4 plane = glm::vec4(normal, glm::dot(normal, light.position));
+                glm::vec3 u = light.u * (1.f / glm::dot(light.u, light.u));
+                glm::vec3 v = light.v * (1.f / glm::dot(light.v, light.v));
+                d = RectIntersect(light.position, u, v, plane, origin, direction);
+                pdf = (d * d) / (light.radiusAreaType.y * glm::dot(-direction, normal));
+            }
+            else if (light.radiusAreaType.z == 1.f) // Spherical Area Light
+            {
+                d = SphereIntersect(light.radiusAreaType.x, light.position, origin, direction);
+                pdf = (d * d) / light.radiusAreaType.y;
+            }
+            if (d < t)
+            {
+                t = d;
+                lightSampleRec.emission = light.emission;
+                lightSampleRec.pdf = pdf;
+                isEmitter = true;
+            }
+        }
+        return isEmitter;
+    }
+
+    static inline int WrapTexel(int coord, int size)
+    {
+        coord %= size;
+        return (coord < 0) ? coord + size : coord;
+    }
+
+    // bilinear filtering with repeat wrapping, like the texture arrays samplers
+    static glm::vec3 SampleTexture(const unsigned char* textures, const glm::ivec2& size, int layer, const glm::vec2& uv)
+    {
+        float x = uv.x * size.x - 0.5f;
+        float y = uv.y * size.y - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        int x0 = WrapTexel(int(fx), size.x), x1 = WrapTexel(int(fx) + 1, size.x);
+        int y0 = WrapTexel(int(fy), size.y), y1 = WrapTexel(int(fy) + 1, size.y);
+        float tx = x - fx;
+        float ty = y - fy;
+        const unsigned char* base = textures + size_t(layer) * size.x * size.y * 3;
+        auto texel = [&](int tx, int ty) {
+            const unsigned char* p = base + (size_t(ty) * size.x + tx) * 3;
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+        glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+        return glm::mix(top, bottom, ty) * (1.f / 255.f);
+    }
+
+    static glm::vec3 SampleHDR(const HDRLoaderResult& hdr, const glm::vec2& uv)
+    {
+        float x = uv.x * hdr.width - 0.5f;
+        float y = uv.y * hdr.height - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        int x0 = WrapTexel(int(fx), hdr.width), x1 = WrapTexel(int(fx) + 1, hdr.width);
+        int y0 = WrapTexel(int(fy), hdr.height), y1 = WrapTexel(int(fy) + 1, hdr.height);
+        float tx = x - fx;
+        float ty = y - fy;
+        auto texel = [&](int tx, int ty) {
+            const float* p = hdr.cols + (size_t(ty) * hdr.width + tx) * 3;
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+        glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+        glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+        return glm::mix(top, bottom, ty);
+    }
+
+    // nearest filtering, like the distribution samplers
+    static inline glm::vec2 MarginalDist(const HDRLoaderResult& hdr, float v)
+    {
+        int y = std::min(std::max(int(v * hdr.height), 0), hdr.height - 1);
+        return hdr.marginalDistData[y];
+    }
+
+    static inline glm::vec2 ConditionalDist(const HDRLoaderResult& hdr, const glm::vec2& uv)
+    {
+        int x = std::min(std::max(int(uv.x * hdr.width), 0), hdr.width - 1);
+        int y = std::min(std::max(int(uv.y * hdr.height), 0), hdr.height - 1);
+        return hdr.conditionalDistData[y * hdr.width + x];
+    }
+
+    static inline glm::vec2 EnvUV(const glm::vec3& direction)
+    {
+        return glm::vec2((PI + atan2f(direction.z, direction.x)) * (1.f / TWO_PI), acosf(glm::clamp(direction.y, -1.f, 1.f)) * (1.f / PI));
+    }
+
+    static float EnvPdf(const HDRLoaderResult& hdr, const glm::vec3& direction)
+    {
+        glm::vec2 uv = EnvUV(direction);
+        float pdf = ConditionalDist(hdr, uv).y * MarginalDist(hdr, uv.y).y;
+        return (pdf * float(hdr.width * hdr.height)) / (2.f * PI * PI * sinf(uv.y * PI));
+    }
+
+    static glm::vec4 EnvSample(const HDRLoaderResult& hdr, float hdrMultiplier, glm::vec3& color, unsigned int& seed)
+    {
+        float r1 = Random(seed);
+        float r2 = Random(seed);
+
+        float v = MarginalDist(hdr, r1).x;
+        float u = ConditionalDist(hdr, glm::vec2(r2, v)).x;
+
+        color = SampleHDR(hdr, glm::vec2(u, v)) * hdrMultiplier;
+        float pdf = ConditionalDist(hdr, glm::vec2(u, v)).y * MarginalDist(hdr, v).y;
+
+        float phi = u * TWO_PI;
+        float theta = v * PI;
+
+        if (sinf(theta) == 0.f)
+            pdf = 0.f;
+
+        return glm::vec4(-sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi), (pdf * float(hdr.width * hdr.height)) / (2.f * PI * PI * sinf(theta)));
+    }
+
+    static glm::vec3 CosineSampleHemisphere(float u1, float u2)
+    {
+        glm::vec3 dir;
+        float r = sqrtf(u1);
+        float phi = 2.f * PI * u2;
+        dir.x = r * cosf(phi);
+        dir.y = r * sinf(phi);
+        dir.z = sqrtf(std::max(0.f, 1.f - dir.x * dir.x - dir.y * dir.y));
+        return dir;
+    }
+
+    static glm::vec3 UniformSampleSphere(float u1, float u2)
+    {
+        float z = 1.f - 2.f * u1;
+        float r = sqrtf(std::max(0.f, 1.f - z * z));
+        float phi = 2.f * PI * u2;
+        return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+    }
+
+    static inline void OrthonormalBasis(const glm::vec3& n, glm::vec3& tangentX, glm::vec3& tangentY)
+    {
+        glm::vec3 upVector = fabsf(n.z) < 0.999f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(1.f, 0.f, 0.f);
+        tangentX = glm::normalize(glm::cross(upVector, n));
+        tangentY = glm::cross(n, tangentX);
+    }
+
+    static void GetNormalAndTexCoord(const Scene* scene, State& state, const glm::vec3& direction)
+    {
+        const NormalTexData& data = scene->normalTexData[state.triID];
+        state.matID = int(data.texCoords[0].z);
+        state.texCoord = glm::vec2(data.texCoords[0]) * state.bary.x + glm::vec2(data.texCoords[1]) * state.bary.y + glm::vec2(data.texCoords[2]) * state.bary.z;
+
+        glm::vec3 normal = glm::normalize(data.normals[0] * state.bary.x + data.normals[1] * state.bary.y + data.normals[2] * state.bary.z);
+        state.normal = normal;
+        state.ffnormal = glm::dot(normal, direction) <= 0.f ? normal : -normal;
+    }
+
+    static void GetMaterialsAndTextures(const Scene* scene, State& state, const glm::vec3& direction)
+    {
+        MaterialData mat = scene->materialData[state.matID];
+        const TexData& texData = scene->texData;
+        glm::vec2 texUV = state.texCoord;
+
+        int albedoID = int(mat.texIDs.x);
+        if (albedoID >= 0 && albedoID < texData.albedoTexCount)
+        {
+            glm::vec3 albedo = glm::pow(SampleTexture(texData.albedoTextures, texData.albedoTextureSize, albedoID, texUV), glm::vec3(2.2f));
+            mat.albedo = glm::vec4(glm::vec3(mat.albedo) * albedo, mat.albedo.w);
+        }
+
+        int metallicRoughnessID = int(mat.texIDs.y);
+        if (metallicRoughnessID >= 0 && metallicRoughnessID < texData.metallicRoughnessTexCount)
+        {
+            glm::vec3 metallicRoughness = SampleTexture(texData.metallicRoughnessTextures, texData.metallicRoughnessTextureSize, metallicRoughnessID, texUV);
+            mat.params.x = powf(metallicRoughness.z, 2.2f);
+            mat.params.y = powf(metallicRoughness.y, 2.2f);
+        }
+
+        int normalID = int(mat.texIDs.z);
+        if (normalID >= 0 && normalID < texData.normalTexCount)
+        {
+            glm::vec3 nrm = SampleTexture(texData.normalTextures, texData.normalTextureSize, normalID, texUV);
+            nrm = glm::normalize(nrm * 2.f - 1.f);
+
+            glm::vec3 tangentX, tangentY;
+            OrthonormalBasis(state.ffnormal, tangentX, tangentY);
+
+            nrm = tangentX * nrm.x + tangentY * nrm.y + state.ffnormal * nrm.z;
+            state.normal = glm::normalize(nrm);
+            state.ffnormal = glm::dot(state.normal, direction) <= 0.f ? state.normal : -state.normal;
+        }
+
+        state.mat = mat;
+    }
+
+    static inline float SchlickFresnel(float u)
+    {
+        float m = glm::clamp(1.f - u, 0.f, 1.f);
+        float m2 = m * m;
+        return m2 * m2 * m; // pow(m,5)
+    }
+
+    static inline float GTR2(float NDotH, float a)
+    {
+        float a2 = a * a;
+        float t = 1.f + (a2 - 1.f) * NDotH * NDotH;
+        return a2 / (PI * t * t);
+    }
+
+    static inline float SmithG_GGX(float NDotv, float alphaG)
+    {
+        float a = alphaG * alphaG;
+        float b = NDotv * NDotv;
+        return 1.f / (NDotv + sqrtf(a + b - a * b));
+    }
+
+    static float UE4Pdf(const glm::vec3& direction, const State& state, const glm::vec3& bsdfDir)
+    {
+        glm::vec3 n = state.normal;
+        glm::vec3 V = -direction;
+        glm::vec3 L = bsdfDir;
+
+        float specularAlpha = std::max(0.001f, state.mat.params.y);
+
+        float diffuseRatio = 0.5f * (1.f - state.mat.params.x);
+        float specularRatio = 1.f - diffuseRatio;
+
+        glm::vec3 halfVec = glm::normalize(L + V);
+
+        float cosTheta = fabsf(glm::dot(halfVec, n));
+        float pdfGTR2 = GTR2(cosTheta, specularAlpha) * cosTheta;
+
+        // calculate diffuse and specular pdfs and mix ratio
+        float pdfSpec = pdfGTR2 / (4.f * fabsf(glm::dot(L, halfVec)));
+        float pdfDiff = fabsf(glm::dot(L, n)) * (1.f / PI);
+
+        // weight pdfs according to ratios
+        return diffuseRatio * pdfDiff + specularRatio * pdfSpec;
+    }
+
+    static glm::vec3 UE4Sample(const glm::vec3& direction, const State& state, unsigned int& seed)
+    {
+        glm::vec3 N = state.normal;
+        glm::vec3 V = -direction;
+
+        float probability = Random(seed);
+        float diffuseRatio = 0.5f * (1.f - state.mat.params.x);
+
+        float r1 = Random(seed);
+        float r2 = Random(seed);
+
+        glm::vec3 tangentX, tangentY;
+        OrthonormalBasis(N, tangentX, tangentY);
+
+        if (probability < diffuseRatio) // sample diffuse
+        {
+            glm::vec3 dir = CosineSampleHemisphere(r1, r2);
+            return tangentX * dir.x + tangentY * dir.y + N * dir.z;
+        }
+
+        float a = std::max(0.001f, state.mat.params.y);
+        float phi = r1 * 2.f * PI;
+
+        float cosTheta = sqrtf((1.f - r2) / (1.f + (a * a - 1.f) * r2));
+        float sinTheta = glm::clamp(sqrtf(1.f - (cosTheta * cosTheta)), 0.f, 1.f);
+
+        glm::vec3 halfVec = glm::vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+        halfVec = tangentX * halfVec.x + tangentY * halfVec.y + N * halfVec.z;
+
+        return 2.f * glm::dot(V, halfVec) * halfVec - V;
+    }
+
+    static glm::vec3 UE4Eval(const glm::vec3& direction, const State& state, const glm::vec3& bsdfDir)
+    {
+        glm::vec3 N = state.normal;
+        glm::vec3 V = -direction;
+        glm::vec3 L = bsdfDir;
+
+        float NDotL = glm::dot(N, L);
+        float NDotV = glm::dot(N, V);
+        if (NDotL <= 0.f || NDotV <= 0.f)
+            return glm::vec3(0.f);
+
+        glm::vec3 H = glm::normalize(L + V);
+        float NDotH = glm::dot(N, H);
+        float LDotH = glm::dot(L, H);
+
+        // specular
+        float specular = 0.5f;
+        glm::vec3 albedo = glm::vec3(state.mat.albedo);
+        glm::vec3 specularCol = glm::mix(glm::vec3(1.f) * 0.08f * specular, albedo, state.mat.params.x);
+        float a = std::max(0.001f, state.mat.params.y);
+        float Ds = GTR2(NDotH, a);
+        float FH = SchlickFresnel(LDotH);
+        glm::vec3 Fs = glm::mix(specularCol, glm::vec3(1.f), FH);
+        float roughg = (state.mat.params.y * 0.5f + 0.5f);
+        roughg = roughg * roughg;
+        float Gs = SmithG_GGX(NDotL, roughg) * SmithG_GGX(NDotV, roughg);
+
+        return (albedo / PI) * (1.f - state.mat.params.x) + Gs * Fs * Ds;
+    }
+
+    static glm::vec3 GlassSample(const glm::vec3& direction, const State& state, unsigned int& seed)
+    {
+        float n1 = 1.f;
+        float n2 = state.mat.params.z;
+        float R0 = (n1 - n2) / (n1 + n2);
+        R0 *= R0;
+        float theta = glm::dot(-direction, state.ffnormal);
+        float prob = R0 + (1.f - R0) * SchlickFresnel(theta);
+
+        float eta = glm::dot(state.normal, state.ffnormal) > 0.f ? (n1 / n2) : (n2 / n1);
+        float cos2t = 1.f - eta * eta * (1.f - theta * theta);
+
+        if (cos2t < 0.f || Random(seed) < prob) // Reflection
+            return glm::normalize(glm::reflect(direction, state.ffnormal));
+
+        // Transmission
+        return glm::normalize(glm::refract(direction, state.ffnormal, eta));
+    }
+
+    static inline float Luminance(const glm::vec3& color)
+    {
+        return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    }
+
+    static inline float PowerHeuristic(float a, float b)
+    {
+        float t = a * a;
+        return t / (b * b + t);
+    }
+
+    static void SampleLight(const LightData& light, int numOfLights, LightSampleRec& lightSampleRec, unsigned int& seed)
+    {
+        float r1 = Random(seed);
+        float r2 = Random(seed);
+
+        if (int(light.radiusAreaType.z) == 0) // Quad Light
+        {
+            lightSampleRec.surfacePos = light.position + light.u * r1 + light.v * r2;
+            lightSampleRec.normal = glm::normalize(glm::cross(light.u, light.v));
+        }
+        else
+        {
+            lightSampleRec.surfacePos = light.position + UniformSampleSphere(r1, r2) * light.radiusAreaType.x;
+            lightSampleRec.normal = glm::normalize(lightSampleRec.surfacePos - light.position);
+        }
+        lightSampleRec.emission = light.emission * float(numOfLights);
+    }
+
+    // shadow ray of a direct light sample. The contribution is added when nothing is hit before maxDist
+    struct ShadowRay
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float maxDist;
+        glm::vec3 contribution;
+    };
+
+    // albedo and normal of the first hit are returned for the denoiser, 0 when nothing or a light is hit
+    void CPURenderer::tracePaths(const glm::vec3* origins, const glm::vec3* directions, int activeMask, unsigned int* seeds, glm::vec3* radiance, glm::vec3* albedo, glm::vec3* normal) const
+    {
+        const HDRLoaderResult& hdr = scene->hdrLoaderRes;
+        const float hdrMultiplier = scene->renderOptions.hdrMultiplier;
+        glm::vec3 origin[4], direction[4], throughput[4];
+        float bsdfPdf[4];
+        bool specularBounce[4];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            origin[lane] = origins[lane];
+            direction[lane] = directions[lane];
+            throughput[lane] = glm::vec3(1.f);
+            radiance[lane] = glm::vec3(0.f);
+            albedo[lane] = glm::vec3(0.f);
+            normal[lane] = glm::vec3(0.f);
+            bsdfPdf[lane] = 0.f;
+            specularBounce[lane] = false;
+        }
+
+        const float maxDist[4] = {INFINITY_DIST, INFINITY_DIST, INFINITY_DIST, INFINITY_DIST};
+        for (int depth = 0; depth < maxDepth && activeMask; depth++)
+        {
+            RayPacket packet;
+            SetupPacket(packet, origin, direction, maxDist, activeMask);
+            intersect(packet);
+            float hitT[4], hitU[4], hitV[4];
+            StoreLanes(hitT, packet.t);
+            StoreLanes(hitU, packet.u);
+            StoreLanes(hitV, packet.v);
+
+            // environment and analytic light samples
+            ShadowRay shadowRays[2][4];
+            int shadowMask[2] = {0, 0};
+
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (!(activeMask & (1 << lane)))
+                    continue;
+                const glm::vec3& rayDir = direction[lane];
+                unsigned int& seed = seeds[lane];
+
+                float t = (packet.triangle[lane] >= 0) ? hitT[lane] : INFINITY_DIST;
+                LightSampleRec lightSampleRec;
+                bool isEmitter = IntersectLights(scene->lightData, origin[lane], rayDir, t, lightSampleRec);
+
+                if (t >= INFINITY_DIST)
+                {
+                    if (useEnvMap)
+                    {
+                        float misWeight = 1.f;
+                        if (depth > 0 && !specularBounce[lane])
+                            misWeight = PowerHeuristic(bsdfPdf[lane], EnvPdf(hdr, rayDir));
+                        radiance[lane] += misWeight * SampleHDR(hdr, EnvUV(rayDir)) * throughput[lane] * hdrMultiplier;
+                    }
+                    activeMask &= ~(1 << lane);
+                    continue;
+                }
+
+                if (isEmitter)
+                {
+                    glm::vec3 Le = lightSampleRec.emission;
+                    if (depth > 0 && !specularBounce[lane])
+                        Le *= PowerHeuristic(bsdfPdf[lane], lightSampleRec.pdf);
+                    radiance[lane] += Le * throughput[lane];
+                    activeMask &= ~(1 << lane);
+                    continue;
+                }
+
+                State state;
+                state.triID = triangles[packet.triangle[lane]].triID;
+                state.fhp = origin[lane] + rayDir * t;
+                state.bary = glm::vec3(1.f - hitU[lane] - hitV[lane], hitU[lane], hitV[lane]);
+                GetNormalAndTexCoord(scene, state, rayDir);
+                GetMaterialsAndTextures(scene, state, rayDir);
+                if (depth == 0)
+                {
+                    albedo[lane] = glm::vec3(state.mat.albedo);
+                    normal[lane] = state.ffnormal;
+                }
+
+                radiance[lane] += glm::vec3(state.mat.emission) * throughput[lane];
+
+                glm::vec3 bsdfDir;
+                if (state.mat.albedo.w == 0.f) // UE4 Brdf
+                {
+                    specularBounce[lane] = false;
+                    if (depth < maxDepth - 1)
+                    {
+                        glm::vec3 surfacePos = state.fhp + state.normal * EPS;
+                        if (useEnvMap)
+                        {
+                            glm::vec3 color;
+                            glm::vec4 dirPdf = EnvSample(hdr, hdrMultiplier, color, seed);
+                            glm::vec3 lightDir = glm::vec3(dirPdf);
+                            float lightPdf = dirPdf.w;
+                            float misWeight = PowerHeuristic(lightPdf, UE4Pdf(rayDir, state, lightDir));
+                            if (misWeight > 0.f)
+                            {
+                                glm::vec3 f = UE4Eval(rayDir, state, lightDir);
+                                ShadowRay& shadowRay = shadowRays[0][lane];
+                                shadowRay.origin = surfacePos;
+                                shadowRay.direction = lightDir;
+                                shadowRay.maxDist = INFINITY_DIST - EPS;
+                                shadowRay.contribution = misWeight * f * fabsf(glm::dot(lightDir, state.normal)) * color / lightPdf * throughput[lane];
+                                shadowMask[0] |= 1 << lane;
+                            }
+                        }
+
+                        if (numOfLights > 0)
+                        {
+                            int index = std::min(int(Random(seed) * numOfLights), numOfLights - 1);
+                            const LightData& light = scene->lightData[index];
+                            LightSampleRec lightSample;
+                            SampleLight(light, numOfLights, lightSample, seed);
+
+                            glm::vec3 lightDir = lightSample.surfacePos - surfacePos;
+                            float lightDist = glm::length(lightDir);
+                            float lightDistSq = lightDist * lightDist;
+                            lightDir /= lightDist;
+
+                            if (glm::dot(lightDir, state.normal) > 0.f && glm::dot(lightDir, lightSample.normal) < 0.f)
+                            {
+                                float lightBsdfPdf = UE4Pdf(rayDir, state, lightDir);
+                                glm::vec3 f = UE4Eval(rayDir, state, lightDir);
+                                float lightPdf = lightDistSq / (light.radiusAreaType.y * fabsf(glm::dot(lightSample.normal, lightDir)));
+
+                                ShadowRay& shadowRay = shadowRays[1][lane];
+                                shadowRay.origin = surfacePos;
+                                shadowRay.direction = lightDir;
+                                shadowRay.maxDist = lightDist - EPS;
+                                shadowRay.contribution = PowerHeuristic(lightPdf, lightBsdfPdf) * f * fabsf(glm::dot(state.normal, lightDir)) * lightSample.emission / lightPdf * throughput[lane];
+                                shadowMask[1] |= 1 << lane;
+                            }
+                        }
+                    }
+
+                    bsdfDir = UE4Sample(rayDir, state, seed);
+                    bsdfPdf[lane] = UE4Pdf(rayDir, state, bsdfDir);
+
+                    if (bsdfPdf[lane] > 0.f)
+                    {
+                        throughput[lane] *= UE4Eval(rayDir, state, bsdfDir) * fabsf(glm::dot(state.normal, bsdfDir)) / bsdfPdf[lane];
+                    }
+                    else
+                    {
+                        activeMask &= ~(1 << lane);
+                        continue;
+                    }
+                }
+                else // Glass
+                {
+                    specularBounce[lane] = true;
+                    bsdfDir = GlassSample(rayDir, state, seed);
+                    bsdfPdf[lane] = 1.f;
+                    throughput[lane] *= glm::vec3(state.mat.albedo); // Pdf will always be 1.0
+                }
+
+                direction[lane] = bsdfDir;
+                origin[lane] = state.fhp + bsdfDir * EPS;
+            }
+
+            // shadow rays of all the lanes are traced together
+            for (int i = 0; i < 2; i++)
+            {
+                if (!shadowMask[i])
+                    continue;
+                glm::vec3 shadowOrigins[4], shadowDirections[4];
+                float shadowDist[4];
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    const ShadowRay& shadowRay = shadowRays[i][lane];
+                    bool active = (shadowMask[i] & (1 << lane)) != 0;
+                    shadowOrigins[lane] = active ? shadowRay.origin : glm::vec3(0.f);
+                    shadowDirections[lane] = active ? shadowRay.direction : glm::vec3(0.f, 0.f, 1.f);
+                    shadowDist[lane] = active ? shadowRay.maxDist : 0.f;
+                }
+                RayPacket shadowPacket;
+                SetupPacket(shadowPacket, shadowOrigins, shadowDirections, shadowDist, shadowMask[i]);
+                int visibleMask = shadowMask[i] & ~occluded(shadowPacket);
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (visibleMask & (1 << lane))
+                        radiance[lane] += shadowRays[i][lane].contribution;
+                }
+            }
+        }
+    }
+
+    struct TileTaskSet : TaskSet
+    {
+        TileTaskSet(CPURenderer* renderer, uint32_t tileCount) : TaskSet(tileCount), mRenderer(renderer)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t i = range.start; i < range.end; i++)
+            {
+                mRenderer->renderTile(int(i));
+            }
+        }
+        CPURenderer* mRenderer;
+    };
+
+    // 2x2 pixels packets. Random sequences only depend on the pixel and the sample index
+    void CPURenderer::renderTile(int tileIndex)
+    {
+        const int tileX = (tileIndex % numTiles[0]) * TileSize;
+        const int tileY = (tileIndex / numTiles[0]) * TileSize;
+        const int width = screenSize.x;
+        const int height = screenSize.y;
+        const float aspect = float(width) / float(height);
+        const float tanHalfFov = tanf(frame.fov * 0.5f);
+
+        for (int y = tileY; y < std::min(tileY + TileSize, height); y += 2)
+        {
+            for (int x = tileX; x < std::min(tileX + TileSize, width); x += 2)
+            {
+                glm::vec3 origins[4], directions[4], radiance[4], albedo[4], normal[4];
+                unsigned int seeds[4];
+                int activeMask = 0;
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    int px = x + (lane & 1);
+                    int py = y + (lane >> 1);
+                    origins[lane] = frame.position;
+                    directions[lane] = frame.forward;
+                    seeds[lane] = 1;
+                    if (px >= width || py >= height)
+                        continue;
+                    activeMask |= 1 << lane;
+
+                    unsigned int& seed = seeds[lane];
+                    seed = Hash(unsigned(py * width + px) ^ Hash(unsigned(sampleCounter) + 0x9E3779B9u));
+
+                    float r1 = 2.f * Random(seed);
+                    float r2 = 2.f * Random(seed);
+                    glm::vec2 jitter;
+                    jitter.x = r1 < 1.f ? sqrtf(r1) - 1.f : 1.f - sqrtf(2.f - r1);
+                    jitter.y = r2 < 1.f ? sqrtf(r2) - 1.f : 1.f - sqrtf(2.f - r2);
+                    jitter /= glm::vec2(width, height) * 0.5f;
+
+                    glm::vec2 d = glm::vec2((px + 0.5f) / width, (py + 0.5f) / height) * 2.f - 1.f + jitter;
+                    d.x *= aspect * tanHalfFov;
+                    d.y *= tanHalfFov;
+                    directions[lane] = glm::normalize(d.x * frame.right + d.y * frame.up + frame.forward);
+                }
+
+                tracePaths(origins, directions, activeMask, seeds, radiance, albedo, normal);
+
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!(activeMask & (1 << lane)))
+                        continue;
+                    int px = x + (lane & 1);
+                    int py = y + (lane >> 1);
+                    const size_t index = size_t(py) * width + px;
+                    float* texel = &accumulation[index * 3];
+                    // a degenerate sample must not spoil the accumulation
+                    if (std::isfinite(radiance[lane].x) && std::isfinite(radiance[lane].y) && std::isfinite(radiance[lane].z))
+                    {
+                        texel[0] += radiance[lane].x;
+                        texel[1] += radiance[lane].y;
+                        texel[2] += radiance[lane].z;
+                        float luminance = Luminance(radiance[lane]);
+                        momentAccumulation[index] += luminance * luminance;
+                    }
+                    for (int i = 0; i < 3; i++)
+                    {
+                        albedoAccumulation[index * 3 + i] += albedo[lane][i];
+                        normalAccumulation[index * 3 + i] += normal[lane][i];
+                    }
+                }
+            }
+        }
+
+        // means for the denoiser and noise of the tile
+        const float invSampleCount = 1.f / float(sampleCounter + 1);
+        float noise = 0.f;
+        for (int y = tileY; y < std::min(tileY + TileSize, height); y++)
+        {
+            for (int x = tileX; x < std::min(tileX + TileSize, width); x++)
+            {
+                const size_t index = size_t(y) * width + x;
+                const float* texel = &accumulation[index * 3];
+                glm::vec3 mean = glm::vec3(texel[0], texel[1], texel[2]) * invSampleCount;
+                float luminance = Luminance(mean);
+                // variance of the mean. Unknown with a single sample, the luminance is used instead
+                float variance = luminance * luminance;
+                if (sampleCounter)
+                {
+                    float sampleVariance = std::max(momentAccumulation[index] * invSampleCount - luminance * luminance, 0.f) * float(sampleCounter + 1) / float(sampleCounter);
+                    variance = sampleVariance * invSampleCount;
+                }
+                noise += sqrtf(variance) / (luminance + 0.05f);
+                for (int i = 0; i < 3; i++)
+                {
+                    radianceMean[index * 4 + i] = mean[i];
+                    albedoMean[index * 4 + i] = albedoAccumulation[index * 3 + i] * invSampleCount;
+                    normalMean[index * 4 + i] = normalAccumulation[index * 3 + i] * invSampleCount;
+                }
+                radianceMean[index * 4 + 3] = variance;
+            }
+        }
+        tileNoise[tileIndex] = noise;
+    }
+
+    CPURenderer::~CPURenderer()
+    {
+        finish();
+    }
+
+    void CPURenderer::init()
+    {
+        if (initialized)
+            return;
+
+        if (scene == nullptr || !scene->gpuBVH || !scene->gpuBVH->numNodes)
+        {
+            Log("Error: No Scene Found\n");
+            return;
+        }
+
+        // flattened BVH with explicit children and float vertices
+        const GPUBVH* gpuBVH = scene->gpuBVH;
+        nodes.resize(gpuBVH->numNodes);
+        for (int i = 0; i < gpuBVH->numNodes; i++)
+        {
+            const GPUBVHNode& gpuNode = gpuBVH->gpuNodes[i];
+            Node& node = nodes[i];
+            node.bboxMin = gpuNode.BBoxMin;
+            node.bboxMax = gpuNode.BBoxMax;
+            bool isLeaf = gpuNode.LRLeaf.z > 0.5f;
+            node.left = isLeaf ? -1 : int(gpuNode.LRLeaf.x);
+            node.right = isLeaf ? -1 : int(gpuNode.LRLeaf.y);
+            node.triangleStart = isLeaf ? int(gpuNode.LRLeaf.x) : 0;
+            node.triangleCount = isLeaf ? int(gpuNode.LRLeaf.y) : 0;
+        }
+
+        triangles.resize(gpuBVH->bvhTriangleIndices.size());
+        for (size_t i = 0; i < triangles.size(); i++)
+        {
+            const glm::vec4& indices = gpuBVH->bvhTriangleIndices[i].indices;
+            const glm::vec3& v0 = scene->vertexData[int(indices.x)].vertex;
+            const glm::vec3& v1 = scene->vertexData[int(indices.y)].vertex;
+            const glm::vec3& v2 = scene->vertexData[int(indices.z)].vertex;
+            triangles[i].v0 = v0;
+            triangles[i].e0 = v1 - v0;
+            triangles[i].e1 = v2 - v0;
+            triangles[i].triID = int(indices.w);
+        }
+
+        numOfLights = int(scene->lightData.size());
+        const HDRLoaderResult& hdr = scene->hdrLoaderRes;
+        useEnvMap = scene->renderOptions.useEnvMap && hdr.cols && hdr.marginalDistData && hdr.conditionalDistData;
+        numTiles[0] = (screenSize.x + TileSize - 1) / TileSize;
+        numTiles[1] = (screenSize.y + TileSize - 1) / TileSize;
+        const size_t pixelCount = size_t(screenSize.x) * screenSize.y;
+        accumulation.resize(pixelCount * 3);
+        momentAccumulation.resize(pixelCount);
+        albedoAccumulation.resize(pixelCount * 3);
+        normalAccumulation.resize(pixelCount * 3);
+        radianceMean.resize(pixelCount * 4);
+        albedoMean.resize(pixelCount * 4);
+        normalMean.resize(pixelCount * 4);
+        tileNoise.resize(numTiles[0] * numTiles[1]);
+        resetAccumulation();
+        frame.position = scene->camera->position;
+        frame.right = scene->camera->right;
+        frame.up = scene->camera->up;
+        frame.forward = scene->camera->forward;
+        frame.fov = scene->camera->fov;
+
+        //----------------------------------------------------------
+        // Output, same tone mapping as the GPU renderers
+        //----------------------------------------------------------
+        quad = new Quad();
+        outputShader = loadShaders(shadersDirectory + "OutputVert.glsl", shadersDirectory + "OutputFrag.glsl");
+
+        glGenTextures(1, &outputTexture);
+        glBindTexture(GL_TEXTURE_2D, outputTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, screenSize.x, screenSize.y, 0, GL_RGB, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        initialized = true;
+    }
+
+    void CPURenderer::finish()
+    {
+        if (!initialized)
+            return;
+
+        glDeleteTextures(1, &outputTexture);
+        delete outputShader;
+        delete quad;
+        outputShader = nullptr;
+        quad = nullptr;
+
+        nodes.clear();
+        triangles.clear();
+        accumulation.clear();
+        momentAccumulation.clear();
+        albedoAccumulation.clear();
+        normalAccumulation.clear();
+        radianceMean.clear();
+        albedoMean.clear();
+        normalMean.clear();
+        denoisedRadiance.clear();
+        denoiseTemp.clear();
+        tileNoise.clear();
+
+        // GPU scene resources were never allocated
+        initialized = false;
+        Log("Renderer finished!\n");
+    }
+
+    void CPURenderer::render()
+    {
+        if (!initialized)
+        {
+            Log("CPU Renderer is not initialized\n");
+            return;
+        }
+
+        if (getProgress() < 1.f)
+        {
+            TileTaskSet tileTask(this, uint32_t(numTiles[0] * numTiles[1]));
+            g_TS.AddTaskSetToPipe(&tileTask);
+            g_TS.WaitforTaskSet(&tileTask);
+            sampleCounter++;
+            denoised = false;
+
+            if (sampleCounter > 1)
+            {
+                float noise = 0.f;
+                for (float tileValue : tileNoise)
+                    noise += tileValue;
+                noiseLevel = noise / float(screenSize.x * screenSize.y);
+            }
+        }
+
+        // the filter also runs when only its settings changed
+        if (denoiseIterations && !denoised && sampleCounter)
+        {
+            denoisedRadiance = radianceMean;
+            denoise(denoisedRadiance, albedoMean, normalMean, screenSize.x, screenSize.y, denoiseIterations, denoiseTemp);
+            denoised = true;
+        }
+    }
+
+    void CPURenderer::present() const
+    {
+        if (!initialized)
+            return;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, outputTexture);
+        float invSampleCounter;
+        if (denoiseIterations && denoised)
+        {
+            // denoised image is already divided, w is ignored by the RGB texture
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screenSize.x, screenSize.y, GL_RGBA, GL_FLOAT, denoisedRadiance.data());
+            invSampleCounter = 1.f;
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screenSize.x, screenSize.y, GL_RGB, GL_FLOAT, accumulation.data());
+            invSampleCounter = 1.f / float(std::max(sampleCounter, 1));
+        }
+
+        outputShader->use();
+        glUniform1f(glGetUniformLocation(outputShader->object(), "invSampleCounter"), invSampleCounter);
+        outputShader->stopUsing();
+        quad->Draw(outputShader);
+    }
+
+    void CPURenderer::update(float secondsElapsed)
+    {
+        if (!initialized)
+            return;
+
+        const Camera* camera = scene->camera;
+        if (camera->isMoving)
+        {
+            resetAccumulation();
+        }
+        frame.position = camera->position;
+        frame.right = camera->right;
+        frame.up = camera->up;
+        frame.forward = camera->forward;
+        frame.fov = camera->fov;
+    }
+
+    float CPURenderer::getProgress() const
+    {
+        if (noiseThreshold > 0.f && noiseLevel <= noiseThreshold)
+            return 1.f;
+        return std::min(float(sampleCounter) / float(std::max(maxSamples, 1)), 1.f);
+    }
+
+    void CPURenderer::setDenoise(int iterations, float noiseThreshold)
+    {
+        if (iterations != denoiseIterations)
+            denoised = false;
+        denoiseIterations = std::max(iterations, 0);
+        this->noiseThreshold = noiseThreshold;
+    }
+
+    void CPURenderer::resetAccumulation()
+    {
+        std::fill(accumulation.begin(), accumulation.end(), 0.f);
+        std::fill(momentAccumulation.begin(), momentAccumulation.end(), 0.f);
+        std::fill(albedoAccumulation.begin(), albedoAccumulation.end(), 0.f);
+        std::fill(normalAccumulation.begin(), normalAccumulation.end(), 0.f);
+        sampleCounter = 0;
+        noiseLevel = FLT_MAX;
+        denoised = false;
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Renderer.h"
+#include <vector>
+#include <cfloat>
+
+namespace GLSLPathTracer
+{
+    // Path tracer running on the CPU, for machines without a usable GPU.
+    // Same scene, BVH and shading model as the GLSL renderers. Rays are traced by packets of 4 with SSE
+    // and the image is rendered by tiles on the task scheduler, one sample per pixel for each render call.
+    class CPURenderer : public Renderer
+    {
+    public:
+        struct RayPacket;
+
+        CPURenderer(const Scene *scene, const std::string& shadersDirectory) : Renderer(scene, shadersDirectory)
+            , maxSamples(scene->renderOptions.maxSamples)
+            , maxDepth(scene->renderOptions.maxDepth)
+            , sampleCounter(0)
+            , denoiseIterations(0)
+            , noiseThreshold(0.f)
+            , noiseLevel(FLT_MAX)
+            , denoised(false)
+            , outputTexture(0)
+            , outputShader(nullptr)
+        {
+        }
+        ~CPURenderer();
+
+        void init();
+        void finish();
+
+        void render();
+        void present() const;
+        void update(float secondsElapsed);
+        float getProgress() const;
+        RendererType getType() const { return Renderer_CPU; }
+
+        // radiance sum of all samples, RGB rows from the bottom of the image
+        const std::vector<float>& getAccumulation() const { return accumulation; }
+        int getSampleCount() const { return sampleCounter; }
+
+        // A-Trous filter iterations applied to the output, 0 to disable.
+        // Rendering stops before maxSamples once the noise level is below noiseThreshold, 0 to disable.
+        void setDenoise(int iterations, float noiseThreshold);
+        // average relative standard error of the pixels luminance, FLT_MAX until 2 samples are accumulated
+        float getNoiseLevel() const { return noiseLevel; }
+
+        void renderTile(int tileIndex);
+
+    private:
+        struct Node
+        {
+            glm::vec3 bboxMin;
+            int left; // -1 for leaves
+            glm::vec3 bboxMax;
+            int right;
+            int triangleStart;
+            int triangleCount;
+        };
+
+        struct Triangle
+        {
+            glm::vec3 v0;
+            glm::vec3 e0;
+            glm::vec3 e1;
+            int triID;
+        };
+
+        struct Frame
+        {
+            glm::vec3 position;
+            glm::vec3 right;
+            glm::vec3 up;
+            glm::vec3 forward;
+            float fov;
+        };
+
+        void intersect(RayPacket& packet) const;
+        int occluded(RayPacket& packet) const;
+        void tracePaths(const glm::vec3* origins, const glm::vec3* directions, int activeMask, unsigned int* seeds, glm::vec3* radiance, glm::vec3* albedo, glm::vec3* normal) const;
+        void resetAccumulation();
+
+        std::vector<Node> nodes;
+        std::vector<Triangle> triangles;
+        std::vector<float> accumulation;
+        // luminance squared, first hit albedo and normal sums. Albedo and normal are RGB like accumulation
+        std::vector<float> momentAccumulation;
+        std::vector<float> albedoAccumulation;
+        std::vector<float> normalAccumulation;
+        // denoiser inputs with 4 floats per pixel, radiance mean has the variance of its luminance in w
+        std::vector<float> radianceMean, albedoMean, normalMean;
+        std::vector<float> denoisedRadiance, denoiseTemp;
+        std::vector<float> tileNoise;
+        int maxSamples, maxDepth;
+        int sampleCounter;
+        int numTiles[2];
+        int denoiseIterations;
+        float noiseThreshold;
+        float noiseLevel;
+        bool denoised;
+        bool useEnvMap;
+        Frame frame;
+        GLuint outputTexture;
+        Program *outputShader;
+    };
+}
@@ -0,0 +1,149 @@
+#include "Platform.h"
+#include "Denoiser.h"
+#include <algorithm>
+#include <cmath>
+
+extern TaskScheduler g_TS;
+
+namespace GLSLPathTracer
+{
+    // B3 spline, 5 taps
+    static const float Kernel[5] = {1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+    // color distance is relative to the noise of the pixel, guides distances are absolute
+    static const float ColorSigma = 32.f;
+    static const float NormalPhi = 0.1f;
+    static const float AlbedoPhi = 0.05f;
+
+    // RGB and a 4th component, one SSE register when available
+#if IMOGEN_SSE2
+    typedef __m128 Pixel;
+
+    static inline Pixel Zero() { return _mm_setzero_ps(); }
+    static inline Pixel Load(const float* pixel) { return _mm_loadu_ps(pixel); }
+    static inline void Store(float* pixel, Pixel value) { _mm_storeu_ps(pixel, value); }
+    static inline Pixel MulAdd(Pixel accum, Pixel value, float weight) { return _mm_add_ps(accum, _mm_mul_ps(value, _mm_set1_ps(weight))); }
+    static inline Pixel Scale(Pixel value, float scale) { return _mm_mul_ps(value, _mm_set1_ps(scale)); }
+    // squared distance of the RGB components
+    static inline float Distance(Pixel a, Pixel b)
+    {
+        const Pixel rgbMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        Pixel d = _mm_and_ps(_mm_sub_ps(a, b), rgbMask);
+        d = _mm_mul_ps(d, d);
+        d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+        d = _mm_add_ss(d, _mm_shuffle_ps(d, d, 1));
+        return _mm_cvtss_f32(d);
+    }
+#else
+    struct Pixel
+    {
+        float v[4];
+    };
+
+    static inline Pixel Zero()
+    {
+        Pixel res = {{0.f, 0.f, 0.f, 0.f}};
+        return res;
+    }
+    static inline Pixel Load(const float* pixel)
+    {
+        Pixel res = {{pixel[0], pixel[1], pixel[2], pixel[3]}};
+        return res;
+    }
+    static inline void Store(float* pixel, Pixel value)
+    {
+        for (int i = 0; i < 4; i++)
+            pixel[i] = value.v[i];
+    }
+    static inline Pixel MulAdd(Pixel accum, Pixel value, float weight)
+    {
+        for (int i = 0; i < 4; i++)
+            accum.v[i] += value.v[i] * weight;
+        return accum;
+    }
+    static inline Pixel Scale(Pixel value, float scale)
+    {
+        for (int i = 0; i < 4; i++)
+            value.v[i] *= scale;
+        return value;
+    }
+    static inline float Distance(Pixel a, Pixel b)
+    {
+        float res = 0.f;
+        for (int i = 0; i < 3; i++)
+            res += (a.v[i] - b.v[i]) * (a.v[i] - b.v[i]);
+        return res;
+    }
+#endif
+
+    struct ATrousTaskSet : TaskSet
+    {
+        ATrousTaskSet(const float* source, const float* albedo, const float* normal, float* destination, int width, int height, int iteration)
+            : TaskSet(height), mSource(source), mAlbedo(albedo), mNormal(normal), mDestination(destination)
+            , mWidth(width), mHeight(height), mStep(1 << iteration), mColorScale(ColorSigma / float(1 << iteration))
+        {
+        }
+
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t y = range.start; y < range.end; y++)
+            {
+                for (int x = 0; x < mWidth; x++)
+                {
+                    const size_t index = (size_t(y) * mWidth + x) * 4;
+                    const Pixel color = Load(mSource + index);
+                    const Pixel albedo = Load(mAlbedo + index);
+                    const Pixel normal = Load(mNormal + index);
+                    const float variance = mSource[index + 3];
+                    const float invColorPhi = 1.f / std::max(variance * mColorScale, 1e-4f);
+
+                    Pixel sum = Zero();
+                    float weightSum = 0.f;
+                    for (int dy = -2; dy <= 2; dy++)
+                    {
+                        const int sy = int(y) + dy * mStep;
+                        if (sy < 0 || sy >= mHeight)
+                            continue;
+                        for (int dx = -2; dx <= 2; dx++)
+                        {
+                            const int sx = x + dx * mStep;
+                            if (sx < 0 || sx >= mWidth)
+                                continue;
+                            const size_t tap = (size_t(sy) * mWidth + sx) * 4;
+                            const Pixel tapColor = Load(mSource + tap);
+                            float exponent = Distance(color, tapColor) * invColorPhi;
+                            exponent += Distance(normal, Load(mNormal + tap)) * (1.f / NormalPhi);
+                            exponent += Distance(albedo, Load(mAlbedo + tap)) * (1.f / AlbedoPhi);
+                            const float weight = Kernel[dx + 2] * Kernel[dy + 2] * expf(-exponent);
+                            sum = MulAdd(sum, tapColor, weight);
+                            weightSum += weight;
+                        }
+                    }
+                    // the center tap always has a weight
+                    Store(mDestination + index, Scale(sum, 1.f / weightSum));
+                    mDestination[index + 3] = variance;
+                }
+            }
+        }
+
+        const float* mSource;
+        const float* mAlbedo;
+        const float* mNormal;
+        float* mDestination;
+        int mWidth, mHeight;
+        int mStep;
+        float mColorScale;
+    };
+
+    void denoise(std::vector<float>& radiance, const std::vector<float>& albedo, const std::vector<float>& normal, int width, int height, int iterations, std::vector<float>& temp)
+    {
+        temp.resize(radiance.size());
+        for (int i = 0; i < iterations; i++)
+        {
+            ATrousTaskSet aTrousTask(radiance.data(), albedo.data(), normal.data(), temp.data(), width, height, i);
+            g_TS.AddTaskSetToPipe(&aTrousTask);
+            g_TS.WaitforTaskSet(&aTrousTask);
+            // ping pong, the last result ends in radiance
+            radiance.swap(temp);
+        }
+    }
+}
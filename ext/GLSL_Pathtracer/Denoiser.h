@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+
+namespace GLSLPathTracer
+{
+    // Edge-avoiding A-Trous wavelet filter (Dammertz et al. 2010) for path traced images.
+    // Images have 4 floats per pixel, rows from the bottom. radiance is RGB with the luminance variance of the mean in w,
+    // albedo and normal are the first hit guides that keep texture and geometry edges.
+    // Each iteration doubles the filter footprint. Result is written to radiance, temp is a scratch buffer.
+    void denoise(std::vector<float>& radiance, const std::vector<float>& albedo, const std::vector<float>& normal, int width, int height, int iterations, std::vector<float>& temp);
+}
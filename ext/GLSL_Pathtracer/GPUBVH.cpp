@@ -54,7 +54,9 @@ namespace GLSLPathTracer
 
     void GPUBVH::createGPUBVH()
     {
-        gpuNodes = new GPUBVHNode[bvh->getNumNodes()];
+        numNodes = bvh->getNumNodes();
+        gpuNodes = new GPUBVHNode[numNodes];
+        current = 0;
         traverseBVH(bvh->getRoot());
     }
 }
\ No newline at end of file
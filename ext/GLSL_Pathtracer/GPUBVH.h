@@ -21,11 +21,14 @@ namespace GLSLPathTracer
     class GPUBVH
     {
     public:
+        GPUBVH() : gpuNodes(nullptr), numNodes(0), bvh(nullptr) {}
         GPUBVH(const BVH *bvh);
+        ~GPUBVH() { delete[] gpuNodes; }
         void createGPUBVH();
         int traverseBVH(BVHNode *root);
         GPUBVHNode *gpuNodes;
-        const BVH *bvh;
+        int numNodes;
+        const BVH *bvh; // only valid while building
         std::vector<TriIndexData> bvhTriangleIndices;
     };
 }
\ No newline at end of file
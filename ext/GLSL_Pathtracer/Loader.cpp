@@ -335,6 +335,7 @@ namespace GLSLPathTracer
             {
                 char rendererType[20] = "None";
                 char envMap[200] = "None";
+                int spatialSplits = 1;
 
                 while (fgets(line, kMaxLineLength, file))
                 {
@@ -350,6 +351,7 @@ namespace GLSLPathTracer
                     sscanf(line, " maxSamples %i", &scene->renderOptions.maxSamples);
                     sscanf(line, " numTilesX %i", &scene->renderOptions.numTilesX);
                     sscanf(line, " numTilesY %i", &scene->renderOptions.numTilesY);
+                    sscanf(line, " spatialSplits %i", &spatialSplits);
 
                     if (strcmp(envMap, "None") != 0)
                     {
@@ -358,6 +360,7 @@ namespace GLSLPathTracer
                         scene->renderOptions.useEnvMap = true;
                     }
                     scene->renderOptions.rendererType = std::string(rendererType);
+                    scene->renderOptions.spatialSplits = spatialSplits != 0;
                 }
             }
 
@@ -15,6 +15,7 @@ namespace GLSLPathTracer
     {
         Renderer_Progressive,
         Renderer_Tiled,
+        Renderer_CPU,
     };
     class Renderer
     {
@@ -15,6 +15,12 @@ namespace GLSLPathTracer
     {
         delete camera;
         delete gpuBVH;
+        delete[] texData.albedoTextures;
+        delete[] texData.metallicRoughnessTextures;
+        delete[] texData.normalTextures;
+        delete[] hdrLoaderRes.cols;
+        delete[] hdrLoaderRes.marginalDistData;
+        delete[] hdrLoaderRes.conditionalDistData;
     }
     void Scene::buildBVH()
     {
@@ -42,15 +48,21 @@ namespace GLSLPathTracer
         std::cout << "Building a new GPU Scene\n";
         GPUScene* gpuScene = new GPUScene(triCount, verCount, tris, verts);
 
-        std::cout << "Building BVH with spatial splits\n";
+        std::cout << (renderOptions.spatialSplits ? "Building BVH with spatial splits\n" : "Building binned BVH\n");
         // create a default platform
         Platform defaultplatform;
         BVH::BuildParams defaultparams;
+        defaultparams.spatialSplits = renderOptions.spatialSplits;
         BVH::Stats stats;
         BVH *myBVH = new BVH(gpuScene, defaultplatform, defaultparams);
 
         std::cout << "Building GPU-BVH\n";
         gpuBVH = new GPUBVH(myBVH);
         std::cout << "GPU-BVH successfully created\n";
+
+        // the flattened nodes are all the renderers need
+        gpuBVH->bvh = nullptr;
+        delete myBVH;
+        delete gpuScene;
     }
 }
\ No newline at end of file
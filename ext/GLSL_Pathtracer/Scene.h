@@ -43,6 +43,17 @@ namespace GLSLPathTracer
 
     struct TexData
     {
+        TexData()
+            : albedoTextures(nullptr)
+            , metallicRoughnessTextures(nullptr)
+            , normalTextures(nullptr)
+            , albedoTexCount(0)
+            , metallicRoughnessTexCount(0)
+            , normalTexCount(0)
+            , albedoTextureSize(0)
+            , metallicRoughnessTextureSize(0)
+            , normalTextureSize(0)
+        {}
         unsigned char* albedoTextures;
         unsigned char* metallicRoughnessTextures;
         unsigned char* normalTextures;
@@ -77,6 +88,7 @@ namespace GLSLPathTracer
             useEnvMap = false;
             resolution = glm::vec2(500, 500);
             hdrMultiplier = 1.0f;
+            spatialSplits = true;
         }
         std::string rendererType;
         glm::ivec2 resolution;
@@ -86,6 +98,7 @@ namespace GLSLPathTracer
         int numTilesY;
         bool useEnvMap;
         float hdrMultiplier;
+        bool spatialSplits; // BVH quality, 0 in the scene file for a faster binned build
     };
 
     class Scene
@@ -20,6 +20,8 @@ public:
 	{
 		width = height = 0;
 		cols = NULL;
+		marginalDistData = NULL;
+		conditionalDistData = NULL;
 	}
 	int width, height;
 	// each pixel takes 3 float32, each component can be of any value...
@@ -69,12 +69,14 @@ public:
 		Stats*      stats;
 		bool        enablePrints;
 		F32         splitAlpha;     // spatial split area threshold, see Nvidia paper on SBVH by Martin Stich, usually 0.05
+		bool        spatialSplits;  // false builds a binned SAH BVH without spatial splits : much faster build, slower traversal
 
 		BuildParams(void)
 		{
 			stats = NULL;
 			enablePrints = true;
 			splitAlpha = 1.0e-5f;
+			spatialSplits = true;
 		}
 
 	};
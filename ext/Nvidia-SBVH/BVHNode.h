@@ -67,6 +67,7 @@ class BVHNode
 {
 public:
 	BVHNode() : m_probability(1.f), m_parentProbability(1.f), m_treelet(-1), m_index(-1) {} 
+	virtual ~BVHNode() {}
 	virtual bool        isLeaf() const = 0;               
 	virtual S32         getNumChildNodes() const = 0;
 	virtual BVHNode*    getChildNode(S32 i) const = 0;
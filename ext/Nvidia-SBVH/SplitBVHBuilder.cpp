@@ -29,15 +29,200 @@
 // project page: http://www.nvidia.com/object/nvidia_research_pub_012.html
 // direct link: http://www.nvidia.com/docs/IO/77714/sbvh.pdf
 
+#include "Platform.h"
+#include <algorithm>
 #include "SplitBVHBuilder.h"
 #include "Sort.h"
 
+extern TaskScheduler g_TS;
+
+// Node searches are parallelized when the node is big enough (findObjectSplit, findBinnedSplit, findSpatialSplit),
+// subtrees are built on separate tasks once both children are big enough (buildNode).
+// Each task owns a BuildContext with its own reference stack and triangle list, the triangles are gathered
+// in depth first order at the end so the tree and the GPUBVH built from it don't depend on the scheduling.
+
+static void RunTaskSet(TaskSet* taskSet)
+{
+	g_TS.AddTaskSetToPipe(taskSet);
+	g_TS.WaitforTaskSet(taskSet);
+}
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::SubtreeTask : TaskSet
+{
+	SubtreeTask(SplitBVHBuilder& builder, BuildContext& context, const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd)
+		: TaskSet(1), m_builder(builder), m_context(context), m_spec(spec), m_level(level), m_progressStart(progressStart), m_progressEnd(progressEnd)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		m_context.root = m_builder.buildNode(m_context, m_spec, m_level, m_progressStart, m_progressEnd);
+	}
+
+	SplitBVHBuilder&        m_builder;
+	BuildContext&           m_context;
+	NodeSpec                m_spec;
+	int                     m_level;
+	F32                     m_progressStart;
+	F32                     m_progressEnd;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::ObjectSweepTask : TaskSet
+{
+	ObjectSweepTask(SplitBVHBuilder& builder, BuildContext& context, const NodeSpec& spec, F32 nodeSAH, ObjectSplit* splits)
+		: TaskSet(3), m_builder(builder), m_context(context), m_spec(spec), m_nodeSAH(nodeSAH), m_splits(splits)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t dim = range.start; dim < range.end; dim++)
+			m_builder.sweepObjectSplit(m_context, m_spec, m_nodeSAH, dim, m_splits[dim]);
+	}
+
+	SplitBVHBuilder&        m_builder;
+	BuildContext&           m_context;
+	const NodeSpec&         m_spec;
+	F32                     m_nodeSAH;
+	ObjectSplit*            m_splits;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::SortChunkTask : TaskSet
+{
+	SortChunkTask(SortKey* keys, int numKeys, int chunkCount)
+		: TaskSet(chunkCount), m_keys(keys), m_numKeys(numKeys)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t chunk = range.start; chunk < range.end; chunk++)
+		{
+			int start = chunk * ParallelSweepMin;
+			std::sort(m_keys + start, m_keys + min1i(start + ParallelSweepMin, m_numKeys));
+		}
+	}
+
+	SortKey*                m_keys;
+	int                     m_numKeys;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::MergeTask : TaskSet
+{
+	MergeTask(const SortKey* src, SortKey* dst, int numKeys, int width)
+		: TaskSet((numKeys + 2 * width - 1) / (2 * width)), m_src(src), m_dst(dst), m_numKeys(numKeys), m_width(width)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t pair = range.start; pair < range.end; pair++)
+		{
+			int start = pair * 2 * m_width;
+			int mid = min1i(start + m_width, m_numKeys);
+			int end = min1i(start + 2 * m_width, m_numKeys);
+			std::merge(m_src + start, m_src + mid, m_src + mid, m_src + end, m_dst + start);
+		}
+	}
+
+	const SortKey*          m_src;
+	SortKey*                m_dst;
+	int                     m_numKeys;
+	int                     m_width;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::CentroidBoundsTask : TaskSet
+{
+	CentroidBoundsTask(const Reference* refs, int numRef, int chunkCount)
+		: TaskSet(chunkCount), m_refs(refs), m_numRef(numRef), m_bounds(chunkCount)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t chunk = range.start; chunk < range.end; chunk++)
+		{
+			int start = chunk * ParallelSweepMin;
+			m_bounds[chunk] = centroidBounds(m_refs + start, min1i(ParallelSweepMin, m_numRef - start));
+		}
+	}
+
+	const Reference*        m_refs;
+	int                     m_numRef;
+	std::vector<AABB>       m_bounds;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::ObjectBinningTask : TaskSet
+{
+	ObjectBinningTask(const Reference* refs, int numRef, int chunkCount, const Vec3f& origin, const Vec3f& scale)
+		: TaskSet(chunkCount), m_refs(refs), m_numRef(numRef), m_origin(origin), m_scale(scale), m_bins(chunkCount * 3 * NumObjectBins)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t chunk = range.start; chunk < range.end; chunk++)
+		{
+			int start = chunk * ParallelSweepMin;
+			binObjects(m_refs + start, min1i(ParallelSweepMin, m_numRef - start), m_origin, m_scale, &m_bins[chunk * 3 * NumObjectBins]);
+		}
+	}
+
+	const Reference*        m_refs;
+	int                     m_numRef;
+	Vec3f                   m_origin;
+	Vec3f                   m_scale;
+	std::vector<ObjectBin>  m_bins;
+};
+
+//------------------------------------------------------------------------
+
+struct SplitBVHBuilder::SpatialBinningTask : TaskSet
+{
+	SpatialBinningTask(const SplitBVHBuilder& builder, const Reference* refs, int numRef, int chunkCount, const Vec3f& origin, const Vec3f& binSize, const Vec3f& invBinSize)
+		: TaskSet(chunkCount), m_builder(builder), m_refs(refs), m_numRef(numRef), m_origin(origin), m_binSize(binSize), m_invBinSize(invBinSize), m_bins(chunkCount * 3 * NumSpatialBins)
+	{
+	}
+
+	virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+	{
+		for (uint32_t chunk = range.start; chunk < range.end; chunk++)
+		{
+			int start = chunk * ParallelSweepMin;
+			m_builder.binSpatial(m_refs + start, min1i(ParallelSweepMin, m_numRef - start), m_origin, m_binSize, m_invBinSize, &m_bins[chunk * 3 * NumSpatialBins]);
+		}
+	}
+
+	const SplitBVHBuilder&  m_builder;
+	const Reference*        m_refs;
+	int                     m_numRef;
+	Vec3f                   m_origin;
+	Vec3f                   m_binSize;
+	Vec3f                   m_invBinSize;
+	std::vector<SpatialBin> m_bins;
+};
+
+//------------------------------------------------------------------------
+
 SplitBVHBuilder::SplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params)
 	: m_bvh(bvh),
 	m_platform(bvh.getPlatform()),
 	m_params(params),
 	m_minOverlap(0.0f),   /// overlap of AABBs
-	m_sortDim(-1),
+	m_rootContext(NULL),
+	m_numDuplicates(0),
 	m_numNodes(0)
 {
 }
@@ -46,6 +231,8 @@ SplitBVHBuilder::SplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params)
 
 SplitBVHBuilder::~SplitBVHBuilder(void)
 {
+	for (size_t i = 0; i < m_contexts.size(); i++)
+		delete m_contexts[i];
 }
 
 //------------------------------------------------------------------------
@@ -60,74 +247,102 @@ BVHNode* SplitBVHBuilder::run(int &numNodes)  /// returns the rootnode
 	const GPUScene::Triangle* tris = m_bvh.getScene()->getTrianglePtr(); // list of all triangles in scene
 	const Vec3f* verts = m_bvh.getScene()->getVertexPtr();  // list of all vertices in scene
 
+	m_rootContext = createContext();
+	Array<Reference>& refStack = m_rootContext->refStack;
+
 	NodeSpec rootSpec;
 	rootSpec.numRef = m_bvh.getScene()->getNumTriangles();  // number of triangles/references in entire scene (root)
-	m_refStack.resize(rootSpec.numRef);
+	refStack.resize(rootSpec.numRef);
 	
 	// calculate the bounds of the rootnode by merging the AABBs of all the references
 	for (int i = 0; i < rootSpec.numRef; i++)
 	{
 		// assign triangle to the array of references
-		m_refStack[i].triIdx = i;  
+		refStack[i].triIdx = i;  
 		
 		// grow the bounds of each reference AABB in all 3 dimensions by including the vertex
 		for (int j = 0; j < 3; j++) 
-			m_refStack[i].bounds.grow(verts[tris[i].vertices._v[j]]);  
+			refStack[i].bounds.grow(verts[tris[i].vertices._v[j]]);  
 		
-		rootSpec.bounds.grow(m_refStack[i].bounds);
+		rootSpec.bounds.grow(refStack[i].bounds);
 	}
 
 	// Initialize rest of the members.
 
 	m_minOverlap = rootSpec.bounds.area() * m_params.splitAlpha;  /// split alpha (maximum allowable overlap) relative to size of rootnode
-	m_rightBounds.reset(max1i(rootSpec.numRef, (int)NumSpatialBins) - 1);
 	m_numDuplicates = 0;
+	m_numNodes = 0;
 	m_progressTimer.start();
 
 	// Build recursively.
-	BVHNode* root = buildNode(rootSpec, 0, 0.0f, 1.0f);  /// actual building of splitBVH
+	BVHNode* root = buildNode(*m_rootContext, rootSpec, 0, 0.0f, 1.0f);  /// actual building of splitBVH
+	m_rootContext->root = root;
 	numNodes = m_numNodes;
-	m_bvh.getTriIndices().compact();   // removes unused memoryspace from triIndices array
+
+	// Gather the triangles of every subtree in the BVH triangle list.
+
+	std::unordered_map<const BVHNode*, const BuildContext*> subtrees;
+	int numTris = 0;
+	for (size_t i = 0; i < m_contexts.size(); i++)
+	{
+		subtrees[m_contexts[i]->root] = m_contexts[i];
+		numTris += m_contexts[i]->tris.getSize();
+	}
+	Array<S32>& triIndices = m_bvh.getTriIndices();
+	triIndices.clear();
+	triIndices.setCapacity(numTris);
+	gatherTriangles(root, m_rootContext, subtrees);
 
 	// Done.
 
 	if (m_params.enablePrints)
-		printf("SplitBVHBuilder: progress %.0f%%, duplicates %.0f%%\n",
-		100.0f, (F32)m_numDuplicates / (F32)m_bvh.getScene()->getNumTriangles() * 100.0f);
+		printf("SplitBVHBuilder: progress %.0f%%, duplicates %.0f%%, %d tasks\n",
+		100.0f, (F32)m_numDuplicates / (F32)m_bvh.getScene()->getNumTriangles() * 100.0f, (int)m_contexts.size());
 
 	return root;
 }
 
 //------------------------------------------------------------------------
 
-int SplitBVHBuilder::sortCompare(void* data, int idxA, int idxB)
+SplitBVHBuilder::BuildContext* SplitBVHBuilder::createContext(void)
 {
-	const SplitBVHBuilder* ptr = (const SplitBVHBuilder*)data;
-	int dim = ptr->m_sortDim;
-	const Reference& ra = ptr->m_refStack[idxA];  // ra is a reference (struct containing a triIdx and bounds)
-	const Reference& rb = ptr->m_refStack[idxB];  // 
-	F32 ca = ra.bounds.min()._v[dim] + ra.bounds.max()._v[dim];  
-	F32 cb = rb.bounds.min()._v[dim] + rb.bounds.max()._v[dim];
-	return (ca < cb) ? -1 : (ca > cb) ? 1 : (ra.triIdx < rb.triIdx) ? -1 : (ra.triIdx > rb.triIdx) ? 1 : 0;
+	std::lock_guard<std::mutex> lock(m_contextsMutex);
+	m_contexts.push_back(new BuildContext);
+	return m_contexts.back();
 }
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::sortSwap(void* data, int idxA, int idxB)
+void SplitBVHBuilder::gatherTriangles(BVHNode* node, const BuildContext* context, const std::unordered_map<const BVHNode*, const BuildContext*>& subtrees)
 {
-	SplitBVHBuilder* ptr = (SplitBVHBuilder*)data;
-	swap(ptr->m_refStack[idxA], ptr->m_refStack[idxB]);
+	auto iter = subtrees.find(node);
+	if (iter != subtrees.end())
+		context = iter->second;
+
+	if (node->isLeaf())
+	{
+		// same order as a serial build : right subtree triangles come first
+		LeafNode* leaf = (LeafNode*)node;
+		Array<S32>& tris = m_bvh.getTriIndices();
+		int lo = tris.getSize();
+		tris.add(context->tris.getPtr(leaf->m_lo), leaf->m_hi - leaf->m_lo);
+		leaf->m_lo = lo;
+		leaf->m_hi = tris.getSize();
+		return;
+	}
+	gatherTriangles(node->getChildNode(1), context, subtrees);
+	gatherTriangles(node->getChildNode(0), context, subtrees);
 }
 
 //------------------------------------------------------------------------
 
 inline float min1f3(const float& a, const float& b, const float& c){ return min1f(min1f(a, b), c); }
 
-BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd)
+BVHNode* SplitBVHBuilder::buildNode(BuildContext& context, const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd)
 {
-	// Display progress.
+	// Display progress. Only the root context reports, it always builds the leftmost branch.
 
-	if (m_params.enablePrints && m_progressTimer.getElapsed() >= 1.0f)
+	if (m_params.enablePrints && &context == m_rootContext && m_progressTimer.getElapsed() >= 1.0f)
 	{
 		printf("SplitBVHBuilder: progress %.0f%%, duplicates %.0f%%\r",
 			progressStart * 100.0f, (F32)m_numDuplicates / (F32)m_bvh.getScene()->getNumTriangles() * 100.0f);
@@ -139,100 +354,352 @@ BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progres
 
 	if (spec.numRef <= m_platform.getMinLeafSize() || level >= MaxDepth)
 	{
-		return createLeaf(spec);
+		return createLeaf(context, spec);
 	}
 
-	// Find split candidates.
+	// Find split candidates. Spatial splits are skipped for fast builds.
 
 	F32 area = spec.bounds.area();
 	F32 leafSAH = area * m_platform.getTriangleCost(spec.numRef);	
 	F32 nodeSAH = area * m_platform.getNodeCost(2);
-	ObjectSplit object = findObjectSplit(spec, nodeSAH);
+	ObjectSplit object = m_params.spatialSplits ? findObjectSplit(context, spec, nodeSAH) : findBinnedSplit(context, spec, nodeSAH);
 
 	SpatialSplit spatial;
-	if (level < MaxSpatialDepth)
+	if (m_params.spatialSplits && level < MaxSpatialDepth)
 	{
 		AABB overlap = object.leftBounds;
 		overlap.intersect(object.rightBounds);
 		if (overlap.area() >= m_minOverlap)
-			spatial = findSpatialSplit(spec, nodeSAH);
+			spatial = findSpatialSplit(context, spec, nodeSAH);
 	}
 
 	// Leaf SAH is the lowest => create leaf.
 
 	F32 minSAH = min1f3(leafSAH, object.sah, spatial.sah);
 	if (minSAH == leafSAH && spec.numRef <= m_platform.getMaxLeafSize()){
-		return createLeaf(spec);
+		return createLeaf(context, spec);
 	}
 
 	// Leaf SAH is not the lowest => Perform spatial split.
 
 	NodeSpec left, right;
 	if (minSAH == spatial.sah){
-		performSpatialSplit(left, right, spec, spatial);
+		performSpatialSplit(context, left, right, spec, spatial);
 	}
 
 	if (!left.numRef || !right.numRef){ /// if either child contains no triangles/references
-		performObjectSplit(left, right, spec, object);
+		if (m_params.spatialSplits)
+			performObjectSplit(context, left, right, spec, object);
+		else
+			performBinnedSplit(context, left, right, spec, object);
 	}
 
 	// Create inner node.
 
 	m_numDuplicates += left.numRef + right.numRef - spec.numRef;
 	F32 progressMid = lerp(progressStart, progressEnd, (F32)right.numRef / (F32)(left.numRef + right.numRef));
-	BVHNode* rightNode = buildNode(right, level + 1, progressStart, progressMid);
-	BVHNode* leftNode = buildNode(left, level + 1, progressMid, progressEnd);
+	BVHNode* rightNode;
+	BVHNode* leftNode;
+	if (left.numRef >= ParallelSubtreeMin && right.numRef >= ParallelSubtreeMin)
+	{
+		// Right child references are on top of the stack, move them to a new context and build it on another task.
+
+		BuildContext* rightContext = createContext();
+		Array<Reference>& refs = context.refStack;
+		rightContext->refStack.set(refs.getPtr(refs.getSize() - right.numRef), right.numRef);
+		refs.resize(refs.getSize() - right.numRef);
+
+		SubtreeTask rightTask(*this, *rightContext, right, level + 1, progressStart, progressMid);
+		g_TS.AddTaskSetToPipe(&rightTask);
+		leftNode = buildNode(context, left, level + 1, progressMid, progressEnd);
+		g_TS.WaitforTaskSet(&rightTask);
+		rightNode = rightContext->root;
+	}
+	else
+	{
+		rightNode = buildNode(context, right, level + 1, progressStart, progressMid);
+		leftNode = buildNode(context, left, level + 1, progressMid, progressEnd);
+	}
 	return new InnerNode(spec.bounds, leftNode, rightNode);
 }
 
 //------------------------------------------------------------------------
 
-BVHNode* SplitBVHBuilder::createLeaf(const NodeSpec& spec)
+BVHNode* SplitBVHBuilder::createLeaf(BuildContext& context, const NodeSpec& spec)
 {
-	Array<S32>& tris = m_bvh.getTriIndices();
+	Array<S32>& tris = context.tris;
 	
 	for (int i = 0; i < spec.numRef; i++)
-		tris.add(m_refStack.removeLast().triIdx); // take a triangle from the stack and add it to tris array
+		tris.add(context.refStack.removeLast().triIdx); // take a triangle from the stack and add it to tris array
 
 	return new LeafNode(spec.bounds, tris.getSize() - spec.numRef, tris.getSize());
 }
 
 //------------------------------------------------------------------------
 
-SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(const NodeSpec& spec, F32 nodeSAH)
+SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH)
 {
+	// Sort and sweep each dimension, big nodes do it on 3 tasks.
+
+	ObjectSplit splits[3];
+	if (spec.numRef >= ParallelSweepMin)
+	{
+		ObjectSweepTask sweepTask(*this, context, spec, nodeSAH, splits);
+		RunTaskSet(&sweepTask);
+	}
+	else
+	{
+		for (int dim = 0; dim < 3; dim++)
+			sweepObjectSplit(context, spec, nodeSAH, dim, splits[dim]);
+	}
+
+	// Select lowest SAH, first dimension wins ties.
+
 	ObjectSplit split;
-	const Reference* refPtr = m_refStack.getPtr(m_refStack.getSize() - spec.numRef);
+	for (int dim = 0; dim < 3; dim++)
+	{
+		if (splits[dim].sah < split.sah)
+			split = splits[dim];
+	}
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::sweepObjectSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH, int dim, ObjectSplit& split)
+{
+	const Reference* refPtr = context.refStack.getPtr(context.refStack.getSize() - spec.numRef);
+
+	// Sort along the dimension.
+
+	std::vector<SortKey>& keys = context.keys[dim];
+	keys.resize(spec.numRef);
+	for (int i = 0; i < spec.numRef; i++)
+	{
+		keys[i].centroid = refPtr[i].bounds.min()._v[dim] + refPtr[i].bounds.max()._v[dim];
+		keys[i].triIdx = refPtr[i].triIdx;
+		keys[i].refIdx = i;
+	}
+	sortKeys(keys, context.sortScratch[dim]);
+
+	// Sweep right to left and determine bounds.
+
+	std::vector<F32>& rightAreas = context.rightAreas[dim];
+	rightAreas.resize(spec.numRef);
+	AABB rightBounds;
+	for (int i = spec.numRef - 1; i > 0; i--)
+	{
+		rightBounds.grow(refPtr[keys[i].refIdx].bounds);
+		rightAreas[i - 1] = rightBounds.area();
+	}
+
+	// Sweep left to right and select lowest SAH.
+
+	AABB leftBounds;
+	for (int i = 1; i < spec.numRef; i++)
+	{
+		leftBounds.grow(refPtr[keys[i - 1].refIdx].bounds);
+		F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(i) + rightAreas[i - 1] * m_platform.getTriangleCost(spec.numRef - i);
+		if (sah < split.sah)
+		{
+			split.sah = sah;
+			split.sortDim = dim;
+			split.numLeft = i;
+			split.leftBounds = leftBounds;
+		}
+	}
+
+	// Only areas are kept by the sweep, compute the selected right bounds.
+
+	for (int i = split.numLeft; split.numLeft && i < spec.numRef; i++)
+		split.rightBounds.grow(refPtr[keys[i].refIdx].bounds);
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::sortKeys(std::vector<SortKey>& keys, std::vector<SortKey>& scratch)
+{
+	int numKeys = (int)keys.size();
+	if (numKeys < ParallelSweepMin)
+	{
+		std::sort(keys.begin(), keys.end());
+		return;
+	}
+
+	// Sort chunks in parallel then merge them pairwise, pairs of each pass are merged in parallel too.
+	// Keys order is total so the result is the same as a serial sort.
+
+	SortChunkTask sortTask(keys.data(), numKeys, (numKeys + ParallelSweepMin - 1) / ParallelSweepMin);
+	RunTaskSet(&sortTask);
+
+	scratch.resize(numKeys);
+	SortKey* src = keys.data();
+	SortKey* dst = scratch.data();
+	for (int width = ParallelSweepMin; width < numKeys; width *= 2)
+	{
+		MergeTask mergeTask(src, dst, numKeys, width);
+		RunTaskSet(&mergeTask);
+		swap(src, dst);
+	}
+	if (src != keys.data())
+		std::copy(src, src + numKeys, keys.data());
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::performObjectSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
+{
+	// Reorder the references as sorted by the sweep of the split dimension.
+
+	Reference* refPtr = context.refStack.getPtr(context.refStack.getSize() - spec.numRef);
+	const std::vector<SortKey>& keys = context.keys[split.sortDim];
+	context.refScratch.assign(refPtr, refPtr + spec.numRef);
+	for (int i = 0; i < spec.numRef; i++)
+		refPtr[i] = context.refScratch[keys[i].refIdx];
+
+	left.numRef = split.numLeft;
+	left.bounds = split.leftBounds;
+	right.numRef = spec.numRef - split.numLeft;
+	right.bounds = split.rightBounds;
+}
+
+//------------------------------------------------------------------------
+
+AABB SplitBVHBuilder::centroidBounds(const Reference* refs, int numRef)
+{
+	AABB bounds;
+	for (int i = 0; i < numRef; i++)
+		bounds.grow(refs[i].bounds.midPoint());
+	return bounds;
+}
 
-	// Sort along each dimension.
+//------------------------------------------------------------------------
 
-	for (m_sortDim = 0; m_sortDim < 3; m_sortDim++)
+int SplitBVHBuilder::objectBin(const Reference& ref, int dim, F32 origin, F32 scale)
+{
+	int bin = (int)((ref.bounds.midPoint()._v[dim] - origin) * scale);
+	return bin < 0 ? 0 : bin >= NumObjectBins ? NumObjectBins - 1 : bin;
+}
+
+//------------------------------------------------------------------------
+
+void SplitBVHBuilder::binObjects(const Reference* refs, int numRef, const Vec3f& origin, const Vec3f& scale, ObjectBin* bins)
+{
+	for (int i = 0; i < 3 * NumObjectBins; i++)
 	{
-		Sort(m_refStack.getSize() - spec.numRef, m_refStack.getSize(), this, sortCompare, sortSwap);
+		bins[i].bounds = AABB();
+		bins[i].count = 0;
+	}
+
+	for (int refIdx = 0; refIdx < numRef; refIdx++)
+	{
+		for (int dim = 0; dim < 3; dim++)
+		{
+			ObjectBin& bin = bins[dim * NumObjectBins + objectBin(refs[refIdx], dim, origin._v[dim], scale._v[dim])];
+			bin.bounds.grow(refs[refIdx].bounds);
+			bin.count++;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findBinnedSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH)
+{
+	// Binned SAH over the centroid bounds, big nodes bin chunks of references on separate tasks.
+
+	const Reference* refPtr = context.refStack.getPtr(context.refStack.getSize() - spec.numRef);
+	int chunkCount = (spec.numRef + ParallelSweepMin - 1) / ParallelSweepMin;
+
+	AABB centroids;
+	if (chunkCount > 1)
+	{
+		CentroidBoundsTask boundsTask(refPtr, spec.numRef, chunkCount);
+		RunTaskSet(&boundsTask);
+		for (int chunk = 0; chunk < chunkCount; chunk++)
+			centroids.grow(boundsTask.m_bounds[chunk]);
+	}
+	else
+	{
+		centroids = centroidBounds(refPtr, spec.numRef);
+	}
+
+	Vec3f origin = centroids.min();
+	Vec3f scale(0.0f, 0.0f, 0.0f);
+	for (int dim = 0; dim < 3; dim++)
+	{
+		F32 extent = centroids.max()._v[dim] - origin._v[dim];
+		scale._v[dim] = (extent > 0.0f) ? (F32)NumObjectBins / extent : 0.0f;
+	}
+
+	ObjectBin bins[3 * NumObjectBins];
+	if (chunkCount > 1)
+	{
+		ObjectBinningTask binningTask(refPtr, spec.numRef, chunkCount, origin, scale);
+		RunTaskSet(&binningTask);
+		for (int i = 0; i < 3 * NumObjectBins; i++)
+		{
+			bins[i] = binningTask.m_bins[i];
+			for (int chunk = 1; chunk < chunkCount; chunk++)
+			{
+				const ObjectBin& chunkBin = binningTask.m_bins[chunk * 3 * NumObjectBins + i];
+				if (chunkBin.count)
+					bins[i].bounds.grow(chunkBin.bounds);
+				bins[i].count += chunkBin.count;
+			}
+		}
+	}
+	else
+	{
+		binObjects(refPtr, spec.numRef, origin, scale, bins);
+	}
+
+	// Select best split plane.
+
+	ObjectSplit split;
+	AABB rightBoundsArray[NumObjectBins - 1];
+	for (int dim = 0; dim < 3; dim++)
+	{
+		// All centroids at the same position, nothing to split.
+
+		if (scale._v[dim] == 0.0f)
+			continue;
+
+		const ObjectBin* dimBins = bins + dim * NumObjectBins;
 
 		// Sweep right to left and determine bounds.
 
 		AABB rightBounds;
-		for (int i = spec.numRef - 1; i > 0; i--)
+		for (int i = NumObjectBins - 1; i > 0; i--)
 		{
-			rightBounds.grow(refPtr[i].bounds);
-			m_rightBounds[i - 1] = rightBounds;
+			if (dimBins[i].count)
+				rightBounds.grow(dimBins[i].bounds);
+			rightBoundsArray[i - 1] = rightBounds;
 		}
 
 		// Sweep left to right and select lowest SAH.
 
 		AABB leftBounds;
-		for (int i = 1; i < spec.numRef; i++)
+		int leftNum = 0;
+		for (int i = 1; i < NumObjectBins; i++)
 		{
-			leftBounds.grow(refPtr[i - 1].bounds);
-			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(i) + m_rightBounds[i - 1].area() * m_platform.getTriangleCost(spec.numRef - i);
+			if (dimBins[i - 1].count)
+				leftBounds.grow(dimBins[i - 1].bounds);
+			leftNum += dimBins[i - 1].count;
+			if (!leftNum || leftNum == spec.numRef)
+				continue;
+
+			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(leftNum) + rightBoundsArray[i - 1].area() * m_platform.getTriangleCost(spec.numRef - leftNum);
 			if (sah < split.sah)
 			{
 				split.sah = sah;
-				split.sortDim = m_sortDim;
-				split.numLeft = i;
+				split.sortDim = dim;
+				split.numLeft = leftNum;
 				split.leftBounds = leftBounds;
-				split.rightBounds = m_rightBounds[i - 1];
+				split.rightBounds = rightBoundsArray[i - 1];
+				split.bin = i;
+				split.binOrigin = origin._v[dim];
+				split.binScale = scale._v[dim];
 			}
 		}
 	}
@@ -241,14 +708,43 @@ SplitBVHBuilder::ObjectSplit SplitBVHBuilder::findObjectSplit(const NodeSpec& sp
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::performObjectSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
+void SplitBVHBuilder::performBinnedSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
 {
-	m_sortDim = split.sortDim;
-	Sort(m_refStack.getSize() - spec.numRef, m_refStack.getSize(), this, sortCompare, sortSwap);
+	Array<Reference>& refs = context.refStack;
+	int leftStart = refs.getSize() - spec.numRef;
+	int leftEnd = leftStart;
+	int rightStart = refs.getSize();
 
-	left.numRef = split.numLeft;
+	if (!split.numLeft)
+	{
+		// No usable plane (centroids all in the same place), split the references in two halves.
+
+		left.numRef = spec.numRef >> 1;
+		right.numRef = spec.numRef - left.numRef;
+		left.bounds = right.bounds = AABB();
+		for (int i = leftStart; i < rightStart; i++)
+		{
+			if (i < leftStart + left.numRef)
+				left.bounds.grow(refs[i].bounds);
+			else
+				right.bounds.grow(refs[i].bounds);
+		}
+		return;
+	}
+
+	// Partition the references, right side ends up on top of the stack.
+
+	while (leftEnd < rightStart)
+	{
+		if (objectBin(refs[leftEnd], split.sortDim, split.binOrigin, split.binScale) < split.bin)
+			leftEnd++;
+		else
+			swap(refs[leftEnd], refs[--rightStart]);
+	}
+
+	left.numRef = leftEnd - leftStart;
 	left.bounds = split.leftBounds;
-	right.numRef = spec.numRef - split.numLeft;
+	right.numRef = spec.numRef - left.numRef;
 	right.bounds = split.rightBounds;
 }
 
@@ -262,62 +758,94 @@ inline Vec3i clamp3i(const Vec3i& v, const Vec3i& lo, const Vec3i& hi){
 	return Vec3i(clamp1i(v.x, lo.x, hi.x), clamp1i(v.y, lo.y, hi.y), clamp1i(v.z, lo.z, hi.z));}
 
 
-SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(const NodeSpec& spec, F32 nodeSAH)
+void SplitBVHBuilder::binSpatial(const Reference* refs, int numRef, const Vec3f& origin, const Vec3f& binSize, const Vec3f& invBinSize, SpatialBin* bins) const
 {
-	// Initialize bins.
-
-	Vec3f origin = spec.bounds.min();
-	Vec3f binSize = (spec.bounds.max() - origin) * (1.0f / (F32)NumSpatialBins);
-	Vec3f invBinSize = Vec3f(1.0f / binSize.x, 1.0f / binSize.y, 1.0f / binSize.z);
-
-	for (int dim = 0; dim < 3; dim++)
+	for (int i = 0; i < 3 * NumSpatialBins; i++)
 	{
-		for (int i = 0; i < NumSpatialBins; i++)
-		{
-			SpatialBin& bin = m_bins[dim][i];
-			bin.bounds = AABB();
-			bin.enter = 0;
-			bin.exit = 0;
-		}
+		bins[i].bounds = AABB();
+		bins[i].enter = 0;
+		bins[i].exit = 0;
 	}
 
 	// Chop references into bins.
 
-	for (int refIdx = m_refStack.getSize() - spec.numRef; refIdx < m_refStack.getSize(); refIdx++)
+	for (int refIdx = 0; refIdx < numRef; refIdx++)
 	{
-		const Reference& ref = m_refStack[refIdx];
+		const Reference& ref = refs[refIdx];
 
 		Vec3i firstBin = clamp3i(Vec3i((ref.bounds.min() - origin) * invBinSize), Vec3i(0, 0, 0), Vec3i(NumSpatialBins - 1, NumSpatialBins - 1, NumSpatialBins - 1));
 		Vec3i lastBin = clamp3i(Vec3i((ref.bounds.max() - origin) * invBinSize), firstBin, Vec3i(NumSpatialBins - 1, NumSpatialBins - 1, NumSpatialBins - 1));
 
 		for (int dim = 0; dim < 3; dim++)
 		{
+			SpatialBin* dimBins = bins + dim * NumSpatialBins;
 			Reference currRef = ref;
 			for (int i = firstBin._v[dim]; i < lastBin._v[dim]; i++)
 			{
 				Reference leftRef, rightRef;
 				splitReference(leftRef, rightRef, currRef, dim, origin._v[dim] + binSize._v[dim] * (F32)(i + 1));
-				m_bins[dim][i].bounds.grow(leftRef.bounds);
+				dimBins[i].bounds.grow(leftRef.bounds);
 				currRef = rightRef;
 			}
-			m_bins[dim][lastBin._v[dim]].bounds.grow(currRef.bounds);
-			m_bins[dim][firstBin._v[dim]].enter++;
-			m_bins[dim][lastBin._v[dim]].exit++;
+			dimBins[lastBin._v[dim]].bounds.grow(currRef.bounds);
+			dimBins[firstBin._v[dim]].enter++;
+			dimBins[lastBin._v[dim]].exit++;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH)
+{
+	// Initialize bins.
+
+	Vec3f origin = spec.bounds.min();
+	Vec3f binSize = (spec.bounds.max() - origin) * (1.0f / (F32)NumSpatialBins);
+	Vec3f invBinSize = Vec3f(1.0f / binSize.x, 1.0f / binSize.y, 1.0f / binSize.z);
+
+	// Bin the references, big nodes bin chunks of references on separate tasks.
+
+	const Reference* refPtr = context.refStack.getPtr(context.refStack.getSize() - spec.numRef);
+	int chunkCount = (spec.numRef + ParallelSweepMin - 1) / ParallelSweepMin;
+	SpatialBin bins[3 * NumSpatialBins];
+	if (chunkCount > 1)
+	{
+		SpatialBinningTask binningTask(*this, refPtr, spec.numRef, chunkCount, origin, binSize, invBinSize);
+		RunTaskSet(&binningTask);
+		for (int i = 0; i < 3 * NumSpatialBins; i++)
+		{
+			bins[i] = binningTask.m_bins[i];
+			for (int chunk = 1; chunk < chunkCount; chunk++)
+			{
+				const SpatialBin& chunkBin = binningTask.m_bins[chunk * 3 * NumSpatialBins + i];
+				if (chunkBin.bounds.valid())   // growing by an empty box would make it infinite
+					bins[i].bounds.grow(chunkBin.bounds);
+				bins[i].enter += chunkBin.enter;
+				bins[i].exit += chunkBin.exit;
+			}
 		}
 	}
+	else
+	{
+		binSpatial(refPtr, spec.numRef, origin, binSize, invBinSize, bins);
+	}
 
 	// Select best split plane.
 
 	SpatialSplit split;
+	AABB rightBoundsArray[NumSpatialBins - 1];
 	for (int dim = 0; dim < 3; dim++)
 	{
+		const SpatialBin* dimBins = bins + dim * NumSpatialBins;
+
 		// Sweep right to left and determine bounds.
 
 		AABB rightBounds;
 		for (int i = NumSpatialBins - 1; i > 0; i--)
 		{
-			rightBounds.grow(m_bins[dim][i].bounds);
-			m_rightBounds[i - 1] = rightBounds;
+			rightBounds.grow(dimBins[i].bounds);
+			rightBoundsArray[i - 1] = rightBounds;
 		}
 
 		// Sweep left to right and select lowest SAH.
@@ -328,11 +856,11 @@ SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(const NodeSpec&
 
 		for (int i = 1; i < NumSpatialBins; i++)
 		{
-			leftBounds.grow(m_bins[dim][i - 1].bounds);
-			leftNum += m_bins[dim][i - 1].enter;
-			rightNum -= m_bins[dim][i - 1].exit;
+			leftBounds.grow(dimBins[i - 1].bounds);
+			leftNum += dimBins[i - 1].enter;
+			rightNum -= dimBins[i - 1].exit;
 
-			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(leftNum) + m_rightBounds[i - 1].area() * m_platform.getTriangleCost(rightNum);
+			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(leftNum) + rightBoundsArray[i - 1].area() * m_platform.getTriangleCost(rightNum);
 			if (sah < split.sah)
 			{
 				split.sah = sah;
@@ -346,7 +874,7 @@ SplitBVHBuilder::SpatialSplit SplitBVHBuilder::findSpatialSplit(const NodeSpec&
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split)
+void SplitBVHBuilder::performSpatialSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split)
 {
 	// Categorize references and compute bounds.
 	//
@@ -354,7 +882,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 	// Uncategorized/split: [leftEnd, rightStart[
 	// Right-hand side:     [rightStart, refs.getSize()[
 
-	Array<Reference>& refs = m_refStack;
+	Array<Reference>& refs = context.refStack;
 	int leftStart = refs.getSize() - spec.numRef;
 	int leftEnd = leftStart;
 	int rightStart = refs.getSize();
@@ -442,7 +970,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 
 //------------------------------------------------------------------------
 
-void SplitBVHBuilder::splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos)
+void SplitBVHBuilder::splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos) const
 {
 	// Initialize references.
 
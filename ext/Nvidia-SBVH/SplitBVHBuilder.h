@@ -28,6 +28,10 @@
 #pragma once
 #include "BVH.h"
 #include "Timer.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 class SplitBVHBuilder
 {
@@ -37,6 +41,9 @@ private:
 		MaxDepth = 64,
 		MaxSpatialDepth = 48,
 		NumSpatialBins = 32,
+		NumObjectBins = 32,       // binned SAH, used instead of the sorted sweeps when spatial splits are disabled
+		ParallelSubtreeMin = 4096, // both children need at least this many references to be built on separate tasks
+		ParallelSweepMin = 32768,  // sorts and binning of bigger nodes are split into chunks of that size
 	};
 
 	struct Reference   /// a AABB bounding box enclosing 1 triangle, a reference can be duplicated by a split to be contained in 2 AABB boxes
@@ -62,8 +69,11 @@ private:
 		S32                 numLeft;  // number of triangles (references) in left child
 		AABB                leftBounds;
 		AABB                rightBounds;
+		S32                 bin;        // binned split : references with a centroid bin lower than this go left
+		F32                 binOrigin;
+		F32                 binScale;
 
-		ObjectSplit(void) : sah(FW_F32_MAX), sortDim(0), numLeft(0) {}
+		ObjectSplit(void) : sah(FW_F32_MAX), sortDim(0), numLeft(0), bin(0), binOrigin(0.0f), binScale(0.0f) {}
 	};
 
 	struct SpatialSplit
@@ -82,6 +92,43 @@ private:
 		S32                 exit;
 	};
 
+	struct ObjectBin
+	{
+		AABB                bounds;
+		S32                 count;
+	};
+
+	struct SortKey   /// reference centroid along the sorted axis, triIdx then refIdx make the order total
+	{
+		F32                 centroid;
+		S32                 triIdx;
+		S32                 refIdx;
+
+		bool operator < (const SortKey& other) const { return (centroid != other.centroid) ? centroid < other.centroid : (triIdx != other.triIdx) ? triIdx < other.triIdx : refIdx < other.refIdx; }
+		friend void swap(SortKey& a, SortKey& b) { SortKey t = a; a = b; b = t; }  // std algorithms would find both std::swap and ::swap
+	};
+
+	struct BuildContext   /// state of a subtree build, only touched by the task building it
+	{
+		Array<Reference>    refStack;
+		Array<S32>          tris;       // leaves index this array until the triangles are gathered in the BVH
+		BVHNode*            root;
+		std::vector<SortKey> keys[3];   // sweep order per axis, the selected one reorders the references
+		std::vector<SortKey> sortScratch[3];
+		std::vector<F32>    rightAreas[3];
+		std::vector<Reference> refScratch;
+
+		BuildContext(void) : root(NULL) {}
+	};
+
+	struct SubtreeTask;
+	struct ObjectSweepTask;
+	struct SortChunkTask;
+	struct MergeTask;
+	struct CentroidBoundsTask;
+	struct ObjectBinningTask;
+	struct SpatialBinningTask;
+
 public:
 	SplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params);
 	~SplitBVHBuilder(void);
@@ -89,18 +136,26 @@ public:
 	BVHNode*                run(int &numNodes);
 
 private:
-	static int              sortCompare(void* data, int idxA, int idxB);
-	static void             sortSwap(void* data, int idxA, int idxB);
-
-	BVHNode*                buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd);
-	BVHNode*                createLeaf(const NodeSpec& spec);
-
-	ObjectSplit             findObjectSplit(const NodeSpec& spec, F32 nodeSAH);
-	void                    performObjectSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
-
-	SpatialSplit            findSpatialSplit(const NodeSpec& spec, F32 nodeSAH);
-	void                    performSpatialSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split);
-	void                    splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos);
+	BVHNode*                buildNode(BuildContext& context, const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd);
+	BVHNode*                createLeaf(BuildContext& context, const NodeSpec& spec);
+	BuildContext*           createContext(void);
+	void                    gatherTriangles(BVHNode* node, const BuildContext* context, const std::unordered_map<const BVHNode*, const BuildContext*>& subtrees);
+
+	ObjectSplit             findObjectSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH);
+	void                    sweepObjectSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH, int dim, ObjectSplit& split);
+	void                    performObjectSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
+	static void             sortKeys(std::vector<SortKey>& keys, std::vector<SortKey>& scratch);
+
+	ObjectSplit             findBinnedSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH);
+	void                    performBinnedSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
+	static AABB             centroidBounds(const Reference* refs, int numRef);
+	static int              objectBin(const Reference& ref, int dim, F32 origin, F32 scale);
+	static void             binObjects(const Reference* refs, int numRef, const Vec3f& origin, const Vec3f& scale, ObjectBin* bins);   // bins[dim * NumObjectBins + i]
+
+	SpatialSplit            findSpatialSplit(BuildContext& context, const NodeSpec& spec, F32 nodeSAH);
+	void                    performSpatialSplit(BuildContext& context, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split);
+	void                    binSpatial(const Reference* refs, int numRef, const Vec3f& origin, const Vec3f& binSize, const Vec3f& invBinSize, SpatialBin* bins) const;   // bins[dim * NumSpatialBins + i]
+	void                    splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos) const;
 
 private:
 	SplitBVHBuilder(const SplitBVHBuilder&); // forbidden
@@ -111,15 +166,13 @@ private:
 	const Platform&         m_platform;
 	const BVH::BuildParams& m_params;
 
-	Array<Reference>      m_refStack;
 	F32                     m_minOverlap;
-	Array<AABB>           m_rightBounds;
-	S32                     m_sortDim;
-	SpatialBin              m_bins[3][NumSpatialBins];
+	BuildContext*           m_rootContext;
+	std::vector<BuildContext*> m_contexts;   // root context and one per subtree built on another task
+	std::mutex              m_contextsMutex;
 
 	FW::Timer               m_progressTimer;
-	S32                     m_numDuplicates;
-	int						m_numNodes;
+	std::atomic<S32>        m_numDuplicates;
+	std::atomic<int>        m_numNodes;
 };
 
-	
\ No newline at end of file
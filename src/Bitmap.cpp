@@ -26,8 +26,18 @@
 #include "Platform.h"
 #include <fstream>
 #include "Bitmap.h"
+#include "ImageOps.h"
+#include "BlockCompression.h"
 #include "Utils.h"
-
+#include "UploadQueue.h"
+
+// Inside DecodeSTB, stb_image allocates decoded texels as image buffers so they can be attached to Image without copy.
+// Other callers (SOIL, the path tracer loader) free their results with free/delete and keep malloc.
+static thread_local bool gSTBIImageBuffer = false;
+#define STBI_MALLOC(size) (gSTBIImageBuffer ? (void*)ImageBuffer::Allocate(size) : malloc(size))
+#define STBI_REALLOC(ptr, size)                                                                                        \
+    (gSTBIImageBuffer ? (void*)ImageBuffer::Reallocate((unsigned char*)(ptr), size) : realloc(ptr, size))
+#define STBI_FREE(ptr) (gSTBIImageBuffer ? ImageBuffer::Release((unsigned char*)(ptr)) : free(ptr))
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -42,40 +52,45 @@
 #if USE_FFMPEG
 #include "ffmpegCodec.h"
 #endif
+#include <atomic>
+#include <memory>
+#include <sys/stat.h>
+
+extern TaskScheduler g_TS;
 ImageCache gImageCache;
 DefaultShaders gDefaultShader;
 #ifdef GL_BGR
 const unsigned int glInputFormats[] = {
     GL_BGR,
     GL_RGB,
-    GL_RGB16,
-    GL_RGB16F,
-    GL_RGB32F,
+    GL_RGB,
+    GL_RGB,
+    GL_RGB,
     GL_RGBA, // RGBE
 
     GL_BGRA,
     GL_RGBA,
-    GL_RGBA16,
-    GL_RGBA16F,
-    GL_RGBA32F,
+    GL_RGBA,
+    GL_RGBA,
+    GL_RGBA,
 
     GL_RGBA, // RGBM
 };
-const unsigned int glInternalFormats[] = {
-    GL_RGB,
-    GL_RGB,
+const unsigned int glStorageFormats[] = {
+    GL_RGB8,
+    GL_RGB8,
     GL_RGB16,
     GL_RGB16F,
     GL_RGB32F,
-    GL_RGBA, // RGBE
+    GL_RGBA8, // RGBE
 
-    GL_RGBA,
-    GL_RGBA,
+    GL_RGBA8,
+    GL_RGBA8,
     GL_RGBA16,
     GL_RGBA16F,
     GL_RGBA32F,
 
-    GL_RGBA, // RGBM
+    GL_RGBA8, // RGBM
 };
 #else
 const unsigned int glInputFormats[] = {
@@ -94,24 +109,41 @@ const unsigned int glInputFormats[] = {
 
     GL_RGBA, // RGBM
 };
-const unsigned int glInternalFormats[] = {
-    GL_RGB,
-    GL_RGB,
-    GL_RGB,
-    GL_RGB,
-    GL_RGB,
-    GL_RGBA, // RGBE
+// no 16 bits normalized formats in GLES 3, the upload queue converts RGB(A)16 images to half float
+const unsigned int glStorageFormats[] = {
+    GL_RGB8,
+    GL_RGB8,
+    GL_RGB16F,
+    GL_RGB16F,
+    GL_RGB32F,
+    GL_RGBA8, // RGBE
 
-    GL_RGBA,
-    GL_RGBA,
-    GL_RGBA,
-    GL_RGBA,
-    GL_RGBA,
+    GL_RGBA8,
+    GL_RGBA8,
+    GL_RGBA16F,
+    GL_RGBA16F,
+    GL_RGBA32F,
 
-    GL_RGBA, // RGBM
+    GL_RGBA8, // RGBM
 };
 
 #endif
+const unsigned int glInputTypes[] = {
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_SHORT,
+    GL_HALF_FLOAT,
+    GL_FLOAT,
+    GL_UNSIGNED_BYTE, // RGBE
+
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_SHORT,
+    GL_HALF_FLOAT,
+    GL_FLOAT,
+
+    GL_UNSIGNED_BYTE, // RGBM
+};
 const unsigned int glCubeFace[] = {
     GL_TEXTURE_CUBE_MAP_POSITIVE_X,
     GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
@@ -139,6 +171,63 @@ void SaveCapture(const std::string& filemane, int x, int y, int w, int h)
     delete[] imgBits;
 }
 
+namespace ImageBuffer
+{
+    // 16 bytes so bits keep the malloc alignment for SIMD loads
+    struct Header
+    {
+        std::atomic<int> mRefCount;
+        uint32_t mPad[3];
+    };
+    static_assert(sizeof(Header) == 16, "Image buffer header must keep bits 16 bytes aligned");
+
+    static inline Header* GetHeader(const unsigned char* bits)
+    {
+        return (Header*)(bits - sizeof(Header));
+    }
+
+    unsigned char* Allocate(size_t size)
+    {
+        Header* header = (Header*)BufferPool::Allocate(sizeof(Header) + size);
+        if (!header)
+            return NULL;
+        new (&header->mRefCount) std::atomic<int>(1);
+        return (unsigned char*)(header + 1);
+    }
+
+    unsigned char* Reallocate(unsigned char* bits, size_t size)
+    {
+        if (!bits)
+            return Allocate(size);
+        size_t capacity = BufferPool::Capacity(GetHeader(bits)) - sizeof(Header);
+        if (size <= capacity)
+            return bits;
+        unsigned char* newBits = Allocate(size);
+        if (newBits)
+            memcpy(newBits, bits, capacity);
+        Release(bits);
+        return newBits;
+    }
+
+    unsigned char* AddRef(unsigned char* bits)
+    {
+        if (bits)
+            GetHeader(bits)->mRefCount.fetch_add(1, std::memory_order_relaxed);
+        return bits;
+    }
+
+    void Release(unsigned char* bits)
+    {
+        if (bits && GetHeader(bits)->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            BufferPool::Free(GetHeader(bits));
+    }
+
+    bool IsShared(const unsigned char* bits)
+    {
+        return bits && GetHeader(bits)->mRefCount.load(std::memory_order_acquire) > 1;
+    }
+} // namespace ImageBuffer
+
 #if USE_FFMPEG
 Image Image::DecodeImage(FFMPEGCodec::Decoder* decoder, int frame)
 {
@@ -169,82 +258,409 @@ Image Image::DecodeImage(FFMPEGCodec::Decoder* decoder, int frame)
     return image;
 }
 #endif
-int Image::LoadSVG(const char* filename, Image* image, float dpi)
+
+// Parsed SVG documents. Documents are parsed once at the reference DPI and scaled when rasterized,
+// so changing the DPI doesn't parse the file again. Entries are dropped when the file changes on disk.
+static const float SVGReferenceDPI = 96.f;
+static const size_t SVGMaxDocumentCount = 16;
+static const int SVGBandHeight = 64;
+
+struct SVGDocumentCache
 {
-    NSVGimage* svgImage;
-    svgImage = nsvgParseFromFile(filename, "px", dpi);
-    if (!svgImage)
-        return EVAL_ERR;
+    std::shared_ptr<NSVGimage> GetDocument(const std::string& filepath)
+    {
+        int64_t fileTime, fileSize;
+        if (!GetFileStamp(filepath, fileTime, fileSize))
+            return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mCacheAccess);
+            auto iter = mDocuments.find(filepath);
+            if (iter != mDocuments.end() && iter->second.mFileTime == fileTime && iter->second.mFileSize == fileSize)
+            {
+                iter->second.mLastUse = ++mUseCounter;
+                return iter->second.mDocument;
+            }
+        }
 
-    int width = (int)svgImage->width;
-    int height = (int)svgImage->height;
+        // parsing is the slow part, don't block the other documents
+        NSVGimage* parsed = nsvgParseFromFile(filepath.c_str(), "px", SVGReferenceDPI);
+        if (!parsed)
+            return nullptr;
+        std::shared_ptr<NSVGimage> document(parsed, nsvgDelete);
+
+        std::lock_guard<std::mutex> lock(mCacheAccess);
+        Entry& entry = mDocuments[filepath];
+        entry.mDocument = document;
+        entry.mFileTime = fileTime;
+        entry.mFileSize = fileSize;
+        entry.mLastUse = ++mUseCounter;
+        while (mDocuments.size() > SVGMaxDocumentCount)
+        {
+            auto oldest = mDocuments.begin();
+            for (auto iter = mDocuments.begin(); iter != mDocuments.end(); ++iter)
+            {
+                if (iter->second.mLastUse < oldest->second.mLastUse)
+                    oldest = iter;
+            }
+            // rasterizations in progress keep their reference
+            mDocuments.erase(oldest);
+        }
+        return document;
+    }
 
-    // Create rasterizer (can be used to render multiple images).
-    NSVGrasterizer* rast = nsvgCreateRasterizer();
+protected:
+    struct Entry
+    {
+        std::shared_ptr<NSVGimage> mDocument;
+        int64_t mFileTime;
+        int64_t mFileSize;
+        uint64_t mLastUse;
+    };
+    std::map<std::string, Entry> mDocuments;
+    std::mutex mCacheAccess;
+    uint64_t mUseCounter = 0;
+};
+static SVGDocumentCache gSVGDocumentCache;
 
-    // Allocate memory for image
-    size_t imgSize = width * height * 4;
-    unsigned char* img = (unsigned char*)malloc(imgSize);
+// Horizontal bands are rasterized in parallel, each with its own rasterizer.
+// Images are bottom-up : bands are written from their last row with a negative stride instead of flipping after.
+struct SVGRasterizeTaskSet : TaskSet
+{
+    SVGRasterizeTaskSet(NSVGimage* document, float scale, unsigned char* bits, int width, int height)
+        : TaskSet((height + SVGBandHeight - 1) / SVGBandHeight)
+        , mDocument(document)
+        , mScale(scale)
+        , mBits(bits)
+        , mWidth(width)
+        , mHeight(height)
+    {
+    }
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        NSVGrasterizer* rasterizer = nsvgCreateRasterizer();
+        for (uint32_t band = range.start; band < range.end; band++)
+        {
+            int y = int(band) * SVGBandHeight;
+            int bandHeight = (y + SVGBandHeight < mHeight) ? SVGBandHeight : mHeight - y;
+            unsigned char* dst = mBits + size_t(mHeight - 1 - y) * mWidth * 4;
+            nsvgRasterize(rasterizer, mDocument, 0.f, -float(y), mScale, dst, mWidth, bandHeight, -mWidth * 4);
+        }
+        nsvgDeleteRasterizer(rasterizer);
+    }
+    NSVGimage* mDocument;
+    float mScale;
+    unsigned char* mBits;
+    int mWidth, mHeight;
+};
+
+int Image::LoadSVG(const char* filename, Image* image, float dpi)
+{
+    std::shared_ptr<NSVGimage> document = gSVGDocumentCache.GetDocument(filename);
+    if (!document)
+        return EVAL_ERR;
+
+    // rasterized straight at the requested resolution
+    float scale = dpi / SVGReferenceDPI;
+    int width = int(ceilf(document->width * scale));
+    int height = int(ceilf(document->height * scale));
+    if (width <= 0 || height <= 0)
+        return EVAL_ERR;
 
-    // Rasterize
-    nsvgRasterize(rast, svgImage, 0, 0, 1, img, width, height, width * 4);
+    size_t imgSize = size_t(width) * height * 4;
+    unsigned char* bits = ImageBuffer::Allocate(imgSize);
+    SVGRasterizeTaskSet rasterizeTask(document.get(), scale, bits, width, height);
+    g_TS.AddTaskSetToPipe(&rasterizeTask);
+    g_TS.WaitforTaskSet(&rasterizeTask);
 
-    image->SetBits(img, imgSize);
+    image->AttachBits(bits, imgSize);
     image->mWidth = width;
     image->mHeight = height;
     image->mNumMips = 1;
     image->mNumFaces = 1;
     image->mFormat = TextureFormat::RGBA8;
     image->mDecoder = NULL;
-
-    Image::VFlip(image);
-    nsvgDelete(svgImage);
-    nsvgDeleteRasterizer(rast);
     return EVAL_OK;
 }
 
-int Image::Read(const char* filename, Image* image)
+// integer box filter factor so the largest side is no bigger than maxSize
+static int ReduceFactor(int width, int height, int maxSize)
 {
-    std::string filenameStr(filename);
-    Image* cacheImage = gImageCache.GetImage(filenameStr);
-    if (cacheImage)
+    if (maxSize <= 0)
+        return 1;
+    int size = (width > height) ? width : height;
+    return (size + maxSize - 1) / maxSize;
+}
+
+template<typename T>
+static inline T BoxAverage(float sum, float count)
+{
+    return T(sum / count + 0.5f);
+}
+
+template<>
+inline float BoxAverage<float>(float sum, float count)
+{
+    return sum / count;
+}
+
+// box filter downscale of decoded texels, by strips of rows
+template<typename T>
+struct ReduceTaskSet : TaskSet
+{
+    ReduceTaskSet(const T* src, int width, int height, int components, int factor, T* dst)
+        : TaskSet((height / factor) ? (height / factor) : 1)
+        , mSrc(src)
+        , mWidth(width)
+        , mHeight(height)
+        , mComponents(components)
+        , mFactor(factor)
+        , mDst(dst)
     {
-        *image = *cacheImage;
-        return EVAL_OK;
     }
-    FILE* fp = fopen(filename, "rb");
-    if (!fp)
-        return EVAL_ERR;
-    fclose(fp);
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        int dstWidth = (mWidth / mFactor) ? (mWidth / mFactor) : 1;
+        for (uint32_t y = range.start; y < range.end; y++)
+        {
+            int y0 = y * mFactor;
+            int y1 = (y0 + mFactor < mHeight) ? y0 + mFactor : mHeight;
+            T* dst = mDst + size_t(y) * dstWidth * mComponents;
+            for (int x = 0; x < dstWidth; x++)
+            {
+                int x0 = x * mFactor;
+                int x1 = (x0 + mFactor < mWidth) ? x0 + mFactor : mWidth;
+                float count = float((x1 - x0) * (y1 - y0));
+                for (int c = 0; c < mComponents; c++)
+                {
+                    float sum = 0.f;
+                    for (int sy = y0; sy < y1; sy++)
+                    {
+                        const T* src = mSrc + (size_t(sy) * mWidth + x0) * mComponents + c;
+                        for (int sx = x0; sx < x1; sx++, src += mComponents)
+                            sum += float(*src);
+                    }
+                    *dst++ = BoxAverage<T>(sum, count);
+                }
+            }
+        }
+    }
+    const T* mSrc;
+    int mWidth, mHeight, mComponents, mFactor;
+    T* mDst;
+};
 
-    int components;
-    unsigned char* bits = stbi_load(filename, &image->mWidth, &image->mHeight, &components, 0);
-    if (!bits)
+template<typename T>
+static void ReduceImage(Image* image, int components, int factor)
+{
+    int dstWidth = (image->mWidth / factor) ? (image->mWidth / factor) : 1;
+    int dstHeight = (image->mHeight / factor) ? (image->mHeight / factor) : 1;
+    unsigned char* reduced = ImageBuffer::Allocate(size_t(dstWidth) * dstHeight * components * sizeof(T));
+    ReduceTaskSet<T> reduceTask(
+        (const T*)image->GetBits(), image->mWidth, image->mHeight, components, factor, (T*)reduced);
+    g_TS.AddTaskSetToPipe(&reduceTask);
+    g_TS.WaitforTaskSet(&reduceTask);
+    image->AttachBits(reduced, size_t(dstWidth) * dstHeight * components * sizeof(T));
+    image->mWidth = dstWidth;
+    image->mHeight = dstHeight;
+}
+
+// Uncompressed true color TGA texels are stored raw : decoded straight from the mapping in parallel strips.
+// Downscaled previews are box filtered from the mapping while decoding.
+struct TGADecodeTaskSet : TaskSet
+{
+    TGADecodeTaskSet(uint32_t rowCount) : TaskSet(rowCount)
     {
-        cmft::Image img;
-        if (!cmft::imageLoad(img, filename))
+    }
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        for (uint32_t y = range.start; y < range.end; y++)
         {
-            return EVAL_ERR;
+            // row order follows stb_image : top to bottom, unless flipped on load
+            int topDown = stbi__vertically_flip_on_load ? (mDstHeight - 1 - int(y)) : int(y);
+            int y0 = topDown * mFactor;
+            int y1 = (y0 + mFactor < mHeight) ? y0 + mFactor : mHeight;
+            unsigned char* dst = mDst + size_t(y) * mDstWidth * mComponents;
+            for (int x = 0; x < mDstWidth; x++)
+            {
+                int x0 = x * mFactor;
+                int x1 = (x0 + mFactor < mWidth) ? x0 + mFactor : mWidth;
+                unsigned int sum[4] = {0, 0, 0, 0};
+                for (int sy = y0; sy < y1; sy++)
+                {
+                    int fileRow = mbBottomOrigin ? (mHeight - 1 - sy) : sy;
+                    const unsigned char* src = mSrc + (size_t(fileRow) * mWidth + x0) * mComponents;
+                    for (int sx = x0; sx < x1; sx++, src += mComponents)
+                    {
+                        for (int c = 0; c < mComponents; c++)
+                            sum[c] += src[c];
+                    }
+                }
+                unsigned int count = (x1 - x0) * (y1 - y0);
+                // BGR(A) to RGB(A)
+                dst[0] = uint8_t((sum[2] + count / 2) / count);
+                dst[1] = uint8_t((sum[1] + count / 2) / count);
+                dst[2] = uint8_t((sum[0] + count / 2) / count);
+                if (mComponents == 4)
+                    dst[3] = uint8_t((sum[3] + count / 2) / count);
+                dst += mComponents;
+            }
         }
-        cmft::imageTransformUseMacroInstead(&img, cmft::IMAGE_OP_FLIP_X, UINT32_MAX);
-        image->SetBits((unsigned char*)img.m_data, img.m_dataSize);
-        image->mWidth = img.m_width;
-        image->mHeight = img.m_height;
-        image->mNumMips = img.m_numMips;
-        image->mNumFaces = img.m_numFaces;
-        image->mFormat = img.m_format;
-        image->mDecoder = NULL;
-        gImageCache.AddImage(filenameStr, image);
+    }
+    const unsigned char* mSrc;
+    int mWidth, mHeight, mComponents, mFactor;
+    int mDstWidth, mDstHeight;
+    bool mbBottomOrigin;
+    unsigned char* mDst;
+};
+
+static bool DecodeTGA(const unsigned char* data, size_t size, int maxSize, Image* image)
+{
+    if (size < 18)
+        return false;
+    int idLength = data[0];
+    int colorMapType = data[1];
+    int imageType = data[2];
+    int width = data[12] | (data[13] << 8);
+    int height = data[14] | (data[15] << 8);
+    int bitsPerPixel = data[16];
+    int descriptor = data[17];
+    if (colorMapType != 0 || imageType != 2 || (bitsPerPixel != 24 && bitsPerPixel != 32) || !width || !height)
+        return false;
+    int components = bitsPerPixel / 8;
+    size_t dataStart = 18 + idLength;
+    if (size < dataStart + size_t(width) * height * components)
+        return false;
+
+    int factor = ReduceFactor(width, height, maxSize);
+    TGADecodeTaskSet decodeTask(0);
+    decodeTask.mSrc = data + dataStart;
+    decodeTask.mWidth = width;
+    decodeTask.mHeight = height;
+    decodeTask.mComponents = components;
+    decodeTask.mFactor = factor;
+    decodeTask.mDstWidth = (width / factor) ? (width / factor) : 1;
+    decodeTask.mDstHeight = (height / factor) ? (height / factor) : 1;
+    decodeTask.mbBottomOrigin = !(descriptor & 0x20);
+    decodeTask.m_SetSize = decodeTask.mDstHeight;
+
+    size_t dstSize = size_t(decodeTask.mDstWidth) * decodeTask.mDstHeight * components;
+    unsigned char* bits = ImageBuffer::Allocate(dstSize);
+    decodeTask.mDst = bits;
+    g_TS.AddTaskSetToPipe(&decodeTask);
+    g_TS.WaitforTaskSet(&decodeTask);
+
+    image->AttachBits(bits, dstSize);
+    image->mWidth = decodeTask.mDstWidth;
+    image->mHeight = decodeTask.mDstHeight;
+    image->mFormat = (components == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
+    return true;
+}
+
+static bool IsPNG16(const unsigned char* data, size_t size)
+{
+    static const unsigned char pngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    return size > 24 && !memcmp(data, pngSignature, sizeof(pngSignature)) && !memcmp(data + 12, "IHDR", 4) &&
+           data[24] == 16;
+}
+
+static bool DecodeSTB(const unsigned char* data, size_t size, int flags, int maxSize, Image* image)
+{
+    int width, height, components;
+    if (!stbi_info_from_memory(data, int(size), &width, &height, &components))
+        return false;
+
+    struct STBIImageBufferScope
+    {
+        STBIImageBufferScope() { gSTBIImageBuffer = true; }
+        ~STBIImageBufferScope() { gSTBIImageBuffer = false; }
+    } imageBufferScope;
+
+    // grey images are expanded to RGBA
+    int desiredComponents = (components == 3) ? 3 : 4;
+    size_t componentSize;
+    void* bits;
+    if ((flags & Image::READ_KEEP_PRECISION) && stbi_is_hdr_from_memory(data, int(size)))
+    {
+        bits = stbi_loadf_from_memory(data, int(size), &width, &height, &components, desiredComponents);
+        componentSize = sizeof(float);
+        image->mFormat = (desiredComponents == 3) ? TextureFormat::RGB32F : TextureFormat::RGBA32F;
+    }
+    else if ((flags & Image::READ_KEEP_PRECISION) && IsPNG16(data, size))
+    {
+        bits = stbi_load_16_from_memory(data, int(size), &width, &height, &components, desiredComponents);
+        componentSize = sizeof(uint16_t);
+        image->mFormat = (desiredComponents == 3) ? TextureFormat::RGB16 : TextureFormat::RGBA16;
+    }
+    else
+    {
+        bits = stbi_load_from_memory(data, int(size), &width, &height, &components, desiredComponents);
+        componentSize = sizeof(uint8_t);
+        image->mFormat = (desiredComponents == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
+    }
+    if (!bits)
+        return false;
+
+    // stb_image allocated with ImageBuffer in this scope : bits are attached without copy
+    image->AttachBits((unsigned char*)bits, size_t(width) * height * desiredComponents * componentSize);
+    image->mWidth = width;
+    image->mHeight = height;
+
+    int factor = ReduceFactor(width, height, maxSize);
+    if (factor > 1)
+    {
+        if (componentSize == sizeof(float))
+            ReduceImage<float>(image, desiredComponents, factor);
+        else if (componentSize == sizeof(uint16_t))
+            ReduceImage<uint16_t>(image, desiredComponents, factor);
+        else
+            ReduceImage<uint8_t>(image, desiredComponents, factor);
+    }
+    return true;
+}
+
+static bool DecodeCMFT(const unsigned char* data, size_t size, Image* image)
+{
+    cmft::Image img;
+    if (!cmft::imageLoad(img, data, uint32_t(size)))
+        return false;
+    cmft::imageTransformUseMacroInstead(&img, cmft::IMAGE_OP_FLIP_X, UINT32_MAX);
+    image->SetBits((unsigned char*)img.m_data, img.m_dataSize);
+    image->mWidth = img.m_width;
+    image->mHeight = img.m_height;
+    image->mNumMips = img.m_numMips;
+    image->mNumFaces = img.m_numFaces;
+    image->mFormat = img.m_format;
+    cmft::imageUnload(img);
+    return true;
+}
+
+int Image::Read(const char* filename, Image* image)
+{
+    return ReadEx(filename, image, 0, 0);
+}
+
+int Image::ReadEx(const char* filename, Image* image, int flags, int maxSize)
+{
+    std::string filenameStr(filename);
+    int cacheVariant = flags | (maxSize << 8);
+    if (gImageCache.GetImage(filenameStr, image, cacheVariant))
+    {
         return EVAL_OK;
     }
 
-    image->SetBits(bits, image->mWidth * image->mHeight * components);
+    MappedFile file;
+    if (!file.Open(filename))
+        return EVAL_ERR;
+
     image->mNumMips = 1;
     image->mNumFaces = 1;
-    image->mFormat = (components == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
     image->mDecoder = NULL;
-    stbi_image_free(bits);
-    gImageCache.AddImage(filenameStr, image);
+    if (!DecodeTGA(file.mData, file.mSize, maxSize, image) &&
+        !DecodeSTB(file.mData, file.mSize, flags, maxSize, image) && !DecodeCMFT(file.mData, file.mSize, image))
+    {
+        return EVAL_ERR;
+    }
+    gImageCache.AddImage(filenameStr, image, cacheVariant);
     return EVAL_OK;
 }
 
@@ -254,28 +670,26 @@ int Image::Free(Image* image)
     return EVAL_OK;
 }
 
-unsigned int Image::Upload(Image* image, unsigned int textureId, int cubeFace)
+unsigned int Image::Upload(Image* image,
+                           unsigned int textureId,
+                           int cubeFace,
+                           std::function<void(unsigned int textureId)> onUploaded)
 {
+    unsigned int targetType = (cubeFace == -1) ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
     if (!textureId)
+    {
         glGenTextures(1, &textureId);
-
-    unsigned int targetType = (cubeFace == -1) ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
-    glBindTexture(targetType, textureId);
-
-    unsigned int inputFormat = glInputFormats[image->mFormat];
-    unsigned int internalFormat = glInternalFormats[image->mFormat];
-    glTexImage2D((cubeFace == -1) ? GL_TEXTURE_2D : glCubeFace[cubeFace],
-                 0,
-                 internalFormat,
-                 image->mWidth,
-                 image->mHeight,
-                 0,
-                 inputFormat,
-                 GL_UNSIGNED_BYTE,
-                 image->GetBits());
+        glBindTexture(targetType, textureId);
+        TexStorage(targetType, image->mNumMips, glStorageFormats[image->mFormat], image->mWidth, image->mHeight);
+    }
+    else
+    {
+        glBindTexture(targetType, textureId);
+    }
     TexParam(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, targetType);
-
     glBindTexture(targetType, 0);
+
+    gUploadQueue.Add(textureId, cubeFace, *image, onUploaded);
     return textureId;
 }
 
@@ -292,21 +706,20 @@ int Image::ReadMem(unsigned char* data, size_t dataSize, Image* image)
 
 void Image::VFlip(Image* image)
 {
-    int pixelSize = (image->mFormat == TextureFormat::RGB8) ? 3 : 4;
-    int stride = image->mWidth * pixelSize;
-    for (int y = 0; y < image->mHeight / 2; y++)
-    {
-        for (int x = 0; x < stride; x++)
-        {
-            unsigned char* p1 = &image->GetBits()[y * stride + x];
-            unsigned char* p2 = &image->GetBits()[(image->mHeight - 1 - y) * stride + x];
-            Swap(*p1, *p2);
-        }
-    }
+    ImageOps::VFlip(image);
 }
 
 int Image::Write(const char* filename, Image* image, int format, int quality)
 {
+    return WriteEx(filename, image, format, quality, BlockCompression::FORMAT_NONE);
+}
+
+int Image::WriteEx(const char* filename, Image* image, int format, int quality, int compression)
+{
+    if ((format == 5 || format == 6) && compression != BlockCompression::FORMAT_NONE)
+    {
+        return BlockCompression::Write(filename, image, format, compression, BlockCompression::GetPreset(quality));
+    }
     int components = textureComponentCount[image->mFormat];
     switch (format)
     {
@@ -341,12 +754,19 @@ int Image::Write(const char* filename, Image* image, int format, int quality)
             img.m_numMips = image->mNumMips;
             img.m_data = image->GetBits();
             img.m_dataSize = image->mDataSize;
+            // image bits may be shared with the cache, convert to a separate buffer
+            cmft::Image converted;
+            bool convert = true;
             if (img.m_format == cmft::TextureFormat::RGBA8)
-                cmft::imageConvert(img, cmft::TextureFormat::BGRA8);
+                cmft::imageConvert(converted, cmft::TextureFormat::BGRA8, img);
             else if (img.m_format == cmft::TextureFormat::RGB8)
-                cmft::imageConvert(img, cmft::TextureFormat::BGR8);
-            image->SetBits((unsigned char*)img.m_data, img.m_dataSize);
-            if (!cmft::imageSave(img, filename, cmft::ImageFileType::DDS))
+                cmft::imageConvert(converted, cmft::TextureFormat::BGR8, img);
+            else
+                convert = false;
+            bool saved = cmft::imageSave(convert ? converted : img, filename, cmft::ImageFileType::DDS);
+            if (convert)
+                cmft::imageUnload(converted);
+            if (!saved)
                 return EVAL_ERR;
         }
         break;
@@ -388,6 +808,452 @@ int Image::EncodePng(Image* image, std::vector<unsigned char>& pngImage)
     return EVAL_OK;
 }
 
+// Lossless codec used for node images embedded in the library.
+// QOI-like byte stream, image split in independent bands of rows so encoding and decoding run in parallel.
+// Blob layout : LosslessHeader, uint32_t band end offsets (mBandCount), band streams.
+static const uint32_t LosslessMagic = 0x31514D49; // 'IMQ1'
+static const uint32_t LosslessBandPixels = 1 << 18;
+
+enum LosslessOp
+{
+    LOSSLESS_OP_INDEX = 0x00,
+    LOSSLESS_OP_DIFF = 0x40,
+    LOSSLESS_OP_LUMA = 0x80,
+    LOSSLESS_OP_RUN = 0xC0,
+    LOSSLESS_OP_RGB = 0xFE,
+    LOSSLESS_OP_RGBA = 0xFF,
+    LOSSLESS_MASK = 0xC0,
+    LOSSLESS_MAX_RUN = 62,
+};
+
+struct LosslessHeader
+{
+    uint32_t mMagic;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint8_t mFormat;
+    uint8_t mComponents;
+    uint16_t mPad;
+    uint32_t mBandHeight;
+    uint32_t mBandCount;
+};
+
+static inline uint32_t LosslessHash(uint32_t px)
+{
+    return ((px & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + ((px >> 16) & 0xFF) * 7 + (px >> 24) * 11) & 63;
+}
+
+static inline uint32_t LosslessLoad(const unsigned char* ptr, int components)
+{
+    if (components == 4)
+    {
+        uint32_t px;
+        memcpy(&px, ptr, 4);
+        return px;
+    }
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | 0xFF000000;
+}
+
+static inline void LosslessStore(unsigned char* ptr, uint32_t px, int components)
+{
+    if (components == 4)
+    {
+        memcpy(ptr, &px, 4);
+        return;
+    }
+    ptr[0] = px & 0xFF;
+    ptr[1] = (px >> 8) & 0xFF;
+    ptr[2] = (px >> 16) & 0xFF;
+}
+
+// number of consecutive pixels equal to px, starting at src
+static uint32_t LosslessRunLength(const unsigned char* src, uint32_t count, uint32_t px, int components)
+{
+    uint32_t run = 0;
+#if IMOGEN_SSE2
+    if (components == 4)
+    {
+        const __m128i ref = _mm_set1_epi32(int(px));
+        while (run + 4 <= count)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(src + run * 4));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(pixels, ref));
+            if (mask != 0xFFFF)
+            {
+                // first differing pixel is the first 4 bits block not set
+                while (mask & 0xF)
+                {
+                    mask >>= 4;
+                    run++;
+                }
+                return run;
+            }
+            run += 4;
+        }
+    }
+#endif
+    while (run < count && LosslessLoad(src + run * components, components) == px)
+    {
+        run++;
+    }
+    return run;
+}
+
+static void LosslessFill(unsigned char* dst, uint32_t count, uint32_t px, int components)
+{
+    uint32_t i = 0;
+#if IMOGEN_SSE2
+    if (components == 4)
+    {
+        const __m128i value = _mm_set1_epi32(int(px));
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_si128((__m128i*)(dst + i * 4), value);
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        LosslessStore(dst + i * components, px, components);
+    }
+}
+
+static size_t LosslessEncodeBand(const unsigned char* src, uint32_t pixelCount, int components, unsigned char* dst)
+{
+    uint32_t index[64] = {};
+    uint32_t previous = 0xFF000000;
+    unsigned char* ptr = dst;
+    for (uint32_t i = 0; i < pixelCount;)
+    {
+        const unsigned char* pixel = src + i * components;
+        uint32_t px = LosslessLoad(pixel, components);
+        if (px == previous)
+        {
+            uint32_t run = LosslessRunLength(pixel, pixelCount - i, px, components);
+            i += run;
+            while (run)
+            {
+                uint32_t count = (run < LOSSLESS_MAX_RUN) ? run : LOSSLESS_MAX_RUN;
+                *ptr++ = uint8_t(LOSSLESS_OP_RUN | (count - 1));
+                run -= count;
+            }
+            continue;
+        }
+
+        uint32_t hash = LosslessHash(px);
+        if (index[hash] == px)
+        {
+            *ptr++ = uint8_t(LOSSLESS_OP_INDEX | hash);
+        }
+        else
+        {
+            index[hash] = px;
+            if ((px >> 24) == (previous >> 24))
+            {
+                int8_t vr = int8_t((px & 0xFF) - (previous & 0xFF));
+                int8_t vg = int8_t(((px >> 8) & 0xFF) - ((previous >> 8) & 0xFF));
+                int8_t vb = int8_t(((px >> 16) & 0xFF) - ((previous >> 16) & 0xFF));
+                int8_t vgr = int8_t(vr - vg);
+                int8_t vgb = int8_t(vb - vg);
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    *ptr++ = uint8_t(LOSSLESS_OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                }
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                {
+                    *ptr++ = uint8_t(LOSSLESS_OP_LUMA | (vg + 32));
+                    *ptr++ = uint8_t(((vgr + 8) << 4) | (vgb + 8));
+                }
+                else
+                {
+                    *ptr++ = LOSSLESS_OP_RGB;
+                    *ptr++ = px & 0xFF;
+                    *ptr++ = (px >> 8) & 0xFF;
+                    *ptr++ = (px >> 16) & 0xFF;
+                }
+            }
+            else
+            {
+                *ptr++ = LOSSLESS_OP_RGBA;
+                memcpy(ptr, &px, 4);
+                ptr += 4;
+            }
+        }
+        previous = px;
+        i++;
+    }
+    return ptr - dst;
+}
+
+static bool
+LosslessDecodeBand(const unsigned char* src, size_t srcSize, uint32_t pixelCount, int components, unsigned char* dst)
+{
+    uint32_t index[64] = {};
+    uint32_t previous = 0xFF000000;
+    const unsigned char* end = src + srcSize;
+    for (uint32_t i = 0; i < pixelCount;)
+    {
+        if (src >= end)
+            return false;
+        uint8_t op = *src++;
+        uint32_t px = previous;
+        if (op == LOSSLESS_OP_RGB)
+        {
+            if (end - src < 3)
+                return false;
+            px = src[0] | (src[1] << 8) | (src[2] << 16) | (previous & 0xFF000000);
+            src += 3;
+        }
+        else if (op == LOSSLESS_OP_RGBA)
+        {
+            if (end - src < 4)
+                return false;
+            memcpy(&px, src, 4);
+            src += 4;
+        }
+        else
+        {
+            switch (op & LOSSLESS_MASK)
+            {
+                case LOSSLESS_OP_INDEX:
+                    px = index[op];
+                    break;
+                case LOSSLESS_OP_DIFF:
+                {
+                    uint32_t r = ((previous & 0xFF) + ((op >> 4) & 3) - 2) & 0xFF;
+                    uint32_t g = (((previous >> 8) & 0xFF) + ((op >> 2) & 3) - 2) & 0xFF;
+                    uint32_t b = (((previous >> 16) & 0xFF) + (op & 3) - 2) & 0xFF;
+                    px = r | (g << 8) | (b << 16) | (previous & 0xFF000000);
+                }
+                break;
+                case LOSSLESS_OP_LUMA:
+                {
+                    if (src >= end)
+                        return false;
+                    uint8_t op2 = *src++;
+                    int vg = (op & 0x3F) - 32;
+                    uint32_t r = ((previous & 0xFF) + vg - 8 + ((op2 >> 4) & 0xF)) & 0xFF;
+                    uint32_t g = (((previous >> 8) & 0xFF) + vg) & 0xFF;
+                    uint32_t b = (((previous >> 16) & 0xFF) + vg - 8 + (op2 & 0xF)) & 0xFF;
+                    px = r | (g << 8) | (b << 16) | (previous & 0xFF000000);
+                }
+                break;
+                case LOSSLESS_OP_RUN:
+                {
+                    uint32_t run = (op & 0x3F) + 1;
+                    if (run > pixelCount - i)
+                        return false;
+                    LosslessFill(dst + i * components, run, previous, components);
+                    i += run;
+                    continue;
+                }
+            }
+        }
+        index[LosslessHash(px)] = px;
+        LosslessStore(dst + i * components, px, components);
+        previous = px;
+        i++;
+    }
+    return true;
+}
+
+struct LosslessBandTaskSet : TaskSet
+{
+    LosslessBandTaskSet(uint32_t bandCount) : TaskSet(bandCount)
+    {
+    }
+
+    uint32_t BandPixelCount(uint32_t band) const
+    {
+        uint32_t firstRow = band * mBandHeight;
+        uint32_t rowCount = (mHeight - firstRow < mBandHeight) ? (mHeight - firstRow) : mBandHeight;
+        return rowCount * mWidth;
+    }
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mBandHeight;
+    int mComponents;
+};
+
+struct LosslessEncodeTaskSet : LosslessBandTaskSet
+{
+    LosslessEncodeTaskSet(uint32_t bandCount) : LosslessBandTaskSet(bandCount), mBands(bandCount)
+    {
+    }
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        for (uint32_t band = range.start; band < range.end; band++)
+        {
+            uint32_t pixelCount = BandPixelCount(band);
+            std::vector<unsigned char>& stream = mBands[band];
+            // worst case is one op byte per pixel on top of the texels
+            stream.resize(size_t(pixelCount) * (mComponents + 1));
+            size_t size = LosslessEncodeBand(
+                mSrc + size_t(band) * mBandHeight * mWidth * mComponents, pixelCount, mComponents, stream.data());
+            stream.resize(size);
+        }
+    }
+    const unsigned char* mSrc;
+    std::vector<std::vector<unsigned char>> mBands;
+};
+
+struct LosslessDecodeTaskSet : LosslessBandTaskSet
+{
+    LosslessDecodeTaskSet(uint32_t bandCount) : LosslessBandTaskSet(bandCount), mbValid(true)
+    {
+    }
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        for (uint32_t band = range.start; band < range.end; band++)
+        {
+            uint32_t start = band ? mOffsets[band - 1] : 0;
+            uint32_t end = mOffsets[band];
+            if (end < start || end > mStreamSize ||
+                !LosslessDecodeBand(mStream + start,
+                                    end - start,
+                                    BandPixelCount(band),
+                                    mComponents,
+                                    mDst + size_t(band) * mBandHeight * mWidth * mComponents))
+            {
+                mbValid = false;
+            }
+        }
+    }
+    const unsigned char* mStream;
+    size_t mStreamSize;
+    const uint32_t* mOffsets;
+    unsigned char* mDst;
+    std::atomic<bool> mbValid;
+};
+
+static void LosslessRun(TaskSet* taskSet)
+{
+    if (taskSet->m_SetSize == 1)
+    {
+        taskSet->ExecuteRange({0, 1}, 0);
+        return;
+    }
+    g_TS.AddTaskSetToPipe(taskSet);
+    g_TS.WaitforTaskSet(taskSet);
+}
+
+// the coder predicts 8 bits per component, 0 for the formats it can't reconstruct
+static int GetLosslessComponents(int format)
+{
+    switch (format)
+    {
+        case TextureFormat::BGR8:
+        case TextureFormat::RGB8:
+        case TextureFormat::BGRA8:
+        case TextureFormat::RGBA8:
+            return textureFormatSize[format];
+        default:
+            return 0;
+    }
+}
+
+int Image::EncodeLossless(Image* image, std::vector<unsigned char>& encoded)
+{
+    int components = GetLosslessComponents(image->mFormat);
+    if (!components || !image->GetBits() || image->mWidth <= 0 || image->mHeight <= 0 ||
+        image->mDataSize < uint32_t(image->mWidth * image->mHeight * components))
+        return EVAL_ERR;
+
+    LosslessHeader header;
+    header.mMagic = LosslessMagic;
+    header.mWidth = image->mWidth;
+    header.mHeight = image->mHeight;
+    header.mFormat = image->mFormat;
+    header.mComponents = uint8_t(components);
+    header.mPad = 0;
+    header.mBandHeight = LosslessBandPixels / header.mWidth;
+    if (header.mBandHeight < 1)
+        header.mBandHeight = 1;
+    header.mBandCount = (header.mHeight + header.mBandHeight - 1) / header.mBandHeight;
+
+    LosslessEncodeTaskSet encodeTask(header.mBandCount);
+    encodeTask.mWidth = header.mWidth;
+    encodeTask.mHeight = header.mHeight;
+    encodeTask.mBandHeight = header.mBandHeight;
+    encodeTask.mComponents = components;
+    encodeTask.mSrc = image->GetBits();
+    LosslessRun(&encodeTask);
+
+    size_t offsetsSize = header.mBandCount * sizeof(uint32_t);
+    size_t streamSize = 0;
+    for (auto& band : encodeTask.mBands)
+        streamSize += band.size();
+
+    encoded.resize(sizeof(LosslessHeader) + offsetsSize + streamSize);
+    unsigned char* ptr = encoded.data();
+    memcpy(ptr, &header, sizeof(LosslessHeader));
+    uint32_t* offsets = (uint32_t*)(ptr + sizeof(LosslessHeader));
+    ptr += sizeof(LosslessHeader) + offsetsSize;
+    uint32_t offset = 0;
+    for (uint32_t band = 0; band < header.mBandCount; band++)
+    {
+        const std::vector<unsigned char>& stream = encodeTask.mBands[band];
+        memcpy(ptr + offset, stream.data(), stream.size());
+        offset += uint32_t(stream.size());
+        offsets[band] = offset;
+    }
+    return EVAL_OK;
+}
+
+int Image::DecodeLossless(const unsigned char* data, size_t dataSize, Image* image)
+{
+    LosslessHeader header;
+    bool isLossless = dataSize >= sizeof(LosslessHeader);
+    if (isLossless)
+    {
+        memcpy(&header, data, sizeof(LosslessHeader));
+        isLossless = header.mMagic == LosslessMagic;
+    }
+    if (!isLossless)
+    {
+        // blobs saved before the lossless codec are PNG
+        int components;
+        unsigned char* bits = stbi_load_from_memory(data, int(dataSize), &image->mWidth, &image->mHeight, &components, 0);
+        if (!bits)
+            return EVAL_ERR;
+        image->SetBits(bits, image->mWidth * image->mHeight * components);
+        image->mNumMips = 1;
+        image->mNumFaces = 1;
+        image->mFormat = (components == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
+        image->mDecoder = NULL;
+        stbi_image_free(bits);
+        return EVAL_OK;
+    }
+
+    size_t offsetsSize = size_t(header.mBandCount) * sizeof(uint32_t);
+    if (!header.mWidth || !header.mHeight || !header.mBandHeight || header.mFormat >= TextureFormat::Count ||
+        header.mComponents != GetLosslessComponents(header.mFormat) ||
+        header.mBandCount != (header.mHeight + header.mBandHeight - 1) / header.mBandHeight ||
+        dataSize < sizeof(LosslessHeader) + offsetsSize)
+        return EVAL_ERR;
+
+    image->Allocate(size_t(header.mWidth) * header.mHeight * header.mComponents);
+    image->mWidth = header.mWidth;
+    image->mHeight = header.mHeight;
+    image->mNumMips = 1;
+    image->mNumFaces = 1;
+    image->mFormat = header.mFormat;
+    image->mDecoder = NULL;
+
+    LosslessDecodeTaskSet decodeTask(header.mBandCount);
+    decodeTask.mWidth = header.mWidth;
+    decodeTask.mHeight = header.mHeight;
+    decodeTask.mBandHeight = header.mBandHeight;
+    decodeTask.mComponents = header.mComponents;
+    decodeTask.mOffsets = (const uint32_t*)(data + sizeof(LosslessHeader));
+    decodeTask.mStream = data + sizeof(LosslessHeader) + offsetsSize;
+    decodeTask.mStreamSize = dataSize - sizeof(LosslessHeader) - offsetsSize;
+    decodeTask.mDst = image->GetBits();
+    LosslessRun(&decodeTask);
+    return decodeTask.mbValid ? EVAL_OK : EVAL_ERR;
+}
+
 void DefaultShaders::Init()
 {
     std::ifstream prgStr("Stock/ProgressingNode.glsl");
@@ -429,28 +1295,96 @@ unsigned int ImageCache::GetTexture(const std::string& filename)
     return textureId;
 }
 
-Image* ImageCache::GetImage(const std::string& filepath)
+ImageCache::ImageCache() : mBudget(512 * 1024 * 1024), mBytes(0), mHits(0), mMisses(0), mEvictions(0)
 {
-    Image* ret = NULL;
-    mCacheAccess.lock();
-    auto iter = mImageCache.find(filepath);
-    if (iter != mImageCache.end())
+}
+
+bool ImageCache::GetImage(const std::string& filepath, Image* image, int variant)
+{
+    int64_t fileTime, fileSize;
+    bool fileExists = GetFileStamp(filepath, fileTime, fileSize);
+
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    auto iter = mImageCache.find(std::make_pair(filepath, variant));
+    if (iter == mImageCache.end())
+    {
+        mMisses++;
+        return false;
+    }
+    Entry& entry = iter->second;
+    if (!fileExists || entry.mFileTime != fileTime || entry.mFileSize != fileSize)
     {
-        ret = &iter->second;
+        // file changed on disk
+        mBytes -= entry.mImage.mDataSize;
+        mLRU.erase(entry.mLRU);
+        mImageCache.erase(iter);
+        mMisses++;
+        return false;
     }
-    mCacheAccess.unlock();
-    return ret;
+    mLRU.splice(mLRU.begin(), mLRU, entry.mLRU);
+    image->Share(entry.mImage);
+    mHits++;
+    return true;
 }
 
-void ImageCache::AddImage(const std::string& filepath, Image* image)
+void ImageCache::AddImage(const std::string& filepath, Image* image, int variant)
 {
-    mCacheAccess.lock();
-    auto iter = mImageCache.find(filepath);
-    if (iter == mImageCache.end())
+    int64_t fileTime, fileSize;
+    if (!GetFileStamp(filepath, fileTime, fileSize))
+        return;
+
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    auto key = std::make_pair(filepath, variant);
+    if (image->mDataSize > mBudget || mImageCache.find(key) != mImageCache.end())
+        return;
+
+    Entry& entry = mImageCache[key];
+    entry.mImage.Share(*image);
+    entry.mFileTime = fileTime;
+    entry.mFileSize = fileSize;
+    entry.mLRU = mLRU.insert(mLRU.begin(), key);
+    mBytes += image->mDataSize;
+    EvictToBudget();
+}
+
+void ImageCache::EvictToBudget()
+{
+    while (mBytes > mBudget && !mLRU.empty())
     {
-        mImageCache.insert(std::make_pair(filepath, *image));
+        auto iter = mImageCache.find(mLRU.back());
+        mBytes -= iter->second.mImage.mDataSize;
+        mImageCache.erase(iter);
+        mLRU.pop_back();
+        mEvictions++;
     }
-    mCacheAccess.unlock();
+}
+
+void ImageCache::SetBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    mBudget = budget;
+    EvictToBudget();
+}
+
+void ImageCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    mImageCache.clear();
+    mLRU.clear();
+    mBytes = 0;
+}
+
+ImageCache::Stats ImageCache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    Stats stats;
+    stats.mHits = mHits;
+    stats.mMisses = mMisses;
+    stats.mEvictions = mEvictions;
+    stats.mBytes = mBytes;
+    stats.mBudget = mBudget;
+    stats.mEntryCount = mImageCache.size();
+    return stats;
 }
 
 void RenderTarget::BindAsTarget() const
@@ -474,6 +1408,7 @@ void RenderTarget::BindCubeFace(size_t face, int mipmap, int faceWidth)
 
 void RenderTarget::Destroy()
 {
+    gUploadQueue.Cancel(mGLTexID);
     if (mGLTexID)
         glDeleteTextures(1, &mGLTexID);
     if (mGLTexDepth)
@@ -511,10 +1446,10 @@ void RenderTarget::Swap(RenderTarget& other)
     ::Swap(mFbo, other.mFbo);
 }
 
-void RenderTarget::InitBuffer(int width, int height, bool depthBuffer)
+void RenderTarget::InitBuffer(int width, int height, bool depthBuffer, int format, int mipmapCount)
 {
     if ((width == mImage->mWidth) && (mImage->mHeight == height) && mImage->mNumFaces == 1 &&
-        (!(depthBuffer ^ (mDepthBuffer != 0))))
+        mImage->mFormat == format && mImage->mNumMips == mipmapCount && (!(depthBuffer ^ (mDepthBuffer != 0))))
         return;
     Destroy();
     if (!width || !height)
@@ -523,9 +1458,9 @@ void RenderTarget::InitBuffer(int width, int height, bool depthBuffer)
     }
     mImage->mWidth = width;
     mImage->mHeight = height;
-    mImage->mNumMips = 1;
+    mImage->mNumMips = mipmapCount;
     mImage->mNumFaces = 1;
-    mImage->mFormat = TextureFormat::RGBA8;
+    mImage->mFormat = format;
 
     glGenFramebuffers(1, &mFbo);
     glBindFramebuffer(GL_FRAMEBUFFER, mFbo);
@@ -533,7 +1468,7 @@ void RenderTarget::InitBuffer(int width, int height, bool depthBuffer)
     // diffuse
     glGenTextures(1, &mGLTexID);
     glBindTexture(GL_TEXTURE_2D, mGLTexID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    TexStorage(GL_TEXTURE_2D, mipmapCount, glStorageFormats[format], width, height);
     TexParam(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_2D);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mGLTexID, 0);
 
@@ -542,7 +1477,7 @@ void RenderTarget::InitBuffer(int width, int height, bool depthBuffer)
         // Z
         glGenTextures(1, &mGLTexDepth);
         glBindTexture(GL_TEXTURE_2D, mGLTexDepth);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        TexStorage(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
         TexParam(GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_2D);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mGLTexDepth, 0);
     }
@@ -563,10 +1498,10 @@ void RenderTarget::InitBuffer(int width, int height, bool depthBuffer)
     glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
 }
 
-void RenderTarget::InitCube(int width, int mipmapCount)
+void RenderTarget::InitCube(int width, int mipmapCount, int format)
 {
     if ((width == mImage->mWidth) && (mImage->mHeight == width) && mImage->mNumFaces == 6 &&
-        (mImage->mNumMips == mipmapCount))
+        (mImage->mNumMips == mipmapCount) && mImage->mFormat == format)
         return;
     Destroy();
 
@@ -579,29 +1514,14 @@ void RenderTarget::InitCube(int width, int mipmapCount)
     mImage->mHeight = width;
     mImage->mNumMips = mipmapCount;
     mImage->mNumFaces = 6;
-    mImage->mFormat = TextureFormat::RGBA8;
+    mImage->mFormat = format;
 
     glGenFramebuffers(1, &mFbo);
     glBindFramebuffer(GL_FRAMEBUFFER, mFbo);
 
     glGenTextures(1, &mGLTexID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, mGLTexID);
-
-    for (int mip = 0; mip < mipmapCount; mip++)
-    {
-        for (int i = 0; i < 6; i++)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                         mip,
-                         GL_RGBA,
-                         width >> mip,
-                         width >> mip,
-                         0,
-                         GL_RGBA,
-                         GL_UNSIGNED_BYTE,
-                         NULL);
-        }
-    }
+    TexStorage(GL_TEXTURE_CUBE_MAP, mipmapCount, glStorageFormats[format], width, width);
 
     TexParam(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_CUBE_MAP);
 
@@ -26,10 +26,12 @@
 #pragma once
 #include <string>
 #include <map>
+#include <list>
 #include <vector>
 #include <string.h>
 #include <mutex>
 #include <memory>
+#include <functional>
 #include <stdlib.h>
 
 #if USE_FFMPEG
@@ -62,18 +64,36 @@ struct TextureFormat
     };
 };
 
+// Pixel buffers are reference counted so cached images are handed out without copy.
+// The counter lives in front of the bits: Image layout stays the one declared for C nodes in Imogen.h
+namespace ImageBuffer
+{
+    unsigned char* Allocate(size_t size);
+    // only for bits not shared yet
+    unsigned char* Reallocate(unsigned char* bits, size_t size);
+    unsigned char* AddRef(unsigned char* bits);
+    void Release(unsigned char* bits);
+    bool IsShared(const unsigned char* bits);
+} // namespace ImageBuffer
+
 struct Image
 {
-    Image() : mDecoder(NULL), mWidth(0), mHeight(0), mNumMips(0), mNumFaces(0), mBits(NULL), mDataSize(0)
+    Image()
+        : mDecoder(NULL), mWidth(0), mHeight(0), mDataSize(0), mNumMips(0), mNumFaces(0), mFormat(0), mBits(NULL)
     {
     }
-    Image(const Image& other) : mBits(NULL), mDataSize(0)
+    // copies share the bits, writers get their own buffer through Allocate or Detach
+    Image(const Image& other) : Image()
     {
-        *this = other;
+        Share(other);
+    }
+    Image(Image&& other) : Image()
+    {
+        *this = std::move(other);
     }
     ~Image()
     {
-        free(mBits);
+        ImageBuffer::Release(mBits);
     }
 
     void* mDecoder;
@@ -84,13 +104,23 @@ struct Image
     uint8_t mFormat;
     Image& operator=(const Image& other)
     {
-        mDecoder = other.mDecoder;
-        mWidth = other.mWidth;
-        mHeight = other.mHeight;
-        mNumMips = other.mNumMips;
-        mNumFaces = other.mNumFaces;
-        mFormat = other.mFormat;
-        SetBits(other.mBits, other.mDataSize);
+        Share(other);
+        return *this;
+    }
+    Image& operator=(Image&& other)
+    {
+        if (this != &other)
+        {
+            mDecoder = other.mDecoder;
+            mWidth = other.mWidth;
+            mHeight = other.mHeight;
+            mNumMips = other.mNumMips;
+            mNumFaces = other.mNumFaces;
+            mFormat = other.mFormat;
+            AttachBits(other.mBits, other.mDataSize);
+            other.mBits = NULL;
+            other.mDataSize = 0;
+        }
         return *this;
     }
     unsigned char* GetBits() const
@@ -102,29 +132,85 @@ struct Image
         Allocate(size);
         memcpy(mBits, bits, size);
     }
+    // bits are only reused when unique and of the same size, otherwise a new buffer is allocated
     void Allocate(size_t size)
     {
-        if (mBits && mDataSize != size)
-            free(mBits);
-        if (size)
-            mBits = (unsigned char*)malloc(size);
+        if (mBits && (!size || mDataSize != size || ImageBuffer::IsShared(mBits)))
+        {
+            ImageBuffer::Release(mBits);
+            mBits = NULL;
+        }
+        if (size && !mBits)
+            mBits = ImageBuffer::Allocate(size);
         mDataSize = uint32_t(size);
     }
     void DoFree()
     {
-        free(mBits);
+        ImageBuffer::Release(mBits);
         mBits = NULL;
         mDataSize = 0;
     }
+    // shallow copy, bits are shared and must be considered read only
+    void Share(const Image& other)
+    {
+        mDecoder = other.mDecoder;
+        mWidth = other.mWidth;
+        mHeight = other.mHeight;
+        mNumMips = other.mNumMips;
+        mNumFaces = other.mNumFaces;
+        mFormat = other.mFormat;
+        if (mBits != other.mBits)
+        {
+            ImageBuffer::Release(mBits);
+            mBits = ImageBuffer::AddRef(other.mBits);
+        }
+        mDataSize = other.mDataSize;
+    }
+    // take ownership of bits allocated with ImageBuffer::Allocate
+    void AttachBits(unsigned char* bits, size_t size)
+    {
+        if (mBits != bits)
+            ImageBuffer::Release(mBits);
+        mBits = bits;
+        mDataSize = uint32_t(size);
+    }
+    // copy on write : get a private copy of shared bits before modifying them
+    void Detach()
+    {
+        if (mBits && ImageBuffer::IsShared(mBits))
+        {
+            unsigned char* shared = mBits;
+            mBits = ImageBuffer::Allocate(mDataSize);
+            memcpy(mBits, shared, mDataSize);
+            ImageBuffer::Release(shared);
+        }
+    }
 
+    // Read flags
+    enum
+    {
+        // keep 16 bits and float texels (16 bits PNG, HDR) instead of converting to 8 bits
+        READ_KEEP_PRECISION = 1 << 0,
+    };
     static int Read(const char* filename, Image* image);
+    // maxSize > 0 decodes a preview no larger than maxSize
+    static int ReadEx(const char* filename, Image* image, int flags, int maxSize);
     static int Free(Image* image);
-    static unsigned int Upload(Image* image, unsigned int textureId, int cubeFace = -1);
+    // textureId 0 creates a texture with the storage for image. Texels are sent by the upload queue over the next
+    // frames, onUploaded is called once they are all in the texture
+    static unsigned int Upload(Image* image,
+                               unsigned int textureId,
+                               int cubeFace = -1,
+                               std::function<void(unsigned int textureId)> onUploaded = nullptr);
     static int LoadSVG(const char* filename, Image* image, float dpi);
     static int ReadMem(unsigned char* data, size_t dataSize, Image* image);
     static void VFlip(Image* image);
     static int Write(const char* filename, Image* image, int format, int quality);
+    // compression is a BlockCompression::Format for DDS and KTX, quality selects the compression preset
+    static int WriteEx(const char* filename, Image* image, int format, int quality, int compression);
     static int EncodePng(Image* image, std::vector<unsigned char>& pngImage);
+    static int EncodeLossless(Image* image, std::vector<unsigned char>& encoded);
+    static int DecodeLossless(const unsigned char* data, size_t dataSize, Image* image);
 #if USE_FFMPEG
     static Image DecodeImage(FFMPEGCodec::Decoder* decoder, int frame);
 #endif
@@ -132,22 +218,62 @@ protected:
     unsigned char* mBits;
 };
 
-extern const unsigned int glInternalFormats[];
+// sized formats for immutable storage
+extern const unsigned int glStorageFormats[];
 extern const unsigned int glInputFormats[];
+extern const unsigned int glInputTypes[];
 extern const unsigned int textureFormatSize[];
 
 struct ImageCache
 {
+    ImageCache();
+
     // synchronous texture cache
     // use for simple textures(stock) or to replace with a more efficient one
     unsigned int GetTexture(const std::string& filename);
-    Image* GetImage(const std::string& filepath);
-    void AddImage(const std::string& filepath, Image* image);
+
+    // decoded images cache. Entries are immutable and share their bits with the images handed out.
+    // return false if the file is not cached or has changed on disk since it was added
+    // variant differentiates decodings of the same file (precision, preview size)
+    bool GetImage(const std::string& filepath, Image* image, int variant = 0);
+    void AddImage(const std::string& filepath, Image* image, int variant = 0);
+    void SetBudget(size_t budget);
+    size_t GetBudget() const
+    {
+        return mBudget;
+    }
+    void Clear();
+
+    struct Stats
+    {
+        uint64_t mHits;
+        uint64_t mMisses;
+        uint64_t mEvictions;
+        size_t mBytes;
+        size_t mBudget;
+        size_t mEntryCount;
+    };
+    Stats GetStats();
 
 protected:
+    struct Entry
+    {
+        Image mImage;
+        int64_t mFileTime;
+        int64_t mFileSize;
+        std::list<std::pair<std::string, int>>::iterator mLRU;
+    };
+    void EvictToBudget();
+
     std::map<std::string, unsigned int> mSynchronousTextureCache;
-    std::map<std::string, Image> mImageCache;
+    std::map<std::pair<std::string, int>, Entry> mImageCache;
+    std::list<std::pair<std::string, int>> mLRU; // most recently used first
     std::mutex mCacheAccess;
+    size_t mBudget;
+    size_t mBytes;
+    uint64_t mHits;
+    uint64_t mMisses;
+    uint64_t mEvictions;
 };
 extern ImageCache gImageCache;
 
@@ -173,8 +299,13 @@ public:
         mImage = std::make_shared<Image>();
     }
 
-    void InitBuffer(int width, int height, bool depthBuffer);
-    void InitCube(int width, int mipmapCount);
+    // the texture storage is immutable: a target changing size, format or mipmap count gets a new texture
+    void InitBuffer(int width,
+                    int height,
+                    bool depthBuffer,
+                    int format = TextureFormat::RGBA8,
+                    int mipmapCount = 1);
+    void InitCube(int width, int mipmapCount, int format = TextureFormat::RGBA8);
     void BindAsTarget() const;
     void BindAsCubeTarget() const;
     void BindCubeFace(size_t face, int mipmap, int faceWidth);
@@ -0,0 +1,764 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "Platform.h"
+#include "BlockCompression.h"
+#include "Bitmap.h"
+#include "ImageOps.h"
+#include "Utils.h"
+#include <algorithm>
+#include <float.h>
+#include <stdio.h>
+
+extern TaskScheduler g_TS;
+
+namespace BlockCompression
+{
+    // 4x4 texels, one array per channel so 4 texels are processed at once
+    struct BlockTexels
+    {
+        float mChannels[4][16];
+    };
+
+    struct BitWriter
+    {
+        BitWriter(unsigned char* data) : mData(data), mBit(0)
+        {
+        }
+        void Write(uint32_t value, int count)
+        {
+            for (int i = 0; i < count; i++, mBit++)
+            {
+                if ((value >> i) & 1)
+                    mData[mBit >> 3] |= 1 << (mBit & 7);
+            }
+        }
+        unsigned char* mData;
+        int mBit;
+    };
+
+    static const float BC1Weights[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+    static const int BC7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    static const float BC7WeightFractions[16] = {0.f / 64.f, 4.f / 64.f, 9.f / 64.f, 13.f / 64.f, 17.f / 64.f, 21.f / 64.f,
+                                                 26.f / 64.f, 30.f / 64.f, 34.f / 64.f, 38.f / 64.f, 43.f / 64.f, 47.f / 64.f,
+                                                 51.f / 64.f, 55.f / 64.f, 60.f / 64.f, 64.f / 64.f};
+
+    static int RefineIterations(int preset)
+    {
+        return (preset == PRESET_HIGH) ? 4 : ((preset == PRESET_NORMAL) ? 1 : 0);
+    }
+
+    static void LoadBlock(const unsigned char* texels, int width, int height, int blockX, int blockY, BlockTexels& block)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            // blocks crossing the border repeat the edge texels
+            int sy = std::min(blockY * 4 + y, height - 1);
+            for (int x = 0; x < 4; x++)
+            {
+                int sx = std::min(blockX * 4 + x, width - 1);
+                const unsigned char* texel = texels + (size_t(sy) * width + sx) * 4;
+                for (int c = 0; c < 4; c++)
+                    block.mChannels[c][y * 4 + x] = float(texel[c]);
+            }
+        }
+    }
+
+    // closest palette entry for each texel, over channels [firstChannel, lastChannel[. returns the block error
+    static float SelectIndices(const BlockTexels& block,
+                               const float (*palette)[4],
+                               int paletteCount,
+                               int firstChannel,
+                               int lastChannel,
+                               unsigned char* indices)
+    {
+        float totalError = 0.f;
+#if IMOGEN_SSE2
+        for (int group = 0; group < 16; group += 4)
+        {
+            __m128 bestError = _mm_set1_ps(FLT_MAX);
+            __m128 bestIndex = _mm_setzero_ps();
+            for (int p = 0; p < paletteCount; p++)
+            {
+                __m128 error = _mm_setzero_ps();
+                for (int c = firstChannel; c < lastChannel; c++)
+                {
+                    __m128 d = _mm_sub_ps(_mm_loadu_ps(&block.mChannels[c][group]), _mm_set1_ps(palette[p][c]));
+                    error = _mm_add_ps(error, _mm_mul_ps(d, d));
+                }
+                __m128 better = _mm_cmplt_ps(error, bestError);
+                bestError = _mm_min_ps(error, bestError);
+                bestIndex = _mm_or_ps(_mm_and_ps(better, _mm_set1_ps(float(p))), _mm_andnot_ps(better, bestIndex));
+            }
+            float errors[4], best[4];
+            _mm_storeu_ps(errors, bestError);
+            _mm_storeu_ps(best, bestIndex);
+            for (int i = 0; i < 4; i++)
+            {
+                indices[group + i] = (unsigned char)best[i];
+                totalError += errors[i];
+            }
+        }
+#else
+        for (int i = 0; i < 16; i++)
+        {
+            float bestError = FLT_MAX;
+            for (int p = 0; p < paletteCount; p++)
+            {
+                float error = 0.f;
+                for (int c = firstChannel; c < lastChannel; c++)
+                {
+                    float d = block.mChannels[c][i] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    indices[i] = (unsigned char)p;
+                }
+            }
+            totalError += bestError;
+        }
+#endif
+        return totalError;
+    }
+
+    // endpoints are the extent of the texels along their principal axis
+    static void FitEndpoints(const BlockTexels& block, int firstChannel, int lastChannel, float* e0, float* e1)
+    {
+        float mean[4] = {0.f, 0.f, 0.f, 0.f};
+        float minimum[4] = {255.f, 255.f, 255.f, 255.f};
+        float maximum[4] = {0.f, 0.f, 0.f, 0.f};
+        for (int c = firstChannel; c < lastChannel; c++)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                mean[c] += block.mChannels[c][i];
+                minimum[c] = std::min(minimum[c], block.mChannels[c][i]);
+                maximum[c] = std::max(maximum[c], block.mChannels[c][i]);
+            }
+            mean[c] /= 16.f;
+        }
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c0 = firstChannel; c0 < lastChannel; c0++)
+            {
+                for (int c1 = firstChannel; c1 < lastChannel; c1++)
+                {
+                    covariance[c0][c1] +=
+                        (block.mChannels[c0][i] - mean[c0]) * (block.mChannels[c1][i] - mean[c1]);
+                }
+            }
+        }
+        // power iteration, starting from the bounding box diagonal
+        float axis[4] = {0.f, 0.f, 0.f, 0.f};
+        for (int c = firstChannel; c < lastChannel; c++)
+            axis[c] = maximum[c] - minimum[c];
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {0.f, 0.f, 0.f, 0.f};
+            float length = 0.f;
+            for (int c0 = firstChannel; c0 < lastChannel; c0++)
+            {
+                for (int c1 = firstChannel; c1 < lastChannel; c1++)
+                    next[c0] += covariance[c0][c1] * axis[c1];
+                length += next[c0] * next[c0];
+            }
+            if (length < 1e-8f)
+                break;
+            length = 1.f / sqrtf(length);
+            for (int c = firstChannel; c < lastChannel; c++)
+                axis[c] = next[c] * length;
+        }
+        float length = 0.f;
+        for (int c = firstChannel; c < lastChannel; c++)
+            length += axis[c] * axis[c];
+        if (length < 1e-8f)
+        {
+            // flat block
+            for (int c = firstChannel; c < lastChannel; c++)
+                e0[c] = e1[c] = mean[c];
+            return;
+        }
+        length = 1.f / sqrtf(length);
+        float minProjection = FLT_MAX;
+        float maxProjection = -FLT_MAX;
+        for (int i = 0; i < 16; i++)
+        {
+            float projection = 0.f;
+            for (int c = firstChannel; c < lastChannel; c++)
+                projection += (block.mChannels[c][i] - mean[c]) * axis[c] * length;
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+        for (int c = firstChannel; c < lastChannel; c++)
+        {
+            e0[c] = std::min(std::max(mean[c] + axis[c] * length * minProjection, 0.f), 255.f);
+            e1[c] = std::min(std::max(mean[c] + axis[c] * length * maxProjection, 0.f), 255.f);
+        }
+    }
+
+    // least squares endpoints for the selected indices. weights[index] is the fraction of e1 for that index
+    static bool RefineEndpoints(const BlockTexels& block,
+                                const unsigned char* indices,
+                                const float* weights,
+                                int firstChannel,
+                                int lastChannel,
+                                float* e0,
+                                float* e1)
+    {
+        float a = 0.f, b = 0.f, c = 0.f;
+        float rhs0[4] = {0.f, 0.f, 0.f, 0.f};
+        float rhs1[4] = {0.f, 0.f, 0.f, 0.f};
+        for (int i = 0; i < 16; i++)
+        {
+            float w = weights[indices[i]];
+            a += (1.f - w) * (1.f - w);
+            b += (1.f - w) * w;
+            c += w * w;
+            for (int ch = firstChannel; ch < lastChannel; ch++)
+            {
+                rhs0[ch] += (1.f - w) * block.mChannels[ch][i];
+                rhs1[ch] += w * block.mChannels[ch][i];
+            }
+        }
+        float determinant = a * c - b * b;
+        if (fabsf(determinant) < 1e-6f)
+            return false;
+        determinant = 1.f / determinant;
+        for (int ch = firstChannel; ch < lastChannel; ch++)
+        {
+            e0[ch] = std::min(std::max((c * rhs0[ch] - b * rhs1[ch]) * determinant, 0.f), 255.f);
+            e1[ch] = std::min(std::max((a * rhs1[ch] - b * rhs0[ch]) * determinant, 0.f), 255.f);
+        }
+        return true;
+    }
+
+    // BC1 color block, always in 4 colors mode so it can be used by BC3
+    struct ColorBlock
+    {
+        uint16_t mColor0, mColor1;
+        unsigned char mIndices[16];
+    };
+
+    static uint16_t To565(const float* color)
+    {
+        int r = int(color[0] * 31.f / 255.f + 0.5f);
+        int g = int(color[1] * 63.f / 255.f + 0.5f);
+        int b = int(color[2] * 31.f / 255.f + 0.5f);
+        return uint16_t((r << 11) | (g << 5) | b);
+    }
+
+    static void From565(uint16_t color, float* rgb)
+    {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+        rgb[0] = float((r << 3) | (r >> 2));
+        rgb[1] = float((g << 2) | (g >> 4));
+        rgb[2] = float((b << 3) | (b >> 2));
+        rgb[3] = 0.f;
+    }
+
+    static float EncodeColorEndpoints(const BlockTexels& block, const float* e0, const float* e1, ColorBlock& color)
+    {
+        color.mColor0 = To565(e1);
+        color.mColor1 = To565(e0);
+        if (color.mColor0 < color.mColor1)
+            Swap(color.mColor0, color.mColor1);
+        float palette[4][4];
+        From565(color.mColor0, palette[0]);
+        From565(color.mColor1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+            palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+        }
+        // equal endpoints : every index selects color0
+        return SelectIndices(block, palette, (color.mColor0 == color.mColor1) ? 1 : 4, 0, 3, color.mIndices);
+    }
+
+    static void EncodeColor(const BlockTexels& block, int preset, unsigned char* output)
+    {
+        float e0[4], e1[4];
+        FitEndpoints(block, 0, 3, e0, e1);
+        ColorBlock best;
+        float bestError = EncodeColorEndpoints(block, e0, e1, best);
+        for (int iteration = 0; iteration < RefineIterations(preset) && bestError > 0.f; iteration++)
+        {
+            // palette order is color0, color1 : fraction of color1 per index
+            if (!RefineEndpoints(block, best.mIndices, BC1Weights, 0, 3, e0, e1))
+                break;
+            ColorBlock color;
+            float error = EncodeColorEndpoints(block, e1, e0, color);
+            if (error >= bestError)
+                break;
+            best = color;
+            bestError = error;
+        }
+        memset(output, 0, 8);
+        BitWriter writer(output);
+        writer.Write(best.mColor0, 16);
+        writer.Write(best.mColor1, 16);
+        for (int i = 0; i < 16; i++)
+            writer.Write(best.mIndices[i], 2);
+    }
+
+    // BC4 single channel block
+    static float EncodeChannelEndpoints(
+        const BlockTexels& block, int channel, int value0, int value1, unsigned char* indices)
+    {
+        float palette[8][4];
+        palette[0][channel] = float(value0);
+        palette[1][channel] = float(value1);
+        if (value0 > value1)
+        {
+            for (int i = 1; i < 7; i++)
+                palette[i + 1][channel] = float(((7 - i) * value0 + i * value1) / 7);
+            return SelectIndices(block, palette, 8, channel, channel + 1, indices);
+        }
+        for (int i = 1; i < 5; i++)
+            palette[i + 1][channel] = float(((5 - i) * value0 + i * value1) / 5);
+        palette[6][channel] = 0.f;
+        palette[7][channel] = 255.f;
+        return SelectIndices(block, palette, 8, channel, channel + 1, indices);
+    }
+
+    static void EncodeChannel(const BlockTexels& block, int channel, int preset, unsigned char* output)
+    {
+        float minimum = 255.f, maximum = 0.f;
+        float innerMinimum = 255.f, innerMaximum = 0.f;
+        for (int i = 0; i < 16; i++)
+        {
+            float value = block.mChannels[channel][i];
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+            if (value > 0.f && value < 255.f)
+            {
+                innerMinimum = std::min(innerMinimum, value);
+                innerMaximum = std::max(innerMaximum, value);
+            }
+        }
+        int bestValue0 = int(maximum);
+        int bestValue1 = int(minimum);
+        unsigned char bestIndices[16];
+        float bestError = EncodeChannelEndpoints(block, channel, bestValue0, bestValue1, bestIndices);
+
+        auto tryEndpoints = [&](int value0, int value1) {
+            unsigned char indices[16];
+            float error = EncodeChannelEndpoints(block, channel, value0, value1, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                bestValue0 = value0;
+                bestValue1 = value1;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+        };
+        if (preset >= PRESET_NORMAL && bestError > 0.f)
+        {
+            // 6 values mode with explicit 0 and 255 for blocks with extreme values
+            if (innerMinimum <= innerMaximum)
+                tryEndpoints(int(innerMinimum), int(innerMaximum));
+        }
+        if (preset == PRESET_HIGH && bestError > 0.f)
+        {
+            // inset endpoints
+            for (int inset0 = 0; inset0 < 4; inset0++)
+            {
+                for (int inset1 = 0; inset1 < 4; inset1++)
+                {
+                    int value0 = int(maximum) - inset0;
+                    int value1 = int(minimum) + inset1;
+                    if (value0 > value1)
+                        tryEndpoints(value0, value1);
+                }
+            }
+        }
+        memset(output, 0, 8);
+        BitWriter writer(output);
+        writer.Write(bestValue0, 8);
+        writer.Write(bestValue1, 8);
+        for (int i = 0; i < 16; i++)
+            writer.Write(bestIndices[i], 3);
+    }
+
+    // BC7 mode 6 : one subset, RGBA 7 bits endpoints with a p-bit each, 4 bits indices
+    struct BC7Block
+    {
+        int mEndpoints[2][4]; // 7 bits
+        int mPBits[2];
+        unsigned char mIndices[16];
+    };
+
+    static void QuantizeBC7Endpoint(const float* endpoint, int* quantized, int& pBit)
+    {
+        float bestError = FLT_MAX;
+        for (int p = 0; p < 2; p++)
+        {
+            int values[4];
+            float error = 0.f;
+            for (int c = 0; c < 4; c++)
+            {
+                values[c] = std::min(std::max(int((endpoint[c] - float(p)) * 0.5f + 0.5f), 0), 127);
+                float d = float((values[c] << 1) | p) - endpoint[c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pBit = p;
+                memcpy(quantized, values, sizeof(values));
+            }
+        }
+    }
+
+    static float EncodeBC7Endpoints(const BlockTexels& block, const float* e0, const float* e1, BC7Block& bc7)
+    {
+        QuantizeBC7Endpoint(e0, bc7.mEndpoints[0], bc7.mPBits[0]);
+        QuantizeBC7Endpoint(e1, bc7.mEndpoints[1], bc7.mPBits[1]);
+        float palette[16][4];
+        for (int c = 0; c < 4; c++)
+        {
+            int value0 = (bc7.mEndpoints[0][c] << 1) | bc7.mPBits[0];
+            int value1 = (bc7.mEndpoints[1][c] << 1) | bc7.mPBits[1];
+            for (int i = 0; i < 16; i++)
+                palette[i][c] = float(((64 - BC7Weights[i]) * value0 + BC7Weights[i] * value1 + 32) >> 6);
+        }
+        return SelectIndices(block, palette, 16, 0, 4, bc7.mIndices);
+    }
+
+    static void EncodeBC7(const BlockTexels& block, int preset, unsigned char* output)
+    {
+        float e0[4], e1[4];
+        FitEndpoints(block, 0, 4, e0, e1);
+        BC7Block best;
+        float bestError = EncodeBC7Endpoints(block, e0, e1, best);
+        for (int iteration = 0; iteration < RefineIterations(preset) && bestError > 0.f; iteration++)
+        {
+            if (!RefineEndpoints(block, best.mIndices, BC7WeightFractions, 0, 4, e0, e1))
+                break;
+            BC7Block bc7;
+            float error = EncodeBC7Endpoints(block, e0, e1, bc7);
+            if (error >= bestError)
+                break;
+            best = bc7;
+            bestError = error;
+        }
+        // the most significant bit of the first index is implicit 0
+        if (best.mIndices[0] & 8)
+        {
+            for (int c = 0; c < 4; c++)
+                Swap(best.mEndpoints[0][c], best.mEndpoints[1][c]);
+            Swap(best.mPBits[0], best.mPBits[1]);
+            for (int i = 0; i < 16; i++)
+                best.mIndices[i] = 15 - best.mIndices[i];
+        }
+        memset(output, 0, 16);
+        BitWriter writer(output);
+        writer.Write(1 << 6, 7);
+        for (int c = 0; c < 4; c++)
+        {
+            writer.Write(best.mEndpoints[0][c], 7);
+            writer.Write(best.mEndpoints[1][c], 7);
+        }
+        writer.Write(best.mPBits[0], 1);
+        writer.Write(best.mPBits[1], 1);
+        for (int i = 0; i < 16; i++)
+            writer.Write(best.mIndices[i], i ? 4 : 3);
+    }
+
+    static void CompressBlock(const BlockTexels& block, int format, int preset, unsigned char* output)
+    {
+        switch (format)
+        {
+            case FORMAT_BC1:
+                EncodeColor(block, preset, output);
+                break;
+            case FORMAT_BC3:
+                EncodeChannel(block, 3, preset, output);
+                EncodeColor(block, preset, output + 8);
+                break;
+            case FORMAT_BC4:
+                EncodeChannel(block, 0, preset, output);
+                break;
+            case FORMAT_BC5:
+                EncodeChannel(block, 0, preset, output);
+                EncodeChannel(block, 1, preset, output + 8);
+                break;
+            case FORMAT_BC7:
+                EncodeBC7(block, preset, output);
+                break;
+        }
+    }
+
+    struct Surface
+    {
+        const unsigned char* mTexels;
+        int mWidth, mHeight;
+        unsigned char* mBlocks;
+        uint32_t mFirstRow; // first block row of the surface over all surfaces
+    };
+
+    static int GetBlockCount(int size)
+    {
+        return std::max((size + 3) / 4, 1);
+    }
+
+    // one task per block row, over all the faces and mips
+    struct CompressTaskSet : TaskSet
+    {
+        CompressTaskSet(const std::vector<Surface>& surfaces, uint32_t rowCount, int format, int preset)
+            : TaskSet(rowCount), mSurfaces(surfaces), mFormat(format), mPreset(preset)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            size_t blockSize = GetBlockSize(mFormat);
+            BlockTexels block;
+            for (uint32_t row = range.start; row < range.end; row++)
+            {
+                auto surface = std::upper_bound(mSurfaces.begin(), mSurfaces.end(), row, [](uint32_t row, const Surface& s) {
+                                   return row < s.mFirstRow;
+                               }) - 1;
+                int blockY = int(row - surface->mFirstRow);
+                int blockCountX = GetBlockCount(surface->mWidth);
+                unsigned char* output = surface->mBlocks + size_t(blockY) * blockCountX * blockSize;
+                for (int blockX = 0; blockX < blockCountX; blockX++, output += blockSize)
+                {
+                    LoadBlock(surface->mTexels, surface->mWidth, surface->mHeight, blockX, blockY, block);
+                    CompressBlock(block, mFormat, mPreset, output);
+                }
+            }
+        }
+        const std::vector<Surface>& mSurfaces;
+        int mFormat;
+        int mPreset;
+    };
+
+    int GetPreset(int quality)
+    {
+        return (quality <= 3) ? PRESET_HIGH : ((quality <= 6) ? PRESET_NORMAL : PRESET_FAST);
+    }
+
+    size_t GetBlockSize(int format)
+    {
+        return (format == FORMAT_BC1 || format == FORMAT_BC4) ? 8 : 16;
+    }
+
+    static size_t GetCompressedSize(int width, int height, int format, int mip)
+    {
+        return size_t(GetBlockCount(std::max(width >> mip, 1))) * GetBlockCount(std::max(height >> mip, 1)) *
+               GetBlockSize(format);
+    }
+
+    int Compress(const Image* image, int format, int preset, std::vector<unsigned char>& blocks)
+    {
+        if (!image || !image->GetBits() || format <= FORMAT_NONE || format >= FORMAT_COUNT)
+            return EVAL_ERR;
+
+        // encoders work on 8 bits RGBA
+        Image converted;
+        const Image* source = image;
+        if (image->mFormat != TextureFormat::RGBA8)
+        {
+            if (ImageOps::Convert(image, &converted, TextureFormat::RGBA8) != EVAL_OK)
+                return EVAL_ERR;
+            source = &converted;
+        }
+        int mipCount = std::max(int(source->mNumMips), 1);
+        int faceCount = std::max(int(source->mNumFaces), 1);
+        if (source->mDataSize < ImageOps::GetImageSize(source->mWidth, source->mHeight, TextureFormat::RGBA8, mipCount, faceCount))
+            return EVAL_ERR;
+
+        size_t compressedFaceSize = 0;
+        for (int mip = 0; mip < mipCount; mip++)
+            compressedFaceSize += GetCompressedSize(source->mWidth, source->mHeight, format, mip);
+        blocks.resize(compressedFaceSize * faceCount);
+
+        std::vector<Surface> surfaces;
+        const unsigned char* texels = source->GetBits();
+        unsigned char* output = blocks.data();
+        uint32_t rowCount = 0;
+        for (int face = 0; face < faceCount; face++)
+        {
+            for (int mip = 0; mip < mipCount; mip++)
+            {
+                Surface surface;
+                surface.mTexels = texels;
+                surface.mWidth = std::max(source->mWidth >> mip, 1);
+                surface.mHeight = std::max(source->mHeight >> mip, 1);
+                surface.mBlocks = output;
+                surface.mFirstRow = rowCount;
+                surfaces.push_back(surface);
+                rowCount += GetBlockCount(surface.mHeight);
+                texels += ImageOps::GetSurfaceSize(source->mWidth, source->mHeight, TextureFormat::RGBA8, mip);
+                output += GetCompressedSize(source->mWidth, source->mHeight, format, mip);
+            }
+        }
+
+        CompressTaskSet compressTask(surfaces, rowCount, format, preset);
+        g_TS.AddTaskSetToPipe(&compressTask);
+        g_TS.WaitforTaskSet(&compressTask);
+        return EVAL_OK;
+    }
+
+    static uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return uint32_t(a) | (uint32_t(b) << 8) | (uint32_t(c) << 16) | (uint32_t(d) << 24);
+    }
+
+    struct DDSPixelFormat
+    {
+        uint32_t mSize;
+        uint32_t mFlags;
+        uint32_t mFourCC;
+        uint32_t mRGBBitCount;
+        uint32_t mBitMasks[4];
+    };
+
+    struct DDSHeader
+    {
+        uint32_t mMagic;
+        uint32_t mSize;
+        uint32_t mFlags;
+        uint32_t mHeight;
+        uint32_t mWidth;
+        uint32_t mPitchOrLinearSize;
+        uint32_t mDepth;
+        uint32_t mMipMapCount;
+        uint32_t mReserved1[11];
+        DDSPixelFormat mPixelFormat;
+        uint32_t mCaps[4];
+        uint32_t mReserved2;
+    };
+
+    struct DDSHeaderDX10
+    {
+        uint32_t mDXGIFormat;
+        uint32_t mResourceDimension;
+        uint32_t mMiscFlag;
+        uint32_t mArraySize;
+        uint32_t mMiscFlags2;
+    };
+
+    static bool WriteDDS(FILE* fp, const Image* image, int format, const std::vector<unsigned char>& blocks)
+    {
+        int mipCount = std::max(int(image->mNumMips), 1);
+        bool cube = image->mNumFaces == 6;
+
+        DDSHeader header;
+        memset(&header, 0, sizeof(header));
+        header.mMagic = MakeFourCC('D', 'D', 'S', ' ');
+        header.mSize = 124;
+        // caps, height, width, pixel format, linear size
+        header.mFlags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000 | ((mipCount > 1) ? 0x20000 : 0);
+        header.mWidth = image->mWidth;
+        header.mHeight = image->mHeight;
+        header.mPitchOrLinearSize = uint32_t(GetCompressedSize(image->mWidth, image->mHeight, format, 0));
+        header.mMipMapCount = mipCount;
+        header.mPixelFormat.mSize = 32;
+        header.mPixelFormat.mFlags = 0x4; // fourCC
+        static const char* fourCCs[] = {"", "DXT1", "DXT5", "ATI1", "ATI2", "DX10"};
+        const char* fourCC = fourCCs[format];
+        header.mPixelFormat.mFourCC = MakeFourCC(fourCC[0], fourCC[1], fourCC[2], fourCC[3]);
+        header.mCaps[0] = 0x1000 | ((mipCount > 1) ? 0x400000 : 0) | ((mipCount > 1 || cube) ? 0x8 : 0);
+        header.mCaps[1] = cube ? (0x200 | 0xFC00) : 0;
+        fwrite(&header, sizeof(header), 1, fp);
+
+        if (format == FORMAT_BC7)
+        {
+            DDSHeaderDX10 headerDX10;
+            headerDX10.mDXGIFormat = 98; // DXGI_FORMAT_BC7_UNORM
+            headerDX10.mResourceDimension = 3; // texture 2D
+            headerDX10.mMiscFlag = cube ? 0x4 : 0;
+            headerDX10.mArraySize = 1;
+            headerDX10.mMiscFlags2 = 0;
+            fwrite(&headerDX10, sizeof(headerDX10), 1, fp);
+        }
+        // DDS stores faces then mips like Image
+        return fwrite(blocks.data(), 1, blocks.size(), fp) == blocks.size();
+    }
+
+    static bool WriteKTX(FILE* fp, const Image* image, int format, const std::vector<unsigned char>& blocks)
+    {
+        static const unsigned char identifier[12] = {
+            0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+        // GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RED_RGTC1,
+        // GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RGBA_BPTC_UNORM
+        static const uint32_t internalFormats[] = {0, 0x83F0, 0x83F3, 0x8DBB, 0x8DBD, 0x8E8C};
+        // GL_RGB, GL_RGBA, GL_RED, GL_RG
+        static const uint32_t baseInternalFormats[] = {0, 0x1907, 0x1908, 0x1903, 0x8227, 0x1908};
+        int mipCount = std::max(int(image->mNumMips), 1);
+        int faceCount = std::max(int(image->mNumFaces), 1);
+
+        uint32_t header[13] = {0x04030201,
+                               0, // glType
+                               1, // glTypeSize
+                               0, // glFormat
+                               internalFormats[format],
+                               baseInternalFormats[format],
+                               uint32_t(image->mWidth),
+                               uint32_t(image->mHeight),
+                               0,
+                               0,
+                               uint32_t(faceCount),
+                               uint32_t(mipCount),
+                               0};
+        fwrite(identifier, sizeof(identifier), 1, fp);
+        fwrite(header, sizeof(header), 1, fp);
+
+        // KTX stores mips then faces
+        size_t faceSize = blocks.size() / faceCount;
+        size_t mipOffset = 0;
+        for (int mip = 0; mip < mipCount; mip++)
+        {
+            uint32_t mipSize = uint32_t(GetCompressedSize(image->mWidth, image->mHeight, format, mip));
+            fwrite(&mipSize, sizeof(mipSize), 1, fp);
+            for (int face = 0; face < faceCount; face++)
+            {
+                if (fwrite(blocks.data() + face * faceSize + mipOffset, 1, mipSize, fp) != mipSize)
+                    return false;
+            }
+            mipOffset += mipSize;
+        }
+        return true;
+    }
+
+    int Write(const char* filename, const Image* image, int fileFormat, int format, int preset)
+    {
+        std::vector<unsigned char> blocks;
+        if (Compress(image, format, preset, blocks) != EVAL_OK)
+            return EVAL_ERR;
+
+        FILE* fp = fopen(filename, "wb");
+        if (!fp)
+            return EVAL_ERR;
+        bool written = (fileFormat == 6) ? WriteKTX(fp, image, format, blocks) : WriteDDS(fp, image, format, blocks);
+        fclose(fp);
+        return written ? EVAL_OK : EVAL_ERR;
+    }
+} // namespace BlockCompression
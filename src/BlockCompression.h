@@ -0,0 +1,62 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+#include <vector>
+#include <stddef.h>
+
+struct Image;
+
+// BCn encoder for DDS and KTX export. Blocks of every face and mip are compressed in parallel.
+namespace BlockCompression
+{
+    enum Format
+    {
+        FORMAT_NONE,
+        FORMAT_BC1, // RGB
+        FORMAT_BC3, // RGBA
+        FORMAT_BC4, // red channel only, for masks
+        FORMAT_BC5, // red and green channels, for normal maps
+        FORMAT_BC7, // RGBA, mode 6
+        FORMAT_COUNT,
+    };
+
+    // endpoints refinement effort
+    enum Preset
+    {
+        PRESET_FAST,
+        PRESET_NORMAL,
+        PRESET_HIGH,
+    };
+
+    // preset for an ImageWrite quality (0 best .. 9 lowest)
+    int GetPreset(int quality);
+    size_t GetBlockSize(int format);
+
+    // blocks are laid out like the image texels : for each face, mips from largest to smallest
+    int Compress(const Image* image, int format, int preset, std::vector<unsigned char>& blocks);
+    // fileFormat is the Image::Write format (5 DDS, 6 KTX)
+    int Write(const char* filename, const Image* image, int fileFormat, int format, int preset);
+} // namespace BlockCompression
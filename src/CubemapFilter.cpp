@@ -0,0 +1,536 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "Platform.h"
+#include "CubemapFilter.h"
+#include "ImageOps.h"
+#include "Bitmap.h"
+#include "Utils.h"
+#include "cmft/cubemaputils.h"
+#include <algorithm>
+#include <vector>
+
+extern TaskScheduler g_TS;
+
+namespace CubemapFilter
+{
+    // samples per texel for the radiance lobes. They are fetched from the source mips (filtered importance
+    // sampling) so a small fixed count stays noise free and the result is deterministic.
+    static const int RadianceSampleCount = 128;
+    static const int MaxMipCount = 16;
+
+    static void RunTaskSet(TaskSet* taskSet)
+    {
+        g_TS.AddTaskSetToPipe(taskSet);
+        g_TS.WaitforTaskSet(taskSet);
+    }
+
+    // float RGBA color, one SSE register when available
+#if IMOGEN_SSE2
+    typedef __m128 Color;
+
+    static inline Color Zero()
+    {
+        return _mm_setzero_ps();
+    }
+    static inline Color Load(const float* texel)
+    {
+        return _mm_loadu_ps(texel);
+    }
+    static inline void Store(float* texel, Color color)
+    {
+        _mm_storeu_ps(texel, color);
+    }
+    static inline Color MulAdd(Color accum, Color color, float weight)
+    {
+        return _mm_add_ps(accum, _mm_mul_ps(color, _mm_set1_ps(weight)));
+    }
+    static inline Color Lerp(Color a, Color b, float t)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+    }
+    static inline Color Scale(Color color, float scale)
+    {
+        return _mm_mul_ps(color, _mm_set1_ps(scale));
+    }
+#else
+    struct Color
+    {
+        float v[4];
+    };
+
+    static inline Color Zero()
+    {
+        Color res = {{0.f, 0.f, 0.f, 0.f}};
+        return res;
+    }
+    static inline Color Load(const float* texel)
+    {
+        Color res = {{texel[0], texel[1], texel[2], texel[3]}};
+        return res;
+    }
+    static inline void Store(float* texel, Color color)
+    {
+        memcpy(texel, color.v, sizeof(float) * 4);
+    }
+    static inline Color MulAdd(Color accum, Color color, float weight)
+    {
+        for (int i = 0; i < 4; i++)
+            accum.v[i] += color.v[i] * weight;
+        return accum;
+    }
+    static inline Color Lerp(Color a, Color b, float t)
+    {
+        for (int i = 0; i < 4; i++)
+            a.v[i] += (b.v[i] - a.v[i]) * t;
+        return a;
+    }
+    static inline Color Scale(Color color, float scale)
+    {
+        for (int i = 0; i < 4; i++)
+            color.v[i] *= scale;
+        return color;
+    }
+#endif
+
+    // float RGBA cubemap with its mip chain, pointers for every face and mip
+    struct SourceCube
+    {
+        SourceCube(const Image& image) : mSize(image.mWidth), mMipCount(std::min(int(image.mNumMips), MaxMipCount))
+        {
+            size_t faceSize = ImageOps::GetImageSize(mSize, mSize, TextureFormat::RGBA32F, image.mNumMips, 1);
+            for (int face = 0; face < 6; face++)
+            {
+                const unsigned char* bits = image.GetBits() + face * faceSize;
+                for (int mip = 0; mip < mMipCount; mip++)
+                {
+                    mTexels[face][mip] = (const float*)bits;
+                    bits += ImageOps::GetSurfaceSize(mSize, mSize, TextureFormat::RGBA32F, mip);
+                }
+            }
+        }
+
+        Color SampleMip(int face, int mip, float u, float v) const
+        {
+            int size = std::max(mSize >> mip, 1);
+            const float* texels = mTexels[face][mip];
+            float x = std::min(std::max(u * size - 0.5f, 0.f), float(size - 1));
+            float y = std::min(std::max(v * size - 0.5f, 0.f), float(size - 1));
+            int x0 = int(x);
+            int y0 = int(y);
+            int x1 = std::min(x0 + 1, size - 1);
+            int y1 = std::min(y0 + 1, size - 1);
+            float fx = x - float(x0);
+            float fy = y - float(y0);
+            Color top = Lerp(Load(texels + (y0 * size + x0) * 4), Load(texels + (y0 * size + x1) * 4), fx);
+            Color bottom = Lerp(Load(texels + (y1 * size + x0) * 4), Load(texels + (y1 * size + x1) * 4), fx);
+            return Lerp(top, bottom, fy);
+        }
+
+        // trilinear fetch, seams are not filtered across faces
+        Color Sample(const float* dir, float lod) const
+        {
+            float u, v;
+            uint8_t face;
+            cmft::vecToTexelCoord(u, v, face, dir);
+            lod = std::min(std::max(lod, 0.f), float(mMipCount - 1));
+            int mip = int(lod);
+            float t = lod - float(mip);
+            Color color = SampleMip(face, mip, u, v);
+            if (t > 0.f && mip + 1 < mMipCount)
+                color = Lerp(color, SampleMip(face, mip + 1, u, v), t);
+            return color;
+        }
+
+        int mSize;
+        int mMipCount;
+        const float* mTexels[6][MaxMipCount];
+    };
+
+    // texel rows of every face and mip of the filtered cube are scheduled as a single range
+    struct Surface
+    {
+        int mFace;
+        int mMip;
+        int mSize;
+        int mFirstRow;
+        float* mTexels;
+    };
+
+    static int BuildSurfaces(Image& result, int faceSize, int mipCount, std::vector<Surface>& surfaces)
+    {
+        size_t faceStride = ImageOps::GetImageSize(faceSize, faceSize, TextureFormat::RGBA32F, mipCount, 1);
+        unsigned char* bits = ImageBuffer::Allocate(faceStride * 6);
+        int rowCount = 0;
+        for (int face = 0; face < 6; face++)
+        {
+            unsigned char* faceBits = bits + face * faceStride;
+            for (int mip = 0; mip < mipCount; mip++)
+            {
+                Surface surface = {face, mip, std::max(faceSize >> mip, 1), rowCount, (float*)faceBits};
+                surfaces.push_back(surface);
+                rowCount += surface.mSize;
+                faceBits += ImageOps::GetSurfaceSize(faceSize, faceSize, TextureFormat::RGBA32F, mip);
+            }
+        }
+        result.mWidth = result.mHeight = faceSize;
+        result.mFormat = TextureFormat::RGBA32F;
+        result.mNumMips = mipCount;
+        result.mNumFaces = 6;
+        result.AttachBits(bits, faceStride * 6);
+        return rowCount;
+    }
+
+    static const Surface& FindSurface(const std::vector<Surface>& surfaces, int row)
+    {
+        auto iter = std::upper_bound(
+            surfaces.begin(), surfaces.end(), row, [](int r, const Surface& surface) { return r < surface.mFirstRow; });
+        return *(iter - 1);
+    }
+
+    static inline void TexelDirection(float* dir, int face, int x, int y, int size)
+    {
+        float invSize = 1.f / float(size);
+        cmft::texelCoordToVec(dir, (float(x) + 0.5f) * 2.f * invSize - 1.f, (float(y) + 0.5f) * 2.f * invSize - 1.f, uint8_t(face));
+    }
+
+    static inline float RadicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return float(bits) * 2.3283064365386963e-10f;
+    }
+
+    // light direction in the tangent space of the texel normal, with its weight and the source lod to fetch
+    struct LobeSample
+    {
+        float mDir[3];
+        float mWeight;
+        float mLod;
+    };
+
+    // normal = view = reflection : samples are the same for every texel of a mip
+    static void BuildLobeSamples(int lightingModel, float specularPower, int sourceSize, std::vector<LobeSample>& samples)
+    {
+        // cmft conventions for brdf and blinn lobes
+        if (lightingModel == LIGHTING_BLINN || lightingModel == LIGHTING_BLINN_BRDF)
+            specularPower *= 0.25f;
+        if (lightingModel == LIGHTING_PHONG_BRDF || lightingModel == LIGHTING_BLINN_BRDF)
+            specularPower += 1.f;
+
+        const float alpha = sqrtf(2.f / (specularPower + 2.f));
+        const float alpha2 = alpha * alpha;
+        const float sourceTexelSolidAngle = 4.f * CMFT_PI / (6.f * float(sourceSize) * float(sourceSize));
+
+        samples.clear();
+        for (int i = 0; i < RadianceSampleCount; i++)
+        {
+            float xi0 = (float(i) + 0.5f) / float(RadianceSampleCount);
+            float xi1 = RadicalInverse(uint32_t(i));
+            float phi = CMFT_2PI * xi0;
+            LobeSample sample;
+            float pdf;
+            if (lightingModel == LIGHTING_GGX)
+            {
+                // half vector from the GGX distribution, reflected around it
+                float cosTheta = sqrtf((1.f - xi1) / (1.f + (alpha2 - 1.f) * xi1));
+                float sinTheta = sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f));
+                float half[3] = {sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta};
+                sample.mDir[0] = 2.f * cosTheta * half[0];
+                sample.mDir[1] = 2.f * cosTheta * half[1];
+                sample.mDir[2] = 2.f * cosTheta * half[2] - 1.f;
+                sample.mWeight = sample.mDir[2];
+                float d = cosTheta * cosTheta * (alpha2 - 1.f) + 1.f;
+                pdf = alpha2 / (CMFT_PI * d * d) * 0.25f;
+            }
+            else
+            {
+                // phong lobe around the reflection vector
+                float cosTheta = powf(1.f - xi1, 1.f / (specularPower + 1.f));
+                float sinTheta = sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f));
+                sample.mDir[0] = sinTheta * cosf(phi);
+                sample.mDir[1] = sinTheta * sinf(phi);
+                sample.mDir[2] = cosTheta;
+                sample.mWeight = 1.f;
+                pdf = (specularPower + 1.f) / CMFT_2PI * powf(cosTheta, specularPower);
+            }
+            if (sample.mDir[2] <= 0.f)
+                continue;
+            float sampleSolidAngle = 1.f / (float(RadianceSampleCount) * std::max(pdf, 1e-6f));
+            sample.mLod = std::max(0.5f * log2f(sampleSolidAngle / sourceTexelSolidAngle) + 1.f, 0.f);
+            samples.push_back(sample);
+        }
+    }
+
+    struct RadianceTaskSet : TaskSet
+    {
+        RadianceTaskSet(const SourceCube& source,
+                        const std::vector<Surface>& surfaces,
+                        const std::vector<LobeSample>* lobes,
+                        int rowCount,
+                        bool excludeBase)
+            : TaskSet(rowCount), mSource(source), mSurfaces(surfaces), mLobes(lobes), mExcludeBase(excludeBase)
+        {
+        }
+
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t row = range.start; row < range.end; row++)
+            {
+                const Surface& surface = FindSurface(mSurfaces, int(row));
+                int y = int(row) - surface.mFirstRow;
+                float* texels = surface.mTexels + size_t(y) * surface.mSize * 4;
+                if (surface.mMip == 0 && mExcludeBase)
+                {
+                    float lod = std::max(log2f(float(mSource.mSize) / float(surface.mSize)), 0.f);
+                    for (int x = 0; x < surface.mSize; x++)
+                    {
+                        float dir[3];
+                        TexelDirection(dir, surface.mFace, x, y, surface.mSize);
+                        Store(texels + x * 4, mSource.Sample(dir, lod));
+                    }
+                    continue;
+                }
+
+                const std::vector<LobeSample>& lobe = mLobes[surface.mMip];
+                for (int x = 0; x < surface.mSize; x++)
+                {
+                    float normal[3], side[3], tangent[3], bitangent[3];
+                    TexelDirection(normal, surface.mFace, x, y, surface.mSize);
+                    const float up[3] = {0.f, 0.f, 1.f};
+                    const float right[3] = {1.f, 0.f, 0.f};
+                    vec3Cross(side, fabsf(normal[2]) < 0.999f ? up : right, normal);
+                    vec3Norm(tangent, side);
+                    vec3Cross(bitangent, normal, tangent);
+
+                    Color accum = Zero();
+                    float weightSum = 0.f;
+                    for (const auto& sample : lobe)
+                    {
+                        float dir[3];
+                        for (int i = 0; i < 3; i++)
+                        {
+                            dir[i] = tangent[i] * sample.mDir[0] + bitangent[i] * sample.mDir[1] +
+                                     normal[i] * sample.mDir[2];
+                        }
+                        accum = MulAdd(accum, mSource.Sample(dir, sample.mLod), sample.mWeight);
+                        weightSum += sample.mWeight;
+                    }
+                    Store(texels + x * 4, weightSum > 0.f ? Scale(accum, 1.f / weightSum) : mSource.Sample(normal, 0.f));
+                }
+            }
+        }
+
+        const SourceCube& mSource;
+        const std::vector<Surface>& mSurfaces;
+        const std::vector<LobeSample>* mLobes;
+        bool mExcludeBase;
+    };
+
+    static bool IsCube(const Image* image)
+    {
+        return image && image->GetBits() && image->mNumFaces == 6 && image->mWidth > 0 &&
+               image->mWidth == image->mHeight && image->mFormat < TextureFormat::Count;
+    }
+
+    static int GetMipCount(int size)
+    {
+        int mipCount = 1;
+        while ((size >> mipCount) > 0)
+            mipCount++;
+        return std::min(mipCount, MaxMipCount);
+    }
+
+    int Radiance(Image* image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias)
+    {
+        if (!IsCube(image) || faceSize < 0 || lightingModel < LIGHTING_PHONG || lightingModel > LIGHTING_GGX)
+            return EVAL_ERR;
+
+        int format = image->mFormat;
+        if (!faceSize)
+            faceSize = image->mWidth;
+
+        Image source;
+        if (ImageOps::Convert(image, &source, TextureFormat::RGBA32F) != EVAL_OK ||
+            ImageOps::GenerateMips(&source, 0) != EVAL_OK)
+        {
+            return EVAL_ERR;
+        }
+        SourceCube sourceCube(source);
+
+        // glossiness goes from 1 to 0 along the mips, like cmft
+        int mipCount = GetMipCount(faceSize);
+        std::vector<LobeSample> lobes[MaxMipCount];
+        for (int mip = 0; mip < mipCount; mip++)
+        {
+            float glossiness = (mipCount == 1) ? 1.f : std::max(1.f - float(mip) / float(mipCount - 1), 0.f);
+            float specularPower = powf(2.f, float(glossScale) * glossiness + float(glossBias));
+            BuildLobeSamples(lightingModel, specularPower, sourceCube.mSize, lobes[mip]);
+        }
+
+        Image result;
+        std::vector<Surface> surfaces;
+        int rowCount = BuildSurfaces(result, faceSize, mipCount, surfaces);
+        RadianceTaskSet radianceTask(sourceCube, surfaces, lobes, rowCount, excludeBase != 0);
+        RunTaskSet(&radianceTask);
+
+        return ImageOps::Convert(&result, image, format);
+    }
+
+    // real spherical harmonics basis, 3 bands
+    static const int SHCoeffCount = 9;
+
+    static inline void SHBasis(float* basis, const float* dir)
+    {
+        const float x = dir[0], y = dir[1], z = dir[2];
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * y;
+        basis[2] = 0.488603f * z;
+        basis[3] = 0.488603f * x;
+        basis[4] = 1.092548f * x * y;
+        basis[5] = 1.092548f * y * z;
+        basis[6] = 0.315392f * (3.f * z * z - 1.f);
+        basis[7] = 1.092548f * x * z;
+        basis[8] = 0.546274f * (x * x - y * y);
+    }
+
+    // every source row is projected in its own slot, slots are summed once all tasks are done
+    struct SHProjectTaskSet : TaskSet
+    {
+        SHProjectTaskSet(const SourceCube& source, float* rowCoeffs)
+            : TaskSet(source.mSize * 6), mSource(source), mRowCoeffs(rowCoeffs)
+        {
+        }
+
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            const int size = mSource.mSize;
+            const float invSize = 1.f / float(size);
+            for (uint32_t row = range.start; row < range.end; row++)
+            {
+                int face = int(row) / size;
+                int y = int(row) % size;
+                const float* texels = mSource.mTexels[face][0] + size_t(y) * size * 4;
+                float v = (float(y) + 0.5f) * 2.f * invSize - 1.f;
+                Color accum[SHCoeffCount];
+                for (int i = 0; i < SHCoeffCount; i++)
+                    accum[i] = Zero();
+
+                for (int x = 0; x < size; x++)
+                {
+                    float u = (float(x) + 0.5f) * 2.f * invSize - 1.f;
+                    float dir[3], basis[SHCoeffCount];
+                    cmft::texelCoordToVec(dir, u, v, uint8_t(face));
+                    SHBasis(basis, dir);
+                    float solidAngle = cmft::texelSolidAngle(u, v, invSize);
+                    Color color = Load(texels + x * 4);
+                    for (int i = 0; i < SHCoeffCount; i++)
+                        accum[i] = MulAdd(accum[i], color, basis[i] * solidAngle);
+                }
+                for (int i = 0; i < SHCoeffCount; i++)
+                    Store(mRowCoeffs + (size_t(row) * SHCoeffCount + i) * 4, accum[i]);
+            }
+        }
+
+        const SourceCube& mSource;
+        float* mRowCoeffs;
+    };
+
+    struct SHEvaluateTaskSet : TaskSet
+    {
+        SHEvaluateTaskSet(const Surface* faces, const float* coeffs)
+            : TaskSet(faces[0].mSize * 6), mFaces(faces), mCoeffs(coeffs)
+        {
+        }
+
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            const int size = mFaces[0].mSize;
+            for (uint32_t row = range.start; row < range.end; row++)
+            {
+                int face = int(row) / size;
+                int y = int(row) % size;
+                float* texels = mFaces[face].mTexels + size_t(y) * size * 4;
+                for (int x = 0; x < size; x++)
+                {
+                    float dir[3], basis[SHCoeffCount];
+                    TexelDirection(dir, face, x, y, size);
+                    SHBasis(basis, dir);
+                    Color color = Zero();
+                    for (int i = 0; i < SHCoeffCount; i++)
+                        color = MulAdd(color, Load(mCoeffs + i * 4), basis[i]);
+                    Store(texels + x * 4, color);
+                }
+            }
+        }
+
+        const Surface* mFaces;
+        const float* mCoeffs;
+    };
+
+    int Irradiance(Image* image, int faceSize)
+    {
+        if (!IsCube(image) || faceSize < 0)
+            return EVAL_ERR;
+
+        int format = image->mFormat;
+        if (!faceSize)
+            faceSize = image->mWidth;
+
+        Image source;
+        if (ImageOps::Convert(image, &source, TextureFormat::RGBA32F) != EVAL_OK)
+            return EVAL_ERR;
+        SourceCube sourceCube(source);
+
+        size_t rowCount = size_t(sourceCube.mSize) * 6;
+        float* rowCoeffs = (float*)BufferPool::Allocate(rowCount * SHCoeffCount * 4 * sizeof(float));
+        SHProjectTaskSet projectTask(sourceCube, rowCoeffs);
+        RunTaskSet(&projectTask);
+
+        // convolution with the clamped cosine lobe (PI, 2PI/3, PI/4 per band), divided by PI
+        static const float bandScale[SHCoeffCount] = {
+            1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+        float coeffs[SHCoeffCount * 4] = {};
+        for (size_t row = 0; row < rowCount; row++)
+        {
+            for (int i = 0; i < SHCoeffCount * 4; i++)
+                coeffs[i] += rowCoeffs[row * SHCoeffCount * 4 + i];
+        }
+        for (int i = 0; i < SHCoeffCount * 4; i++)
+            coeffs[i] *= bandScale[i / 4];
+        BufferPool::Free(rowCoeffs);
+
+        Image result;
+        std::vector<Surface> surfaces;
+        BuildSurfaces(result, faceSize, 1, surfaces);
+        SHEvaluateTaskSet evaluateTask(surfaces.data(), coeffs);
+        RunTaskSet(&evaluateTask);
+
+        return ImageOps::Convert(&result, image, format);
+    }
+} // namespace CubemapFilter
@@ -0,0 +1,49 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+struct Image;
+
+// CPU image based lighting filters for cubemaps. No GPU involved, results only depend on the source.
+// Faces, mips and texel rows are filtered in parallel on the task scheduler.
+namespace CubemapFilter
+{
+    enum LightingModel
+    {
+        LIGHTING_PHONG,
+        LIGHTING_PHONG_BRDF,
+        LIGHTING_BLINN,
+        LIGHTING_BLINN_BRDF,
+        LIGHTING_GGX,
+    };
+
+    // Prefiltered radiance with a full mip chain. Glossiness goes from 1 (first mip) to 0 (last mip),
+    // specular power is 2^(glossScale * glossiness + glossBias). faceSize 0 keeps the source size.
+    // excludeBase copies the source in the first mip instead of filtering it.
+    int Radiance(Image* image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias);
+    // Diffuse irradiance divided by PI, from the 3 bands spherical harmonics of the source
+    int Irradiance(Image* image, int faceSize);
+} // namespace CubemapFilter
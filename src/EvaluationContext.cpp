@@ -87,6 +87,7 @@ EvaluationContext::EvaluationContext(EvaluationStages& evaluation,
                                      int defaultWidth,
                                      int defaultHeight)
     : mEvaluationStages(evaluation)
+    , mJobGenerationCount(0)
 #ifdef __EMSCRIPTEN
     , mbSynchronousEvaluation(true)
 #else
@@ -161,6 +162,8 @@ void EvaluationContext::Clear()
     mDirtyFlags.clear();
     mbProcessing.clear();
     mProgress.clear();
+    mGeneration.clear();
+    InvalidateJobGenerations(0);
 }
 
 unsigned int EvaluationContext::GetEvaluationTexture(size_t target)
@@ -438,7 +441,7 @@ void EvaluationContext::EvaluateGLSL(const EvaluationStage& evaluationStage,
     {
         glUseProgram(gDefaultShader.mNodeErrorShader);
         // mFSQuad.Render();
-        evaluationStage.mGScene->Draw(this, evaluationInfo);
+        evaluationStage.mGScene->Draw();
         return;
     }
     for (int i = 0; i < 2; i++)
@@ -574,7 +577,7 @@ void EvaluationContext::EvaluateGLSL(const EvaluationStage& evaluationStage,
                 }
                 else
                 {
-                    evaluationStage.mGScene->Draw(this, evaluationInfo);
+                    evaluationStage.mGScene->Draw();
                 }
             } // face
         }     // mip
@@ -687,6 +690,35 @@ void EvaluationContext::PreRun()
     mbProcessing.resize(mEvaluationStages.GetStagesCount(), 0);
     mProgress.resize(mEvaluationStages.GetStagesCount(), 0.f);
     mActive.resize(mEvaluationStages.GetStagesCount(), false);
+    mGeneration.resize(mEvaluationStages.GetStagesCount(), 0);
+    ReserveJobGenerations(mEvaluationStages.GetStagesCount());
+}
+
+void EvaluationContext::ReserveJobGenerations(size_t count)
+{
+    // jobs of this context are started on this thread: none can start while the array is replaced
+    if (count <= mJobGenerationCount || EvaluationAPI::GetPendingJobCount())
+    {
+        return;
+    }
+    // room for the next added stages
+    count += 32;
+    std::unique_ptr<std::atomic<unsigned int>[]> jobGeneration(new std::atomic<unsigned int>[count]);
+    for (size_t i = 0; i < count; i++)
+    {
+        jobGeneration[i] = (i < mJobGenerationCount) ? mJobGeneration[i].load() : 0;
+    }
+    mJobGeneration = std::move(jobGeneration);
+    mJobGenerationCount = count;
+}
+
+void EvaluationContext::InvalidateJobGenerations(size_t first)
+{
+    // stages from first have a new index, the jobs in flight for their old index are dropped
+    for (size_t i = first; i < mJobGenerationCount; i++)
+    {
+        mJobGeneration[i] = 0;
+    }
 }
 
 void EvaluationContext::RunNode(size_t nodeIndex)
@@ -735,6 +767,7 @@ void EvaluationContext::RunNode(size_t nodeIndex)
         EvaluateGLSL(currentStage, nodeIndex, mEvaluationInfo);
     }
     mDirtyFlags[nodeIndex] = 0;
+    StageBumpGeneration(nodeIndex);
 }
 
 bool EvaluationContext::RunNodeList(const std::vector<size_t>& nodesToEvaluate)
@@ -780,8 +813,13 @@ void EvaluationContext::RunSingle(size_t nodeIndex, EvaluationInfo& evaluationIn
     glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
 }
 
-void EvaluationContext::RecurseBackward(size_t target, std::vector<size_t>& usedNodes)
+void EvaluationContext::RecurseBackward(size_t target, std::vector<size_t>& usedNodes, std::vector<bool>& visited)
 {
+    // shared inputs are only walked once
+    if (visited[target])
+        return;
+    visited[target] = true;
+
     const EvaluationStage& evaluation = mEvaluationStages.GetEvaluationStage(target);
     const Input& input = evaluation.mInput;
 
@@ -790,11 +828,10 @@ void EvaluationContext::RecurseBackward(size_t target, std::vector<size_t>& used
         int targetIndex = input.mInputs[inputIndex];
         if (targetIndex == -1)
             continue;
-        RecurseBackward(targetIndex, usedNodes);
+        RecurseBackward(targetIndex, usedNodes, visited);
     }
 
-    if (std::find(usedNodes.begin(), usedNodes.end(), target) == usedNodes.end())
-        usedNodes.push_back(target);
+    usedNodes.push_back(target);
 }
 
 void EvaluationContext::RunDirty()
@@ -840,7 +877,8 @@ bool EvaluationContext::RunBackward(size_t nodeIndex)
     memset(&mEvaluationInfo, 0, sizeof(EvaluationInfo));
     mEvaluationInfo.forcedDirty = true;
     std::vector<size_t> nodesToEvaluate;
-    RecurseBackward(nodeIndex, nodesToEvaluate);
+    std::vector<bool> visited(mEvaluationStages.GetStagesCount(), false);
+    RecurseBackward(nodeIndex, nodesToEvaluate, visited);
     AllocRenderTargetsForBaking(nodesToEvaluate);
     return RunNodeList(nodesToEvaluate);
 }
@@ -896,6 +934,41 @@ void EvaluationContext::SetTargetDirty(size_t target, DirtyFlag dirtyFlag, bool
     }
 }
 
+void EvaluationContext::SetTargetsDirty(const std::vector<size_t>& targets, DirtyFlag dirtyFlag)
+{
+    if (targets.empty())
+        return;
+    mDirtyFlags.resize(mEvaluationStages.GetStagesCount(), 0);
+    std::vector<bool> isTarget(mDirtyFlags.size(), false);
+    for (auto target : targets)
+    {
+        mDirtyFlags[target] = dirtyFlag;
+        isTarget[target] = true;
+    }
+    // children of any target come after the first target in evaluation order
+    const auto& evaluationOrderList = mEvaluationStages.GetForwardEvaluationOrder();
+    size_t i = 0;
+    while (i < evaluationOrderList.size() &&
+           (evaluationOrderList[i] >= isTarget.size() || !isTarget[evaluationOrderList[i]]))
+        i++;
+    for (i++; i < evaluationOrderList.size(); i++)
+    {
+        size_t currentNodeIndex = evaluationOrderList[i];
+        if (currentNodeIndex >= mDirtyFlags.size() || mDirtyFlags[currentNodeIndex])
+            continue;
+
+        auto& currentEvaluation = mEvaluationStages.GetEvaluationStage(currentNodeIndex);
+        for (auto inp : currentEvaluation.mInput.mInputs)
+        {
+            if (inp >= 0 && mDirtyFlags[inp])
+            {
+                mDirtyFlags[currentNodeIndex] = Dirty::Input;
+                break;
+            }
+        }
+    }
+}
+
 void EvaluationContext::UserAddStage()
 {
     URAdd<std::shared_ptr<RenderTarget>> undoRedoAddRenderTarget(int(mStageTarget.size()),
@@ -903,24 +976,37 @@ void EvaluationContext::UserAddStage()
     URAdd<DirtyFlag> undoRedoAddDirty(int(mDirtyFlags.size()), [&]() { return &mDirtyFlags; });
     URAdd<int> undoRedoAddProcessing(int(mbProcessing.size()), [&]() { return &mbProcessing; });
     URAdd<float> undoRedoAddProgress(int(mProgress.size()), [&]() { return &mProgress; });
+    URAdd<unsigned int> undoRedoAddGeneration(int(mGeneration.size()), [&]() { return &mGeneration; });
 
     mStageTarget.push_back(std::make_shared<RenderTarget>());
     mDirtyFlags.push_back(Dirty::All);
     mbProcessing.push_back(0);
     mProgress.push_back(0.f);
+    mGeneration.push_back(0);
+    ReserveJobGenerations(mGeneration.size());
+    InvalidateJobGenerations(mGeneration.size() - 1);
 }
 
 void EvaluationContext::UserDeleteStage(size_t index)
 {
     URDel<std::shared_ptr<RenderTarget>> undoRedoDelRenderTarget(int(index), [&]() { return &mStageTarget; });
-    URDel<DirtyFlag> undoRedoDelDirty(int(index), [&]() { return &mDirtyFlags; });
+    // restored stages load their scenes and decoders again
+    URDel<DirtyFlag> undoRedoDelDirty(
+        int(index), [&]() { return &mDirtyFlags; }, [](int) {}, [&](int index) { mDirtyFlags[index] = Dirty::All; });
     URDel<int> undoRedoDelProcessing(int(index), [&]() { return &mbProcessing; });
     URDel<float> undoRedoDelProgress(int(index), [&]() { return &mProgress; });
+    URDel<unsigned int> undoRedoDelGeneration(
+        int(index),
+        [&]() { return &mGeneration; },
+        [&](int index) { InvalidateJobGenerations(index); },
+        [&](int index) { InvalidateJobGenerations(index); });
 
     mStageTarget.erase(mStageTarget.begin() + index);
     mDirtyFlags.erase(mDirtyFlags.begin() + index);
     mbProcessing.erase(mbProcessing.begin() + index);
     mProgress.erase(mProgress.begin() + index);
+    mGeneration.erase(mGeneration.begin() + index);
+    InvalidateJobGenerations(index);
 }
 
 void EvaluationContext::AllocateComputeBuffer(int target, int elementCount, int elementSize)
@@ -971,9 +1057,33 @@ void EvaluationContext::StageSetProgress(size_t target, float progress)
     mProgress[target] = progress;
 }
 
+void EvaluationContext::StageBumpGeneration(size_t target)
+{
+    static std::atomic<unsigned int> generation(0);
+    mGeneration.resize(mEvaluationStages.GetStagesCount(), 0);
+    if (target >= mGeneration.size())
+    {
+        return;
+    }
+    mGeneration[target] = ++generation;
+}
+
+unsigned int EvaluationContext::StageNewJobGeneration(size_t target)
+{
+    // unique across stages: a job of a deleted stage doesn't match the stage taking its index
+    static std::atomic<unsigned int> generation(0);
+    if (target >= mJobGenerationCount)
+    {
+        return 0;
+    }
+    unsigned int jobGeneration = ++generation;
+    mJobGeneration[target] = jobGeneration;
+    return jobGeneration;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-Builder::Builder() : mbRunning(true)
+Builder::Builder() : mbRunning(true), mAddedCount(0), mBuiltCount(0)
 {
 #ifndef __EMSCRIPTEN__
     mThread = std::thread([&]() { BuildEntries(); });
@@ -982,15 +1092,28 @@ Builder::Builder() : mbRunning(true)
 
 Builder::~Builder()
 {
-    mbRunning = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mbRunning = false;
+        mBuiltCondition.notify_all();
+    }
     mThread.join();
 }
 
-void Builder::Add(const char* graphName, const EvaluationStages& stages)
+uint64_t Builder::Add(const char* graphName, const EvaluationStages& stages)
 {
-    mMutex.lock();
+    std::lock_guard<std::mutex> lock(mMutex);
     mEntries.push_back({graphName, 0.f, stages});
-    mMutex.unlock();
+    return ++mAddedCount;
+}
+
+void Builder::WaitBuilt(uint64_t id)
+{
+    // nothing is built without the builder thread
+    if (!mThread.joinable())
+        return;
+    std::unique_lock<std::mutex> lock(mMutex);
+    mBuiltCondition.wait(lock, [&]() { return mBuiltCount >= id || !mbRunning; });
 }
 
 EvaluationStages BuildEvaluationFromMaterial(Material& material)
@@ -1020,16 +1143,17 @@ EvaluationStages BuildEvaluationFromMaterial(Material& material)
     return evaluationStages;
 }
 
-void Builder::Add(Material* material)
+uint64_t Builder::Add(Material* material)
 {
     try
     {
-        Add(material->mName.c_str(), BuildEvaluationFromMaterial(*material));
+        return Add(material->mName.c_str(), BuildEvaluationFromMaterial(*material));
     }
     catch (std::exception e)
     {
         Log("Exception : %s\n", e.what());
     }
+    return 0;
 }
 
 bool Builder::UpdateBuildInfo(std::vector<BuildInfo>& buildInfo)
@@ -1080,12 +1204,23 @@ void Builder::DoBuild(Entry& entry)
                 writeContext.RunSingle(i, evaluationInfo);
             }
         }
-        entry.mProgress = float(i + 1) / float(stageCount);
+        SetProgress(entry, float(i + 1) / float(stageCount));
+        // node jobs of the edited graph go first, the build resumes once they are done
+        while (mbRunning && EvaluationAPI::GetPendingJobCount())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
         if (!mbRunning)
             break;
     }
 }
 
+void Builder::SetProgress(Entry& entry, float progress)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    entry.mProgress = progress;
+}
+
 void MakeThreadContext();
 void Builder::BuildEntries()
 {
@@ -1093,20 +1228,26 @@ void Builder::BuildEntries()
 
     while (mbRunning)
     {
-        if (mMutex.try_lock())
+        // the lock is only held to pick and remove entries, adding graphs doesn't wait for the current build
+        Entry* entry = nullptr;
         {
+            std::lock_guard<std::mutex> lock(mMutex);
             if (!mEntries.empty())
             {
-                auto& entry = *mEntries.begin();
-                entry.mProgress = 0.01f;
-                DoBuild(entry);
-                entry.mProgress = 1.f;
-                if (entry.mProgress >= 1.f)
-                {
-                    mEntries.erase(mEntries.begin());
-                }
+                entry = &mEntries.front();
+                entry->mProgress = 0.01f;
             }
-            mMutex.unlock();
+        }
+        if (entry)
+        {
+            DoBuild(*entry);
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mEntries.pop_front();
+                mBuiltCount++;
+            }
+            mBuiltCondition.notify_all();
+            continue;
         }
 #ifdef Sleep
         Sleep(100);
@@ -27,6 +27,8 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <list>
+#include <condition_variable>
 #include "EvaluationStages.h"
 
 struct EvaluationInfo
@@ -116,6 +118,8 @@ struct EvaluationContext
         mbSynchronousEvaluation = synchronous;
     }
     void SetTargetDirty(size_t target, DirtyFlag dirtyflag, bool onlyChild = false);
+    // same as SetTargetDirty for each target with a single propagation to the children
+    void SetTargetsDirty(const std::vector<size_t>& targets, DirtyFlag dirtyflag);
     int StageIsProcessing(size_t target) const
     {
         if (target >= mbProcessing.size())
@@ -130,6 +134,25 @@ struct EvaluationContext
     }
     void StageSetProcessing(size_t target, int processing);
     void StageSetProgress(size_t target, float progress);
+    // content generation of the stage target. unique across contexts, changes each time the target is rendered or
+    // receives an image
+    unsigned int StageGetGeneration(size_t target) const
+    {
+        if (target >= mGeneration.size())
+            return 0;
+        return mGeneration[target];
+    }
+    void StageBumpGeneration(size_t target);
+    // asynchronous jobs of a stage keep the generation returned when they are started. Starting a new job supersedes
+    // the ones in flight: they can stop early and their results are dropped
+    unsigned int StageNewJobGeneration(size_t target);
+    // called from the job threads. Stages without a generation slot yet are never superseded
+    bool StageIsJobCurrent(size_t target, unsigned int jobGeneration) const
+    {
+        if (target >= mJobGenerationCount)
+            return true;
+        return mJobGeneration[target] == jobGeneration;
+    }
 
     void AllocRenderTargetsForEditingPreview();
 
@@ -164,6 +187,8 @@ struct EvaluationContext
 
 protected:
     void PreRun();
+    void ReserveJobGenerations(size_t count);
+    void InvalidateJobGenerations(size_t first);
     void EvaluateGLSL(const EvaluationStage& evaluationStage, size_t index, EvaluationInfo& evaluationInfo);
     void EvaluateC(const EvaluationStage& evaluationStage, size_t index, EvaluationInfo& evaluationInfo);
     void EvaluatePython(const EvaluationStage& evaluationStage, size_t index, EvaluationInfo& evaluationInfo);
@@ -172,7 +197,7 @@ protected:
     bool RunNodeList(const std::vector<size_t>& nodesToEvaluate);
     void RunNode(size_t nodeIndex);
 
-    void RecurseBackward(size_t target, std::vector<size_t>& usedNodes);
+    void RecurseBackward(size_t target, std::vector<size_t>& usedNodes, std::vector<bool>& visited);
 
     void BindTextures(const EvaluationStage& evaluationStage,
                       unsigned int program,
@@ -192,6 +217,10 @@ protected:
     std::vector<int> mbProcessing;
     std::vector<float> mProgress;
     std::vector<bool> mActive;
+    std::vector<unsigned int> mGeneration;
+    // read by the job threads without lock: the array is only replaced when no job is pending
+    std::unique_ptr<std::atomic<unsigned int>[]> mJobGeneration;
+    size_t mJobGenerationCount;
     EvaluationInfo mEvaluationInfo;
 
     std::vector<int> mStillDirty;
@@ -209,8 +238,14 @@ struct Builder
     Builder();
     ~Builder();
 
-    void Add(const char* graphName, const EvaluationStages& stages);
-    void Add(Material* material);
+    // entries are built in order on the builder thread. Return the entry id, 0 if it couldn't be added
+    uint64_t Add(const char* graphName, const EvaluationStages& stages);
+    uint64_t Add(Material* material);
+    bool IsBuilt(uint64_t id) const
+    {
+        return mBuiltCount >= id;
+    }
+    void WaitBuilt(uint64_t id);
     struct BuildInfo
     {
         std::string mName;
@@ -225,6 +260,9 @@ private:
     std::thread mThread;
 
     std::atomic_bool mbRunning;
+    std::condition_variable mBuiltCondition;
+    uint64_t mAddedCount;
+    std::atomic<uint64_t> mBuiltCount;
 
     struct Entry
     {
@@ -232,9 +270,11 @@ private:
         float mProgress;
         EvaluationStages mEvaluationStages;
     };
-    std::vector<Entry> mEntries;
+    // the entry being built stays at the front, references are kept valid while entries are added
+    std::list<Entry> mEntries;
     void BuildEntries();
     void DoBuild(Entry& entry);
+    void SetProgress(Entry& entry, float progress);
 };
 
 namespace DrawUICallbacks
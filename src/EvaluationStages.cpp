@@ -36,6 +36,39 @@ EvaluationStages::EvaluationStages() : mFrameMin(0), mFrameMax(1)
 {
 }
 
+// full screen triangle drawn by the stages without a scene
+static std::shared_ptr<Scene> GetDefaultScene()
+{
+    static std::shared_ptr<Scene> defaultScene;
+    if (!defaultScene)
+    {
+        defaultScene = std::make_shared<Scene>();
+        defaultScene->mMeshes.resize(1);
+        auto& mesh = defaultScene->mMeshes.back();
+        mesh.mPrimitives.resize(1);
+        auto& prim = mesh.mPrimitives.back();
+        static const float fsVts[] = {0.f, 0.f, 2.f, 0.f, 0.f, 2.f};
+        prim.AddBuffer(fsVts, Scene::Mesh::Format::UV, 2 * sizeof(float), 3);
+        // add node and transform
+        defaultScene->mWorldTransforms.resize(1);
+        defaultScene->mWorldTransforms[0].Identity();
+        defaultScene->mMeshIndex.resize(1, 0);
+        defaultScene->Upload();
+    }
+    return defaultScene;
+}
+
+void ReleaseUndoResources(EvaluationStage& stage)
+{
+#if USE_FFMPEG
+    stage.mDecoder = NULL;
+#endif
+    // the renderer points to the path tracer scene
+    stage.renderer = nullptr;
+    stage.mScene = nullptr;
+    stage.mGScene = GetDefaultScene();
+}
+
 void EvaluationStages::AddSingleEvaluation(size_t nodeType)
 {
     EvaluationStage evaluation;
@@ -54,23 +87,8 @@ void EvaluationStages::AddSingleEvaluation(size_t nodeType)
     evaluation.mbDepthBuffer = false;
     evaluation.mbClearBuffer = false;
     evaluation.mVertexSpace = 0;
-    static std::shared_ptr<Scene> defaultScene;
-    if (!defaultScene)
-    {
-        defaultScene = std::make_shared<Scene>();
-        defaultScene->mMeshes.resize(1);
-        auto& mesh = defaultScene->mMeshes.back();
-        mesh.mPrimitives.resize(1);
-        auto& prim = mesh.mPrimitives.back();
-        static const float fsVts[] = {0.f, 0.f, 2.f, 0.f, 0.f, 2.f};
-        prim.AddBuffer(fsVts, Scene::Mesh::Format::UV, 2 * sizeof(float), 3);
-        // add node and transform
-        defaultScene->mWorldTransforms.resize(1);
-        defaultScene->mWorldTransforms[0].Identity();
-        defaultScene->mMeshIndex.resize(1, 0);
-    }
     evaluation.mScene = nullptr;
-    evaluation.mGScene = defaultScene;
+    evaluation.mGScene = GetDefaultScene();
     evaluation.renderer = nullptr;
     evaluation.mRuntimeUniqueId = GetRuntimeId();
     const size_t inputCount = gMetaNodes[nodeType].mInputs.size();
@@ -504,103 +522,188 @@ void EvaluationStages::SetIOPin(size_t nodeIndex, size_t io, bool forOutput, boo
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
-void Scene::Mesh::Primitive::Draw() const
+void Scene::Mesh::Primitive::Draw(unsigned int instanceCount) const
+{
+    if (!mVAO)
+        return;
+
+    glBindVertexArray(mVAO);
+    if (!mIndexBuffer.id)
+    {
+        glDrawArraysInstanced(GL_TRIANGLES, 0, mBuffers[0].count, instanceCount);
+    }
+    else
+    {
+        glDrawElementsInstanced(GL_TRIANGLES,
+                                mIndexBuffer.count,
+                                (mIndexBuffer.stride == 4) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+                                (void*)0,
+                                instanceCount);
+    }
+    glBindVertexArray(0);
+}
+void Scene::Mesh::Primitive::AddBuffer(const void* data, unsigned int format, unsigned int stride, unsigned int count)
+{
+    unsigned int va;
+    glGenBuffers(1, &va);
+    glBindBuffer(GL_ARRAY_BUFFER, va);
+    glBufferData(GL_ARRAY_BUFFER, stride * count, data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mBuffers.push_back({va, format, stride, count});
+}
+
+void Scene::Mesh::Primitive::AddIndexBuffer(const void* data, unsigned int stride, unsigned int count)
+{
+    unsigned int ia;
+    glGenBuffers(1, &ia);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ia);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, stride * count, data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    mIndexBuffer = {ia, stride, count};
+}
+void Scene::Mesh::Primitive::Upload(unsigned int instanceBuffer, unsigned int firstInstance)
 {
-    unsigned int vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    if (mBuffers.empty())
+    {
+        for (auto& stream : mStreams)
+        {
+            AddBuffer(stream.mData.data(), stream.mFormat, stream.mComponentCount * sizeof(float), mVertexCount);
+        }
+        if (!mIndices.empty())
+        {
+            AddIndexBuffer(mIndices.data(), sizeof(uint32_t), (unsigned int)mIndices.size());
+        }
+    }
+    if (mBuffers.empty() || mVAO)
+        return;
 
+    glGenVertexArrays(1, &mVAO);
+    glBindVertexArray(mVAO);
     for (auto& buffer : mBuffers)
     {
         glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
         switch (buffer.format)
         {
             case Format::UV:
-                glVertexAttribPointer(SemUV0, 2, GL_FLOAT, GL_FALSE, 8, 0);
+                glVertexAttribPointer(SemUV0, 2, GL_FLOAT, GL_FALSE, buffer.stride, 0);
                 glEnableVertexAttribArray(SemUV0);
                 break;
             case Format::COL:
-                glVertexAttribPointer(SemUV0 + 1, 4, GL_FLOAT, GL_FALSE, 16, 0);
+                glVertexAttribPointer(SemUV0 + 1, 4, GL_FLOAT, GL_FALSE, buffer.stride, 0);
                 glEnableVertexAttribArray(SemUV0 + 1);
                 break;
             case Format::POS:
-                glVertexAttribPointer(SemUV0 + 2, 3, GL_FLOAT, GL_FALSE, 12, 0);
+                glVertexAttribPointer(SemUV0 + 2, 3, GL_FLOAT, GL_FALSE, buffer.stride, 0);
                 glEnableVertexAttribArray(SemUV0 + 2);
                 break;
             case Format::NORM:
-                glVertexAttribPointer(SemUV0 + 3, 3, GL_FLOAT, GL_FALSE, 12, 0);
+                glVertexAttribPointer(SemUV0 + 3, 3, GL_FLOAT, GL_FALSE, buffer.stride, 0);
                 glEnableVertexAttribArray(SemUV0 + 3);
                 break;
         }
     }
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-
-    glBindVertexArray(vao);
 
-    if (!mIndexBuffer.id)
+    // the mesh instances range is fixed, the VAO points straight at it
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (int column = 0; column < 4; column++)
     {
-        glDrawArrays(GL_TRIANGLES, 0, mBuffers[0].count);
+        size_t offset = firstInstance * sizeof(Mat4x4) + column * 4 * sizeof(float);
+        glVertexAttribPointer(SemInstanceTransform + column, 4, GL_FLOAT, GL_FALSE, sizeof(Mat4x4), (void*)offset);
+        glEnableVertexAttribArray(SemInstanceTransform + column);
+        glVertexAttribDivisor(SemInstanceTransform + column, 1);
     }
-    else
+    if (mIndexBuffer.id)
     {
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexBuffer.id);
-        glDrawElements(GL_TRIANGLES,
-                       mIndexBuffer.count,
-                       (mIndexBuffer.stride == 4) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
-                       (void*)0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    glDeleteVertexArrays(1, &vao);
-}
-void Scene::Mesh::Primitive::AddBuffer(const void* data, unsigned int format, unsigned int stride, unsigned int count)
-{
-    unsigned int va;
-    glGenBuffers(1, &va);
-    glBindBuffer(GL_ARRAY_BUFFER, va);
-    glBufferData(GL_ARRAY_BUFFER, stride * count, data, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    mBuffers.push_back({va, format, stride, count});
 }
 
-void Scene::Mesh::Primitive::AddIndexBuffer(const void* data, unsigned int stride, unsigned int count)
-{
-    unsigned int ia;
-    glGenBuffers(1, &ia);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ia);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, stride * count, data, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    mIndexBuffer = {ia, stride, count};
-}
 void Scene::Mesh::Draw() const
 {
     for (auto& prim : mPrimitives)
     {
-        prim.Draw();
+        prim.Draw(mInstanceCount);
     }
 }
-void Scene::Draw(EvaluationContext *context, EvaluationInfo& evaluationInfo) const
+
+void Scene::Draw() const
 {
-    for (unsigned int i = 0; i < mMeshIndex.size(); i++)
+    for (auto& mesh : mMeshes)
+    {
+        if (mesh.mInstanceCount)
+        {
+            mesh.Draw();
+        }
+    }
+}
+
+void Scene::Upload()
+{
+    if (mbUploaded)
+        return;
+
+    // node transforms sorted by mesh
+    std::vector<unsigned int> firstInstance(mMeshes.size() + 1, 0);
+    for (int index : mMeshIndex)
+    {
+        if (index != -1)
+            firstInstance[index + 1]++;
+    }
+    for (size_t i = 0; i < mMeshes.size(); i++)
+    {
+        firstInstance[i + 1] += firstInstance[i];
+        mMeshes[i].mFirstInstance = firstInstance[i];
+        mMeshes[i].mInstanceCount = 0;
+    }
+    std::vector<Mat4x4> instances(firstInstance[mMeshes.size()]);
+    for (size_t i = 0; i < mMeshIndex.size(); i++)
     {
         int index = mMeshIndex[i];
         if (index == -1)
             continue;
-        glBindBuffer(GL_UNIFORM_BUFFER, context->mEvaluationStateGLSLBuffer);
-        memcpy(evaluationInfo.model, mWorldTransforms[i], sizeof(Mat4x4));
-        FPU_MatrixF_x_MatrixF(evaluationInfo.model, evaluationInfo.viewProjection, evaluationInfo.modelViewProjection);
-        glBufferData(GL_UNIFORM_BUFFER, sizeof(EvaluationInfo), &evaluationInfo, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
-        mMeshes[index].Draw();
+        auto& mesh = mMeshes[index];
+        instances[mesh.mFirstInstance + mesh.mInstanceCount++] = mWorldTransforms[i];
     }
+
+    glGenBuffers(1, &mInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Mat4x4), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for (auto& mesh : mMeshes)
+    {
+        for (auto& prim : mesh.mPrimitives)
+        {
+            prim.Upload(mInstanceBuffer, mesh.mFirstInstance);
+        }
+    }
+    mbUploaded = true;
 }
 
 Scene::~Scene()
 {
-    // todo : clear ia/va
+    if (!mbUploaded)
+        return;
+    for (auto& mesh : mMeshes)
+    {
+        for (auto& prim : mesh.mPrimitives)
+        {
+            for (auto& buffer : prim.mBuffers)
+            {
+                glDeleteBuffers(1, &buffer.id);
+            }
+            if (prim.mIndexBuffer.id)
+            {
+                glDeleteBuffers(1, &prim.mIndexBuffer.id);
+            }
+            if (prim.mVAO)
+            {
+                glDeleteVertexArrays(1, &prim.mVAO);
+            }
+        }
+    }
+    glDeleteBuffers(1, &mInstanceBuffer);
 }
\ No newline at end of file
@@ -39,6 +39,10 @@ struct ImDrawList;
 struct ImDrawCmd;
 struct EvaluationContext;
 struct EvaluationInfo;
+namespace GLSLPathTracer
+{
+    class Scene;
+}
 
 enum BlendOp
 {
@@ -104,22 +108,44 @@ struct Scene
             unsigned int stride;
             unsigned int count;
         };
+        // float vertex attribute decoded on CPU
+        struct Stream
+        {
+            unsigned int mFormat;
+            unsigned int mComponentCount;
+            std::vector<float> mData;
+        };
         struct Primitive
         {
             std::vector<Buffer> mBuffers;
             IndexBuffer mIndexBuffer = {0, 0, 0};
+            // vertex streams, index buffer and instance transforms bindings, created once by Upload
+            unsigned int mVAO = 0;
+            // geometry filled by the loaders on any thread, turned into GL buffers by Upload
+            std::vector<Stream> mStreams;
+            std::vector<uint32_t> mIndices;
+            unsigned int mVertexCount = 0;
             void AddBuffer(const void* data, unsigned int format, unsigned int stride, unsigned int count);
             void AddIndexBuffer(const void* data, unsigned int stride, unsigned int count);
-            void Draw() const;
+            void Upload(unsigned int instanceBuffer, unsigned int firstInstance);
+            void Draw(unsigned int instanceCount) const;
         };
         std::vector<Primitive> mPrimitives;
+        // range of the nodes using this mesh in the scene instance buffer
+        unsigned int mFirstInstance = 0;
+        unsigned int mInstanceCount = 0;
         void Draw() const;
     };
     std::vector<Mesh> mMeshes;
     std::vector<Mat4x4> mWorldTransforms;
     std::vector<int> mMeshIndex;
     std::string mName;
-    void Draw(EvaluationContext* context, EvaluationInfo& evaluationInfo) const;
+    // node world transforms grouped by mesh, each mesh is drawn once with instancing
+    unsigned int mInstanceBuffer = 0;
+    bool mbUploaded = false;
+    // main thread only. Loaders only decode on CPU so they can run in jobs.
+    void Upload();
+    void Draw() const;
 };
 
 struct EvaluationStage
@@ -156,7 +182,7 @@ struct EvaluationStage
     uint8_t mbShift : 1;
 
     // scene render
-    void* mScene; // for path tracer
+    std::shared_ptr<GLSLPathTracer::Scene> mScene; // for path tracer, owned with the RTSceneCache
     std::shared_ptr<Scene> mGScene;
     void* renderer;
     Image DecodeImage();
@@ -188,6 +214,17 @@ struct EvaluationStage
     }
 };
 
+// stages in the undo history drop their decoder, scenes and renderer. They are created again when the stage is
+// evaluated after an undo
+void ReleaseUndoResources(EvaluationStage& stage);
+
+// only the stage own memory is counted, see ReleaseUndoResources
+inline size_t GetUndoMemorySize(const EvaluationStage& stage)
+{
+    return sizeof(EvaluationStage) + stage.mParameters.capacity() +
+           stage.mInputSamplers.capacity() * sizeof(InputSampler);
+}
+
 // simple API
 struct EvaluationStages
 {
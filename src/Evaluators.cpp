@@ -26,6 +26,10 @@
 #include "Evaluators.h"
 #include "EvaluationStages.h"
 #include "Bitmap.h"
+#include "ImageOps.h"
+#include "CubemapFilter.h"
+#include "GLTFLoader.h"
+#include "RTSceneCache.h"
 #include "EvaluationContext.h"
 #include <vector>
 #include <map>
@@ -34,12 +38,13 @@
 #include "Loader.h"
 #include "TiledRenderer.h"
 #include "ProgressiveRenderer.h"
+#include "CPURenderer.h"
 #include "GPUBVH.h"
 #include "Camera.h"
 #include <fstream>
-#define CGLTF_IMPLEMENTATION
-#include "cgltf.h"
+#include <functional>
 #include "NodeGraphControler.h"
+#include "UploadQueue.h"
 
 Evaluators gEvaluators;
 
@@ -55,7 +60,9 @@ static const EValuationFunction evaluationFunctions[] = {
     {"Log", (void*)Log},
     {"log2", (void*)static_cast<float (*)(float)>(log2)},
     {"ReadImage", (void*)EvaluationAPI::Read},
+    {"ReadImageEx", (void*)EvaluationAPI::ReadEx},
     {"WriteImage", (void*)EvaluationAPI::Write},
+    {"WriteImageEx", (void*)EvaluationAPI::WriteEx},
     {"GetEvaluationImage", (void*)EvaluationAPI::GetEvaluationImage},
     {"SetEvaluationImage", (void*)EvaluationAPI::SetEvaluationImage},
     {"SetEvaluationImageCube", (void*)EvaluationAPI::SetEvaluationImageCube},
@@ -75,6 +82,11 @@ static const EValuationFunction evaluationFunctions[] = {
     {"SetProcessing", (void*)EvaluationAPI::SetProcessing},
     {"Job", (void*)EvaluationAPI::Job},
     {"JobMain", (void*)EvaluationAPI::JobMain},
+    {"NewJobGeneration", (void*)EvaluationAPI::NewJobGeneration},
+    {"IsJobCurrent", (void*)EvaluationAPI::IsJobCurrent},
+    {"ParallelFor", (void*)EvaluationAPI::ParallelFor},
+    {"ParallelForAsync", (void*)EvaluationAPI::ParallelForAsync},
+    {"ParallelForWait", (void*)EvaluationAPI::ParallelForWait},
     {"memmove", (void*)memmove},
     {"strcpy", (void*)strcpy},
     {"strlen", (void*)strlen},
@@ -91,7 +103,17 @@ static const EValuationFunction evaluationFunctions[] = {
     {"OverrideInput", (void*)EvaluationAPI::OverrideInput},
     {"InitRenderer", (void*)EvaluationAPI::InitRenderer},
     {"UpdateRenderer", (void*)EvaluationAPI::UpdateRenderer},
+    {"SetRendererDenoise", (void*)EvaluationAPI::SetRendererDenoise},
     {"ReadGLTF", (void*)EvaluationAPI::ReadGLTF},
+    {"FreeScene", (void*)EvaluationAPI::FreeScene},
+    {"ResizeImage", (void*)ImageOps::Resize},
+    {"ConvertImage", (void*)ImageOps::Convert},
+    {"FlipImage", (void*)ImageOps::VFlip},
+    {"PremultiplyImage", (void*)ImageOps::Premultiply},
+    {"UnpremultiplyImage", (void*)ImageOps::Unpremultiply},
+    {"GenerateImageMips", (void*)ImageOps::GenerateMips},
+    {"CubemapFilter", (void*)CubemapFilter::Radiance},
+    {"CubemapIrradiance", (void*)CubemapFilter::Irradiance},
 };
 
 static void libtccErrorFunc(void* opaque, const char* msg)
@@ -105,6 +127,11 @@ void LogPython(const std::string& str)
     Log(str.c_str());
 }
 
+static size_t GetImageFaceSize(const Image& image)
+{
+    return ImageOps::GetImageSize(image.mWidth, image.mHeight, image.mFormat, image.mNumMips, 1);
+}
+
 #if USE_PYTHON
 PYBIND11_MAKE_OPAQUE(Image);
 
@@ -124,21 +151,333 @@ extern std::vector<ImHotKey::HotKey> mHotkeys;
 
 
 void RenderImogenFrame();
-void NodeGraphLayout();
+void NodeGraphLayout(bool selectionOnly);
 void NodeGraphUpdateScrolling();
 void NodeGraphUpdateEvaluationOrder(NodeGraphControlerBase* delegate);
 
 
+// NumPy element of each format. 8 bits encodings (RGBE, RGBM) are exposed as raw bytes
+static bool GetImageElement(int format, size_t& elementSize, std::string& elementFormat)
+{
+    switch (format)
+    {
+        case TextureFormat::BGR8:
+        case TextureFormat::RGB8:
+        case TextureFormat::RGBE:
+        case TextureFormat::BGRA8:
+        case TextureFormat::RGBA8:
+        case TextureFormat::RGBM:
+            elementSize = 1;
+            elementFormat = "B";
+            return true;
+        case TextureFormat::RGB16:
+        case TextureFormat::RGBA16:
+            elementSize = 2;
+            elementFormat = "H";
+            return true;
+        case TextureFormat::RGB16F:
+        case TextureFormat::RGBA16F:
+            elementSize = 2;
+            elementFormat = "e";
+            return true;
+        case TextureFormat::RGB32F:
+        case TextureFormat::RGBA32F:
+            elementSize = 4;
+            elementFormat = "f";
+            return true;
+    }
+    return false;
+}
+
+// Image layout matching a (height, width, channels) or (faces, height, width, channels) C contiguous buffer.
+// The format comes from the element type and the channel count.
+static Image GetBufferLayout(const pybind11::buffer_info& info)
+{
+    if (info.ndim != 3 && info.ndim != 4)
+        throw pybind11::value_error("Image buffer must be (height, width, channels) or (6, size, size, channels)");
+    const int faces = info.ndim == 4 ? int(info.shape[0]) : 1;
+    const pybind11::ssize_t height = info.shape[info.ndim - 3];
+    const pybind11::ssize_t width = info.shape[info.ndim - 2];
+    const pybind11::ssize_t channels = info.shape[info.ndim - 1];
+    if (channels != 3 && channels != 4)
+        throw pybind11::value_error("Image buffer must have 3 or 4 channels");
+    if (faces != 1 && (faces != 6 || width != height))
+        throw pybind11::value_error("Image buffer must have 1 face or 6 square cube faces");
+
+    const char kind = info.format.empty() ? 0 : info.format.back();
+    int format = TextureFormat::Null;
+    if (info.itemsize == 1 && kind == 'B')
+        format = channels == 3 ? TextureFormat::RGB8 : TextureFormat::RGBA8;
+    else if (info.itemsize == 2 && kind == 'H')
+        format = channels == 3 ? TextureFormat::RGB16 : TextureFormat::RGBA16;
+    else if (info.itemsize == 2 && kind == 'e')
+        format = channels == 3 ? TextureFormat::RGB16F : TextureFormat::RGBA16F;
+    else if (info.itemsize == 4 && kind == 'f')
+        format = channels == 3 ? TextureFormat::RGB32F : TextureFormat::RGBA32F;
+    if (format == TextureFormat::Null)
+        throw pybind11::value_error("Image buffer elements must be uint8, uint16, float16 or float32");
+
+    pybind11::ssize_t stride = info.itemsize;
+    for (int i = int(info.ndim) - 1; i >= 0; i--)
+    {
+        if (info.strides[i] != stride)
+            throw pybind11::value_error("Image buffer must be C contiguous");
+        stride *= info.shape[i];
+    }
+
+    Image image;
+    image.mWidth = int(width);
+    image.mHeight = int(height);
+    image.mNumFaces = uint8_t(faces);
+    image.mNumMips = 1;
+    image.mFormat = uint8_t(format);
+    return image;
+}
+
+// Typed Python value written as laid out in the parameter block: numbers for scalars, sequences for vectors,
+// sequences of points for ramps ((x, y) or (r, g, b, position)) and str for filenames
+static void PythonToParameter(pybind11::handle value, ConTypes type, unsigned char* parameter)
+{
+    float* pf = (float*)parameter;
+    int* pi = (int*)parameter;
+    size_t count = 1;
+    switch (type)
+    {
+        case Con_Float:
+        case Con_Angle:
+            pf[0] = value.cast<float>();
+            return;
+        case Con_Int:
+        case Con_Enum:
+            pi[0] = value.cast<int>();
+            return;
+        case Con_Bool:
+            pi[0] = pybind11::bool_(pybind11::reinterpret_borrow<pybind11::object>(value)) ? 1 : 0;
+            return;
+        case Con_FilenameRead:
+        case Con_FilenameWrite:
+        {
+            std::string filename = value.cast<std::string>();
+            size_t length = std::min(filename.size(), GetParameterTypeSize(type) - 1);
+            memset(parameter, 0, GetParameterTypeSize(type));
+            memcpy(parameter, filename.c_str(), length);
+            return;
+        }
+        case Con_Float2:
+        case Con_Angle2:
+        case Con_Int2:
+            count = 2;
+            break;
+        case Con_Float3:
+        case Con_Angle3:
+            count = 3;
+            break;
+        case Con_Float4:
+        case Con_Angle4:
+        case Con_Color4:
+            count = 4;
+            break;
+        case Con_Ramp:
+        case Con_Ramp4:
+        {
+            const size_t pointSize = (type == Con_Ramp) ? 2 : 4;
+            auto points = value.cast<pybind11::sequence>();
+            if (points.size() < 2 || points.size() > 8)
+                throw pybind11::value_error("Ramps have 2 to 8 points");
+            for (size_t i = 0; i < 8; i++)
+            {
+                float* point = pf + i * pointSize;
+                if (i >= points.size())
+                {
+                    // unused points are out of the [0, 1] range
+                    memset(point, 0, pointSize * sizeof(float));
+                    point[(type == Con_Ramp) ? 0 : 3] = -1.f;
+                    continue;
+                }
+                auto components = points[i].cast<pybind11::sequence>();
+                if (components.size() != pointSize)
+                    throw pybind11::value_error("Ramp points must have 2 components, 4 for color ramps");
+                for (size_t j = 0; j < pointSize; j++)
+                    point[j] = components[j].cast<float>();
+            }
+            return;
+        }
+        default:
+            throw pybind11::value_error("Parameter type can't be set from Python");
+    }
+    auto components = value.cast<pybind11::sequence>();
+    if (components.size() != count)
+        throw pybind11::value_error("Wrong number of components");
+    for (size_t i = 0; i < count; i++)
+    {
+        if (type == Con_Int2)
+            pi[i] = components[i].cast<int>();
+        else
+            pf[i] = components[i].cast<float>();
+    }
+}
+
+// Result of an asynchronous call from Python. done() polls, result() waits with the GIL released and
+// returns the call result. Futures are awaitable, asyncio coroutines can overlap them with other work.
+struct PyFuture
+{
+    virtual ~PyFuture()
+    {
+    }
+    virtual bool IsDone() = 0;
+    virtual int Wait() = 0;
+};
+
+// native call run by the task scheduler. Python objects used by the call are kept alive by the future.
+// Local to this file like the pybind11 objects it holds
+namespace
+{
+struct PyTaskFuture : PyFuture
+{
+    struct CallTaskSet : TaskSet
+    {
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            mResult = mFunction();
+        }
+        std::function<int()> mFunction;
+        int mResult;
+    };
+
+    PyTaskFuture(std::function<int()> function, pybind11::object keepAlive) : mKeepAlive(keepAlive)
+    {
+        mTask.mFunction = function;
+        mTask.mResult = EVAL_ERR;
+        g_TS.AddTaskSetToPipe(&mTask);
+    }
+    virtual ~PyTaskFuture()
+    {
+        Wait();
+    }
+    virtual bool IsDone()
+    {
+        return mTask.GetIsComplete();
+    }
+    virtual int Wait()
+    {
+        if (!mTask.GetIsComplete())
+        {
+            pybind11::gil_scoped_release release;
+            g_TS.WaitforTaskSet(&mTask);
+        }
+        return mTask.mResult;
+    }
+
+    CallTaskSet mTask;
+    pybind11::object mKeepAlive;
+};
+} // namespace
+
+// graph queued to the builder thread
+extern Builder* gBuilder;
+struct PyBuildFuture : PyFuture
+{
+    PyBuildFuture(uint64_t id) : mId(id)
+    {
+    }
+    virtual bool IsDone()
+    {
+        return !mId || gBuilder->IsBuilt(mId);
+    }
+    virtual int Wait()
+    {
+        if (!mId)
+            return EVAL_ERR;
+        pybind11::gil_scoped_release release;
+        gBuilder->WaitBuilt(mId);
+        return EVAL_OK;
+    }
+
+    uint64_t mId;
+};
+
 PYBIND11_EMBEDDED_MODULE(Imogen, m)
 {
-    pybind11::class_<Image>(m, "Image");
+    pybind11::class_<PyFuture>(m, "Future")
+        .def("done", &PyFuture::IsDone)
+        .def("result", &PyFuture::Wait)
+        .def("__await__", [](pybind11::object future) { return future; })
+        .def("__iter__", [](pybind11::object future) { return future; })
+        .def("__next__", [](PyFuture& future) -> pybind11::object {
+            // bare yields give the hand back to the asyncio loop until the call is done
+            if (!future.IsDone())
+                return pybind11::none();
+            pybind11::int_ result(future.Wait());
+            PyErr_SetObject(PyExc_StopIteration, result.ptr());
+            throw pybind11::error_already_set();
+        });
+
+    // Images expose their first mip of each face to NumPy without copy : numpy.asarray(image).
+    // Rows are in the image order, faces are strided over the mip chain.
+    pybind11::class_<Image>(m, "Image", pybind11::buffer_protocol())
+        .def(pybind11::init<>())
+        .def(pybind11::init([](int width, int height, int format, int faces, int mips) {
+                 size_t elementSize;
+                 std::string elementFormat;
+                 if (width <= 0 || height <= 0 || !GetImageElement(format, elementSize, elementFormat))
+                     throw pybind11::value_error("Invalid image size or format");
+                 if ((faces != 1 && faces != 6) || mips < 1 || (width >> (mips - 1)) < 1 || (height >> (mips - 1)) < 1)
+                     throw pybind11::value_error("Invalid image face or mip count");
+                 Image* image = new Image;
+                 image->mWidth = width;
+                 image->mHeight = height;
+                 image->mFormat = uint8_t(format);
+                 image->mNumFaces = uint8_t(faces);
+                 image->mNumMips = uint8_t(mips);
+                 image->Allocate(GetImageFaceSize(*image) * faces);
+                 return image;
+             }),
+             pybind11::arg("width"),
+             pybind11::arg("height"),
+             pybind11::arg("format") = int(TextureFormat::RGBA8),
+             pybind11::arg("faces") = 1,
+             pybind11::arg("mips") = 1)
+        // the image owns reference counted bits : the array is copied once, then handed out without copy
+        .def(pybind11::init([](pybind11::buffer buffer) {
+            pybind11::buffer_info info = buffer.request();
+            Image* image = new Image(GetBufferLayout(info));
+            image->SetBits((unsigned char*)info.ptr, GetImageFaceSize(*image) * image->mNumFaces);
+            return image;
+        }))
+        .def_readonly("width", &Image::mWidth)
+        .def_readonly("height", &Image::mHeight)
+        .def_readonly("faces", &Image::mNumFaces)
+        .def_readonly("mips", &Image::mNumMips)
+        .def_readonly("format", &Image::mFormat)
+        .def_buffer([](Image& image) -> pybind11::buffer_info {
+            // the view is writable, shared bits (cache entries, other images) get their own copy first
+            image.Detach();
+            // buffer requests can't fail : empty images and unknown formats are seen as raw bytes
+            size_t elementSize;
+            std::string elementFormat;
+            if (!image.GetBits() || !GetImageElement(image.mFormat, elementSize, elementFormat))
+                return pybind11::buffer_info(image.GetBits(), pybind11::ssize_t(image.GetBits() ? image.mDataSize : 0));
+            const pybind11::ssize_t itemSize = pybind11::ssize_t(elementSize);
+            const pybind11::ssize_t texelSize = textureFormatSize[image.mFormat];
+            std::vector<pybind11::ssize_t> shape = {image.mHeight, image.mWidth, texelSize / itemSize};
+            std::vector<pybind11::ssize_t> strides = {image.mWidth * texelSize, texelSize, itemSize};
+            if (image.mNumFaces > 1)
+            {
+                shape.insert(shape.begin(), image.mNumFaces);
+                strides.insert(strides.begin(), pybind11::ssize_t(GetImageFaceSize(image)));
+            }
+            return pybind11::buffer_info(
+                image.GetBits(), itemSize, elementFormat, pybind11::ssize_t(shape.size()), shape, strides);
+        });
 
     m.def("Render", []() { RenderImogenFrame(); });
-    m.def("CaptureScreen", [](const std::string& filename, const std::string& content) {
-        extern std::map<std::string, ImRect> interfacesRect;
-        ImRect rc = interfacesRect[content];
-        SaveCapture(filename, int(rc.Min.x), int(rc.Min.y), int(rc.GetWidth()), int(rc.GetHeight()));
-    });
+    m.def("CaptureScreen",
+          [](const std::string& filename, const std::string& content) {
+              extern std::map<std::string, ImRect> interfacesRect;
+              ImRect rc = interfacesRect[content];
+              SaveCapture(filename, int(rc.Min.x), int(rc.Min.y), int(rc.GetWidth()), int(rc.GetHeight()));
+          },
+          pybind11::call_guard<pybind11::gil_scoped_release>());
     m.def("SetSynchronousEvaluation", [](bool synchronous) {
         Imogen::instance->GetNodeGraphControler()->mEditingContext.SetSynchronous(synchronous);
     });
@@ -147,6 +486,40 @@ PYBIND11_EMBEDDED_MODULE(Imogen, m)
     m.def("SetParameter", [](int nodeIndex, const std::string& paramName, const std::string& value) {
         Imogen::instance->GetNodeGraphControler()->SetParameter(nodeIndex, paramName, value);
     });
+    // parameters is a dict of parameter names or indices to typed values
+    m.def("SetParameters", [](int nodeIndex, pybind11::dict parameters) {
+        NodeGraphControler* controler = Imogen::instance->GetNodeGraphControler();
+        if (nodeIndex < 0 || nodeIndex >= int(controler->mEvaluationStages.mStages.size()))
+            throw pybind11::index_error("Invalid node index");
+        const uint32_t nodeType = uint32_t(controler->mEvaluationStages.mStages[nodeIndex].mType);
+        const MetaNode& metaNode = gMetaNodes[nodeType];
+        unsigned char value[1024];
+        controler->BeginParameterBatch();
+        try
+        {
+            for (auto parameter : parameters)
+            {
+                int parameterIndex = pybind11::isinstance<pybind11::str>(parameter.first)
+                                         ? GetParameterIndex(nodeType, parameter.first.cast<std::string>().c_str())
+                                         : parameter.first.cast<int>();
+                if (parameterIndex < 0 || parameterIndex >= int(metaNode.mParams.size()))
+                    throw pybind11::key_error(pybind11::str(parameter.first));
+                ConTypes parameterType = metaNode.mParams[parameterIndex].mType;
+                if (GetParameterTypeSize(parameterType) > sizeof(value))
+                    throw pybind11::value_error("Parameter type can't be set from Python");
+                PythonToParameter(parameter.second, parameterType, value);
+                controler->SetParameter(nodeIndex, parameterIndex, value);
+            }
+        }
+        catch (...)
+        {
+            controler->EndParameterBatch();
+            throw;
+        }
+        controler->EndParameterBatch();
+    });
+    m.def("BeginBatch", []() { Imogen::instance->GetNodeGraphControler()->BeginParameterBatch(); });
+    m.def("EndBatch", []() { Imogen::instance->GetNodeGraphControler()->EndParameterBatch(); });
     m.def("Connect", [](int nodeSource, int slotSource, int nodeDestination, int slotDestination) {
         // Imogen::instance->GetNodeGraphControler()->AddLink(nodeSource, slotSource, nodeDestination, slotDestination);
         NodeGraphAddLink(
@@ -154,7 +527,7 @@ PYBIND11_EMBEDDED_MODULE(Imogen, m)
     });
     m.def("AutoLayout", []() {
         NodeGraphUpdateEvaluationOrder(Imogen::instance->GetNodeGraphControler());
-        NodeGraphLayout();
+        NodeGraphLayout(false);
         NodeGraphUpdateScrolling();
     });
     m.def("DeleteGraph", []() { Imogen::instance->DeleteCurrentMaterial(); });
@@ -231,13 +604,23 @@ PYBIND11_EMBEDDED_MODULE(Imogen, m)
         }
         return d;
     });
-    graph.def("Build", [](PyGraph& pyGraph) {
-        extern Builder* gBuilder;
+    graph.def("Build",
+              [](PyGraph& pyGraph) {
+                  if (gBuilder)
+                  {
+                      Material* material = pyGraph.mGraph;
+                      gBuilder->Add(material);
+                  }
+              },
+              pybind11::call_guard<pybind11::gil_scoped_release>());
+    graph.def("BuildAsync", [](PyGraph& pyGraph) -> PyFuture* {
+        uint64_t id = 0;
         if (gBuilder)
         {
-            Material* material = pyGraph.mGraph;
-            gBuilder->Add(material);
+            pybind11::gil_scoped_release release;
+            id = gBuilder->Add(pyGraph.mGraph);
         }
+        return new PyBuildFuture(id);
     });
     auto node = pybind11::class_<PyNode>(m, "Node");
     node.def("GetType", [](PyNode& node) {
@@ -393,20 +776,107 @@ PYBIND11_EMBEDDED_MODULE(Imogen, m)
     });
     m.def("Log", LogPython);
     m.def("log2", static_cast<float (*)(float)>(log2));
-    m.def("ReadImage", Image::Read);
-    m.def("WriteImage", Image::Write);
+    m.def("ReadImage", Image::Read, pybind11::call_guard<pybind11::gil_scoped_release>());
+    m.def("ReadImageEx", Image::ReadEx, pybind11::call_guard<pybind11::gil_scoped_release>());
+    m.def("WriteImage", Image::Write, pybind11::call_guard<pybind11::gil_scoped_release>());
+    m.def("WriteImageEx", Image::WriteEx, pybind11::call_guard<pybind11::gil_scoped_release>());
+    // the image must not be used until the future is done
+    m.def("ReadImageAsync", [](const std::string& filename, pybind11::object image) -> PyFuture* {
+        Image* target = image.cast<Image*>();
+        return new PyTaskFuture([=]() { return Image::Read(filename.c_str(), target); }, image);
+    });
+    m.def("ReadImageExAsync",
+          [](const std::string& filename, pybind11::object image, int flags, int maxSize) -> PyFuture* {
+              Image* target = image.cast<Image*>();
+              return new PyTaskFuture(
+                  [=]() { return Image::ReadEx(filename.c_str(), target, flags, maxSize); }, image);
+          });
+    m.def("WriteImageAsync",
+          [](const std::string& filename, pybind11::object image, int format, int quality) -> PyFuture* {
+              Image* source = image.cast<Image*>();
+              return new PyTaskFuture(
+                  [=]() { return Image::Write(filename.c_str(), source, format, quality); }, image);
+          });
+    m.def("WriteImageExAsync",
+          [](const std::string& filename,
+             pybind11::object image,
+             int format,
+             int quality,
+             int compression) -> PyFuture* {
+              Image* source = image.cast<Image*>();
+              return new PyTaskFuture(
+                  [=]() { return Image::WriteEx(filename.c_str(), source, format, quality, compression); }, image);
+          });
+    m.def("SetImageCacheBudget", [](size_t budget) { gImageCache.SetBudget(budget); });
+    m.def("GetImageCacheStats", []() {
+        ImageCache::Stats stats = gImageCache.GetStats();
+        auto d = pybind11::dict();
+        d["hits"] = stats.mHits;
+        d["misses"] = stats.mMisses;
+        d["evictions"] = stats.mEvictions;
+        d["bytes"] = stats.mBytes;
+        d["budget"] = stats.mBudget;
+        d["entries"] = stats.mEntryCount;
+        return d;
+    });
     m.def("GetEvaluationImage", EvaluationAPI::GetEvaluationImage);
     m.def("SetEvaluationImage", EvaluationAPI::SetEvaluationImage);
+    // NumPy arrays are uploaded straight from their memory. The queue holds the buffer until its texels are sent,
+    // changes made to the array in the meantime may be uploaded
+    m.def("SetEvaluationImage", [](EvaluationContext* evaluationContext, int target, pybind11::buffer buffer) {
+        std::shared_ptr<pybind11::buffer_info> info(new pybind11::buffer_info(buffer.request()),
+                                                    [](pybind11::buffer_info* info) {
+                                                        // released by the upload queue outside of Python calls
+                                                        pybind11::gil_scoped_acquire acquire;
+                                                        delete info;
+                                                    });
+        Image layout = GetBufferLayout(*info);
+        return EvaluationAPI::SetEvaluationBits(evaluationContext, target, &layout, (unsigned char*)info->ptr, info);
+    });
     m.def("SetEvaluationImageCube", EvaluationAPI::SetEvaluationImageCube);
     m.def("AllocateImage", EvaluationAPI::AllocateImage);
     m.def("FreeImage", Image::Free);
+    m.def("ResizeImage", ImageOps::Resize);
+    m.def("ConvertImage", ImageOps::Convert);
+    m.def("FlipImage", ImageOps::VFlip);
+    m.def("PremultiplyImage", ImageOps::Premultiply);
+    m.def("UnpremultiplyImage", ImageOps::Unpremultiply);
+    m.def("GenerateImageMips", ImageOps::GenerateMips);
+    m.def("CubemapFilter", CubemapFilter::Radiance);
+    m.def("CubemapIrradiance", CubemapFilter::Irradiance);
     m.def("SetThumbnailImage", EvaluationAPI::SetThumbnailImage);
-    m.def("Evaluate", EvaluationAPI::Evaluate);
+    // Python nodes of the evaluated graph take the GIL back in Evaluator::RunPython
+    m.def("Evaluate", EvaluationAPI::Evaluate, pybind11::call_guard<pybind11::gil_scoped_release>());
     m.def("SetBlendingMode", EvaluationAPI::SetBlendingMode);
     m.def("GetEvaluationSize", EvaluationAPI::GetEvaluationSize);
     m.def("SetEvaluationSize", EvaluationAPI::SetEvaluationSize);
     m.def("SetEvaluationCubeSize", EvaluationAPI::SetEvaluationCubeSize);
     m.def("SetProcessing", EvaluationAPI::SetProcessing);
+    // function(begin, end, threadIndex) is called with the GIL: only Python code releasing it (NumPy) runs in parallel
+    m.def("ParallelFor", [](int count, int grainSize, pybind11::function function) {
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        {
+            pybind11::gil_scoped_release release;
+            EvaluationAPI::RunParallelFor(count, grainSize, [&](int begin, int end, int threadIndex) {
+                pybind11::gil_scoped_acquire acquire;
+                try
+                {
+                    function(begin, end, threadIndex);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                    return EVAL_ERR;
+                }
+                return EVAL_OK;
+            });
+        }
+        if (error)
+            std::rethrow_exception(error);
+    });
     /*
     m.def("Job", EvaluationStages::Job );
     m.def("JobMain", EvaluationStages::JobMain );
@@ -763,11 +1233,28 @@ void Evaluators::ReloadPlugins()
 #if USE_PYTHON
 void Evaluator::RunPython() const
 {
+    // evaluations run from the builder thread or from API calls that released the GIL
+    pybind11::gil_scoped_acquire acquire;
     mPyModule.attr("main")(gEvaluators.mImogenModule.attr("accessor_api")());
 }
 #endif
 namespace EvaluationAPI
 {
+    // the stage shows its new image once the texels are in the texture. A target replaced meanwhile is left alone
+    static std::function<void(unsigned int)> SetDirtyWhenUploaded(EvaluationContext* evaluationContext,
+                                                                  int target,
+                                                                  DirtyFlag dirtyFlag,
+                                                                  bool onlyChild)
+    {
+        RenderTarget* renderTarget = evaluationContext->GetRenderTarget(target).get();
+        return [evaluationContext, target, renderTarget, dirtyFlag, onlyChild](unsigned int) {
+            if (evaluationContext->GetRenderTarget(target).get() == renderTarget)
+            {
+                evaluationContext->SetTargetDirty(target, dirtyFlag, onlyChild);
+            }
+        };
+    }
+
     int SetEvaluationImageCube(EvaluationContext* evaluationContext, int target, Image* image, int cubeFace)
     {
         if (image->mNumFaces != 1)
@@ -780,10 +1267,15 @@ namespace EvaluationAPI
             return EVAL_ERR;
         }
 
-        tgt->InitCube(image->mWidth, image->mNumMips);
+        tgt->InitCube(image->mWidth, image->mNumMips, image->mFormat);
 
-        Image::Upload(image, tgt->mGLTexID, cubeFace);
-        evaluationContext->SetTargetDirty(target, true);
+        Image::Upload(image, tgt->mGLTexID, cubeFace, SetDirtyWhenUploaded(evaluationContext, target, true, false));
+        // synchronous evaluations use the texture right after
+        if (evaluationContext->IsSynchronous())
+        {
+            gUploadQueue.Flush(tgt->mGLTexID);
+        }
+        evaluationContext->StageBumpGeneration(target);
         return EVAL_OK;
     }
 
@@ -871,37 +1363,74 @@ namespace EvaluationAPI
         return EVAL_OK;
     }
 
+    // scenes are looked up by loading jobs and registered on the main thread
     std::map<std::string, std::weak_ptr<Scene>> gSceneCache;
+    // cached scenes returned by ReadGLTF are kept alive until the job gives them to SetEvaluationScene or FreeScene
+    std::multimap<Scene*, std::shared_ptr<Scene>> gPendingScenes;
+    std::mutex gSceneCacheMutex;
+
+    // with gSceneCacheMutex locked. Empty for scenes fresh from a loader
+    static std::shared_ptr<Scene> TakePendingScene(Scene* scene)
+    {
+        auto iter = gPendingScenes.find(scene);
+        if (iter == gPendingScenes.end())
+            return nullptr;
+        std::shared_ptr<Scene> pendingScene = iter->second;
+        gPendingScenes.erase(iter);
+        return pendingScene;
+    }
 
     int SetEvaluationRTScene(EvaluationContext* evaluationContext, int target, void* scene)
     {
-        evaluationContext->mEvaluationStages.mStages[target].mScene = scene;
+        auto sharedScene = gRTSceneCache.Find(scene);
+        if (!sharedScene)
+            return EVAL_ERR;
+        evaluationContext->mEvaluationStages.mStages[target].mScene = sharedScene;
         return EVAL_OK;
     }
 
     int GetEvaluationRTScene(EvaluationContext* evaluationContext, int target, void** scene)
     {
-        *scene = evaluationContext->mEvaluationStages.mStages[target].mScene;
+        *scene = evaluationContext->mEvaluationStages.mStages[target].mScene.get();
         return EVAL_OK;
     }
 
 
     int SetEvaluationScene(EvaluationContext* evaluationContext, int target, void* scene)
     {
-        const std::string& name = ((Scene*)scene)->mName;
         auto& stage = evaluationContext->mEvaluationStages.mStages[target];
+        std::lock_guard<std::mutex> lock(gSceneCacheMutex);
+        std::shared_ptr<Scene> pendingScene = TakePendingScene((Scene*)scene);
+        if (pendingScene)
+        {
+            if (stage.mGScene != pendingScene)
+            {
+                stage.mGScene = pendingScene;
+                evaluationContext->SetTargetDirty(target, Dirty::Input);
+            }
+            return EVAL_OK;
+        }
+
+        const std::string& name = ((Scene*)scene)->mName;
         auto iter = gSceneCache.find(name);
         if (iter == gSceneCache.end() || iter->second.expired())
         {
+            ((Scene*)scene)->Upload();
             stage.mGScene = std::shared_ptr<Scene>((Scene*)scene);
-            gSceneCache.insert(std::make_pair(name, stage.mGScene));
+            gSceneCache[name] = stage.mGScene;
             evaluationContext->SetTargetDirty(target, Dirty::Input);
             return EVAL_OK;
         }
 
-        if (stage.mGScene != iter->second.lock())
+        std::shared_ptr<Scene> cachedScene = iter->second.lock();
+        if (cachedScene.get() != scene && !((Scene*)scene)->mbUploaded)
         {
-            stage.mGScene = iter->second.lock();
+            // fresh from a loader but loaded twice while the first one was on its way
+            delete (Scene*)scene;
+        }
+        if (stage.mGScene != cachedScene)
+        {
+            stage.mGScene = cachedScene;
             evaluationContext->SetTargetDirty(target, Dirty::Input);
         }
         return EVAL_OK;
@@ -953,16 +1482,14 @@ namespace EvaluationAPI
         {
             return EVAL_ERR;
         }
+        // texels still in the upload queue
+        gUploadQueue.Flush(tgt->mGLTexID);
 
-        // compute total size
         auto img = tgt->mImage;
-        unsigned int texelSize = textureFormatSize[img->mFormat];
-        unsigned int texelFormat = glInternalFormats[img->mFormat];
-        uint32_t size = 0; // img.mNumFaces * img.mWidth * img.mHeight * texelSize;
-        for (int i = 0; i < img->mNumMips; i++)
-            size += img->mNumFaces * (img->mWidth >> i) * (img->mHeight >> i) * texelSize;
+        unsigned int texelFormat = glInputFormats[img->mFormat];
+        unsigned int texelType = glInputTypes[img->mFormat];
 
-        image->Allocate(size);
+        image->Allocate(GetImageFaceSize(*img) * img->mNumFaces);
         image->mWidth = img->mWidth;
         image->mHeight = img->mHeight;
         image->mNumMips = img->mNumMips;
@@ -970,13 +1497,15 @@ namespace EvaluationAPI
         image->mNumFaces = img->mNumFaces;
 #ifdef glGetTexImage
         unsigned char* ptr = image->GetBits();
+        // rows are not padded, RGB rows are not always a multiple of 4 bytes
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
         if (img->mNumFaces == 1)
         {
             glBindTexture(GL_TEXTURE_2D, tgt->mGLTexID);
             for (int i = 0; i < img->mNumMips; i++)
             {
-                glGetTexImage(GL_TEXTURE_2D, i, texelFormat, GL_UNSIGNED_BYTE, ptr);
-                ptr += (img->mWidth >> i) * (img->mHeight >> i) * texelSize;
+                glGetTexImage(GL_TEXTURE_2D, i, texelFormat, texelType, ptr);
+                ptr += ImageOps::GetSurfaceSize(img->mWidth, img->mHeight, img->mFormat, i);
             }
         }
         else
@@ -986,163 +1515,154 @@ namespace EvaluationAPI
             {
                 for (int i = 0; i < img->mNumMips; i++)
                 {
-                    glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + cube, i, texelFormat, GL_UNSIGNED_BYTE, ptr);
-                    ptr += (img->mWidth >> i) * (img->mHeight >> i) * texelSize;
+                    glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + cube, i, texelFormat, texelType, ptr);
+                    ptr += ImageOps::GetSurfaceSize(img->mWidth, img->mHeight, img->mFormat, i);
                 }
             }
         }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
 #endif
         return EVAL_OK;
     }
 
     int SetEvaluationImage(EvaluationContext* evaluationContext, int target, Image* image)
+    {
+        return SetEvaluationBits(evaluationContext, target, image, image->GetBits());
+    }
+
+    int SetEvaluationBits(EvaluationContext* evaluationContext,
+                          int target,
+                          Image* image,
+                          unsigned char* bits,
+                          std::shared_ptr<void> bitsOwner)
     {
         EvaluationStage& stage = evaluationContext->mEvaluationStages.mStages[target];
         auto tgt = evaluationContext->GetRenderTarget(target);
         if (!tgt)
             return EVAL_ERR;
-        unsigned int texelSize = textureFormatSize[image->mFormat];
-        unsigned int inputFormat = glInputFormats[image->mFormat];
-        unsigned int internalFormat = glInternalFormats[image->mFormat];
-        unsigned char* ptr = image->GetBits();
+        unsigned int textureType = (image->mNumFaces == 1) ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
         if (image->mNumFaces == 1)
         {
-            tgt->InitBuffer(image->mWidth, image->mHeight, stage.mbDepthBuffer);
-
-            glBindTexture(GL_TEXTURE_2D, tgt->mGLTexID);
-
-            for (int i = 0; i < image->mNumMips; i++)
-            {
-                glTexImage2D(GL_TEXTURE_2D,
-                             i,
-                             internalFormat,
-                             image->mWidth >> i,
-                             image->mHeight >> i,
-                             0,
-                             inputFormat,
-                             GL_UNSIGNED_BYTE,
-                             ptr);
-                ptr += (image->mWidth >> i) * (image->mHeight >> i) * texelSize;
-            }
-
-            if (image->mNumMips > 1)
-                TexParam(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_2D);
-            else
-                TexParam(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_2D);
+            tgt->InitBuffer(image->mWidth, image->mHeight, stage.mbDepthBuffer, image->mFormat, image->mNumMips);
         }
         else
         {
-            tgt->InitCube(image->mWidth, image->mNumMips);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, tgt->mGLTexID);
+            tgt->InitCube(image->mWidth, image->mNumMips, image->mFormat);
+        }
+        glBindTexture(textureType, tgt->mGLTexID);
+        if (image->mNumMips > 1)
+            TexParam(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, textureType);
+        else
+            TexParam(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, textureType);
+        glBindTexture(textureType, 0);
 
-            for (int face = 0; face < image->mNumFaces; face++)
+        // the queue shares the image bits. Other memory is copied unless its owner keeps it alive
+        auto onUploaded = SetDirtyWhenUploaded(evaluationContext, target, Dirty::Input, true);
+        if (bitsOwner)
+        {
+            gUploadQueue.Add(tgt->mGLTexID, -1, *image, bits, bitsOwner, onUploaded);
+        }
+        else
+        {
+            Image upload(*image);
+            if (bits != image->GetBits())
             {
-                for (int i = 0; i < image->mNumMips; i++)
-                {
-                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
-                                 i,
-                                 internalFormat,
-                                 image->mWidth >> i,
-                                 image->mWidth >> i,
-                                 0,
-                                 inputFormat,
-                                 GL_UNSIGNED_BYTE,
-                                 ptr);
-                    ptr += (image->mWidth >> i) * (image->mWidth >> i) * texelSize;
-                }
+                upload.SetBits(bits, GetImageFaceSize(*image) * image->mNumFaces);
             }
-
-            if (image->mNumMips > 1)
-                TexParam(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_CUBE_MAP);
-            else
-                TexParam(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_CUBE_MAP);
+            gUploadQueue.Add(tgt->mGLTexID, -1, upload, onUploaded);
+        }
+        if (evaluationContext->IsSynchronous())
+        {
+            gUploadQueue.Flush(tgt->mGLTexID);
         }
         #if USE_FFMPEG
         if (stage.mDecoder.get() != (FFMPEGCodec::Decoder*)image->mDecoder)
             stage.mDecoder = std::shared_ptr<FFMPEGCodec::Decoder>((FFMPEGCodec::Decoder*)image->mDecoder);
             #endif
-        evaluationContext->SetTargetDirty(target, Dirty::Input, true);
+        evaluationContext->StageBumpGeneration(target);
         return EVAL_OK;
     }
 
     int LoadScene(const char* filename, void** pscene)
     {
-        // todo: make a real good cache system
-        static std::map<std::string, GLSLPathTracer::Scene*> cachedScenes;
-        std::string sFilename(filename);
-        auto iter = cachedScenes.find(sFilename);
-        if (iter != cachedScenes.end())
+        auto scene = gRTSceneCache.GetScene(filename);
+        if (!scene)
+            return EVAL_ERR;
+        // the cache keeps the scene until a stage takes its reference with SetEvaluationRTScene
+        *pscene = scene.get();
+        return EVAL_OK;
+    }
+
+    // headless machines only have a software GL driver, path tracing shaders are much slower there than the CPU renderer
+    static bool HasHardwareRenderer()
+    {
+        static const char* softwareRenderers[] = {"llvmpipe", "softpipe", "SwiftShader", "Software Rasterizer", "GDI Generic"};
+        const char* glRenderer = (const char*)glGetString(GL_RENDERER);
+        if (!glRenderer)
         {
-            *pscene = iter->second;
-            return EVAL_OK;
+            return false;
         }
-
-        GLSLPathTracer::Scene* scene = GLSLPathTracer::LoadScene(sFilename);
-        if (!scene)
+        for (auto softwareRenderer : softwareRenderers)
         {
-            Log("Unable to load scene\n");
-            return EVAL_ERR;
+            if (strstr(glRenderer, softwareRenderer))
+            {
+                return false;
+            }
         }
-        cachedScenes.insert(std::make_pair(sFilename, scene));
-        *pscene = scene;
-
-        Log("Scene Loaded\n\n");
-
-        scene->buildBVH();
-
-        // --------Print info on memory usage ------------- //
-
-        Log("Triangles: %d\n", scene->triangleIndices.size());
-        Log("Triangle Indices: %d\n", scene->gpuBVH->bvhTriangleIndices.size());
-        Log("Vertices: %d\n", scene->vertexData.size());
-
-        long long scene_data_bytes = sizeof(GLSLPathTracer::GPUBVHNode) * scene->gpuBVH->bvh->getNumNodes() +
-                                     sizeof(GLSLPathTracer::TriangleData) * scene->gpuBVH->bvhTriangleIndices.size() +
-                                     sizeof(GLSLPathTracer::VertexData) * scene->vertexData.size() +
-                                     sizeof(GLSLPathTracer::NormalTexData) * scene->normalTexData.size() +
-                                     sizeof(GLSLPathTracer::MaterialData) * scene->materialData.size() +
-                                     sizeof(GLSLPathTracer::LightData) * scene->lightData.size();
-
-        Log("GPU Memory used for BVH and scene data: %d MB\n", scene_data_bytes / 1048576);
-
-        long long tex_data_bytes = scene->texData.albedoTextureSize.x * scene->texData.albedoTextureSize.y *
-                                       scene->texData.albedoTexCount * 3 +
-                                   scene->texData.metallicRoughnessTextureSize.x *
-                                       scene->texData.metallicRoughnessTextureSize.y *
-                                       scene->texData.metallicRoughnessTexCount * 3 +
-                                   scene->texData.normalTextureSize.x * scene->texData.normalTextureSize.y *
-                                       scene->texData.normalTexCount * 3 +
-                                   scene->hdrLoaderRes.width * scene->hdrLoaderRes.height * sizeof(GL_FLOAT) * 3;
-
-        Log("GPU Memory used for Textures: %d MB\n", tex_data_bytes / 1048576);
-
-        Log("Total GPU Memory used: %d MB\n", (scene_data_bytes + tex_data_bytes) / 1048576);
-
-        return EVAL_OK;
+        return true;
     }
 
     int InitRenderer(EvaluationContext* evaluationContext, int target, int mode, void* scene)
     {
-        GLSLPathTracer::Scene* rdscene = (GLSLPathTracer::Scene*)scene;
-        evaluationContext->mEvaluationStages.mStages[target].mScene = scene;
+        auto& stage = evaluationContext->mEvaluationStages.mStages[target];
+        if (stage.mScene.get() != scene)
+        {
+            stage.mScene = gRTSceneCache.Find(scene);
+        }
+        GLSLPathTracer::Scene* rdscene = stage.mScene.get();
+        if (!rdscene)
+            return EVAL_ERR;
 
         GLSLPathTracer::Renderer* currentRenderer =
             (GLSLPathTracer::Renderer*)evaluationContext->mEvaluationStages.mStages[target].renderer;
         if (!currentRenderer)
         {
             // auto renderer = new GLSLPathTracer::TiledRenderer(rdscene, "Stock/PathTracer/Tiled/");
-            auto renderer = new GLSLPathTracer::ProgressiveRenderer(rdscene, "Stock/PathTracer/Progressive/");
+            GLSLPathTracer::Renderer* renderer;
+            if (mode == 2 || !HasHardwareRenderer())
+            {
+                // output shaders are shared with the progressive renderer
+                renderer = new GLSLPathTracer::CPURenderer(rdscene, "Stock/PathTracer/Progressive/");
+            }
+            else
+            {
+                renderer = new GLSLPathTracer::ProgressiveRenderer(rdscene, "Stock/PathTracer/Progressive/");
+            }
             renderer->init();
             evaluationContext->mEvaluationStages.mStages[target].renderer = renderer;
         }
         return EVAL_OK;
     }
 
+    int SetRendererDenoise(EvaluationContext* evaluationContext, int target, int iterations, float noiseThreshold)
+    {
+        GLSLPathTracer::Renderer* renderer =
+            (GLSLPathTracer::Renderer*)evaluationContext->mEvaluationStages.mStages[target].renderer;
+        if (!renderer)
+            return EVAL_ERR;
+        // only the CPU renderer keeps its accumulation in memory
+        if (renderer->getType() == GLSLPathTracer::Renderer_CPU)
+        {
+            ((GLSLPathTracer::CPURenderer*)renderer)->setDenoise(iterations, noiseThreshold);
+        }
+        return EVAL_OK;
+    }
+
     int UpdateRenderer(EvaluationContext* evaluationContext, int target)
     {
         auto& eval = evaluationContext->mEvaluationStages;
         GLSLPathTracer::Renderer* renderer = (GLSLPathTracer::Renderer*)eval.mStages[target].renderer;
-        GLSLPathTracer::Scene* rdscene = (GLSLPathTracer::Scene*)eval.mStages[target].mScene;
+        GLSLPathTracer::Scene* rdscene = eval.mStages[target].mScene.get();
 
         Camera* camera = eval.GetCameraParameter(target);
         if (camera)
@@ -1188,18 +1708,41 @@ namespace EvaluationAPI
 
     typedef int (*jobFunction)(void*);
 
+    // C job tasks and their payload copy share a single pooled block
+    template<typename T>
+    T* NewCFunctionTask(jobFunction function, void* ptr, unsigned int size)
+    {
+        void* block = BufferPool::Allocate(sizeof(T) + size);
+        void* buffer = ((T*)block) + 1;
+        memcpy(buffer, ptr, size);
+        return new (block) T(function, buffer);
+    }
+
+    template<typename T>
+    void DeleteCFunctionTask(T* task)
+    {
+        task->~T();
+        BufferPool::Free(task);
+    }
+
+    // node jobs queued or running. Thumbnail decodes and the builder wait for them to keep the edited graph responsive
+    static std::atomic<int> gPendingJobCount(0);
+
+    int GetPendingJobCount()
+    {
+        return gPendingJobCount;
+    }
+
     struct CFunctionTaskSet : TaskSet
     {
-        CFunctionTaskSet(jobFunction function, void* ptr, unsigned int size)
-            : TaskSet(), mFunction(function), mBuffer(malloc(size))
+        CFunctionTaskSet(jobFunction function, void* buffer) : TaskSet(), mFunction(function), mBuffer(buffer)
         {
-            memcpy(mBuffer, ptr, size);
         }
         virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
         {
             mFunction(mBuffer);
-            free(mBuffer);
-            delete this;
+            DeleteCFunctionTask(this);
+            gPendingJobCount--;
         }
         jobFunction mFunction;
         void* mBuffer;
@@ -1207,18 +1750,17 @@ namespace EvaluationAPI
 
     struct CFunctionMainTask : PinnedTask
     {
-        CFunctionMainTask(jobFunction function, void* ptr, unsigned int size)
+        CFunctionMainTask(jobFunction function, void* buffer)
             : PinnedTask(0) // set pinned thread to 0
             , mFunction(function)
-            , mBuffer(malloc(size))
+            , mBuffer(buffer)
         {
-            memcpy(mBuffer, ptr, size);
         }
         virtual void Execute()
         {
             mFunction(mBuffer);
-            free(mBuffer);
-            delete this;
+            DeleteCFunctionTask(this);
+            gPendingJobCount--;
         }
         jobFunction mFunction;
         void* mBuffer;
@@ -1232,7 +1774,8 @@ namespace EvaluationAPI
         }
         else
         {
-            g_TS.AddTaskSetToPipe(new CFunctionTaskSet(jobFunction, ptr, size));
+            gPendingJobCount++;
+            g_TS.AddTaskSetToPipe(NewCFunctionTask<CFunctionTaskSet>(jobFunction, ptr, size));
         }
         return EVAL_OK;
     }
@@ -1245,14 +1788,113 @@ namespace EvaluationAPI
         }
         else
         {
-            g_TS.AddPinnedTask(new CFunctionMainTask(jobMainFunction, ptr, size));
+            gPendingJobCount++;
+            g_TS.AddPinnedTask(NewCFunctionTask<CFunctionMainTask>(jobMainFunction, ptr, size));
         }
         return EVAL_OK;
     }
 
+    unsigned int NewJobGeneration(EvaluationContext* evaluationContext, int target)
+    {
+        return evaluationContext->StageNewJobGeneration(target);
+    }
+
+    int IsJobCurrent(EvaluationContext* evaluationContext, int target, unsigned int generation)
+    {
+        return evaluationContext->StageIsJobCurrent(target, generation) ? 1 : 0;
+    }
+
+    // The set is made of grains of grainSize elements so partitions split by the scheduler stay whole grains
+    struct ParallelForTaskSet final : TaskSet
+    {
+        ParallelForTaskSet(int count, int grainSize, const std::function<int(int, int, int)>& function)
+            : TaskSet(uint32_t((count + grainSize - 1) / grainSize))
+            , mCount(count)
+            , mGrainSize(grainSize)
+            , mFunction(function)
+            , mResult(EVAL_OK)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            int begin = int(range.start) * mGrainSize;
+            int end = int(std::min(int64_t(range.end) * mGrainSize, int64_t(mCount)));
+            if (mFunction(begin, end, int(threadnum)) != EVAL_OK)
+                mResult = EVAL_ERR;
+        }
+
+        int mCount;
+        int mGrainSize;
+        std::function<int(int, int, int)> mFunction;
+        std::atomic<int> mResult;
+    };
+
+    // a few grains per thread leave room for balancing uneven ranges
+    static int GetParallelForGrainSize(int count, int grainSize)
+    {
+        if (grainSize > 0)
+            return grainSize;
+        int grainCount = int(std::max(std::thread::hardware_concurrency(), 1u)) * 8;
+        return std::max((count + grainCount - 1) / grainCount, 1);
+    }
+
+    static ParallelForTaskSet* StartParallelFor(int count,
+                                                int grainSize,
+                                                const std::function<int(int, int, int)>& function)
+    {
+        if (count <= 0)
+            return nullptr;
+        ParallelForTaskSet* task = new ParallelForTaskSet(count, GetParallelForGrainSize(count, grainSize), function);
+        g_TS.AddTaskSetToPipe(task);
+        return task;
+    }
+
+    int ParallelForWait(void* parallelFor)
+    {
+        ParallelForTaskSet* task = (ParallelForTaskSet*)parallelFor;
+        if (!task)
+            return EVAL_OK;
+        g_TS.WaitforTaskSet(task);
+        int result = task->mResult;
+        delete task;
+        return result;
+    }
+
+    int RunParallelFor(int count,
+                       int grainSize,
+                       const std::function<int(int begin, int end, int threadIndex)>& function)
+    {
+        return ParallelForWait(StartParallelFor(count, grainSize, function));
+    }
+
+    void* ParallelForAsync(EvaluationContext* evaluationContext,
+                           int count,
+                           int grainSize,
+                           parallelForFunction function,
+                           void* userData)
+    {
+        return StartParallelFor(count, grainSize, [=](int begin, int end, int threadIndex) {
+            return function(begin, end, threadIndex, userData);
+        });
+    }
+
+    int ParallelFor(EvaluationContext* evaluationContext,
+                    int count,
+                    int grainSize,
+                    parallelForFunction function,
+                    void* userData)
+    {
+        return ParallelForWait(ParallelForAsync(evaluationContext, count, grainSize, function, userData));
+    }
+
     int Read(EvaluationContext* evaluationContext, const char* filename, Image* image)
     {
-        if (Image::Read(filename, image) == EVAL_OK)
+        return ReadEx(evaluationContext, filename, image, 0, 0);
+    }
+
+    int ReadEx(EvaluationContext* evaluationContext, const char* filename, Image* image, int flags, int maxSize)
+    {
+        if (Image::ReadEx(filename, image, flags, maxSize) == EVAL_OK)
             return EVAL_OK;
             #if USE_FFMPEG
         // try to load movie
@@ -1265,6 +1907,16 @@ namespace EvaluationAPI
     }
 
     int Write(EvaluationContext* evaluationContext, const char* filename, Image* image, int format, int quality)
+    {
+        return WriteEx(evaluationContext, filename, image, format, quality, 0);
+    }
+
+    int WriteEx(EvaluationContext* evaluationContext,
+                const char* filename,
+                Image* image,
+                int format,
+                int quality,
+                int compression)
     {
         if (format == 7)
         {
@@ -1277,7 +1929,7 @@ namespace EvaluationAPI
             return EVAL_OK;
         }
 
-        return Image::Write(filename, image, format, quality);
+        return Image::WriteEx(filename, image, format, quality, compression);
     }
 
     int Evaluate(EvaluationContext* evaluationContext, int target, int width, int height, Image* image)
@@ -1313,92 +1965,29 @@ namespace EvaluationAPI
     int ReadGLTF(EvaluationContext* evaluationContext, const char* filename, Scene** scene)
     {
         std::string strFilename(filename);
-        auto iter = gSceneCache.find(strFilename);
-        if (iter != gSceneCache.end() && (!iter->second.expired()))
-        {
-            *scene = iter->second.lock().get();
-            return EVAL_OK;
-        }
-        cgltf_options options;
-        memset(&options, 0, sizeof(options));
-        cgltf_data* data = NULL;
-        cgltf_result result = cgltf_parse_file(&options, filename, &data);
-        if (result != cgltf_result_success)
-            return EVAL_ERR;
-
-        result = cgltf_load_buffers(&options, data, filename);
-        if (result != cgltf_result_success)
-            return EVAL_ERR;
-
-        Scene* sc = new Scene;
-        sc->mName = strFilename;
-        // gSceneCache.insert(std::make_pair(strFilename, sc));
-        // gScenePointerCache.insert(std::make_pair(sc.get(), sc));
-
-        sc->mMeshes.resize(data->meshes_count);
-        for (unsigned int i = 0; i < data->meshes_count; i++)
         {
-            auto& gltfMesh = data->meshes[i];
-            auto& mesh = sc->mMeshes[i];
-            mesh.mPrimitives.resize(gltfMesh.primitives_count);
-            // attributes
-            for (unsigned int j = 0; j < gltfMesh.primitives_count; j++)
+            std::lock_guard<std::mutex> lock(gSceneCacheMutex);
+            auto iter = gSceneCache.find(strFilename);
+            std::shared_ptr<Scene> cachedScene = (iter != gSceneCache.end()) ? iter->second.lock() : nullptr;
+            if (cachedScene)
             {
-                auto& gltfPrim = gltfMesh.primitives[j];
-                auto& prim = mesh.mPrimitives[j];
-
-                for (unsigned int k = 0; k < gltfPrim.attributes_count; k++)
-                {
-                    unsigned int format = 0;
-                    auto attr = gltfPrim.attributes[k];
-                    switch (attr.type)
-                    {
-                        case cgltf_attribute_type_position:
-                            format = Scene::Mesh::Format::POS;
-                            break;
-                        case cgltf_attribute_type_normal:
-                            format = Scene::Mesh::Format::NORM;
-                            break;
-                        case cgltf_attribute_type_texcoord:
-                            format = Scene::Mesh::Format::UV;
-                            break;
-                        case cgltf_attribute_type_color:
-                            format = Scene::Mesh::Format::COL;
-                            break;
-                    }
-                    const char* buffer = ((char*)attr.data->buffer_view->buffer->data) +
-                                         attr.data->buffer_view->offset + attr.data->offset;
-                    prim.AddBuffer(buffer, format, (unsigned int)attr.data->stride, (unsigned int)attr.data->count);
-                }
-
-                // indices
-                const char* buffer = ((char*)gltfPrim.indices->buffer_view->buffer->data) +
-                                     gltfPrim.indices->buffer_view->offset + gltfPrim.indices->offset;
-                prim.AddIndexBuffer(
-                    buffer, (unsigned int)gltfPrim.indices->stride, (unsigned int)gltfPrim.indices->count);
+                gPendingScenes.insert(std::make_pair(cachedScene.get(), cachedScene));
+                *scene = cachedScene.get();
+                return EVAL_OK;
             }
         }
+        // CPU only, GL buffers are created by SetEvaluationScene on the main thread
+        return GLTFLoader::Load(filename, scene);
+    }
 
-        sc->mWorldTransforms.resize(data->nodes_count);
-        sc->mMeshIndex.resize(data->nodes_count, -1);
-
-        // transforms
-        for (unsigned int i = 0; i < data->nodes_count; i++)
-        {
-            cgltf_node_transform_world(&data->nodes[i], sc->mWorldTransforms[i]);
-        }
-
-        for (unsigned int i = 0; i < data->nodes_count; i++)
+    void FreeScene(Scene* scene)
+    {
+        std::lock_guard<std::mutex> lock(gSceneCacheMutex);
+        // scenes from the cache are owned by their stages, only the reference of the job is released
+        if (scene && !TakePendingScene(scene) && !scene->mbUploaded)
         {
-            if (!data->nodes[i].mesh)
-                continue;
-            sc->mMeshIndex[i] = int(data->nodes[i].mesh - data->meshes);
+            delete scene;
         }
-
-
-        cgltf_free(data);
-        *scene = sc;
-        return EVAL_OK;
     }
 
 } // namespace EvaluationAPI
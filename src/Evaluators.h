@@ -27,6 +27,7 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <functional>
 #include "Imogen.h"
 #if USE_PYTHON
 #include "pybind11/embed.h"
@@ -114,6 +115,13 @@ namespace EvaluationAPI
     // API
     int GetEvaluationImage(EvaluationContext* evaluationContext, int target, Image* image);
     int SetEvaluationImage(EvaluationContext* evaluationContext, int target, Image* image);
+    // uploads bits laid out as described by image, the image bits are not used. Without bitsOwner the bits are copied,
+    // otherwise bitsOwner keeps them alive until they are uploaded
+    int SetEvaluationBits(EvaluationContext* evaluationContext,
+                          int target,
+                          Image* image,
+                          unsigned char* bits,
+                          std::shared_ptr<void> bitsOwner = nullptr);
     int SetEvaluationImageCube(EvaluationContext* evaluationContext, int target, Image* image, int cubeFace);
     int SetThumbnailImage(EvaluationContext* evaluationContext, Image* image);
     int AllocateImage(Image* image);
@@ -131,6 +139,29 @@ namespace EvaluationAPI
     int SetEvaluationCubeSize(EvaluationContext* evaluationContext, int target, int faceWidth, int mipmapCount);
     int Job(EvaluationContext* evaluationContext, int (*jobFunction)(void*), void* ptr, unsigned int size);
     int JobMain(EvaluationContext* evaluationContext, int (*jobMainFunction)(void*), void* ptr, unsigned int size);
+    // jobs of a stage started with a new generation supersede the older ones. IsJobCurrent is 0 for superseded jobs
+    unsigned int NewJobGeneration(EvaluationContext* evaluationContext, int target);
+    int IsJobCurrent(EvaluationContext* evaluationContext, int target, unsigned int generation);
+    // Job and JobMain tasks not done yet
+    int GetPendingJobCount();
+    // data parallel loop over [0, count). The task threads get ranges of at least grainSize elements (0 picks a size)
+    // with their thread index for per thread buffers. Returns EVAL_ERR if any range did
+    typedef int (*parallelForFunction)(int begin, int end, int threadIndex, void* userData);
+    int ParallelFor(EvaluationContext* evaluationContext,
+                    int count,
+                    int grainSize,
+                    parallelForFunction function,
+                    void* userData);
+    // same without waiting, ParallelForWait returns the result when every range is done and releases the handle
+    void* ParallelForAsync(EvaluationContext* evaluationContext,
+                           int count,
+                           int grainSize,
+                           parallelForFunction function,
+                           void* userData);
+    int ParallelForWait(void* parallelFor);
+    int RunParallelFor(int count,
+                       int grainSize,
+                       const std::function<int(int begin, int end, int threadIndex)>& function);
     void SetProcessing(EvaluationContext* context, int target, int processing);
     int AllocateComputeBuffer(EvaluationContext* context, int target, int elementCount, int elementSize);
 
@@ -144,10 +175,20 @@ namespace EvaluationAPI
     int GetEvaluationRenderer(EvaluationContext* evaluationContext, int target, void** renderer);
     int InitRenderer(EvaluationContext* evaluationContext, int target, int mode, void* scene);
     int UpdateRenderer(EvaluationContext* evaluationContext, int target);
+    int SetRendererDenoise(EvaluationContext* evaluationContext, int target, int iterations, float noiseThreshold);
 
     int Read(EvaluationContext* evaluationContext, const char* filename, Image* image);
+    int ReadEx(EvaluationContext* evaluationContext, const char* filename, Image* image, int flags, int maxSize);
     int Write(EvaluationContext* evaluationContext, const char* filename, Image* image, int format, int quality);
+    int WriteEx(EvaluationContext* evaluationContext,
+                const char* filename,
+                Image* image,
+                int format,
+                int quality,
+                int compression);
     int Evaluate(EvaluationContext* evaluationContext, int target, int width, int height, Image* image);
 
     int ReadGLTF(EvaluationContext* evaluationContext, const char* filename, Scene** scene);
+    // releases a scene from ReadGLTF that wasn't given to SetEvaluationScene
+    void FreeScene(Scene* scene);
 } // namespace EvaluationAPI
\ No newline at end of file
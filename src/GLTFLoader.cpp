@@ -0,0 +1,627 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "Platform.h"
+#include "GLTFLoader.h"
+#include "EvaluationStages.h"
+#include "Utils.h"
+#define CGLTF_IMPLEMENTATION
+#include "cgltf.h"
+#include <algorithm>
+#include <vector>
+#include <sys/stat.h>
+
+extern TaskScheduler g_TS;
+
+namespace GLTFLoader
+{
+    static const char* MeshCacheDirectory = "Cache";
+    static const uint32_t MeshCacheMagic = 0x4853454D; // 'MESH'
+    static const uint32_t MeshCacheVersion = 1;
+    // post transform vertex cache size the triangles are ordered for
+    static const int VertexCacheSize = 32;
+
+    static void RunTaskSet(TaskSet* taskSet)
+    {
+        g_TS.AddTaskSetToPipe(taskSet);
+        g_TS.WaitforTaskSet(taskSet);
+    }
+
+    static bool ReadFile(const std::string& filename, std::vector<unsigned char>& content)
+    {
+        FILE* fp = fopen(filename.c_str(), "rb");
+        if (!fp)
+            return false;
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        content.resize(size > 0 ? size_t(size) : 0);
+        bool res = content.empty() || fread(content.data(), content.size(), 1, fp) == 1;
+        fclose(fp);
+        return res;
+    }
+
+    // the key covers the file content and the stamps of external buffers
+    static uint64_t GetSceneKey(const std::vector<unsigned char>& content, const cgltf_data* data, const char* filename)
+    {
+        uint64_t key = Hash(content.data(), content.size());
+        std::string basePath(filename);
+        size_t separator = basePath.find_last_of("/\\");
+        basePath = (separator == std::string::npos) ? std::string() : basePath.substr(0, separator + 1);
+        for (cgltf_size i = 0; i < data->buffers_count; i++)
+        {
+            const char* uri = data->buffers[i].uri;
+            if (!uri || !strncmp(uri, "data:", 5))
+                continue;
+            struct stat fileStat;
+            std::string bufferPath = basePath + uri;
+            if (stat(bufferPath.c_str(), &fileStat))
+                continue;
+            int64_t stamp[2] = {int64_t(fileStat.st_mtime), int64_t(fileStat.st_size)};
+            key = Hash(stamp, sizeof(stamp), Hash(uri, strlen(uri), key));
+        }
+        return key;
+    }
+
+    static std::string GetCacheFilename(uint64_t key)
+    {
+        char name[64];
+        sprintf(name, "/%016llx.mesh", (unsigned long long)key);
+        return std::string(MeshCacheDirectory) + name;
+    }
+
+    // Binary cache layout :
+    // header | per node : world transform, mesh index | per mesh : primitive count, per primitive :
+    // stream count, vertex count, index count, streams (format, component count, floats), indices
+    struct CacheHeader
+    {
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint64_t mKey;
+        uint32_t mMeshCount;
+        uint32_t mNodeCount;
+    };
+
+    template<typename T>
+    static void Append(std::vector<unsigned char>& blob, const T* data, size_t count)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        blob.insert(blob.end(), bytes, bytes + sizeof(T) * count);
+    }
+
+    template<typename T>
+    static void Append(std::vector<unsigned char>& blob, const T& value)
+    {
+        Append(blob, &value, 1);
+    }
+
+    struct CacheReader
+    {
+        CacheReader(const std::vector<unsigned char>& blob) : mData(blob.data()), mRemaining(blob.size())
+        {
+        }
+        template<typename T>
+        bool Read(T* data, size_t count)
+        {
+            size_t size = sizeof(T) * count;
+            if (size > mRemaining)
+                return false;
+            memcpy(data, mData, size);
+            mData += size;
+            mRemaining -= size;
+            return true;
+        }
+        template<typename T>
+        bool Read(T& value)
+        {
+            return Read(&value, 1);
+        }
+        const unsigned char* mData;
+        size_t mRemaining;
+    };
+
+    static void WriteCache(const Scene* scene, uint64_t key)
+    {
+        std::vector<unsigned char> blob;
+        CacheHeader header = {MeshCacheMagic, MeshCacheVersion, key, uint32_t(scene->mMeshes.size()), uint32_t(scene->mMeshIndex.size())};
+        Append(blob, header);
+        for (size_t i = 0; i < scene->mMeshIndex.size(); i++)
+        {
+            Append(blob, (const float*)scene->mWorldTransforms[i].m16, 16);
+            Append(blob, int32_t(scene->mMeshIndex[i]));
+        }
+        for (auto& mesh : scene->mMeshes)
+        {
+            Append(blob, uint32_t(mesh.mPrimitives.size()));
+            for (auto& prim : mesh.mPrimitives)
+            {
+                Append(blob, uint32_t(prim.mStreams.size()));
+                Append(blob, uint32_t(prim.mVertexCount));
+                Append(blob, uint32_t(prim.mIndices.size()));
+                for (auto& stream : prim.mStreams)
+                {
+                    Append(blob, uint32_t(stream.mFormat));
+                    Append(blob, uint32_t(stream.mComponentCount));
+                    Append(blob, stream.mData.data(), stream.mData.size());
+                }
+                Append(blob, prim.mIndices.data(), prim.mIndices.size());
+            }
+        }
+
+#ifdef WIN32
+        CreateDirectoryA(MeshCacheDirectory, NULL);
+#else
+        mkdir(MeshCacheDirectory, 0755);
+#endif
+        // written aside and renamed so a concurrent load never sees a partial file
+        std::string filename = GetCacheFilename(key);
+        std::string tempFilename = filename + ".tmp";
+        FILE* fp = fopen(tempFilename.c_str(), "wb");
+        if (!fp)
+            return;
+        bool written = fwrite(blob.data(), blob.size(), 1, fp) == 1;
+        fclose(fp);
+        remove(filename.c_str());
+        if (!written || rename(tempFilename.c_str(), filename.c_str()))
+            remove(tempFilename.c_str());
+    }
+
+    static Scene* ReadCache(uint64_t key)
+    {
+        std::vector<unsigned char> blob;
+        if (!ReadFile(GetCacheFilename(key), blob))
+            return nullptr;
+
+        CacheReader reader(blob);
+        CacheHeader header;
+        if (!reader.Read(header) || header.mMagic != MeshCacheMagic || header.mVersion != MeshCacheVersion ||
+            header.mKey != key)
+        {
+            return nullptr;
+        }
+
+        Scene* scene = new Scene;
+        bool valid = true;
+        scene->mWorldTransforms.resize(header.mNodeCount);
+        scene->mMeshIndex.resize(header.mNodeCount);
+        for (uint32_t i = 0; i < header.mNodeCount && valid; i++)
+        {
+            int32_t meshIndex;
+            valid = reader.Read(scene->mWorldTransforms[i].m16, 16) && reader.Read(meshIndex) &&
+                    meshIndex >= -1 && meshIndex < int32_t(header.mMeshCount);
+            scene->mMeshIndex[i] = meshIndex;
+        }
+        scene->mMeshes.resize(header.mMeshCount);
+        for (auto& mesh : scene->mMeshes)
+        {
+            uint32_t primitiveCount = 0;
+            valid = valid && reader.Read(primitiveCount) && primitiveCount <= reader.mRemaining;
+            if (!valid)
+                break;
+            mesh.mPrimitives.resize(primitiveCount);
+            for (auto& prim : mesh.mPrimitives)
+            {
+                uint32_t streamCount, vertexCount, indexCount;
+                valid = reader.Read(streamCount) && reader.Read(vertexCount) && reader.Read(indexCount) &&
+                        streamCount <= 4;
+                if (!valid)
+                    break;
+                prim.mVertexCount = vertexCount;
+                prim.mStreams.resize(streamCount);
+                for (auto& stream : prim.mStreams)
+                {
+                    valid = reader.Read(stream.mFormat) && reader.Read(stream.mComponentCount) &&
+                            stream.mComponentCount <= 4 &&
+                            size_t(vertexCount) * stream.mComponentCount * sizeof(float) <= reader.mRemaining;
+                    if (!valid)
+                        break;
+                    stream.mData.resize(size_t(vertexCount) * stream.mComponentCount);
+                    reader.Read(stream.mData.data(), stream.mData.size());
+                }
+                valid = valid && size_t(indexCount) * sizeof(uint32_t) <= reader.mRemaining;
+                if (!valid)
+                    break;
+                prim.mIndices.resize(indexCount);
+                reader.Read(prim.mIndices.data(), prim.mIndices.size());
+            }
+        }
+        if (!valid)
+        {
+            delete scene;
+            return nullptr;
+        }
+        return scene;
+    }
+
+    // one accessor converted to a float stream or to the index buffer
+    struct DecodeItem
+    {
+        const cgltf_accessor* mAccessor;
+        Scene::Mesh::Primitive* mPrimitive;
+        int mStream; // -1 for indices
+    };
+
+    struct DecodeTaskSet : TaskSet
+    {
+        DecodeTaskSet(const std::vector<DecodeItem>& items) : TaskSet(uint32_t(items.size())), mItems(items)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t i = range.start; i < range.end; i++)
+            {
+                const DecodeItem& item = mItems[i];
+                const cgltf_accessor* accessor = item.mAccessor;
+                if (item.mStream < 0)
+                {
+                    auto& indices = item.mPrimitive->mIndices;
+                    for (cgltf_size j = 0; j < indices.size(); j++)
+                    {
+                        indices[j] = uint32_t(cgltf_accessor_read_index(accessor, j));
+                    }
+                    continue;
+                }
+                auto& stream = item.mPrimitive->mStreams[item.mStream];
+                const cgltf_size componentCount = stream.mComponentCount;
+                const cgltf_size count = std::min(cgltf_size(item.mPrimitive->mVertexCount), accessor->count);
+                float* dst = stream.mData.data();
+                const cgltf_size accessorComponentCount = cgltf_num_components(accessor->type);
+                if (accessor->component_type == cgltf_component_type_r_32f && !accessor->is_sparse &&
+                    accessor->buffer_view && accessorComponentCount == componentCount)
+                {
+                    // tightly converted float data, copied element by element to drop the interleaving
+                    const unsigned char* src = (const unsigned char*)accessor->buffer_view->buffer->data +
+                                               accessor->buffer_view->offset + accessor->offset;
+                    for (cgltf_size j = 0; j < count; j++)
+                    {
+                        memcpy(dst + j * componentCount, src + j * accessor->stride, componentCount * sizeof(float));
+                    }
+                    continue;
+                }
+                for (cgltf_size j = 0; j < count; j++)
+                {
+                    // RGB colors get an opaque alpha
+                    float value[16] = {0.f, 0.f, 0.f, 1.f};
+                    cgltf_accessor_read_float(accessor, j, value, accessorComponentCount);
+                    memcpy(dst + j * componentCount, value, componentCount * sizeof(float));
+                }
+            }
+        }
+        const std::vector<DecodeItem>& mItems;
+    };
+
+    // Tom Forsyth's linear speed vertex cache optimisation
+    static float VertexScore(int cachePosition, uint32_t remainingValence)
+    {
+        if (!remainingValence)
+            return -1.f;
+        float score = 0.f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+            {
+                // last triangle vertices, don't favor them to avoid strips that turn back on themselves
+                score = 0.75f;
+            }
+            else
+            {
+                score = powf(1.f - float(cachePosition - 3) / float(VertexCacheSize - 3), 1.5f);
+            }
+        }
+        // favor vertices with few triangles left so they are done and out of the way
+        return score + 2.f / sqrtf(float(remainingValence));
+    }
+
+    static void OptimizeVertexCache(std::vector<uint32_t>& indices, unsigned int vertexCount)
+    {
+        const size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2)
+            return;
+
+        // triangles using each vertex. Live triangles are kept at the start of every vertex range.
+        std::vector<uint32_t> valence(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            valence[indices[i]]++;
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (unsigned int v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + valence[v];
+        std::vector<uint32_t> vertexTriangles(offsets[vertexCount]);
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+                vertexTriangles[fill[indices[t * 3 + k]]++] = uint32_t(t);
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for (unsigned int v = 0; v < vertexCount; v++)
+            vertexScore[v] = VertexScore(-1, valence[v]);
+        std::vector<bool> triangleAdded(triangleCount, false);
+
+        std::vector<uint32_t> result;
+        result.reserve(triangleCount * 3);
+        uint32_t cache[VertexCacheSize + 3];
+        int cacheCount = 0;
+        size_t scanCursor = 0;
+        int64_t bestTriangle = -1;
+        for (size_t added = 0; added < triangleCount; added++)
+        {
+            if (bestTriangle < 0)
+            {
+                // nothing connected to the cache : restart from the next triangle left
+                while (triangleAdded[scanCursor])
+                    scanCursor++;
+                bestTriangle = int64_t(scanCursor);
+            }
+            const uint32_t* triangle = &indices[size_t(bestTriangle) * 3];
+            triangleAdded[size_t(bestTriangle)] = true;
+            result.insert(result.end(), triangle, triangle + 3);
+
+            uint32_t newCache[VertexCacheSize + 3];
+            int newCacheCount = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = triangle[k];
+                // remove the triangle from the live ones of the vertex
+                uint32_t* first = &vertexTriangles[offsets[v]];
+                uint32_t* last = first + valence[v] - 1;
+                for (uint32_t* iter = first; iter <= last; iter++)
+                {
+                    if (*iter == uint32_t(bestTriangle))
+                    {
+                        std::swap(*iter, *last);
+                        break;
+                    }
+                }
+                valence[v]--;
+                newCache[newCacheCount++] = v;
+            }
+            for (int i = 0; i < cacheCount; i++)
+            {
+                uint32_t v = cache[i];
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                    newCache[newCacheCount++] = v;
+            }
+            // evicted vertices lose their cache bonus
+            for (int i = VertexCacheSize; i < newCacheCount; i++)
+            {
+                cachePosition[newCache[i]] = -1;
+                vertexScore[newCache[i]] = VertexScore(-1, valence[newCache[i]]);
+            }
+            cacheCount = std::min(newCacheCount, VertexCacheSize);
+            for (int i = 0; i < cacheCount; i++)
+            {
+                cache[i] = newCache[i];
+                cachePosition[cache[i]] = i;
+                vertexScore[cache[i]] = VertexScore(i, valence[cache[i]]);
+            }
+
+            // next triangle is the best one using cached vertices
+            bestTriangle = -1;
+            float bestScore = -1.f;
+            for (int i = 0; i < newCacheCount; i++)
+            {
+                uint32_t v = newCache[i];
+                for (uint32_t j = 0; j < valence[v]; j++)
+                {
+                    uint32_t t = vertexTriangles[offsets[v] + j];
+                    float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] +
+                                  vertexScore[indices[t * 3 + 2]];
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        bestTriangle = t;
+                    }
+                }
+            }
+        }
+        indices.swap(result);
+    }
+
+    // vertices reordered by first use so fetches follow the index buffer
+    static void OptimizeVertexFetch(Scene::Mesh::Primitive& prim)
+    {
+        std::vector<uint32_t> remap(prim.mVertexCount, uint32_t(-1));
+        uint32_t next = 0;
+        for (auto& index : prim.mIndices)
+        {
+            if (remap[index] == uint32_t(-1))
+                remap[index] = next++;
+            index = remap[index];
+        }
+        for (auto& stream : prim.mStreams)
+        {
+            std::vector<float> data(size_t(next) * stream.mComponentCount);
+            for (uint32_t v = 0; v < prim.mVertexCount; v++)
+            {
+                if (remap[v] == uint32_t(-1))
+                    continue;
+                memcpy(&data[size_t(remap[v]) * stream.mComponentCount],
+                       &stream.mData[size_t(v) * stream.mComponentCount],
+                       stream.mComponentCount * sizeof(float));
+            }
+            stream.mData.swap(data);
+        }
+        // unreferenced vertices are dropped
+        prim.mVertexCount = next;
+    }
+
+    struct OptimizeTaskSet : TaskSet
+    {
+        OptimizeTaskSet(const std::vector<Scene::Mesh::Primitive*>& primitives)
+            : TaskSet(uint32_t(primitives.size())), mPrimitives(primitives)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t i = range.start; i < range.end; i++)
+            {
+                auto& prim = *mPrimitives[i];
+                if (prim.mIndices.empty())
+                {
+                    prim.mIndices.resize(prim.mVertexCount - prim.mVertexCount % 3);
+                    for (uint32_t j = 0; j < uint32_t(prim.mIndices.size()); j++)
+                        prim.mIndices[j] = j;
+                }
+                // drop incomplete triangles and out of range indices
+                prim.mIndices.resize(prim.mIndices.size() - prim.mIndices.size() % 3);
+                for (auto& index : prim.mIndices)
+                    index = std::min(index, prim.mVertexCount - 1);
+                OptimizeVertexCache(prim.mIndices, prim.mVertexCount);
+                OptimizeVertexFetch(prim);
+            }
+        }
+        const std::vector<Scene::Mesh::Primitive*>& mPrimitives;
+    };
+
+    static bool GetStreamFormat(const cgltf_attribute& attribute, unsigned int& format, unsigned int& componentCount)
+    {
+        // first texcoord and color sets only
+        switch (attribute.type)
+        {
+            case cgltf_attribute_type_position:
+                format = Scene::Mesh::Format::POS;
+                componentCount = 3;
+                return true;
+            case cgltf_attribute_type_normal:
+                format = Scene::Mesh::Format::NORM;
+                componentCount = 3;
+                return true;
+            case cgltf_attribute_type_texcoord:
+                format = Scene::Mesh::Format::UV;
+                componentCount = 2;
+                return attribute.index == 0;
+            case cgltf_attribute_type_color:
+                format = Scene::Mesh::Format::COL;
+                componentCount = 4;
+                return attribute.index == 0;
+            default:
+                return false;
+        }
+    }
+
+    static Scene* Decode(cgltf_data* data)
+    {
+        Scene* scene = new Scene;
+        scene->mWorldTransforms.resize(data->nodes_count);
+        scene->mMeshIndex.resize(data->nodes_count, -1);
+        std::vector<bool> meshReferenced(data->meshes_count, false);
+        for (cgltf_size i = 0; i < data->nodes_count; i++)
+        {
+            cgltf_node_transform_world(&data->nodes[i], scene->mWorldTransforms[i]);
+            if (!data->nodes[i].mesh)
+                continue;
+            scene->mMeshIndex[i] = int(data->nodes[i].mesh - data->meshes);
+            meshReferenced[scene->mMeshIndex[i]] = true;
+        }
+
+        // streams are allocated here, tasks only fill them
+        std::vector<DecodeItem> items;
+        std::vector<Scene::Mesh::Primitive*> primitives;
+        scene->mMeshes.resize(data->meshes_count);
+        for (cgltf_size i = 0; i < data->meshes_count; i++)
+        {
+            if (!meshReferenced[i])
+                continue;
+            auto& gltfMesh = data->meshes[i];
+            auto& mesh = scene->mMeshes[i];
+            mesh.mPrimitives.resize(gltfMesh.primitives_count);
+            for (cgltf_size j = 0; j < gltfMesh.primitives_count; j++)
+            {
+                auto& gltfPrim = gltfMesh.primitives[j];
+                auto& prim = mesh.mPrimitives[j];
+                if (gltfPrim.type != cgltf_primitive_type_triangles)
+                    continue;
+
+                for (cgltf_size k = 0; k < gltfPrim.attributes_count; k++)
+                {
+                    if (gltfPrim.attributes[k].type == cgltf_attribute_type_position)
+                        prim.mVertexCount = (unsigned int)gltfPrim.attributes[k].data->count;
+                }
+                if (!prim.mVertexCount)
+                    continue;
+
+                for (cgltf_size k = 0; k < gltfPrim.attributes_count; k++)
+                {
+                    auto& attribute = gltfPrim.attributes[k];
+                    unsigned int format, componentCount;
+                    if (!GetStreamFormat(attribute, format, componentCount))
+                        continue;
+                    Scene::Mesh::Stream stream;
+                    stream.mFormat = format;
+                    stream.mComponentCount = componentCount;
+                    stream.mData.resize(size_t(prim.mVertexCount) * componentCount, 0.f);
+                    prim.mStreams.push_back(std::move(stream));
+                    items.push_back({attribute.data, &prim, int(prim.mStreams.size()) - 1});
+                }
+                if (gltfPrim.indices)
+                {
+                    prim.mIndices.resize(gltfPrim.indices->count);
+                    items.push_back({gltfPrim.indices, &prim, -1});
+                }
+                primitives.push_back(&prim);
+            }
+        }
+
+        DecodeTaskSet decodeTask(items);
+        RunTaskSet(&decodeTask);
+        OptimizeTaskSet optimizeTask(primitives);
+        RunTaskSet(&optimizeTask);
+        return scene;
+    }
+
+    int Load(const char* filename, Scene** scene)
+    {
+        std::vector<unsigned char> content;
+        if (!ReadFile(filename, content))
+            return EVAL_ERR;
+
+        // parsing the description is cheap and gives the external buffers to validate the cache with
+        cgltf_options options;
+        memset(&options, 0, sizeof(options));
+        cgltf_data* data = NULL;
+        if (cgltf_parse(&options, content.data(), content.size(), &data) != cgltf_result_success)
+            return EVAL_ERR;
+
+        uint64_t key = GetSceneKey(content, data, filename);
+        Scene* sc = ReadCache(key);
+        if (!sc)
+        {
+            if (cgltf_load_buffers(&options, data, filename) != cgltf_result_success)
+            {
+                cgltf_free(data);
+                return EVAL_ERR;
+            }
+            sc = Decode(data);
+            WriteCache(sc, key);
+        }
+        cgltf_free(data);
+
+        sc->mName = filename;
+        *scene = sc;
+        return EVAL_OK;
+    }
+} // namespace GLTFLoader
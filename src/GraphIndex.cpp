@@ -0,0 +1,290 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "Platform.h"
+#include "GraphIndex.h"
+#include "NodeGraph.h"
+#include <algorithm>
+
+GraphIndex::GraphIndex() : mReachableWordCount(0), mReachableDirty(true)
+{
+}
+
+void GraphIndex::Clear()
+{
+    mInputs.clear();
+    mOutputs.clear();
+    mOrder.clear();
+    mPosition.clear();
+    mVisited.clear();
+    mReachable.clear();
+    mReachableDirty = true;
+}
+
+void GraphIndex::Rebuild(size_t nodeCount, const std::vector<NodeLink>& links)
+{
+    mInputs.assign(nodeCount, std::vector<size_t>());
+    mOutputs.assign(nodeCount, std::vector<size_t>());
+    mVisited.assign(nodeCount, 0);
+    for (auto& link : links)
+    {
+        if (size_t(link.InputIdx) >= nodeCount || size_t(link.OutputIdx) >= nodeCount)
+            continue;
+        mOutputs[link.InputIdx].push_back(link.OutputIdx);
+        mInputs[link.OutputIdx].push_back(link.InputIdx);
+    }
+    SortNodes();
+    mReachableDirty = true;
+}
+
+// Kahn's algorithm. Nodes without inputs keep their index order
+void GraphIndex::SortNodes()
+{
+    const size_t nodeCount = mInputs.size();
+    std::vector<size_t> inputCount(nodeCount);
+    mOrder.clear();
+    mOrder.reserve(nodeCount);
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        inputCount[i] = mInputs[i].size();
+        if (!inputCount[i])
+            mOrder.push_back(i);
+    }
+    for (size_t head = 0; head < mOrder.size(); head++)
+    {
+        for (auto destination : mOutputs[mOrder[head]])
+        {
+            if (!--inputCount[destination])
+                mOrder.push_back(destination);
+        }
+    }
+    // nodes in or after a loop. Should not happen but they still get evaluated
+    if (mOrder.size() < nodeCount)
+    {
+        for (size_t i = 0; i < nodeCount; i++)
+        {
+            if (inputCount[i])
+                mOrder.push_back(i);
+        }
+    }
+    mPosition.resize(nodeCount);
+    for (size_t i = 0; i < nodeCount; i++)
+        mPosition[mOrder[i]] = i;
+}
+
+void GraphIndex::AddNode()
+{
+    mInputs.push_back(std::vector<size_t>());
+    mOutputs.push_back(std::vector<size_t>());
+    mPosition.push_back(mOrder.size());
+    mOrder.push_back(mInputs.size() - 1);
+    mVisited.push_back(0);
+    mReachableDirty = true;
+}
+
+static void EraseValue(std::vector<size_t>& values, size_t value)
+{
+    values.erase(std::remove(values.begin(), values.end(), value), values.end());
+}
+
+static void ShiftDown(std::vector<size_t>& values, size_t index)
+{
+    for (auto& value : values)
+    {
+        if (value > index)
+            value--;
+    }
+}
+
+void GraphIndex::DelNode(size_t index)
+{
+    if (index >= mInputs.size())
+        return;
+
+    for (auto source : mInputs[index])
+        EraseValue(mOutputs[source], index);
+    for (auto destination : mOutputs[index])
+        EraseValue(mInputs[destination], index);
+    mInputs.erase(mInputs.begin() + index);
+    mOutputs.erase(mOutputs.begin() + index);
+    for (size_t i = 0; i < mInputs.size(); i++)
+    {
+        ShiftDown(mInputs[i], index);
+        ShiftDown(mOutputs[i], index);
+    }
+
+    mOrder.erase(mOrder.begin() + mPosition[index]);
+    ShiftDown(mOrder, index);
+    mPosition.resize(mOrder.size());
+    for (size_t i = 0; i < mOrder.size(); i++)
+        mPosition[mOrder[i]] = i;
+    mVisited.pop_back();
+    mReachableDirty = true;
+}
+
+void GraphIndex::AddLink(size_t source, size_t destination)
+{
+    const size_t nodeCount = mInputs.size();
+    if (source >= nodeCount || destination >= nodeCount)
+        return;
+
+    mOutputs[source].push_back(destination);
+    mInputs[destination].push_back(source);
+    mReachableDirty = true;
+
+    // Pearce-Kelly: the order is still valid unless destination is evaluated before source.
+    // Only the nodes between them in the order are moved.
+    const size_t lowerBound = mPosition[destination];
+    const size_t upperBound = mPosition[source];
+    if (lowerBound > upperBound)
+        return;
+
+    std::vector<size_t> forward, backward, stack;
+    bool loop = source == destination;
+
+    // nodes depending on destination that are not already after source
+    stack.push_back(destination);
+    mVisited[destination] = 1;
+    while (!stack.empty() && !loop)
+    {
+        size_t current = stack.back();
+        stack.pop_back();
+        forward.push_back(current);
+        for (auto next : mOutputs[current])
+        {
+            if (next == source)
+                loop = true;
+            if (mVisited[next] || mPosition[next] > upperBound)
+                continue;
+            mVisited[next] = 1;
+            stack.push_back(next);
+        }
+    }
+    // a loop stops the search early, the nodes still on the stack were marked but are not in forward
+    for (auto node : stack)
+        mVisited[node] = 0;
+    // nodes source depends on that are not already before destination
+    stack.clear();
+    if (!loop)
+    {
+        stack.push_back(source);
+        mVisited[source] = 1;
+    }
+    while (!stack.empty())
+    {
+        size_t current = stack.back();
+        stack.pop_back();
+        backward.push_back(current);
+        for (auto previous : mInputs[current])
+        {
+            if (mVisited[previous] || mPosition[previous] < lowerBound)
+                continue;
+            mVisited[previous] = 1;
+            stack.push_back(previous);
+        }
+    }
+
+    for (auto node : forward)
+        mVisited[node] = 0;
+    for (auto node : backward)
+        mVisited[node] = 0;
+
+    if (loop)
+    {
+        SortNodes();
+        return;
+    }
+
+    // reuse the positions of both sets: backward nodes first, relative orders are kept
+    auto byPosition = [&](size_t a, size_t b) { return mPosition[a] < mPosition[b]; };
+    std::sort(forward.begin(), forward.end(), byPosition);
+    std::sort(backward.begin(), backward.end(), byPosition);
+    std::vector<size_t> positions;
+    positions.reserve(forward.size() + backward.size());
+    for (auto node : backward)
+        positions.push_back(mPosition[node]);
+    for (auto node : forward)
+        positions.push_back(mPosition[node]);
+    std::sort(positions.begin(), positions.end());
+
+    size_t slot = 0;
+    for (auto node : backward)
+        mOrder[positions[slot++]] = node;
+    for (auto node : forward)
+        mOrder[positions[slot++]] = node;
+    for (auto position : positions)
+        mPosition[mOrder[position]] = position;
+}
+
+void GraphIndex::DelLink(size_t source, size_t destination)
+{
+    const size_t nodeCount = mInputs.size();
+    if (source >= nodeCount || destination >= nodeCount)
+        return;
+
+    // removing a link never breaks the order
+    auto& outputs = mOutputs[source];
+    auto outputIter = std::find(outputs.begin(), outputs.end(), destination);
+    if (outputIter == outputs.end())
+        return;
+    outputs.erase(outputIter);
+    auto& inputs = mInputs[destination];
+    auto inputIter = std::find(inputs.begin(), inputs.end(), source);
+    if (inputIter != inputs.end())
+        inputs.erase(inputIter);
+    mReachableDirty = true;
+}
+
+// reverse evaluation order so each node ORs the rows of its already computed destinations
+void GraphIndex::ComputeReachability() const
+{
+    const size_t nodeCount = mInputs.size();
+    mReachableWordCount = (nodeCount + 63) / 64;
+    mReachable.assign(nodeCount * mReachableWordCount, 0);
+    for (size_t i = nodeCount; i > 0; i--)
+    {
+        const size_t node = mOrder[i - 1];
+        uint64_t* row = &mReachable[node * mReachableWordCount];
+        for (auto destination : mOutputs[node])
+        {
+            const uint64_t* destinationRow = &mReachable[destination * mReachableWordCount];
+            for (size_t word = 0; word < mReachableWordCount; word++)
+                row[word] |= destinationRow[word];
+            row[destination / 64] |= 1ULL << (destination % 64);
+        }
+    }
+    mReachableDirty = false;
+}
+
+bool GraphIndex::IsReachable(size_t source, size_t destination) const
+{
+    const size_t nodeCount = mInputs.size();
+    if (source >= nodeCount || destination >= nodeCount)
+        return false;
+    if (mReachableDirty)
+        ComputeReachability();
+    return (mReachable[source * mReachableWordCount + destination / 64] >> (destination % 64)) & 1;
+}
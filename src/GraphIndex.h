@@ -0,0 +1,95 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#pragma once
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct NodeLink;
+
+// Adjacency of the node graph with an evaluation order and reachability queries.
+// Links go from a source node (NodeLink::InputIdx) to a destination node (NodeLink::OutputIdx), the same pair
+// can be linked several times through different slots.
+// The evaluation order is a topological order kept valid incrementally when links are added,
+// reachability is answered with a bitset per node rebuilt lazily after changes.
+struct GraphIndex
+{
+    GraphIndex();
+
+    void Clear();
+    // linear time, for bulk changes like loading or undo
+    void Rebuild(size_t nodeCount, const std::vector<NodeLink>& links);
+
+    // new node is evaluated last
+    void AddNode();
+    // links of the node are removed, indices of the following nodes are shifted down
+    void DelNode(size_t index);
+    // links with out of range indices are ignored
+    void AddLink(size_t source, size_t destination);
+    void DelLink(size_t source, size_t destination);
+
+    // true if there is a path from source to destination
+    bool IsReachable(size_t source, size_t destination) const;
+    // true if linking source to destination would make a loop
+    bool IsCycling(size_t source, size_t destination) const
+    {
+        return source == destination || IsReachable(destination, source);
+    }
+
+    size_t GetNodeCount() const
+    {
+        return mInputs.size();
+    }
+    // sources first
+    const std::vector<size_t>& GetEvaluationOrder() const
+    {
+        return mOrder;
+    }
+    const std::vector<size_t>& GetInputNodes(size_t index) const
+    {
+        return mInputs[index];
+    }
+    const std::vector<size_t>& GetOutputNodes(size_t index) const
+    {
+        return mOutputs[index];
+    }
+
+protected:
+    void SortNodes();
+    void ComputeReachability() const;
+
+    std::vector<std::vector<size_t>> mInputs;
+    std::vector<std::vector<size_t>> mOutputs;
+    std::vector<size_t> mOrder;
+    std::vector<size_t> mPosition; // in mOrder, per node
+    std::vector<uint8_t> mVisited;
+
+    // one row of mReachableWordCount words per node, bit set for each node reachable from it
+    mutable std::vector<uint64_t> mReachable;
+    mutable size_t mReachableWordCount;
+    mutable bool mReachableDirty;
+};
@@ -0,0 +1,324 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "Platform.h"
+#include "GraphLayout.h"
+#include "GraphIndex.h"
+#include <algorithm>
+
+static const int CrossingSweeps = 12;
+static const int PlacementSweeps = 8;
+
+// nodes of the graph followed by dummy nodes on the long links
+struct LayeredGraph
+{
+    std::vector<int> mLayer;
+    // linked nodes in the layer above (sources side) and below
+    std::vector<std::vector<int>> mUpper;
+    std::vector<std::vector<int>> mLower;
+    std::vector<std::vector<int>> mLayers;
+    std::vector<int> mRank; // in its layer
+
+    int AddNode(int layer)
+    {
+        mLayer.push_back(layer);
+        mUpper.push_back(std::vector<int>());
+        mLower.push_back(std::vector<int>());
+        return int(mLayer.size()) - 1;
+    }
+    void AddEdge(int upper, int lower)
+    {
+        mLower[upper].push_back(lower);
+        mUpper[lower].push_back(upper);
+    }
+    void UpdateRanks(int layer)
+    {
+        const std::vector<int>& layerNodes = mLayers[layer];
+        for (size_t i = 0; i < layerNodes.size(); i++)
+            mRank[layerNodes[i]] = int(i);
+    }
+};
+
+// crossings between a layer and the one below, inversion count with a Fenwick tree
+static size_t CountCrossings(const LayeredGraph& graph, int layer, std::vector<int>& tree)
+{
+    const std::vector<int>& upperNodes = graph.mLayers[layer];
+    const int lowerCount = int(graph.mLayers[layer - 1].size());
+    tree.assign(lowerCount + 1, 0);
+
+    size_t crossings = 0;
+    size_t edgeCount = 0;
+    std::vector<int> ranks;
+    for (auto node : upperNodes)
+    {
+        // edges from the same node don't cross each other
+        ranks.clear();
+        for (auto lower : graph.mLower[node])
+            ranks.push_back(graph.mRank[lower]);
+        for (auto rank : ranks)
+        {
+            // edges already inserted ending strictly after rank
+            size_t before = 0;
+            for (int i = rank + 1; i > 0; i -= i & -i)
+                before += tree[i];
+            crossings += edgeCount - before;
+        }
+        for (auto rank : ranks)
+        {
+            for (int i = rank + 1; i <= lowerCount; i += i & -i)
+                tree[i]++;
+            edgeCount++;
+        }
+    }
+    return crossings;
+}
+
+static size_t CountCrossings(const LayeredGraph& graph, std::vector<int>& tree)
+{
+    size_t crossings = 0;
+    for (int layer = 1; layer < int(graph.mLayers.size()); layer++)
+        crossings += CountCrossings(graph, layer, tree);
+    return crossings;
+}
+
+// sort a layer by the mean rank of the linked nodes in the adjacent layer, unlinked nodes keep their rank
+static void SortByBarycenter(LayeredGraph& graph, int layer, bool useUpper, std::vector<float>& keys)
+{
+    std::vector<int>& layerNodes = graph.mLayers[layer];
+    for (auto node : layerNodes)
+    {
+        const std::vector<int>& linked = useUpper ? graph.mUpper[node] : graph.mLower[node];
+        if (linked.empty())
+        {
+            keys[node] = float(graph.mRank[node]);
+            continue;
+        }
+        float sum = 0.f;
+        for (auto other : linked)
+            sum += float(graph.mRank[other]);
+        keys[node] = sum / float(linked.size());
+    }
+    std::stable_sort(layerNodes.begin(), layerNodes.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+    graph.UpdateRanks(layer);
+}
+
+// closest positions to desired (least squares) keeping the layer order and a spacing of 1: pool adjacent violators
+// on desired[i] - i
+static void PlaceLayer(const std::vector<int>& layerNodes, const std::vector<float>& desired, std::vector<float>& stack)
+{
+    struct Block
+    {
+        float mSum;
+        int mCount;
+    };
+    std::vector<Block> blocks;
+    blocks.reserve(layerNodes.size());
+    for (size_t i = 0; i < layerNodes.size(); i++)
+    {
+        blocks.push_back({desired[i] - float(i), 1});
+        while (blocks.size() > 1)
+        {
+            Block& last = blocks[blocks.size() - 1];
+            Block& previous = blocks[blocks.size() - 2];
+            if (previous.mSum * float(last.mCount) <= last.mSum * float(previous.mCount))
+                break;
+            previous.mSum += last.mSum;
+            previous.mCount += last.mCount;
+            blocks.pop_back();
+        }
+    }
+    size_t i = 0;
+    for (auto& block : blocks)
+    {
+        const float mean = block.mSum / float(block.mCount);
+        for (int j = 0; j < block.mCount; j++, i++)
+            stack[layerNodes[i]] = mean + float(i);
+    }
+}
+
+static void PlaceByMedian(LayeredGraph& graph, int layer, bool useUpper, std::vector<float>& stack)
+{
+    const std::vector<int>& layerNodes = graph.mLayers[layer];
+    std::vector<float> desired(layerNodes.size());
+    std::vector<float> linkedStacks;
+    for (size_t i = 0; i < layerNodes.size(); i++)
+    {
+        const int node = layerNodes[i];
+        const std::vector<int>& linked = useUpper ? graph.mUpper[node] : graph.mLower[node];
+        if (linked.empty())
+        {
+            desired[i] = stack[node];
+            continue;
+        }
+        linkedStacks.clear();
+        for (auto other : linked)
+            linkedStacks.push_back(stack[other]);
+        std::sort(linkedStacks.begin(), linkedStacks.end());
+        const size_t half = linkedStacks.size() / 2;
+        desired[i] =
+            (linkedStacks.size() & 1) ? linkedStacks[half] : (linkedStacks[half - 1] + linkedStacks[half]) * 0.5f;
+    }
+    PlaceLayer(layerNodes, desired, stack);
+}
+
+void ComputeGraphLayout(const GraphIndex& graphIndex,
+                        const std::vector<uint8_t>& mask,
+                        std::vector<LayoutPosition>& positions)
+{
+    const size_t nodeCount = graphIndex.GetNodeCount();
+    auto isPlaced = [&](size_t node) { return mask.empty() || mask[node]; };
+    positions.assign(nodeCount, {-1, 0.f});
+
+    // longest path layering, destinations are done first in reverse evaluation order
+    LayeredGraph graph;
+    int layerCount = 0;
+    const std::vector<size_t>& order = graphIndex.GetEvaluationOrder();
+    std::vector<int> layers(nodeCount, -1);
+    for (size_t i = order.size(); i > 0; i--)
+    {
+        const size_t node = order[i - 1];
+        if (!isPlaced(node))
+            continue;
+        int layer = 0;
+        for (auto destination : graphIndex.GetOutputNodes(node))
+        {
+            if (isPlaced(destination))
+                layer = std::max(layer, layers[destination] + 1);
+        }
+        layers[node] = layer;
+        layerCount = std::max(layerCount, layer + 1);
+    }
+    // outputs of deep nodes would stay in layer 0 with long links: move nodes with inputs next to their closest input,
+    // in evaluation order so inputs are final
+    for (auto node : order)
+    {
+        if (layers[node] < 0)
+            continue;
+        int closestInput = -1;
+        for (auto source : graphIndex.GetInputNodes(node))
+        {
+            if (layers[source] >= 0 && (closestInput < 0 || layers[source] < closestInput))
+                closestInput = layers[source];
+        }
+        if (closestInput > 0)
+            layers[node] = closestInput - 1;
+    }
+    for (size_t node = 0; node < nodeCount; node++)
+        graph.AddNode(layers[node]);
+
+    // split links spanning several layers
+    for (size_t node = 0; node < nodeCount; node++)
+    {
+        if (layers[node] < 0)
+            continue;
+        for (auto destination : graphIndex.GetOutputNodes(node))
+        {
+            if (layers[destination] < 0)
+                continue;
+            int upper = int(node);
+            for (int layer = layers[node] - 1; layer > layers[destination]; layer--)
+            {
+                int dummy = graph.AddNode(layer);
+                graph.AddEdge(upper, dummy);
+                upper = dummy;
+            }
+            graph.AddEdge(upper, int(destination));
+        }
+    }
+
+    const size_t totalCount = graph.mLayer.size();
+    graph.mLayers.resize(layerCount);
+    graph.mRank.resize(totalCount);
+    for (size_t node = 0; node < totalCount; node++)
+    {
+        if (graph.mLayer[node] >= 0)
+            graph.mLayers[graph.mLayer[node]].push_back(int(node));
+    }
+    for (int layer = 0; layer < layerCount; layer++)
+        graph.UpdateRanks(layer);
+
+    // crossing reduction, sweeping from the outputs to the sources then back. Best order is kept
+    std::vector<float> keys(totalCount);
+    std::vector<int> tree;
+    std::vector<std::vector<int>> bestLayers = graph.mLayers;
+    size_t bestCrossings = CountCrossings(graph, tree);
+    for (int sweep = 0; sweep < CrossingSweeps && bestCrossings; sweep++)
+    {
+        if (sweep & 1)
+        {
+            for (int layer = layerCount - 2; layer >= 0; layer--)
+                SortByBarycenter(graph, layer, true, keys);
+        }
+        else
+        {
+            for (int layer = 1; layer < layerCount; layer++)
+                SortByBarycenter(graph, layer, false, keys);
+        }
+        size_t crossings = CountCrossings(graph, tree);
+        if (crossings < bestCrossings)
+        {
+            bestCrossings = crossings;
+            bestLayers = graph.mLayers;
+        }
+    }
+    graph.mLayers = bestLayers;
+    for (int layer = 0; layer < layerCount; layer++)
+        graph.UpdateRanks(layer);
+
+    // coordinates, starting from the ranks and moving nodes toward the median of the linked nodes
+    std::vector<float> stack(totalCount);
+    for (size_t node = 0; node < totalCount; node++)
+        stack[node] = float(graph.mRank[node]);
+    for (int sweep = 0; sweep < PlacementSweeps; sweep++)
+    {
+        if (sweep & 1)
+        {
+            for (int layer = layerCount - 2; layer >= 0; layer--)
+                PlaceByMedian(graph, layer, true, stack);
+        }
+        else
+        {
+            for (int layer = 1; layer < layerCount; layer++)
+                PlaceByMedian(graph, layer, false, stack);
+        }
+    }
+
+    // top at 0
+    float minStack = 0.f;
+    bool first = true;
+    for (size_t node = 0; node < nodeCount; node++)
+    {
+        if (layers[node] < 0)
+            continue;
+        minStack = first ? stack[node] : std::min(minStack, stack[node]);
+        first = false;
+    }
+    for (size_t node = 0; node < nodeCount; node++)
+    {
+        if (layers[node] >= 0)
+            positions[node] = {layers[node], stack[node] - minStack};
+    }
+}
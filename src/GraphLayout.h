@@ -0,0 +1,47 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+struct GraphIndex;
+
+struct LayoutPosition
+{
+    int mLayer;
+    float mStack;
+};
+
+// Layered graph layout (Sugiyama). Layers are the longest path to a node without outputs: layer 0 holds the
+// graph outputs and sources get the highest layers. Links spanning several layers go through dummy nodes,
+// crossings are reduced with barycentric sweeps and stack positions are placed as close as possible to the linked
+// nodes while keeping one unit between nodes of the same layer.
+// Only nodes with a non zero mask are placed, links to other nodes are ignored. An empty mask selects all nodes.
+// Unplaced nodes get layer -1.
+void ComputeGraphLayout(const GraphIndex& graph,
+                        const std::vector<uint8_t>& mask,
+                        std::vector<LayoutPosition>& positions);
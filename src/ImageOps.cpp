@@ -0,0 +1,813 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "Platform.h"
+#include "ImageOps.h"
+#include "Bitmap.h"
+#include "Utils.h"
+#include "cmft/common/halffloat.h"
+#include <algorithm>
+
+extern TaskScheduler g_TS;
+
+namespace ImageOps
+{
+    // same range as the cmft RGBM encoding
+    static const float RGBMRange = 6.f;
+    // texels are converted by blocks that stay in cache, tasks get chunks of blocks
+    static const size_t BlockTexelCount = 256;
+    static const size_t ChunkTexelCount = 16384;
+
+    static inline unsigned char ToUnorm8(float v)
+    {
+        return (unsigned char)(std::min(std::max(v, 0.f), 1.f) * 255.f + 0.5f);
+    }
+
+    static inline unsigned short ToUnorm16(float v)
+    {
+        return (unsigned short)(std::min(std::max(v, 0.f), 1.f) * 65535.f + 0.5f);
+    }
+
+    static void RunTaskSet(TaskSet* taskSet)
+    {
+        g_TS.AddTaskSetToPipe(taskSet);
+        g_TS.WaitforTaskSet(taskSet);
+    }
+
+    // 8 bits RGBA/BGRA <-> float RGBA, 4 texels at a time
+    static void DecodeRGBA8(const unsigned char* src, size_t count, float* dst, bool bgra)
+    {
+        size_t i = 0;
+#if IMOGEN_SSE2
+        const __m128 scale = _mm_set1_ps(1.f / 255.f);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i texels = _mm_loadu_si128((const __m128i*)(src + i * 4));
+            __m128i lo = _mm_unpacklo_epi8(texels, zero);
+            __m128i hi = _mm_unpackhi_epi8(texels, zero);
+            __m128 v[4] = {_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)),
+                           _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+                           _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)),
+                           _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero))};
+            for (int j = 0; j < 4; j++)
+            {
+                __m128 t = _mm_mul_ps(v[j], scale);
+                if (bgra)
+                    t = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 0, 1, 2));
+                _mm_storeu_ps(dst + (i + j) * 4, t);
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            const unsigned char* s = src + i * 4;
+            float* d = dst + i * 4;
+            d[0] = float(s[bgra ? 2 : 0]) / 255.f;
+            d[1] = float(s[1]) / 255.f;
+            d[2] = float(s[bgra ? 0 : 2]) / 255.f;
+            d[3] = float(s[3]) / 255.f;
+        }
+    }
+
+    static void EncodeRGBA8(const float* src, size_t count, unsigned char* dst, bool bgra)
+    {
+        size_t i = 0;
+#if IMOGEN_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 scale = _mm_set1_ps(255.f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v[4];
+            for (int j = 0; j < 4; j++)
+            {
+                __m128 t = _mm_loadu_ps(src + (i + j) * 4);
+                if (bgra)
+                    t = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 0, 1, 2));
+                t = _mm_min_ps(_mm_max_ps(t, zero), one);
+                v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(t, scale), half));
+            }
+            __m128i lo = _mm_packs_epi32(v[0], v[1]);
+            __m128i hi = _mm_packs_epi32(v[2], v[3]);
+            _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            const float* s = src + i * 4;
+            unsigned char* d = dst + i * 4;
+            d[bgra ? 2 : 0] = ToUnorm8(s[0]);
+            d[1] = ToUnorm8(s[1]);
+            d[bgra ? 0 : 2] = ToUnorm8(s[2]);
+            d[3] = ToUnorm8(s[3]);
+        }
+    }
+
+    static void DecodeTexels(const unsigned char* src, int format, size_t count, float* dst)
+    {
+        const unsigned short* src16 = (const unsigned short*)src;
+        const float* src32 = (const float*)src;
+        switch (format)
+        {
+            case TextureFormat::BGR8:
+            case TextureFormat::RGB8:
+            {
+                int r = (format == TextureFormat::BGR8) ? 2 : 0;
+                for (size_t i = 0; i < count; i++, src += 3, dst += 4)
+                {
+                    dst[0] = float(src[r]) / 255.f;
+                    dst[1] = float(src[1]) / 255.f;
+                    dst[2] = float(src[2 - r]) / 255.f;
+                    dst[3] = 1.f;
+                }
+                break;
+            }
+            case TextureFormat::RGB16:
+                for (size_t i = 0; i < count; i++, src16 += 3, dst += 4)
+                {
+                    dst[0] = float(src16[0]) / 65535.f;
+                    dst[1] = float(src16[1]) / 65535.f;
+                    dst[2] = float(src16[2]) / 65535.f;
+                    dst[3] = 1.f;
+                }
+                break;
+            case TextureFormat::RGB16F:
+                for (size_t i = 0; i < count; i++, src16 += 3, dst += 4)
+                {
+                    dst[0] = cmft::halfToFloat(src16[0]);
+                    dst[1] = cmft::halfToFloat(src16[1]);
+                    dst[2] = cmft::halfToFloat(src16[2]);
+                    dst[3] = 1.f;
+                }
+                break;
+            case TextureFormat::RGB32F:
+                for (size_t i = 0; i < count; i++, src32 += 3, dst += 4)
+                {
+                    dst[0] = src32[0];
+                    dst[1] = src32[1];
+                    dst[2] = src32[2];
+                    dst[3] = 1.f;
+                }
+                break;
+            case TextureFormat::RGBE:
+                for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+                {
+                    float exponent = src[3] ? ldexpf(1.f, int(src[3]) - (128 + 8)) : 0.f;
+                    dst[0] = float(src[0]) * exponent;
+                    dst[1] = float(src[1]) * exponent;
+                    dst[2] = float(src[2]) * exponent;
+                    dst[3] = 1.f;
+                }
+                break;
+            case TextureFormat::BGRA8:
+            case TextureFormat::RGBA8:
+                DecodeRGBA8(src, count, dst, format == TextureFormat::BGRA8);
+                break;
+            case TextureFormat::RGBA16:
+                for (size_t i = 0; i < count * 4; i++)
+                    dst[i] = float(src16[i]) / 65535.f;
+                break;
+            case TextureFormat::RGBA16F:
+                for (size_t i = 0; i < count * 4; i++)
+                    dst[i] = cmft::halfToFloat(src16[i]);
+                break;
+            case TextureFormat::RGBA32F:
+                memcpy(dst, src, count * 4 * sizeof(float));
+                break;
+            case TextureFormat::RGBM:
+                for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+                {
+                    float multiplier = float(src[3]) / 255.f * RGBMRange;
+                    dst[0] = float(src[0]) / 255.f * multiplier;
+                    dst[1] = float(src[1]) / 255.f * multiplier;
+                    dst[2] = float(src[2]) / 255.f * multiplier;
+                    dst[3] = 1.f;
+                }
+                break;
+        }
+    }
+
+    static void EncodeTexels(const float* src, int format, size_t count, unsigned char* dst)
+    {
+        unsigned short* dst16 = (unsigned short*)dst;
+        float* dst32 = (float*)dst;
+        switch (format)
+        {
+            case TextureFormat::BGR8:
+            case TextureFormat::RGB8:
+            {
+                int r = (format == TextureFormat::BGR8) ? 2 : 0;
+                for (size_t i = 0; i < count; i++, src += 4, dst += 3)
+                {
+                    dst[r] = ToUnorm8(src[0]);
+                    dst[1] = ToUnorm8(src[1]);
+                    dst[2 - r] = ToUnorm8(src[2]);
+                }
+                break;
+            }
+            case TextureFormat::RGB16:
+                for (size_t i = 0; i < count; i++, src += 4, dst16 += 3)
+                {
+                    dst16[0] = ToUnorm16(src[0]);
+                    dst16[1] = ToUnorm16(src[1]);
+                    dst16[2] = ToUnorm16(src[2]);
+                }
+                break;
+            case TextureFormat::RGB16F:
+                for (size_t i = 0; i < count; i++, src += 4, dst16 += 3)
+                {
+                    dst16[0] = cmft::halfFromFloat(src[0]);
+                    dst16[1] = cmft::halfFromFloat(src[1]);
+                    dst16[2] = cmft::halfFromFloat(src[2]);
+                }
+                break;
+            case TextureFormat::RGB32F:
+                for (size_t i = 0; i < count; i++, src += 4, dst32 += 3)
+                {
+                    dst32[0] = src[0];
+                    dst32[1] = src[1];
+                    dst32[2] = src[2];
+                }
+                break;
+            case TextureFormat::RGBE:
+                for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+                {
+                    float maxValue = std::max(std::max(src[0], src[1]), src[2]);
+                    if (maxValue < 1e-32f)
+                    {
+                        dst[0] = dst[1] = dst[2] = dst[3] = 0;
+                        continue;
+                    }
+                    int exponent;
+                    float scale = frexpf(maxValue, &exponent) * 256.f / maxValue;
+                    dst[0] = (unsigned char)std::max(src[0] * scale, 0.f);
+                    dst[1] = (unsigned char)std::max(src[1] * scale, 0.f);
+                    dst[2] = (unsigned char)std::max(src[2] * scale, 0.f);
+                    dst[3] = (unsigned char)(exponent + 128);
+                }
+                break;
+            case TextureFormat::BGRA8:
+            case TextureFormat::RGBA8:
+                EncodeRGBA8(src, count, dst, format == TextureFormat::BGRA8);
+                break;
+            case TextureFormat::RGBA16:
+                for (size_t i = 0; i < count * 4; i++)
+                    dst16[i] = ToUnorm16(src[i]);
+                break;
+            case TextureFormat::RGBA16F:
+                for (size_t i = 0; i < count * 4; i++)
+                    dst16[i] = cmft::halfFromFloat(src[i]);
+                break;
+            case TextureFormat::RGBA32F:
+                memcpy(dst, src, count * 4 * sizeof(float));
+                break;
+            case TextureFormat::RGBM:
+                for (size_t i = 0; i < count; i++, src += 4, dst += 4)
+                {
+                    float r = std::max(src[0], 0.f) / RGBMRange;
+                    float g = std::max(src[1], 0.f) / RGBMRange;
+                    float b = std::max(src[2], 0.f) / RGBMRange;
+                    float multiplier = std::min(std::max(std::max(r, g), std::max(b, 1e-6f)), 1.f);
+                    multiplier = ceilf(multiplier * 255.f) / 255.f;
+                    dst[0] = ToUnorm8(r / multiplier);
+                    dst[1] = ToUnorm8(g / multiplier);
+                    dst[2] = ToUnorm8(b / multiplier);
+                    dst[3] = ToUnorm8(multiplier);
+                }
+                break;
+        }
+    }
+
+    static bool HasAlpha(int format)
+    {
+        return format == TextureFormat::BGRA8 || format == TextureFormat::RGBA8 || format == TextureFormat::RGBA16 ||
+               format == TextureFormat::RGBA16F || format == TextureFormat::RGBA32F;
+    }
+
+    static void MultiplyAlpha(float* texels, size_t count, bool divide)
+    {
+        size_t i = 0;
+#if IMOGEN_SSE2
+        const __m128 colorMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 zero = _mm_setzero_ps();
+        for (; i < count; i++)
+        {
+            __m128 texel = _mm_loadu_ps(texels + i * 4);
+            __m128 alpha = _mm_shuffle_ps(texel, texel, _MM_SHUFFLE(3, 3, 3, 3));
+            if (divide)
+            {
+                // transparent texels keep their color
+                __m128 valid = _mm_cmpgt_ps(alpha, zero);
+                alpha = _mm_or_ps(_mm_and_ps(valid, _mm_div_ps(one, alpha)), _mm_andnot_ps(valid, one));
+            }
+            // alpha channel is left untouched
+            alpha = _mm_or_ps(_mm_and_ps(colorMask, alpha), _mm_andnot_ps(colorMask, one));
+            _mm_storeu_ps(texels + i * 4, _mm_mul_ps(texel, alpha));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            float* texel = texels + i * 4;
+            float alpha = texel[3];
+            if (divide)
+                alpha = (alpha > 0.f) ? 1.f / alpha : 1.f;
+            texel[0] *= alpha;
+            texel[1] *= alpha;
+            texel[2] *= alpha;
+        }
+    }
+
+    // decode texels, optionally apply an operation, encode them to another format. src and dst can be the same
+    struct TexelTaskSet : TaskSet
+    {
+        enum Operation
+        {
+            OP_NONE,
+            OP_PREMULTIPLY,
+            OP_UNPREMULTIPLY,
+        };
+        TexelTaskSet(
+            const unsigned char* src, int srcFormat, unsigned char* dst, int dstFormat, size_t count, int operation)
+            : TaskSet(uint32_t((count + ChunkTexelCount - 1) / ChunkTexelCount))
+            , mSrc(src)
+            , mSrcFormat(srcFormat)
+            , mDst(dst)
+            , mDstFormat(dstFormat)
+            , mCount(count)
+            , mOperation(operation)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            float texels[BlockTexelCount * 4];
+            size_t srcTexelSize = textureFormatSize[mSrcFormat];
+            size_t dstTexelSize = textureFormatSize[mDstFormat];
+            for (uint32_t chunk = range.start; chunk < range.end; chunk++)
+            {
+                size_t first = size_t(chunk) * ChunkTexelCount;
+                size_t last = std::min(first + ChunkTexelCount, mCount);
+                for (size_t block = first; block < last; block += BlockTexelCount)
+                {
+                    size_t count = std::min(BlockTexelCount, last - block);
+                    DecodeTexels(mSrc + block * srcTexelSize, mSrcFormat, count, texels);
+                    if (mOperation != OP_NONE)
+                        MultiplyAlpha(texels, count, mOperation == OP_UNPREMULTIPLY);
+                    EncodeTexels(texels, mDstFormat, count, mDst + block * dstTexelSize);
+                }
+            }
+        }
+        const unsigned char* mSrc;
+        int mSrcFormat;
+        unsigned char* mDst;
+        int mDstFormat;
+        size_t mCount;
+        int mOperation;
+    };
+
+    static void ConvertTexels(const unsigned char* src, int srcFormat, unsigned char* dst, int dstFormat, size_t count)
+    {
+        if (!count)
+            return;
+        TexelTaskSet convertTask(src, srcFormat, dst, dstFormat, count, TexelTaskSet::OP_NONE);
+        RunTaskSet(&convertTask);
+    }
+
+    static bool IsValid(const Image* image)
+    {
+        if (!image || !image->GetBits() || image->mFormat >= TextureFormat::Count || image->mWidth <= 0 ||
+            image->mHeight <= 0)
+        {
+            return false;
+        }
+        size_t size = GetImageSize(image->mWidth,
+                                   image->mHeight,
+                                   image->mFormat,
+                                   std::max(int(image->mNumMips), 1),
+                                   std::max(int(image->mNumFaces), 1));
+        return image->mDataSize >= size;
+    }
+
+    size_t GetSurfaceSize(int width, int height, int format, int mip)
+    {
+        return size_t(std::max(width >> mip, 1)) * std::max(height >> mip, 1) * textureFormatSize[format];
+    }
+
+    size_t GetImageSize(int width, int height, int format, int mipCount, int faceCount)
+    {
+        size_t size = 0;
+        for (int mip = 0; mip < mipCount; mip++)
+            size += GetSurfaceSize(width, height, format, mip);
+        return size * faceCount;
+    }
+
+    // Separable resampling : weights of the source texels for each destination texel along one axis
+    struct FilterWeights
+    {
+        std::vector<int> mFirst;
+        std::vector<int> mCount;
+        std::vector<float> mWeights; // mMaxCount per destination texel
+        int mMaxCount;
+    };
+
+    static float Sinc(float x)
+    {
+        x *= PI;
+        return (fabsf(x) < 1e-5f) ? 1.f : sinf(x) / x;
+    }
+
+    static float FilterWeight(int filter, float x)
+    {
+        if (filter == FILTER_LANCZOS)
+            return (fabsf(x) < 3.f) ? Sinc(x) * Sinc(x / 3.f) : 0.f;
+        return (x >= -0.5f && x < 0.5f) ? 1.f : 0.f;
+    }
+
+    static void ComputeFilterWeights(int srcSize, int dstSize, int filter, FilterWeights& weights)
+    {
+        float scale = float(dstSize) / float(srcSize);
+        // filter is widened when minifying
+        float filterScale = (scale < 1.f) ? 1.f / scale : 1.f;
+        float support = ((filter == FILTER_LANCZOS) ? 3.f : 0.5f) * filterScale;
+        weights.mMaxCount = int(ceilf(support * 2.f)) + 2;
+        weights.mFirst.resize(dstSize);
+        weights.mCount.resize(dstSize);
+        weights.mWeights.assign(size_t(dstSize) * weights.mMaxCount, 0.f);
+        for (int i = 0; i < dstSize; i++)
+        {
+            float center = (float(i) + 0.5f) / scale;
+            int first = std::max(int(floorf(center - support - 0.5f)), 0);
+            int last = std::min(int(ceilf(center + support - 0.5f)), srcSize - 1);
+            last = std::min(last, first + weights.mMaxCount - 1);
+            float* w = &weights.mWeights[size_t(i) * weights.mMaxCount];
+            float total = 0.f;
+            for (int j = first; j <= last; j++)
+            {
+                w[j - first] = FilterWeight(filter, (float(j) + 0.5f - center) / filterScale);
+                total += w[j - first];
+            }
+            if (fabsf(total) < 1e-6f)
+            {
+                // no texel under the filter : nearest
+                first = std::min(int(center), srcSize - 1);
+                last = first;
+                w[0] = total = 1.f;
+            }
+            for (int j = first; j <= last; j++)
+                w[j - first] /= total;
+            weights.mFirst[i] = first;
+            weights.mCount[i] = last - first + 1;
+        }
+    }
+
+    static inline void AccumulateTexels(float* dst, const float* src, float weight, size_t floatCount)
+    {
+        size_t i = 0;
+#if IMOGEN_SSE2
+        __m128 w = _mm_set1_ps(weight);
+        for (; i + 4 <= floatCount; i += 4)
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), w)));
+#endif
+        for (; i < floatCount; i++)
+            dst[i] += src[i] * weight;
+    }
+
+    // horizontal pass : each row of the source is filtered to the destination width
+    struct ResampleRowsTaskSet : TaskSet
+    {
+        ResampleRowsTaskSet(const float* src, int srcWidth, int height, const FilterWeights& weights, int dstWidth, float* dst)
+            : TaskSet(height), mSrc(src), mSrcWidth(srcWidth), mWeights(weights), mDstWidth(dstWidth), mDst(dst)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t y = range.start; y < range.end; y++)
+            {
+                const float* src = mSrc + size_t(y) * mSrcWidth * 4;
+                float* dst = mDst + size_t(y) * mDstWidth * 4;
+                for (int x = 0; x < mDstWidth; x++, dst += 4)
+                {
+                    const float* w = &mWeights.mWeights[size_t(x) * mWeights.mMaxCount];
+                    const float* texel = src + size_t(mWeights.mFirst[x]) * 4;
+                    int count = mWeights.mCount[x];
+#if IMOGEN_SSE2
+                    __m128 sum = _mm_setzero_ps();
+                    for (int i = 0; i < count; i++, texel += 4)
+                        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texel), _mm_set1_ps(w[i])));
+                    _mm_storeu_ps(dst, sum);
+#else
+                    dst[0] = dst[1] = dst[2] = dst[3] = 0.f;
+                    for (int i = 0; i < count; i++, texel += 4)
+                    {
+                        dst[0] += texel[0] * w[i];
+                        dst[1] += texel[1] * w[i];
+                        dst[2] += texel[2] * w[i];
+                        dst[3] += texel[3] * w[i];
+                    }
+#endif
+                }
+            }
+        }
+        const float* mSrc;
+        int mSrcWidth;
+        const FilterWeights& mWeights;
+        int mDstWidth;
+        float* mDst;
+    };
+
+    // vertical pass : destination rows are weighted sums of whole source rows
+    struct ResampleColumnsTaskSet : TaskSet
+    {
+        ResampleColumnsTaskSet(const float* src, int width, const FilterWeights& weights, int dstHeight, float* dst)
+            : TaskSet(dstHeight), mSrc(src), mWidth(width), mWeights(weights), mDst(dst)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            size_t rowFloats = size_t(mWidth) * 4;
+            for (uint32_t y = range.start; y < range.end; y++)
+            {
+                float* dst = mDst + y * rowFloats;
+                memset(dst, 0, rowFloats * sizeof(float));
+                const float* w = &mWeights.mWeights[size_t(y) * mWeights.mMaxCount];
+                for (int i = 0; i < mWeights.mCount[y]; i++)
+                    AccumulateTexels(dst, mSrc + (mWeights.mFirst[y] + i) * rowFloats, w[i], rowFloats);
+            }
+        }
+        const float* mSrc;
+        int mWidth;
+        const FilterWeights& mWeights;
+        float* mDst;
+    };
+
+    int Resize(const Image* source, Image* destination, int width, int height, int filter)
+    {
+        if (!IsValid(source) || !destination || width <= 0 || height <= 0)
+            return EVAL_ERR;
+
+        int format = source->mFormat;
+        int faceCount = std::max(int(source->mNumFaces), 1);
+        size_t srcFaceSize = GetImageSize(source->mWidth, source->mHeight, format, std::max(int(source->mNumMips), 1), 1);
+        size_t dstFaceSize = GetSurfaceSize(width, height, format, 0);
+        unsigned char* bits = ImageBuffer::Allocate(dstFaceSize * faceCount);
+
+        FilterWeights horizontal, vertical;
+        ComputeFilterWeights(source->mWidth, width, filter, horizontal);
+        ComputeFilterWeights(source->mHeight, height, filter, vertical);
+
+        float* srcTexels = (float*)BufferPool::Allocate(size_t(source->mWidth) * source->mHeight * 4 * sizeof(float));
+        float* rows = (float*)BufferPool::Allocate(size_t(width) * source->mHeight * 4 * sizeof(float));
+        float* dstTexels = (float*)BufferPool::Allocate(size_t(width) * height * 4 * sizeof(float));
+        for (int face = 0; face < faceCount; face++)
+        {
+            ConvertTexels(source->GetBits() + face * srcFaceSize,
+                          format,
+                          (unsigned char*)srcTexels,
+                          TextureFormat::RGBA32F,
+                          size_t(source->mWidth) * source->mHeight);
+
+            ResampleRowsTaskSet rowsTask(srcTexels, source->mWidth, source->mHeight, horizontal, width, rows);
+            RunTaskSet(&rowsTask);
+            ResampleColumnsTaskSet columnsTask(rows, width, vertical, height, dstTexels);
+            RunTaskSet(&columnsTask);
+
+            ConvertTexels(
+                (unsigned char*)dstTexels, TextureFormat::RGBA32F, bits + face * dstFaceSize, format, size_t(width) * height);
+        }
+        BufferPool::Free(srcTexels);
+        BufferPool::Free(rows);
+        BufferPool::Free(dstTexels);
+
+        destination->mWidth = width;
+        destination->mHeight = height;
+        destination->mFormat = format;
+        destination->mNumMips = 1;
+        destination->mNumFaces = faceCount;
+        destination->AttachBits(bits, dstFaceSize * faceCount);
+        return EVAL_OK;
+    }
+
+    int Convert(const Image* source, Image* destination, int format)
+    {
+        if (!IsValid(source) || !destination || format < 0 || format >= TextureFormat::Count)
+            return EVAL_ERR;
+
+        int mipCount = std::max(int(source->mNumMips), 1);
+        int faceCount = std::max(int(source->mNumFaces), 1);
+        size_t size = GetImageSize(source->mWidth, source->mHeight, format, mipCount, faceCount);
+        size_t texelCount = size / textureFormatSize[format];
+        unsigned char* bits = ImageBuffer::Allocate(size);
+        ConvertTexels(source->GetBits(), source->mFormat, bits, format, texelCount);
+
+        destination->mWidth = source->mWidth;
+        destination->mHeight = source->mHeight;
+        destination->mNumMips = mipCount;
+        destination->mNumFaces = faceCount;
+        destination->mFormat = format;
+        destination->AttachBits(bits, size);
+        return EVAL_OK;
+    }
+
+    static void SwapRows(unsigned char* a, unsigned char* b, size_t size)
+    {
+        size_t i = 0;
+#if IMOGEN_SSE2
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            _mm_storeu_si128((__m128i*)(a + i), vb);
+            _mm_storeu_si128((__m128i*)(b + i), va);
+        }
+#endif
+        for (; i < size; i++)
+            Swap(a[i], b[i]);
+    }
+
+    struct FlipTaskSet : TaskSet
+    {
+        FlipTaskSet(unsigned char* bits, size_t stride, int height)
+            : TaskSet(height / 2), mBits(bits), mStride(stride), mHeight(height)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t y = range.start; y < range.end; y++)
+                SwapRows(mBits + y * mStride, mBits + (mHeight - 1 - y) * mStride, mStride);
+        }
+        unsigned char* mBits;
+        size_t mStride;
+        int mHeight;
+    };
+
+    int VFlip(Image* image)
+    {
+        if (!IsValid(image))
+            return EVAL_ERR;
+
+        image->Detach();
+        unsigned char* bits = image->GetBits();
+        for (int face = 0; face < std::max(int(image->mNumFaces), 1); face++)
+        {
+            for (int mip = 0; mip < std::max(int(image->mNumMips), 1); mip++)
+            {
+                int height = std::max(image->mHeight >> mip, 1);
+                if (height > 1)
+                {
+                    FlipTaskSet flipTask(bits, GetSurfaceSize(image->mWidth, 1, image->mFormat, mip), height);
+                    RunTaskSet(&flipTask);
+                }
+                bits += GetSurfaceSize(image->mWidth, image->mHeight, image->mFormat, mip);
+            }
+        }
+        return EVAL_OK;
+    }
+
+    static int ApplyAlpha(Image* image, int operation)
+    {
+        if (!IsValid(image))
+            return EVAL_ERR;
+        if (!HasAlpha(image->mFormat))
+            return EVAL_OK;
+
+        image->Detach();
+        size_t texelCount = GetImageSize(image->mWidth,
+                                         image->mHeight,
+                                         image->mFormat,
+                                         std::max(int(image->mNumMips), 1),
+                                         std::max(int(image->mNumFaces), 1)) /
+                            textureFormatSize[image->mFormat];
+        TexelTaskSet alphaTask(
+            image->GetBits(), image->mFormat, image->GetBits(), image->mFormat, texelCount, operation);
+        RunTaskSet(&alphaTask);
+        return EVAL_OK;
+    }
+
+    int Premultiply(Image* image)
+    {
+        return ApplyAlpha(image, TexelTaskSet::OP_PREMULTIPLY);
+    }
+
+    int Unpremultiply(Image* image)
+    {
+        return ApplyAlpha(image, TexelTaskSet::OP_UNPREMULTIPLY);
+    }
+
+    // 2x2 box filter of the previous mip, edge texels are repeated for odd sizes
+    struct MipTaskSet : TaskSet
+    {
+        MipTaskSet(const float* src, int srcWidth, int srcHeight, float* dst, int dstWidth, int dstHeight)
+            : TaskSet(dstHeight)
+            , mSrc(src)
+            , mSrcWidth(srcWidth)
+            , mSrcHeight(srcHeight)
+            , mDst(dst)
+            , mDstWidth(dstWidth)
+        {
+        }
+        virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+        {
+            for (uint32_t y = range.start; y < range.end; y++)
+            {
+                const float* row0 = mSrc + size_t(std::min(int(y) * 2, mSrcHeight - 1)) * mSrcWidth * 4;
+                const float* row1 = mSrc + size_t(std::min(int(y) * 2 + 1, mSrcHeight - 1)) * mSrcWidth * 4;
+                float* dst = mDst + size_t(y) * mDstWidth * 4;
+                for (int x = 0; x < mDstWidth; x++, dst += 4)
+                {
+                    int x0 = std::min(x * 2, mSrcWidth - 1) * 4;
+                    int x1 = std::min(x * 2 + 1, mSrcWidth - 1) * 4;
+#if IMOGEN_SSE2
+                    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+                                            _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+                    _mm_storeu_ps(dst, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+                    for (int c = 0; c < 4; c++)
+                        dst[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+                }
+            }
+        }
+        const float* mSrc;
+        int mSrcWidth, mSrcHeight;
+        float* mDst;
+        int mDstWidth;
+    };
+
+    int GenerateMips(Image* image, int mipCount)
+    {
+        if (!IsValid(image))
+            return EVAL_ERR;
+
+        int maxMipCount = 1;
+        while ((std::max(image->mWidth, image->mHeight) >> maxMipCount) > 0)
+            maxMipCount++;
+        if (mipCount <= 0 || mipCount > maxMipCount)
+            mipCount = std::min(maxMipCount, 255);
+
+        int format = image->mFormat;
+        int faceCount = std::max(int(image->mNumFaces), 1);
+        size_t srcFaceSize = GetImageSize(image->mWidth, image->mHeight, format, std::max(int(image->mNumMips), 1), 1);
+        size_t dstFaceSize = GetImageSize(image->mWidth, image->mHeight, format, mipCount, 1);
+        unsigned char* bits = ImageBuffer::Allocate(dstFaceSize * faceCount);
+
+        size_t baseTexelCount = size_t(image->mWidth) * image->mHeight;
+        float* texels = (float*)BufferPool::Allocate(baseTexelCount * 4 * sizeof(float));
+        float* mipTexels = (float*)BufferPool::Allocate(std::max(baseTexelCount / 2, size_t(1)) * 4 * sizeof(float));
+        for (int face = 0; face < faceCount; face++)
+        {
+            const unsigned char* src = image->GetBits() + face * srcFaceSize;
+            unsigned char* dst = bits + face * dstFaceSize;
+            memcpy(dst, src, GetSurfaceSize(image->mWidth, image->mHeight, format, 0));
+            if (mipCount < 2)
+                continue;
+
+            // mips are filtered from the float texels of the previous one
+            ConvertTexels(src, format, (unsigned char*)texels, TextureFormat::RGBA32F, baseTexelCount);
+            float* previous = texels;
+            float* current = mipTexels;
+            for (int mip = 1; mip < mipCount; mip++)
+            {
+                dst += GetSurfaceSize(image->mWidth, image->mHeight, format, mip - 1);
+                int srcWidth = std::max(image->mWidth >> (mip - 1), 1);
+                int srcHeight = std::max(image->mHeight >> (mip - 1), 1);
+                int dstWidth = std::max(image->mWidth >> mip, 1);
+                int dstHeight = std::max(image->mHeight >> mip, 1);
+                MipTaskSet mipTask(previous, srcWidth, srcHeight, current, dstWidth, dstHeight);
+                RunTaskSet(&mipTask);
+                ConvertTexels((unsigned char*)current, TextureFormat::RGBA32F, dst, format, size_t(dstWidth) * dstHeight);
+                Swap(previous, current);
+            }
+        }
+        BufferPool::Free(texels);
+        BufferPool::Free(mipTexels);
+
+        image->mNumMips = mipCount;
+        image->mNumFaces = faceCount;
+        image->AttachBits(bits, dstFaceSize * faceCount);
+        return EVAL_OK;
+    }
+} // namespace ImageOps
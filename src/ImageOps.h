@@ -0,0 +1,56 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+#include <stddef.h>
+
+struct Image;
+
+// CPU image processing for C and Python nodes, so simple operations don't need a GPU pass and a readback.
+// Texels are processed as float RGBA (SSE2 when available) by strips of rows on the task scheduler.
+// Images are laid out like the evaluation images : for each face, mips from largest to smallest.
+namespace ImageOps
+{
+    enum Filter
+    {
+        FILTER_BOX,
+        FILTER_LANCZOS,
+    };
+
+    size_t GetSurfaceSize(int width, int height, int format, int mip);
+    size_t GetImageSize(int width, int height, int format, int mipCount, int faceCount);
+
+    // resample the first mip of every face. destination can be source.
+    int Resize(const Image* source, Image* destination, int width, int height, int filter);
+    // convert between any TextureFormat. destination can be source.
+    int Convert(const Image* source, Image* destination, int format);
+    // flip every face and mip upside down
+    int VFlip(Image* image);
+    // no-op for formats without alpha
+    int Premultiply(Image* image);
+    int Unpremultiply(Image* image);
+    // rebuild the mips of every face from the first one with a box filter. mipCount 0 for the full chain
+    int GenerateMips(Image* image, int mipCount);
+} // namespace ImageOps
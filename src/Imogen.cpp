@@ -37,6 +37,7 @@
 #include "imgui_stdlib.h"
 #include "ImSequencer.h"
 #include "Evaluators.h"
+#include "RTSceneCache.h"
 #include "UI.h"
 #include "imgui_markdown/imgui_markdown.h"
 #include "imHotKey.h"
@@ -338,17 +339,22 @@ struct PinnedTaskUploadImage : PinnedTask
         , mIdentifier(identifier)
         , mbIsThumbnail(isThumbnail)
         , mControler(controler)
+        , mMaterialIdentifier(std::make_pair(0, 0))
+        , mMaterialNodeIdentifier(std::make_pair(0, 0))
     {
     }
 
     virtual void Execute()
     {
-        unsigned int textureId = Image::Upload(mImage, 0);
         if (mbIsThumbnail)
         {
-            Material* material = library.Get(mIdentifier);
-            if (material)
-                material->mThumbnailTextureId = textureId;
+            // the default icon stays until the texels are uploaded
+            ASyncId identifier = mIdentifier;
+            Image::Upload(mImage, 0, -1, [identifier](unsigned int textureId) {
+                Material* material = library.Get(identifier);
+                if (material)
+                    material->mThumbnailTextureId = textureId;
+            });
         }
         else
         {
@@ -359,6 +365,14 @@ struct PinnedTaskUploadImage : PinnedTask
                 EvaluationAPI::SetEvaluationImage(&mControler->mEditingContext, int(nodeIndex), mImage);
                 mControler->mEvaluationStages.SetEvaluationParameters(nodeIndex, node->mParameters);
                 mControler->mEditingContext.StageSetProcessing(nodeIndex, false);
+
+                // target content is now the one stored in the material node
+                Material* material = mMaterialIdentifier.second ? library.Get(mMaterialIdentifier) : nullptr;
+                MaterialNode* materialNode = material ? material->Get(mMaterialNodeIdentifier) : nullptr;
+                if (materialNode)
+                {
+                    materialNode->mImageGeneration = mControler->mEditingContext.StageGetGeneration(nodeIndex);
+                }
             }
             Image::Free(mImage);
         }
@@ -367,6 +381,8 @@ struct PinnedTaskUploadImage : PinnedTask
     NodeGraphControler* mControler;
     ASyncId mIdentifier;
     bool mbIsThumbnail;
+    ASyncId mMaterialIdentifier;
+    ASyncId mMaterialNodeIdentifier;
 };
 
 struct DecodeThumbnailTaskSet : TaskSet
@@ -402,21 +418,18 @@ struct DecodeThumbnailTaskSet : TaskSet
 
 struct EncodeImageTaskSet : TaskSet
 {
-    EncodeImageTaskSet(Image image, ASyncId materialIdentifier, ASyncId nodeIdentifier)
-        : TaskSet(), mMaterialIdentifier(materialIdentifier), mNodeIdentifier(nodeIdentifier), mImage(image)
+    EncodeImageTaskSet(Image image, ASyncId materialIdentifier, ASyncId nodeIdentifier, unsigned int generation)
+        : TaskSet()
+        , mMaterialIdentifier(materialIdentifier)
+        , mNodeIdentifier(nodeIdentifier)
+        , mImage(std::move(image))
+        , mGeneration(generation)
     {
     }
     virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
     {
-        int outlen;
-        int components = 4;
-        unsigned char* bits = stbi_write_png_to_mem((unsigned char*)mImage.GetBits(),
-                                                    mImage.mWidth * components,
-                                                    mImage.mWidth,
-                                                    mImage.mHeight,
-                                                    components,
-                                                    &outlen);
-        if (bits)
+        std::vector<unsigned char> encoded;
+        if (Image::EncodeLossless(&mImage, encoded) == EVAL_OK)
         {
             Material* material = library.Get(mMaterialIdentifier);
             if (material)
@@ -424,8 +437,8 @@ struct EncodeImageTaskSet : TaskSet
                 MaterialNode* node = material->Get(mNodeIdentifier);
                 if (node)
                 {
-                    node->mImage.resize(outlen);
-                    memcpy(node->mImage.data(), bits, outlen);
+                    node->mImage.swap(encoded);
+                    node->mImageGeneration = mGeneration;
                 }
             }
         }
@@ -434,36 +447,42 @@ struct EncodeImageTaskSet : TaskSet
     ASyncId mMaterialIdentifier;
     ASyncId mNodeIdentifier;
     Image mImage;
+    unsigned int mGeneration;
 };
 
 struct DecodeImageTaskSet : TaskSet
 {
-    DecodeImageTaskSet(std::vector<uint8_t>* src, ASyncId identifier, NodeGraphControler* nodeGraphControler)
-        : TaskSet(), mIdentifier(identifier), mSrc(src), mNodeGraphControler(nodeGraphControler)
+    DecodeImageTaskSet(std::vector<uint8_t>* src,
+                       ASyncId identifier,
+                       NodeGraphControler* nodeGraphControler,
+                       ASyncId materialIdentifier,
+                       ASyncId materialNodeIdentifier)
+        : TaskSet()
+        , mIdentifier(identifier)
+        , mSrc(src)
+        , mNodeGraphControler(nodeGraphControler)
+        , mMaterialIdentifier(materialIdentifier)
+        , mMaterialNodeIdentifier(materialNodeIdentifier)
     {
     }
     virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
     {
         Image image;
-        int components;
-        unsigned char* data =
-            stbi_load_from_memory(mSrc->data(), int(mSrc->size()), &image.mWidth, &image.mHeight, &components, 0);
-        if (data)
+        if (Image::DecodeLossless(mSrc->data(), mSrc->size(), &image) == EVAL_OK)
         {
-            image.SetBits(data, image.mWidth * image.mHeight * components);
-            image.mNumFaces = 1;
-            image.mNumMips = 1;
-            image.mFormat = (components == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
             PinnedTaskUploadImage uploadTexTask(&image, mIdentifier, false, mNodeGraphControler);
+            uploadTexTask.mMaterialIdentifier = mMaterialIdentifier;
+            uploadTexTask.mMaterialNodeIdentifier = mMaterialNodeIdentifier;
             g_TS.AddPinnedTask(&uploadTexTask);
             g_TS.WaitforTask(&uploadTexTask);
-            stbi_image_free(data);
         }
         delete this;
     }
     ASyncId mIdentifier;
     std::vector<uint8_t>* mSrc;
     NodeGraphControler* mNodeGraphControler;
+    ASyncId mMaterialIdentifier;
+    ASyncId mMaterialNodeIdentifier;
 };
 
 void Imogen::DecodeThumbnailAsync(Material* material)
@@ -472,11 +491,25 @@ void Imogen::DecodeThumbnailAsync(Material* material)
     if (!material->mThumbnailTextureId)
     {
         material->mThumbnailTextureId = defaultTextureId;
-        g_TS.AddTaskSetToPipe(
-            new DecodeThumbnailTaskSet(&material->mThumbnail,
-                                       std::make_pair(material - library.mMaterials.data(), material->mRuntimeUniqueId),
-                                       mNodeGraphControler));
+        mPendingThumbnails.push_back(
+            std::make_pair(material - library.mMaterials.data(), material->mRuntimeUniqueId));
+    }
+}
+
+void Imogen::DispatchThumbnailDecodes()
+{
+    // library browsing must not delay the jobs of the edited graph
+    if (mPendingThumbnails.empty() || EvaluationAPI::GetPendingJobCount())
+        return;
+    for (auto identifier : mPendingThumbnails)
+    {
+        Material* material = library.Get(identifier);
+        if (material)
+        {
+            g_TS.AddTaskSetToPipe(new DecodeThumbnailTaskSet(&material->mThumbnail, identifier, mNodeGraphControler));
+        }
     }
+    mPendingThumbnails.clear();
 }
 
 template<typename T, typename Ty>
@@ -596,14 +629,16 @@ void ValidateMaterial(Library& library, NodeGraphControler& nodeGraphControler,
         MaterialNode& dstNode = material.mMaterialNodes[i];
         MetaNode& metaNode = gMetaNodes[srcNode.mType];
         dstNode.mRuntimeUniqueId = GetRuntimeId();
-        if (metaNode.mbSaveTexture)
+        unsigned int generation = nodeGraphControler.mEditingContext.StageGetGeneration(i);
+        if (metaNode.mbSaveTexture && (dstNode.mImage.empty() || dstNode.mImageGeneration != generation))
         {
             Image image;
             if (EvaluationAPI::GetEvaluationImage(&nodeGraphControler.mEditingContext, int(i), &image) == EVAL_OK)
             {
-                g_TS.AddTaskSetToPipe(new EncodeImageTaskSet(image,
+                g_TS.AddTaskSetToPipe(new EncodeImageTaskSet(std::move(image),
                                                              std::make_pair(materialIndex, material.mRuntimeUniqueId),
-                                                             std::make_pair(i, dstNode.mRuntimeUniqueId)));
+                                                             std::make_pair(i, dstNode.mRuntimeUniqueId),
+                                                             generation));
             }
         }
 
@@ -682,8 +717,12 @@ void Imogen::UpdateNewlySelectedGraph()
             if (!node.mImage.empty())
             {
                 mNodeGraphControler->mEditingContext.StageSetProcessing(i, true);
-                g_TS.AddTaskSetToPipe(new DecodeImageTaskSet(
-                    &node.mImage, std::make_pair(i, lastNode.mRuntimeUniqueId), mNodeGraphControler));
+                g_TS.AddTaskSetToPipe(
+                    new DecodeImageTaskSet(&node.mImage,
+                                           std::make_pair(i, lastNode.mRuntimeUniqueId),
+                                           mNodeGraphControler,
+                                           std::make_pair(mSelectedMaterial, material.mRuntimeUniqueId),
+                                           std::make_pair(i, node.mRuntimeUniqueId)));
             }
             lastNode.mInputSamplers = node.mInputSamplers;
             mNodeGraphControler->mEvaluationStages.SetEvaluationSampler(i, node.mInputSamplers);
@@ -1383,7 +1422,7 @@ void Imogen::Init()
         std::function<void()> function;
     };
     static const std::vector<HotKeyFunction> hotKeyFunctions = {
-        {"Layout", "Reorder nodes in a simpler layout", []() { NodeGraphLayout(); }},
+        {"Layout", "Reorder selected nodes, or all nodes, in a simpler layout", []() { NodeGraphLayout(true); }},
         {"PlayPause", "Play or Stop current animation", [&]() { PlayPause(); }},
         {"AnimationFirstFrame",
          "Set current time to the first frame of animation",
@@ -1459,6 +1498,12 @@ static const ImVec2 deltaHeight = ImVec2(0, 32);
 
 void Imogen::RunDeferedCommands()
 {
+    #if USE_PYTHON
+    {
+        // the main thread holds the GIL, Python threads and evaluations waiting for it run between frames
+        pybind11::gil_scoped_release release;
+    }
+    #endif
     if (!mRunCommand.size())
         return;
     std::string tmpCommand = mRunCommand;
@@ -1511,7 +1556,7 @@ void Imogen::ShowAppMainMenuBar()
     {
         if (Button("Layout", "Layout", buttonSize))
         {
-            NodeGraphLayout();
+            NodeGraphLayout(true);
         }
         if (Button("MaterialExport", "Export Material", buttonSize))
         {
@@ -1930,6 +1975,7 @@ void Imogen::Show(Builder* builder, Library& library, bool capturing)
     int currentTime = mCurrentTime;
     ImGuiIO& io = ImGui::GetIO();
     mBuilder = builder;
+    DispatchThumbnailDecodes();
     if (!capturing)
     {
         ShowTitleBar(builder);
@@ -2154,6 +2200,18 @@ void Imogen::ReadLine(ImGuiContext* ctx, ImGuiSettingsHandler* handler, void* en
         {
              userdata->imogen->mbShowMouseState = active;
         }       
+        else if (sscanf(line_start, "ImageCacheBudgetMB=%d", &active) == 1)
+        {
+            gImageCache.SetBudget(size_t(active) * 1024 * 1024);
+        }
+        else if (sscanf(line_start, "RTSceneCacheBudgetMB=%d", &active) == 1)
+        {
+            gRTSceneCache.SetBudget(size_t(active) * 1024 * 1024);
+        }
+        else if (sscanf(line_start, "UndoBudgetMB=%d", &active) == 1)
+        {
+            gUndoRedoHandler.SetBudget(size_t(active) * 1024 * 1024);
+        }
 		else
         {
             for (auto& hotkey : mHotkeys)
@@ -2180,6 +2238,9 @@ void Imogen::WriteAll(ImGuiContext* ctx, ImGuiSettingsHandler* handler, ImGuiTex
     buf->appendf("ShowParameters=%d\n", instance->mbShowParameters ? 1 : 0);
     buf->appendf("ShowMouseState=%d\n", instance->mbShowMouseState ? 1 : 0);
     buf->appendf("LibraryViewMode=%d\n", instance->mLibraryViewMode);
+    buf->appendf("ImageCacheBudgetMB=%d\n", int(gImageCache.GetBudget() / (1024 * 1024)));
+    buf->appendf("RTSceneCacheBudgetMB=%d\n", int(gRTSceneCache.GetBudget() / (1024 * 1024)));
+    buf->appendf("UndoBudgetMB=%d\n", int(gUndoRedoHandler.GetBudget() / (1024 * 1024)));
 
     for (const auto& hotkey : mHotkeys)
     {
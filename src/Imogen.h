@@ -26,6 +26,8 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <functional>
@@ -82,6 +84,8 @@ struct Imogen
     void SetExistingMaterialActive(int materialIndex);
     void SetExistingMaterialActive(const char* materialName);
     void DecodeThumbnailAsync(Material* material);
+    // queued thumbnails are decoded when no node job is pending
+    void DispatchThumbnailDecodes();
 
     static void RenderPreviewNode(int selNode, NodeGraphControler& nodeGraphControler, bool forceUI = false);
     void HandleHotKeys();
@@ -150,10 +154,30 @@ protected:
     int mCurrentTime = 0;
 
     std::string mRunCommand;
+    std::vector<ASyncId> mPendingThumbnails;
 
     std::vector<std::function<void()>> mHotkeyFunctions;
 };
 
+// memory kept by an undo entry for a copied element. Overload for elements owning more memory
+template<typename T>
+size_t GetUndoMemorySize(const T&)
+{
+    return sizeof(T);
+}
+
+// called on the copy kept by an undo entry. Overload for elements sharing resources they can rebuild
+template<typename T>
+void ReleaseUndoResources(T&)
+{
+}
+
+template<typename T>
+size_t GetUndoMemorySize(const std::vector<T>& elements)
+{
+    return sizeof(elements) + elements.capacity() * sizeof(T);
+}
+
 struct UndoRedo
 {
     UndoRedo();
@@ -188,15 +212,32 @@ struct UndoRedo
     {
         return mbDiscarded;
     }
+    // merge next into this entry when they change the same thing. Returns false when not possible
+    virtual bool Merge(const UndoRedo&)
+    {
+        return false;
+    }
+    virtual size_t GetMemorySize() const
+    {
+        size_t size = sizeof(UndoRedo);
+        for (auto& undoRedo : mSubUndoRedo)
+        {
+            size += undoRedo->GetMemorySize();
+        }
+        return size;
+    }
 
 protected:
     std::vector<std::shared_ptr<UndoRedo>> mSubUndoRedo;
     bool mbDiscarded;
 };
 
+// History is limited by a memory budget, oldest entries are dropped first.
+// Entries added less than MergeDelay seconds apart are merged when they allow it (dragging a slider).
 struct UndoRedoHandler
 {
-    UndoRedoHandler() : mbProcessing(false), mCurrent(NULL)
+    UndoRedoHandler()
+        : mbProcessing(false), mCurrent(NULL), mBudget(64 * 1024 * 1024), mMemoryUsed(0), mLastAddTime(-1000.)
     {
     }
     ~UndoRedoHandler()
@@ -213,6 +254,7 @@ struct UndoRedoHandler
         mRedos.push_back(mUndos.back());
         mUndos.pop_back();
         mbProcessing = false;
+        mLastAddTime = -1000.;
     }
 
     void Redo()
@@ -224,6 +266,7 @@ struct UndoRedoHandler
         mUndos.push_back(mRedos.back());
         mRedos.pop_back();
         mbProcessing = false;
+        mLastAddTime = -1000.;
     }
 
     template<typename T>
@@ -232,11 +275,38 @@ struct UndoRedoHandler
         if (undoRedo.IsDiscarded())
             return;
         if (mCurrent && &undoRedo != mCurrent)
+        {
             mCurrent->AddSubUndoRedo(undoRedo);
+        }
         else
+        {
+            const double time = ImGui::GetTime();
+            if (!mUndos.empty() && mRedos.empty() && time - mLastAddTime < MergeDelay)
+            {
+                size_t previousSize = mUndos.back()->GetMemorySize();
+                if (mUndos.back()->Merge(undoRedo))
+                {
+                    mMemoryUsed += mUndos.back()->GetMemorySize() - previousSize;
+                    mLastAddTime = time;
+                    return;
+                }
+            }
             mUndos.push_back(std::make_shared<T>(undoRedo));
+            mMemoryUsed += mUndos.back()->GetMemorySize();
+            mLastAddTime = time;
+        }
         mbProcessing = true;
+        for (auto& redo : mRedos)
+        {
+            mMemoryUsed -= redo->GetMemorySize();
+        }
         mRedos.clear();
+        // keep at least the last one
+        while (mMemoryUsed > mBudget && mUndos.size() > 1)
+        {
+            mMemoryUsed -= mUndos.front()->GetMemorySize();
+            mUndos.pop_front();
+        }
         mbProcessing = false;
     }
 
@@ -245,15 +315,35 @@ struct UndoRedoHandler
         mbProcessing = true;
         mUndos.clear();
         mRedos.clear();
+        mMemoryUsed = 0;
         mbProcessing = false;
     }
 
+    void SetBudget(size_t budget)
+    {
+        mBudget = budget;
+    }
+    size_t GetBudget() const
+    {
+        return mBudget;
+    }
+    size_t GetMemoryUsed() const
+    {
+        return mMemoryUsed;
+    }
+
     bool mbProcessing;
     UndoRedo* mCurrent;
     // private:
 
-    std::vector<std::shared_ptr<UndoRedo>> mUndos;
+    std::deque<std::shared_ptr<UndoRedo>> mUndos;
     std::vector<std::shared_ptr<UndoRedo>> mRedos;
+
+protected:
+    static constexpr double MergeDelay = 1.0;
+    size_t mBudget;
+    size_t mMemoryUsed;
+    double mLastAddTime;
 };
 
 extern UndoRedoHandler gUndoRedoHandler;
@@ -314,6 +404,10 @@ struct URChange : public UndoRedo
         *GetElements(mIndex) = mPostDo;
         Changed(mIndex);
     }
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + GetUndoMemorySize(mPreDo) + GetUndoMemorySize(mPostDo);
+    }
 
     T mPreDo;
     T mPostDo;
@@ -324,6 +418,111 @@ struct URChange : public UndoRedo
 };
 
 
+// URChange for byte blocks like node parameters. Only the XOR delta between before and after is kept, run length
+// encoded. Changes of overlapping bytes in quick succession are merged in a single entry.
+struct URChangeDelta : public UndoRedo
+{
+    URChangeDelta(int index,
+                  std::function<std::vector<unsigned char>*(int index)> GetElements,
+                  std::function<void(int index)> Changed = [](int) {})
+        : mIndex(index)
+        , mbFullCopy(false)
+        , mFirstByte(0)
+        , mLastByte(0)
+        , mBlockSize(0)
+        , GetElements(GetElements)
+        , Changed(Changed)
+    {
+        if (gUndoRedoHandler.mbProcessing)
+            return;
+
+        mPreDo = *GetElements(mIndex);
+    }
+    virtual ~URChangeDelta()
+    {
+        if (gUndoRedoHandler.mbProcessing || mbDiscarded)
+            return;
+
+        const std::vector<unsigned char>& postDo = *GetElements(mIndex);
+        if (postDo == mPreDo)
+            return;
+
+        if (postDo.size() == mPreDo.size())
+        {
+            EncodeDelta(mPreDo, postDo, mDelta);
+            mFirstByte = 0;
+            while (mPreDo[mFirstByte] == postDo[mFirstByte])
+                mFirstByte++;
+            mLastByte = postDo.size() - 1;
+            while (mPreDo[mLastByte] == postDo[mLastByte])
+                mLastByte--;
+            mBlockSize = postDo.size();
+            std::vector<unsigned char>().swap(mPreDo);
+        }
+        else
+        {
+            // size changed, full copies
+            mPostDo = postDo;
+            mbFullCopy = true;
+        }
+        gUndoRedoHandler.AddUndo(*this);
+    }
+    virtual void Undo()
+    {
+        if (mbFullCopy)
+            *GetElements(mIndex) = mPreDo;
+        else
+            ApplyDelta(*GetElements(mIndex), mDelta);
+        Changed(mIndex);
+        UndoRedo::Undo();
+    }
+    virtual void Redo()
+    {
+        UndoRedo::Redo();
+        if (mbFullCopy)
+            *GetElements(mIndex) = mPostDo;
+        else
+            ApplyDelta(*GetElements(mIndex), mDelta);
+        Changed(mIndex);
+    }
+    virtual bool Merge(const UndoRedo& next)
+    {
+        const URChangeDelta* nextDelta = dynamic_cast<const URChangeDelta*>(&next);
+        if (!nextDelta || nextDelta->mIndex != mIndex || mbFullCopy || nextDelta->mbFullCopy ||
+            !mSubUndoRedo.empty() || !nextDelta->mSubUndoRedo.empty() || nextDelta->mBlockSize != mBlockSize ||
+            nextDelta->mFirstByte > mLastByte || nextDelta->mLastByte < mFirstByte ||
+            GetElements(mIndex) != nextDelta->GetElements(nextDelta->mIndex))
+            return false;
+
+        // XOR deltas add up
+        std::vector<unsigned char> zero(mBlockSize, 0);
+        std::vector<unsigned char> merged(zero);
+        ApplyDelta(merged, mDelta);
+        ApplyDelta(merged, nextDelta->mDelta);
+        EncodeDelta(zero, merged, mDelta);
+        mFirstByte = std::min(mFirstByte, nextDelta->mFirstByte);
+        mLastByte = std::max(mLastByte, nextDelta->mLastByte);
+        return true;
+    }
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + sizeof(URChangeDelta) - sizeof(UndoRedo) + mDelta.capacity() +
+               mPreDo.capacity() + mPostDo.capacity();
+    }
+
+    std::vector<unsigned char> mPreDo;
+    std::vector<unsigned char> mPostDo;
+    std::vector<unsigned char> mDelta;
+    int mIndex;
+    bool mbFullCopy;
+    // range of changed bytes, to only merge changes of the same parameters
+    size_t mFirstByte, mLastByte;
+    size_t mBlockSize;
+
+    std::function<std::vector<unsigned char>*(int index)> GetElements;
+    std::function<void(int index)> Changed;
+};
+
 struct URDummy : public UndoRedo
 {
     URDummy() : UndoRedo()
@@ -362,6 +561,7 @@ struct URDel : public UndoRedo
             return;
 
         mDeletedElement = (*GetElements())[mIndex];
+        ReleaseUndoResources(mDeletedElement);
     }
     virtual ~URDel()
     {
@@ -382,6 +582,10 @@ struct URDel : public UndoRedo
         OnDelete(mIndex);
         GetElements()->erase(GetElements()->begin() + mIndex);
     }
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + GetUndoMemorySize(mDeletedElement);
+    }
 
     T mDeletedElement;
     int mIndex;
@@ -407,6 +611,7 @@ struct URAdd : public UndoRedo
             return;
 
         mAddedElement = (*GetElements())[mIndex];
+        ReleaseUndoResources(mAddedElement);
         // add to handler
         gUndoRedoHandler.AddUndo(*this);
     }
@@ -422,6 +627,10 @@ struct URAdd : public UndoRedo
         GetElements()->insert(GetElements()->begin() + mIndex, mAddedElement);
         OnNew(mIndex);
     }
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + GetUndoMemorySize(mAddedElement);
+    }
 
     T mAddedElement;
     int mIndex;
@@ -138,6 +138,7 @@ struct MaterialNode
     uint32_t mFrameEnd;
     // runtime
     unsigned int mRuntimeUniqueId;
+    unsigned int mImageGeneration{0}; // stage generation mImage was encoded from
 };
 
 struct MaterialNodeRug
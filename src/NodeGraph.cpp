@@ -37,6 +37,9 @@
 #include <array>
 #include "imgui_markdown/imgui_markdown.h"
 #include "UI.h"
+#include "GraphIndex.h"
+#include "SpatialGrid.h"
+#include "GraphLayout.h"
 
 void AddExtractedView(size_t nodeIndex);
 extern ImGui::MarkdownConfig mdConfig;
@@ -56,69 +59,17 @@ Node::Node(int type, const ImVec2& pos)
     mbSelected = false;
 }
 
-struct NodeOrder
-{
-    size_t mNodeIndex;
-    size_t mNodePriority;
-    bool operator<(const NodeOrder& other) const
-    {
-        return other.mNodePriority < mNodePriority; // reverse order compared to priority value: lower last
-    }
-};
-
-size_t PickBestNode(const std::vector<NodeOrder>& orders)
-{
-    for (auto& order : orders)
-    {
-        if (order.mNodePriority == 0)
-            return order.mNodeIndex;
-    }
-    // issue!
-    assert(0);
-    return -1;
-}
-
-void RecurseSetPriority(std::vector<NodeOrder>& orders,
-                        const std::vector<NodeLink>& links,
-                        size_t currentIndex,
-                        size_t currentPriority,
-                        size_t& undeterminedNodeCount)
-{
-    if (!orders[currentIndex].mNodePriority)
-        undeterminedNodeCount--;
-
-    orders[currentIndex].mNodePriority = std::max(orders[currentIndex].mNodePriority, currentPriority + 1);
-    for (auto& link : links)
-    {
-        if (link.OutputIdx == currentIndex)
-        {
-            RecurseSetPriority(orders, links, link.InputIdx, currentPriority + 1, undeterminedNodeCount);
-        }
-    }
-}
-
-std::vector<NodeOrder> ComputeEvaluationOrder(const std::vector<NodeLink>& links, size_t nodeCount)
-{
-    std::vector<NodeOrder> orders(nodeCount);
-    for (size_t i = 0; i < nodeCount; i++)
-    {
-        orders[i].mNodeIndex = i;
-        orders[i].mNodePriority = 0;
-    }
-    size_t undeterminedNodeCount = nodeCount;
-    while (undeterminedNodeCount)
-    {
-        size_t currentIndex = PickBestNode(orders);
-        RecurseSetPriority(orders, links, currentIndex, orders[currentIndex].mNodePriority, undeterminedNodeCount);
-    };
-    //
-    return orders;
-}
-
 const float NODE_SLOT_RADIUS = 8.0f;
 const ImVec2 NODE_WINDOW_PADDING(8.0f, 8.0f);
-
-static std::vector<NodeOrder> mOrders;
+// below this zoom, nodes are flat rectangles without preview, title or slot names
+const float NODE_DETAIL_FACTOR = 0.4f;
+// graph space node bounds. Padding is in pixels so it is 5 times bigger at the lowest zoom
+const ImVec2 NODE_GRAPH_EXTENT = ImVec2(100.f, 100.f) + NODE_WINDOW_PADDING * 10.f;
+
+static GraphIndex graphIndex;
+static SpatialGrid nodeGrid;
+static SpatialGrid linkGrid;
+static bool spatialGridDirty = true;
 static std::vector<Node> nodes;
 static std::vector<Node> mNodesClipboard;
 static std::vector<NodeLink> links;
@@ -172,6 +123,10 @@ void NodeGraphClear()
 {
     nodes.clear();
     links.clear();
+    graphIndex.Clear();
+    nodeGrid.Clear();
+    linkGrid.Clear();
+    spatialGridDirty = true;
     rugs.clear();
     editRug = NULL;
     nodeOperation = NO_None;
@@ -189,15 +144,61 @@ const std::vector<NodeRug>& NodeGraphRugs()
     return rugs;
 }
 
+static ImRect GetNodeGraphRect(const Node& node)
+{
+    return ImRect(node.Pos, node.Pos + NODE_GRAPH_EXTENT);
+}
+
+// screen space rectangle to graph space
+static ImRect GetGraphRect(const ImRect& rect, const ImVec2 offset, const float factor)
+{
+    return ImRect((rect.Min - offset) / factor, (rect.Max - offset) / factor);
+}
+
+static void UpdateSpatialGrids()
+{
+    if (!spatialGridDirty && nodeGrid.GetCount() == nodes.size() && linkGrid.GetCount() == links.size())
+        return;
+
+    std::vector<ImRect> rects(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+        rects[i] = GetNodeGraphRect(nodes[i]);
+    nodeGrid.Build(rects);
+
+    // links stay between both nodes, plus the bend of links going backward
+    rects.resize(links.size());
+    for (size_t i = 0; i < links.size(); i++)
+    {
+        const NodeLink& link = links[i];
+        if (link.InputIdx < 0 || link.OutputIdx < 0 || size_t(link.InputIdx) >= nodes.size() ||
+            size_t(link.OutputIdx) >= nodes.size())
+        {
+            rects[i] = ImRect();
+            continue;
+        }
+        rects[i] = GetNodeGraphRect(nodes[link.InputIdx]);
+        rects[i].Add(GetNodeGraphRect(nodes[link.OutputIdx]));
+        rects[i].Expand(16.f);
+    }
+    linkGrid.Build(rects);
+    spatialGridDirty = false;
+}
+
 NodeRug* DisplayRugs(NodeRug* editRug, ImDrawList* drawList, ImVec2 offset, float factor)
 {
     ImGuiIO& io = ImGui::GetIO();
     NodeRug* ret = editRug;
 
+    static std::vector<int> candidateNodes;
+    const ImRect viewRect(drawList->GetClipRectMin(), drawList->GetClipRectMax());
+    const bool detailed = factor >= NODE_DETAIL_FACTOR;
+
     // mouse pointer over any node?
     bool overAnyNode = false;
-    for (auto& node : nodes)
+    nodeGrid.Query(GetGraphRect(ImRect(io.MousePos, io.MousePos), offset, factor), candidateNodes);
+    for (auto nodeIndex : candidateNodes)
     {
+        const Node& node = nodes[nodeIndex];
         ImVec2 node_rect_min = offset + node.Pos * factor;
         ImVec2 node_rect_max = node_rect_min + node.Size;
         if (ImRect(node_rect_min, node_rect_max).Contains(io.MousePos))
@@ -212,16 +213,17 @@ NodeRug* DisplayRugs(NodeRug* editRug, ImDrawList* drawList, ImVec2 offset, floa
         auto& rug = rugs[rugIndex];
         if (&rug == editRug)
             continue;
-        ImGui::PushID(900 + rugIndex);
         ImVec2 commentSize = rug.mSize * factor;
 
         ImVec2 node_rect_min = offset + rug.mPos * factor;
-
-        ImGui::SetCursorScreenPos(node_rect_min + NODE_WINDOW_PADDING);
-
         ImVec2 node_rect_max = node_rect_min + commentSize;
 
         ImRect rugRect(node_rect_min, node_rect_max);
+        if (!viewRect.Overlaps(rugRect))
+            continue;
+
+        ImGui::PushID(900 + rugIndex);
+        ImGui::SetCursorScreenPos(node_rect_min + NODE_WINDOW_PADDING);
         if (rugRect.Contains(io.MousePos) && !overAnyNode)
         {
             if (io.MouseDoubleClicked[0])
@@ -230,8 +232,10 @@ NodeRug* DisplayRugs(NodeRug* editRug, ImDrawList* drawList, ImVec2 offset, floa
             }
             else if (io.KeyShift && ImGui::IsMouseClicked(0))
             {
-                for (auto& node : nodes)
+                nodeGrid.Query(GetGraphRect(rugRect, offset, factor), candidateNodes);
+                for (auto nodeIndex : candidateNodes)
                 {
+                    Node& node = nodes[nodeIndex];
                     ImVec2 node_rect_min = offset + node.Pos * factor;
                     ImVec2 node_rect_max = node_rect_min + node.Size;
                     if (rugRect.Overlaps(ImRect(node_rect_min, node_rect_max)))
@@ -243,17 +247,22 @@ NodeRug* DisplayRugs(NodeRug* editRug, ImDrawList* drawList, ImVec2 offset, floa
         }
         // drawList->AddText(io.FontDefault, 13 * ImLerp(1.f, factor, 0.5f), node_rect_min + ImVec2(5, 5), (rug.mColor &
         // 0xFFFFFF) + 0xFF404040, rug.mText.c_str());
-        ImGui::SetCursorScreenPos(node_rect_min + NODE_WINDOW_PADDING);
-        ImGui::PushStyleColor(ImGuiCol_FrameBg, 0x0);
-        ImGui::PushStyleColor(ImGuiCol_Border, 0x0);
-        ImGui::BeginChildFrame(
-            88 + rugIndex, commentSize - NODE_WINDOW_PADDING * 2, ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav);
-
-        ImGui::Markdown(rug.mText.c_str(), rug.mText.length(), mdConfig);
         drawList->AddRectFilled(node_rect_min, node_rect_max, (rug.mColor & 0xFFFFFF) + 0x60000000, 10.0f, 15);
         drawList->AddRect(node_rect_min, node_rect_max, (rug.mColor & 0xFFFFFF) + 0x90000000, 10.0f, 15, 2.f);
-        ImGui::EndChildFrame();
-        ImGui::PopStyleColor(2);
+        // text is not readable when zoomed out
+        if (detailed)
+        {
+            ImGui::SetCursorScreenPos(node_rect_min + NODE_WINDOW_PADDING);
+            ImGui::PushStyleColor(ImGuiCol_FrameBg, 0x0);
+            ImGui::PushStyleColor(ImGuiCol_Border, 0x0);
+            ImGui::BeginChildFrame(88 + rugIndex,
+                                   commentSize - NODE_WINDOW_PADDING * 2,
+                                   ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_NoNav);
+
+            ImGui::Markdown(rug.mText.c_str(), rug.mText.length(), mdConfig);
+            ImGui::EndChildFrame();
+            ImGui::PopStyleColor(2);
+        }
         ImGui::PopID();
     }
     return ret;
@@ -375,33 +384,19 @@ bool EditRug(NodeRug* rug, ImDrawList* drawList, ImVec2 offset, float factor)
     return false;
 }
 
-bool RecurseIsLinked(int from, int to)
+static void SendEvaluationOrder(NodeGraphControlerBase* controler)
 {
-    for (auto& link : links)
+    if (controler)
     {
-        if (link.InputIdx == from)
-        {
-            if (link.OutputIdx == to)
-                return true;
-
-            if (RecurseIsLinked(link.OutputIdx, to))
-                return true;
-        }
+        controler->UpdateEvaluationList(graphIndex.GetEvaluationOrder());
     }
-    return false;
 }
 
 void NodeGraphUpdateEvaluationOrder(NodeGraphControlerBase* controler)
 {
-    mOrders = ComputeEvaluationOrder(links, nodes.size());
-    std::sort(mOrders.begin(), mOrders.end());
-    std::vector<size_t> nodeOrderList(mOrders.size());
-    for (size_t i = 0; i < mOrders.size(); i++)
-        nodeOrderList[i] = mOrders[i].mNodeIndex;
-    if (controler)
-    {
-        controler->UpdateEvaluationList(nodeOrderList);
-    }
+    graphIndex.Rebuild(nodes.size(), links);
+    spatialGridDirty = true;
+    SendEvaluationOrder(controler);
 }
 
 size_t NodeGraphAddNode(NodeGraphControlerBase* controler,
@@ -414,6 +409,8 @@ size_t NodeGraphAddNode(NodeGraphControlerBase* controler,
 {
     size_t index = nodes.size();
     nodes.push_back(Node(type, ImVec2(float(posx), float(posy))));
+    graphIndex.AddNode();
+    spatialGridDirty = true;
 
     controler->AddSingleNode(type);
     if (parameters)
@@ -438,6 +435,8 @@ void NodeGraphAddLink(NodeGraphControlerBase* controler, int InputIdx, int Input
     nl.OutputIdx = OutputIdx;
     nl.OutputSlot = OutputSlot;
     links.push_back(nl);
+    graphIndex.AddLink(nl.InputIdx, nl.OutputIdx);
+    spatialGridDirty = true;
     controler->AddLink(nl.InputIdx, nl.InputSlot, nl.OutputIdx, nl.OutputSlot);
 }
 
@@ -549,7 +548,9 @@ static void DeleteSelectedNodes(NodeGraphControlerBase* controler)
 
         // delete links
         nodes.erase(nodes.begin() + selection);
-        NodeGraphUpdateEvaluationOrder(controler);
+        graphIndex.DelNode(selection);
+        spatialGridDirty = true;
+        SendEvaluationOrder(controler);
 
         // inform delegate
         controler->UserDeleteNode(selection);
@@ -712,10 +713,15 @@ static void ContextMenu(ImVec2 offset, int nodeHovered, NodeGraphControlerBase*
     }
 }
 
-static void DisplayLinks(
-    ImDrawList* drawList, const ImVec2 offset, const float factor, const ImRect regionRect, int hoveredNode)
+static void DisplayLinks(ImDrawList* drawList,
+                         const ImVec2 offset,
+                         const float factor,
+                         const ImRect regionRect,
+                         int hoveredNode,
+                         const std::vector<int>& visibleLinks)
 {
-    for (int link_idx = 0; link_idx < links.size(); link_idx++)
+    const bool detailed = factor >= NODE_DETAIL_FACTOR;
+    for (auto link_idx : visibleLinks)
     {
         NodeLink* link = &links[link_idx];
         Node* node_inp = &nodes[link->InputIdx];
@@ -819,7 +825,8 @@ static void DisplayLinks(
             }
         }
         float highLightFactor = factor * highlightCons ? 2.0f : 1.f;
-        for (int pass = 0; pass < 2; pass++)
+        // no outline when zoomed out
+        for (int pass = detailed ? 0 : 1; pass < 2; pass++)
         {
             drawList->AddPolyline(
                 pts.data(), ptCount, pass ? col : 0xFF000000, false, (pass ? 5.f : 7.5f) * highLightFactor);
@@ -849,7 +856,8 @@ static void HandleQuadSelection(ImDrawList* drawList, const ImVec2 offset, const
         drawList->AddRect(bmin, bmax, 0xFFFF2020, 1.f);
         if (!io.MouseDown[0])
         {
-            if (!io.KeyCtrl && !io.KeyShift)
+            // without shift, only the nodes in the quad stay selected
+            if (!io.KeyShift)
             {
                 for (int nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++)
                 {
@@ -860,28 +868,16 @@ static void HandleQuadSelection(ImDrawList* drawList, const ImVec2 offset, const
 
             nodeOperation = NO_None;
             ImRect selectionRect(bmin, bmax);
-            for (int nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++)
+            static std::vector<int> candidateNodes;
+            nodeGrid.Query(GetGraphRect(selectionRect, offset, factor), candidateNodes);
+            for (auto nodeIndex : candidateNodes)
             {
                 Node* node = &nodes[nodeIndex];
                 ImVec2 node_rect_min = offset + node->Pos * factor;
                 ImVec2 node_rect_max = node_rect_min + node->Size;
                 if (selectionRect.Overlaps(ImRect(node_rect_min, node_rect_max)))
                 {
-                    if (io.KeyCtrl)
-                    {
-                        node->mbSelected = false;
-                    }
-                    else
-                    {
-                        node->mbSelected = true;
-                    }
-                }
-                else
-                {
-                    if (!io.KeyShift)
-                    {
-                        node->mbSelected = false;
-                    }
+                    node->mbSelected = !io.KeyCtrl;
                 }
             }
         }
@@ -908,12 +904,16 @@ bool HandleConnections(ImDrawList* drawList,
     auto deleteLink = [controler](int index) {
         NodeLink& link = links[index];
         controler->DelLink(link.OutputIdx, link.OutputSlot);
-        NodeGraphUpdateEvaluationOrder(controler);
+        graphIndex.DelLink(link.InputIdx, link.OutputIdx);
+        spatialGridDirty = true;
+        SendEvaluationOrder(controler);
     };
     auto addLink = [controler](int index) {
         NodeLink& link = links[index];
         controler->AddLink(link.InputIdx, link.InputSlot, link.OutputIdx, link.OutputSlot);
-        NodeGraphUpdateEvaluationOrder(controler);
+        graphIndex.AddLink(link.InputIdx, link.OutputIdx);
+        spatialGridDirty = true;
+        SendEvaluationOrder(controler);
     };
 
     size_t metaNodeCount = gMetaNodes.size();
@@ -923,6 +923,7 @@ bool HandleConnections(ImDrawList* drawList,
 
     // draw/use inputs/outputs
     bool hoverSlot = false;
+    const bool detailed = factor >= NODE_DETAIL_FACTOR;
     for (int i = 0; i < 2; i++)
     {
         float closestDistance = FLT_MAX;
@@ -940,11 +941,14 @@ bool HandleConnections(ImDrawList* drawList,
                            (distance < NODE_SLOT_RADIUS * 2.f) && (distance < closestDistance);
 
             const char* conText = con[slot_idx].mName.c_str();
-            ImVec2 textSize;
-            textSize = ImGui::CalcTextSize(conText);
-            ImVec2 textPos =
-                p + ImVec2(-NODE_SLOT_RADIUS * (i ? -1.f : 1.f) * (overCon ? 3.f : 2.f) - (i ? 0 : textSize.x),
-                           -textSize.y / 2);
+            ImVec2 textPos;
+            if (detailed)
+            {
+                ImVec2 textSize = ImGui::CalcTextSize(conText);
+                textPos =
+                    p + ImVec2(-NODE_SLOT_RADIUS * (i ? -1.f : 1.f) * (overCon ? 3.f : 2.f) - (i ? 0 : textSize.x),
+                               -textSize.y / 2);
+            }
 
             ImRect nodeRect = node->GetNodeRect(factor);
             if (overCon || (nodeRect.Contains(io.MousePos - offset) && closestConn == -1 &&
@@ -956,6 +960,8 @@ bool HandleConnections(ImDrawList* drawList,
                 closestPos = p;
             }
 
+            if (!detailed)
+                continue;
             drawList->AddCircleFilled(p, NODE_SLOT_RADIUS * 1.2f, IM_COL32(0, 0, 0, 200));
             drawList->AddCircleFilled(p, NODE_SLOT_RADIUS * 0.75f * 1.2f, IM_COL32(160, 160, 160, 200));
             drawList->AddText(io.FontDefault, 14, textPos + ImVec2(2, 2), IM_COL32(0, 0, 0, 255), conText);
@@ -969,8 +975,11 @@ bool HandleConnections(ImDrawList* drawList,
             hoverSlot = true;
             drawList->AddCircleFilled(closestPos, NODE_SLOT_RADIUS * 2.f, IM_COL32(0, 0, 0, 200));
             drawList->AddCircleFilled(closestPos, NODE_SLOT_RADIUS * 1.5f, IM_COL32(200, 200, 200, 200));
-            drawList->AddText(io.FontDefault, 16, closestTextPos + ImVec2(1, 1), IM_COL32(0, 0, 0, 255), conText);
-            drawList->AddText(io.FontDefault, 16, closestTextPos, IM_COL32(250, 250, 250, 255), conText);
+            if (detailed)
+            {
+                drawList->AddText(io.FontDefault, 16, closestTextPos + ImVec2(1, 1), IM_COL32(0, 0, 0, 255), conText);
+                drawList->AddText(io.FontDefault, 16, closestTextPos, IM_COL32(250, 250, 250, 255), conText);
+            }
             bool inputToOutput = (!editingInput && !i) || (editingInput && i);
             if (nodeOperation == NO_EditingLink && !io.MouseDown[0] && !bDrawOnly)
             {
@@ -983,7 +992,7 @@ bool HandleConnections(ImDrawList* drawList,
                     else
                         nl = NodeLink(editingNodeIndex, editingSlotIndex, nodeIndex, closestConn);
 
-                    if (RecurseIsLinked(nl.OutputIdx, nl.InputIdx))
+                    if (graphIndex.IsCycling(nl.InputIdx, nl.OutputIdx))
                     {
                         Log("Acyclic graph. Loop is not allowed.\n");
                         break;
@@ -1006,8 +1015,10 @@ bool HandleConnections(ImDrawList* drawList,
                         {
                             URDel<NodeLink> undoRedoDel(linkIndex, []() { return &links; }, deleteLink, addLink);
                             controler->DelLink(link.OutputIdx, link.OutputSlot);
+                            graphIndex.DelLink(link.InputIdx, link.OutputIdx);
                             links.erase(links.begin() + linkIndex);
-                            NodeGraphUpdateEvaluationOrder(controler);
+                            spatialGridDirty = true;
+                            SendEvaluationOrder(controler);
                             break;
                         }
                     }
@@ -1018,7 +1029,9 @@ bool HandleConnections(ImDrawList* drawList,
 
                         links.push_back(nl);
                         controler->AddLink(nl.InputIdx, nl.InputSlot, nl.OutputIdx, nl.OutputSlot);
-                        NodeGraphUpdateEvaluationOrder(controler);
+                        graphIndex.AddLink(nl.InputIdx, nl.OutputIdx);
+                        spatialGridDirty = true;
+                        SendEvaluationOrder(controler);
                     }
                 }
             }
@@ -1042,8 +1055,10 @@ bool HandleConnections(ImDrawList* drawList,
                         {
                             URDel<NodeLink> undoRedoDel(linkIndex, []() { return &links; }, deleteLink, addLink);
                             controler->DelLink(link.OutputIdx, link.OutputSlot);
+                            graphIndex.DelLink(link.InputIdx, link.OutputIdx);
                             links.erase(links.begin() + linkIndex);
-                            NodeGraphUpdateEvaluationOrder(controler);
+                            spatialGridDirty = true;
+                            SendEvaluationOrder(controler);
                             break;
                         }
                     }
@@ -1157,6 +1172,15 @@ static bool DrawNode(ImDrawList* drawList,
                       15,
                       currentSelectedNode ? 6.f : 2.f);
 
+    if (factor < NODE_DETAIL_FACTOR)
+    {
+        drawList->AddRectFilled(node_rect_min,
+                                node_rect_max,
+                                metaNodes[node->mType].mHeaderColor | (nodeHovered ? 0x404040 : 0),
+                                2.0f);
+        return nodeHovered;
+    }
+
     ImVec2 imgPos = node_rect_min + ImVec2(14, 25);
     ImVec2 imgSize = node_rect_max + ImVec2(-5, -5) - imgPos;
     float imgSizeComp = std::min(imgSize.x, imgSize.y);
@@ -1273,6 +1297,7 @@ void NodeGraph(NodeGraphControlerBase* controler, bool enabled)
     ImRect regionRect(windowPos, windowPos + canvasSize);
 
     HandleZoomScroll(regionRect);
+    UpdateSpatialGrids();
     ImVec2 offset = ImGui::GetCursorScreenPos() + scrolling * factor;
     captureOffset = scrollRegionLocalPos + scrolling * factor + ImVec2(10.f, 0.f);
 
@@ -1311,6 +1336,14 @@ void NodeGraph(NodeGraphControlerBase* controler, bool enabled)
         DrawGrid(drawList, windowPos, canvasSize, factor);
     }
 
+    // visible nodes and links, with room for the pinned slots around nodes
+    static std::vector<int> visibleNodes;
+    static std::vector<int> visibleLinks;
+    ImRect viewRect = GetGraphRect(regionRect, offset, factor);
+    viewRect.Expand(40.f / factor);
+    nodeGrid.Query(viewRect, visibleNodes);
+    linkGrid.Query(viewRect, visibleLinks);
+
     bool openContextMenu = false;
     
     if (!enabled)
@@ -1320,7 +1353,7 @@ void NodeGraph(NodeGraphControlerBase* controler, bool enabled)
     // Display links
     drawList->ChannelsSplit(3);
     drawList->ChannelsSetCurrent(1); // Background
-    DisplayLinks(drawList, offset, factor, regionRect, hoveredNode);
+    DisplayLinks(drawList, offset, factor, regionRect, hoveredNode, visibleLinks);
 
     // edit node link
     if (nodeOperation == NO_EditingLink)
@@ -1335,7 +1368,7 @@ void NodeGraph(NodeGraphControlerBase* controler, bool enabled)
     hoveredNode = -1;
     for (int i = 0; i < 2; i++)
     {
-        for (int nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++)
+        for (auto nodeIndex : visibleNodes)
         {
             Node* node = &nodes[nodeIndex];
             if (node->mbSelected != (i != 0))
@@ -1373,6 +1406,7 @@ void NodeGraph(NodeGraphControlerBase* controler, bool enabled)
                 continue;
             node.Pos += io.MouseDelta / factor;
         }
+        spatialGridDirty = true;
     }
 
     // rugs
@@ -1440,113 +1474,59 @@ nodeGraphExit:;
 }
 
 
-struct NodePosition
-{
-    int mLayer;
-    int mStackIndex;
-};
-
-void RecurseNodeGraphLayout(std::vector<NodePosition>& positions,
-                            std::map<int, int>& stacks,
-                            const std::vector<NodeLink>& links,
-                            size_t currentIndex,
-                            int currentLayer)
+void NodeGraphLayout(bool selectionOnly)
 {
-    if (positions[currentIndex].mLayer == -1)
-    {
-        positions[currentIndex].mLayer = currentLayer;
-        int layer = positions[currentIndex].mLayer = currentLayer;
-        if (stacks.find(layer) != stacks.end())
-            stacks[layer]++;
-        else
-            stacks[layer] = 0;
-        positions[currentIndex].mStackIndex = stacks[currentLayer];
-    }
-    else
-    {
-        // already hooked node
-        if (currentLayer > positions[currentIndex].mLayer)
-        {
-            // remove stack at current pos
-            int currentStack = positions[currentIndex].mStackIndex;
-            for (auto& pos : positions)
-            {
-                if (pos.mLayer == positions[currentIndex].mLayer && pos.mStackIndex > currentStack)
-                {
-                    pos.mStackIndex--;
-                    stacks[pos.mLayer]--;
-                }
-            }
-            // apply new one
-            int layer = positions[currentIndex].mLayer = currentLayer;
-            if (stacks.find(layer) != stacks.end())
-                stacks[layer]++;
-            else
-                stacks[layer] = 0;
-            positions[currentIndex].mStackIndex = stacks[currentLayer];
-        }
-    }
+    URDummy dummy;
+    if (graphIndex.GetNodeCount() != nodes.size())
+        graphIndex.Rebuild(nodes.size(), links);
 
-    std::vector<int> inputNodes(nodes[currentIndex].InputsCount, -1);
-    for (auto& link : links)
-    {
-        if (link.OutputIdx != currentIndex)
-            continue;
-        inputNodes[link.OutputSlot] = link.InputIdx;
-    }
-    for (auto inputNode : inputNodes)
+    // with 2 or more selected nodes, only the selection is moved and links to other nodes are ignored
+    std::vector<uint8_t> mask;
+    const auto selectedCount =
+        std::count_if(nodes.begin(), nodes.end(), [](const Node& node) { return node.mbSelected; });
+    if (selectionOnly && selectedCount > 1)
     {
-        if (inputNode == -1)
-            continue;
-        RecurseNodeGraphLayout(positions, stacks, links, inputNode, currentLayer + 1);
+        mask.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            mask[i] = nodes[i].mbSelected ? 1 : 0;
     }
-}
-
-void NodeGraphLayout()
-{
-    URDummy dummy;
-    std::vector<size_t> nodeOrderList(mOrders.size());
 
     // get stack/layer pos
-    std::vector<NodePosition> nodePositions(nodes.size(), {-1, -1});
-    std::map<int, int> stacks;
+    std::vector<LayoutPosition> nodePositions;
+    ComputeGraphLayout(graphIndex, mask, nodePositions);
+
     ImRect sourceRect, destRect;
-    std::vector<URChange<Node>*> undos(nodes.size());
+    std::vector<URChange<Node>*> undos;
 
     // compute source bounds
     for (unsigned int i = 0; i < nodes.size(); i++)
     {
+        if (nodePositions[i].mLayer < 0)
+            continue;
         const Node& node = nodes[i];
         sourceRect.Add(ImRect(node.Pos, node.Pos + node.Size));
-        undos[i] = new URChange<Node>(i, [](int index) { return &nodes[index]; }, [](int) {});
-    }
-
-    for (unsigned int i = 0; i < nodes.size(); i++)
-    {
-        size_t nodeIndex = mOrders[nodes.size() - i - 1].mNodeIndex;
-        RecurseNodeGraphLayout(nodePositions, stacks, links, nodeIndex, 0);
+        undos.push_back(
+            new URChange<Node>(i, [](int index) { return &nodes[index]; }, [](int) { spatialGridDirty = true; }));
     }
 
     // set x,y position from layer/stack
     for (unsigned int i = 0; i < nodes.size(); i++)
     {
-        size_t nodeIndex = mOrders[i].mNodeIndex;
-        auto& layout = nodePositions[nodeIndex];
-        nodes[nodeIndex].Pos = ImVec2(-layout.mLayer * 180.f, layout.mStackIndex * 140.f);
-    }
-
-    // new bounds
-    for (auto& node : nodes)
-    {
-        destRect.Add(ImRect(node.Pos, node.Pos + node.Size));
+        auto& layout = nodePositions[i];
+        if (layout.mLayer < 0)
+            continue;
+        nodes[i].Pos = ImVec2(-layout.mLayer * 180.f, layout.mStack * 140.f);
+        destRect.Add(ImRect(nodes[i].Pos, nodes[i].Pos + nodes[i].Size));
     }
 
-    // move all nodes
+    // move laid out nodes back where they were
     ImVec2 offset = sourceRect.GetCenter() - destRect.GetCenter();
-    for (auto& node : nodes)
+    for (unsigned int i = 0; i < nodes.size(); i++)
     {
-        node.Pos += offset;
+        if (nodePositions[i].mLayer >= 0)
+            nodes[i].Pos += offset;
     }
+    spatialGridDirty = true;
 
     // finish undo
     for (auto& undo : undos)
@@ -1581,9 +1561,10 @@ ImRect GetFinalNodeDisplayRect()
 {
     NodeGraphUpdateEvaluationOrder(nullptr);
     ImRect rect(ImVec2(0.f, 0.f), ImVec2(0.f, 0.f));
-    if (!mOrders.empty() && !nodes.empty())
+    const std::vector<size_t>& order = graphIndex.GetEvaluationOrder();
+    if (!order.empty() && !nodes.empty())
     {
-        auto& node = nodes[mOrders.back().mNodeIndex];
+        auto& node = nodes[order.back()];
         rect = ImRect(node.Pos, node.Pos + node.Size);
     }
     return DisplayRectMargin(rect);
@@ -186,5 +186,5 @@ void NodeGraphAddLink(NodeGraphControlerBase* delegate, int InputIdx, int InputS
 void NodeGraphUpdateEvaluationOrder(NodeGraphControlerBase* delegate);
 void NodeGraphUpdateScrolling();
 void NodeGraphSelectNode(int selectedNodeIndex);
-void NodeGraphLayout();
+void NodeGraphLayout(bool selectionOnly);
 bool IsIOUsed(int nodeIndex, int slotIndex, bool forOutput);
\ No newline at end of file
@@ -33,7 +33,10 @@
 #include "Utils.h"
 
 NodeGraphControler::NodeGraphControler()
-    : mbMouseDragging(false), mEditingContext(mEvaluationStages, false, 1024, 1024), mUndoRedoParamSetMouse(nullptr)
+    : mbMouseDragging(false)
+    , mEditingContext(mEvaluationStages, false, 1024, 1024)
+    , mUndoRedoParamSetMouse(nullptr)
+    , mBatchDepth(0)
 {
     mCategories = &MetaNode::mCategories;
 }
@@ -45,13 +48,29 @@ void NodeGraphControler::Clear()
     mEvaluationStages.Clear();
     mEvaluationStages.mStages.clear();
     mEditingContext.Clear();
+    // a batch left open by a script doesn't apply to the next graph
+    for (auto& nodeUndoRedo : mBatchNodeUndoRedo)
+    {
+        nodeUndoRedo.second->Discard();
+    }
+    mBatchNodeUndoRedo.clear();
+    if (mBatchUndoRedo)
+    {
+        mBatchUndoRedo->Discard();
+        mBatchUndoRedo.reset();
+    }
+    mBatchDepth = 0;
 }
 
 void NodeGraphControler::SetParamBlock(size_t index, const std::vector<unsigned char>& parameters)
 {
     auto& stage = mEvaluationStages.mStages[index];
-    stage.mParameters = parameters;
-    mEvaluationStages.SetEvaluationParameters(index, parameters);
+    // blocks saved before parameters were appended to the node keep the default values of the new ones
+    if (parameters.size() < stage.mParameters.size())
+        std::copy(parameters.begin(), parameters.end(), stage.mParameters.begin());
+    else
+        stage.mParameters = parameters;
+    mEvaluationStages.SetEvaluationParameters(index, stage.mParameters);
     mEvaluationStages.SetEvaluationSampler(index, stage.mInputSamplers);
     mEditingContext.SetTargetDirty(index, Dirty::Parameter);
 }
@@ -411,10 +430,9 @@ void NodeGraphControler::EditNodeParameters()
     if (!ImGui::CollapsingHeader(currentMeta.mName.c_str(), 0, ImGuiTreeNodeFlags_DefaultOpen))
         return;
 
-    URChange<std::vector<unsigned char>> undoRedoParameter(
-        int(index),
-        [&](int index) { return &mEvaluationStages.mStages[index].mParameters; },
-        [&](int index) { UpdateDirtyParameter(index); });
+    URChangeDelta undoRedoParameter(int(index),
+                                    [&](int index) { return &mEvaluationStages.mStages[index].mParameters; },
+                                    [&](int index) { UpdateDirtyParameter(index); });
 
     unsigned char* paramBuffer = stage.mParameters.data();
     int i = 0;
@@ -561,7 +579,7 @@ void NodeGraphControler::SetKeyboardMouse(float rx,
     }
     if ((lButDown || rButDown) && !mUndoRedoParamSetMouse)
     {
-        mUndoRedoParamSetMouse = new URChange<std::vector<unsigned char>>(
+        mUndoRedoParamSetMouse = new URChangeDelta(
             mSelectedNodeIndex,
             [&](int index) { return &mEvaluationStages.mStages[index].mParameters; },
             [&](int index) { UpdateDirtyParameter(index); });
@@ -851,6 +869,78 @@ void NodeGraphControler::SetParameter(int nodeIndex,
     }
     ConTypes parameterType = GetParameterType(uint32_t(nodeType), parameterIndex);
     size_t paramOffset = GetParameterOffset(uint32_t(nodeType), parameterIndex);
-    ParseStringToParameter(parameterValue, parameterType, &mEvaluationStages.mStages[nodeIndex].mParameters[paramOffset]);
-    mEditingContext.SetTargetDirty(nodeIndex, Dirty::Parameter);
+    // parsed on a copy so the change goes through the undo and dirty handling of typed values
+    const std::vector<unsigned char>& parameters = mEvaluationStages.mStages[nodeIndex].mParameters;
+    if (paramOffset + GetParameterTypeSize(parameterType) > parameters.size())
+    {
+        return;
+    }
+    std::vector<unsigned char> value(parameters.begin() + paramOffset,
+                                     parameters.begin() + paramOffset + GetParameterTypeSize(parameterType));
+    ParseStringToParameter(parameterValue, parameterType, value.data());
+    SetParameter(nodeIndex, parameterIndex, value.data());
+}
+
+bool NodeGraphControler::SetParameter(int nodeIndex, int parameterIndex, const void* value)
+{
+    if (nodeIndex < 0 || nodeIndex >= int(mEvaluationStages.mStages.size()))
+    {
+        return false;
+    }
+    auto& stage = mEvaluationStages.mStages[nodeIndex];
+    const MetaNode& metaNode = gMetaNodes[stage.mType];
+    if (parameterIndex < 0 || parameterIndex >= int(metaNode.mParams.size()))
+    {
+        return false;
+    }
+    size_t paramOffset = GetParameterOffset(uint32_t(stage.mType), parameterIndex);
+    size_t paramSize = GetParameterTypeSize(metaNode.mParams[parameterIndex].mType);
+    if (paramOffset + paramSize > stage.mParameters.size())
+    {
+        return false;
+    }
+
+    BeginParameterBatch();
+    auto& nodeUndoRedo = mBatchNodeUndoRedo[nodeIndex];
+    if (!nodeUndoRedo)
+    {
+        nodeUndoRedo = std::make_unique<URChangeDelta>(
+            nodeIndex,
+            [&](int index) { return &mEvaluationStages.mStages[index].mParameters; },
+            [&](int index) { UpdateDirtyParameter(index); });
+    }
+    memcpy(&stage.mParameters[paramOffset], value, paramSize);
+    EndParameterBatch();
+    return true;
+}
+
+void NodeGraphControler::BeginParameterBatch()
+{
+    if (!mBatchDepth++)
+    {
+        mBatchUndoRedo = std::make_unique<URDummy>();
+    }
+}
+
+void NodeGraphControler::EndParameterBatch()
+{
+    if (!mBatchDepth || --mBatchDepth)
+    {
+        return;
+    }
+    std::vector<size_t> dirtyNodes;
+    for (auto& nodeUndoRedo : mBatchNodeUndoRedo)
+    {
+        auto& stage = mEvaluationStages.mStages[nodeUndoRedo.first];
+        mEvaluationStages.SetEvaluationParameters(nodeUndoRedo.first, stage.mParameters);
+        dirtyNodes.push_back(nodeUndoRedo.first);
+    }
+    // node changes are added to the batch entry, the batch entry is added when released
+    mBatchNodeUndoRedo.clear();
+    if (dirtyNodes.empty())
+    {
+        mBatchUndoRedo->Discard();
+    }
+    mBatchUndoRedo.reset();
+    mEditingContext.SetTargetsDirty(dirtyNodes, Dirty::Parameter);
 }
\ No newline at end of file
@@ -135,7 +135,7 @@ struct NodeGraphControler : public NodeGraphControlerBase
     std::vector<EvaluationStage> mStagesClipboard;
     int mBackgroundNode;
     bool mbMouseDragging;
-    URChange<std::vector<unsigned char>>* mUndoRedoParamSetMouse;
+    URChangeDelta* mUndoRedoParamSetMouse;
 
     EvaluationStage* Get(ASyncId id)
     {
@@ -143,6 +143,11 @@ struct NodeGraphControler : public NodeGraphControlerBase
     }
     void NodeEdit();
     void SetParameter(int nodeIndex, const std::string& parameterName, const std::string& parameterValue);
+    // value is laid out as the parameter in the node parameter block. Return false for unknown nodes or parameters
+    bool SetParameter(int nodeIndex, int parameterIndex, const void* value);
+    // scripted edits between Begin and End make a single undo entry and dirty the changed nodes once. Batches nest
+    void BeginParameterBatch();
+    void EndParameterBatch();
 protected:
     bool EditSingleParameter(unsigned int nodeIndex,
                              unsigned int parameterIndex,
@@ -153,4 +158,9 @@ protected:
     void EditNodeParameters();
     void HandlePin(uint32_t parameterPair);
     void HandlePinIO(size_t nodeIndex, size_t slotIndex, bool forOutput);
+
+    int mBatchDepth;
+    std::unique_ptr<URDummy> mBatchUndoRedo;
+    // one parameter block change per edited node
+    std::map<int, std::unique_ptr<URChangeDelta>> mBatchNodeUndoRedo;
 };
@@ -31,7 +31,11 @@
 #include <SDL.h>
 #include <GLES3/gl3.h>
 
-typedef int TaskSetPartition;
+struct TaskSetPartition
+{
+    uint32_t start;
+    uint32_t end;
+};
 struct PinnedTask
 {
     PinnedTask(int) {}
@@ -40,7 +44,10 @@ struct PinnedTask
 
 struct TaskSet
 {
+    TaskSet() : m_SetSize(1) {}
+    TaskSet(uint32_t setSize) : m_SetSize(setSize) {}
     virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum) = 0;
+    uint32_t m_SetSize;
 };
 
 struct TaskScheduler
@@ -54,9 +61,10 @@ struct TaskScheduler
         task->Execute();
     }
     void WaitforTask(PinnedTask *task) { }
+    void WaitforTaskSet(TaskSet* taskSet) { }
     void AddTaskSetToPipe(TaskSet* taskSet)
     {
-        taskSet->ExecuteRange(0, 0);
+        taskSet->ExecuteRange({0, taskSet->m_SetSize}, 0);
     }
 };
 
@@ -91,4 +99,9 @@ typedef enki::TaskScheduler TaskScheduler;
     
 #error unknown platform
 
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMOGEN_SSE2 1
 #endif
\ No newline at end of file
@@ -0,0 +1,511 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "Platform.h"
+#include "RTSceneCache.h"
+#include "Utils.h"
+#include "Scene.h"
+#include "Loader.h"
+#include "GPUBVH.h"
+#include "Camera.h"
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+#include <sys/stat.h>
+
+RTSceneCache gRTSceneCache;
+
+static const uint32_t RTSceneCacheMagic = 0x43535452; // 'RTSC'
+static const uint32_t RTSceneCacheVersion = 1;
+
+// scene file lines referencing meshes, textures and environment maps
+static const char* RTSceneDependencies[] = {
+    " file %s", " albedoTexture %s", " metallicRoughnessTexture %s", " normalTexture %s", " envMap %s"};
+
+// the key covers the scene file content and the stamps of the files it references
+static uint64_t GetSceneKey(const MappedFile& file)
+{
+    uint64_t key = Hash(file.mData, file.mSize);
+    const char* text = (const char*)file.mData;
+    const char* end = text + file.mSize;
+    while (text < end)
+    {
+        const char* lineEnd = (const char*)memchr(text, '\n', end - text);
+        if (!lineEnd)
+            lineEnd = end;
+        char line[2048];
+        size_t length = std::min(size_t(lineEnd - text), sizeof(line) - 1);
+        memcpy(line, text, length);
+        line[length] = 0;
+        text = lineEnd + 1;
+
+        for (const char* dependency : RTSceneDependencies)
+        {
+            char path[2048];
+            int64_t stamp[2];
+            if (sscanf(line, dependency, path) == 1 && GetFileStamp(path, stamp[0], stamp[1]))
+            {
+                key = Hash(stamp, sizeof(stamp), Hash(path, strlen(path), key));
+            }
+        }
+    }
+    return key;
+}
+
+// next to the executable, whatever the working directory
+static const std::string& GetCacheDirectory()
+{
+    static const std::string directory = []() {
+        std::string path;
+        char* basePath = SDL_GetBasePath();
+        if (basePath)
+        {
+            path = basePath;
+            SDL_free(basePath);
+        }
+        return path + "Cache";
+    }();
+    return directory;
+}
+
+static std::string GetCacheFilename(uint64_t key)
+{
+    char name[64];
+    sprintf(name, "/%016llx.rtscene", (unsigned long long)key);
+    return GetCacheDirectory() + name;
+}
+
+// Binary cache layout :
+// header | render options | camera | triangles, normals and texcoords, vertices, materials, lights |
+// albedo, metallic roughness and normal textures | environment map and its distributions | BVH nodes, BVH triangles
+struct CacheHeader
+{
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint64_t mKey;
+};
+
+template<typename T>
+static void Append(std::vector<unsigned char>& blob, const T* data, size_t count)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    blob.insert(blob.end(), bytes, bytes + sizeof(T) * count);
+}
+
+template<typename T>
+static void Append(std::vector<unsigned char>& blob, const T& value)
+{
+    Append(blob, &value, 1);
+}
+
+template<typename T>
+static void AppendVector(std::vector<unsigned char>& blob, const std::vector<T>& vector)
+{
+    Append(blob, uint32_t(vector.size()));
+    Append(blob, vector.data(), vector.size());
+}
+
+static void AppendTextures(std::vector<unsigned char>& blob, const unsigned char* textures, int count, glm::ivec2 size)
+{
+    Append(blob, int32_t(count));
+    Append(blob, count ? size : glm::ivec2(0));
+    if (count)
+    {
+        Append(blob, textures, size_t(size.x) * size.y * 3 * count);
+    }
+}
+
+// reads straight from the mapped cache file
+struct CacheReader
+{
+    CacheReader(const unsigned char* data, size_t size) : mData(data), mRemaining(size)
+    {
+    }
+    template<typename T>
+    bool Read(T* data, size_t count)
+    {
+        // glm vectors and the scene structures built on them have user copy operators and aren't trivially
+        // copyable. Their bytes are still the whole value
+        static_assert(std::is_standard_layout<T>::value && std::is_trivially_destructible<T>::value,
+                      "cached types are plain data");
+        if (count > mRemaining / sizeof(T))
+            return false;
+        size_t size = sizeof(T) * count;
+        memcpy(static_cast<void*>(data), mData, size);
+        mData += size;
+        mRemaining -= size;
+        return true;
+    }
+    template<typename T>
+    bool Read(T& value)
+    {
+        return Read(&value, 1);
+    }
+    template<typename T>
+    bool ReadVector(std::vector<T>& vector)
+    {
+        uint32_t count;
+        if (!Read(count) || count > mRemaining / sizeof(T))
+            return false;
+        vector.resize(count);
+        return Read(vector.data(), count);
+    }
+    // array allocated like the scene loader does, the scene frees it
+    template<typename T>
+    bool ReadArray(T*& data, size_t count)
+    {
+        if (count > mRemaining / sizeof(T))
+            return false;
+        data = new T[count];
+        return Read(data, count);
+    }
+    bool ReadTextures(unsigned char*& textures, int& count, glm::ivec2& size)
+    {
+        int32_t textureCount;
+        if (!Read(textureCount) || !Read(size) || textureCount < 0 || size.x < 0 || size.y < 0)
+            return false;
+        count = textureCount;
+        return !count || ReadArray(textures, size_t(size.x) * size.y * 3 * count);
+    }
+    const unsigned char* mData;
+    size_t mRemaining;
+};
+
+static void WriteCache(const GLSLPathTracer::Scene* scene, uint64_t key)
+{
+    std::vector<unsigned char> blob;
+    CacheHeader header = {RTSceneCacheMagic, RTSceneCacheVersion, key};
+    Append(blob, header);
+
+    const GLSLPathTracer::RenderOptions& options = scene->renderOptions;
+    Append(blob, uint32_t(options.rendererType.size()));
+    Append(blob, options.rendererType.data(), options.rendererType.size());
+    Append(blob, options.resolution);
+    Append(blob, int32_t(options.maxSamples));
+    Append(blob, int32_t(options.maxDepth));
+    Append(blob, int32_t(options.numTilesX));
+    Append(blob, int32_t(options.numTilesY));
+    Append(blob, uint8_t(options.useEnvMap));
+    Append(blob, options.hdrMultiplier);
+    Append(blob, uint8_t(options.spatialSplits));
+
+    const GLSLPathTracer::Camera* camera = scene->camera;
+    Append(blob, camera->position);
+    Append(blob, camera->forward);
+    Append(blob, camera->fov);
+    Append(blob, camera->focalDist);
+    Append(blob, camera->aperture);
+
+    AppendVector(blob, scene->triangleIndices);
+    AppendVector(blob, scene->normalTexData);
+    AppendVector(blob, scene->vertexData);
+    AppendVector(blob, scene->materialData);
+    AppendVector(blob, scene->lightData);
+
+    const GLSLPathTracer::TexData& texData = scene->texData;
+    AppendTextures(blob, texData.albedoTextures, texData.albedoTexCount, texData.albedoTextureSize);
+    AppendTextures(blob, texData.metallicRoughnessTextures, texData.metallicRoughnessTexCount, texData.metallicRoughnessTextureSize);
+    AppendTextures(blob, texData.normalTextures, texData.normalTexCount, texData.normalTextureSize);
+
+    const HDRLoaderResult& hdr = scene->hdrLoaderRes;
+    bool hasEnvMap = hdr.cols && hdr.marginalDistData && hdr.conditionalDistData;
+    Append(blob, uint8_t(hasEnvMap));
+    if (hasEnvMap)
+    {
+        Append(blob, int32_t(hdr.width));
+        Append(blob, int32_t(hdr.height));
+        Append(blob, hdr.cols, size_t(hdr.width) * hdr.height * 3);
+        Append(blob, hdr.marginalDistData, size_t(hdr.height));
+        Append(blob, hdr.conditionalDistData, size_t(hdr.width) * hdr.height);
+    }
+
+    Append(blob, int32_t(scene->gpuBVH->numNodes));
+    Append(blob, scene->gpuBVH->gpuNodes, size_t(scene->gpuBVH->numNodes));
+    AppendVector(blob, scene->gpuBVH->bvhTriangleIndices);
+
+#ifdef WIN32
+    CreateDirectoryA(GetCacheDirectory().c_str(), NULL);
+#else
+    mkdir(GetCacheDirectory().c_str(), 0755);
+#endif
+    // written aside and renamed so a concurrent load never sees a partial file
+    std::string filename = GetCacheFilename(key);
+    std::string tempFilename = filename + ".tmp";
+    FILE* fp = fopen(tempFilename.c_str(), "wb");
+    if (!fp)
+        return;
+    bool written = fwrite(blob.data(), blob.size(), 1, fp) == 1;
+    fclose(fp);
+    remove(filename.c_str());
+    if (!written || rename(tempFilename.c_str(), filename.c_str()))
+        remove(tempFilename.c_str());
+}
+
+static GLSLPathTracer::Scene* ReadCache(const std::string& filepath, uint64_t key)
+{
+    MappedFile file;
+    if (!file.Open(GetCacheFilename(key).c_str()))
+        return nullptr;
+
+    CacheReader reader(file.mData, file.mSize);
+    CacheHeader header;
+    if (!reader.Read(header) || header.mMagic != RTSceneCacheMagic || header.mVersion != RTSceneCacheVersion ||
+        header.mKey != key)
+    {
+        return nullptr;
+    }
+
+    GLSLPathTracer::Scene* scene = new GLSLPathTracer::Scene(filepath);
+    GLSLPathTracer::RenderOptions& options = scene->renderOptions;
+    uint32_t rendererTypeLength;
+    int32_t maxSamples, maxDepth, numTilesX, numTilesY;
+    uint8_t useEnvMap, spatialSplits;
+    bool valid = reader.Read(rendererTypeLength) && rendererTypeLength <= reader.mRemaining;
+    if (valid)
+    {
+        options.rendererType.assign((const char*)reader.mData, rendererTypeLength);
+        reader.mData += rendererTypeLength;
+        reader.mRemaining -= rendererTypeLength;
+    }
+    valid = valid && reader.Read(options.resolution) && reader.Read(maxSamples) && reader.Read(maxDepth) &&
+            reader.Read(numTilesX) && reader.Read(numTilesY) && reader.Read(useEnvMap) &&
+            reader.Read(options.hdrMultiplier) && reader.Read(spatialSplits);
+    options.maxSamples = maxSamples;
+    options.maxDepth = maxDepth;
+    options.numTilesX = numTilesX;
+    options.numTilesY = numTilesY;
+    options.useEnvMap = useEnvMap != 0;
+    options.spatialSplits = spatialSplits != 0;
+
+    glm::vec3 position, forward;
+    float fov, focalDist, aperture;
+    valid = valid && reader.Read(position) && reader.Read(forward) && reader.Read(fov) && reader.Read(focalDist) &&
+            reader.Read(aperture);
+    if (valid)
+    {
+        scene->addCamera(position, position + forward, glm::degrees(fov));
+        scene->camera->focalDist = focalDist;
+        scene->camera->aperture = aperture;
+    }
+
+    valid = valid && reader.ReadVector(scene->triangleIndices) && reader.ReadVector(scene->normalTexData) &&
+            reader.ReadVector(scene->vertexData) && reader.ReadVector(scene->materialData) &&
+            reader.ReadVector(scene->lightData);
+
+    GLSLPathTracer::TexData& texData = scene->texData;
+    valid = valid &&
+            reader.ReadTextures(texData.albedoTextures, texData.albedoTexCount, texData.albedoTextureSize) &&
+            reader.ReadTextures(texData.metallicRoughnessTextures,
+                                texData.metallicRoughnessTexCount,
+                                texData.metallicRoughnessTextureSize) &&
+            reader.ReadTextures(texData.normalTextures, texData.normalTexCount, texData.normalTextureSize);
+
+    HDRLoaderResult& hdr = scene->hdrLoaderRes;
+    uint8_t hasEnvMap = 0;
+    valid = valid && reader.Read(hasEnvMap);
+    if (valid && hasEnvMap)
+    {
+        int32_t width, height;
+        valid = reader.Read(width) && reader.Read(height) && width > 0 && height > 0;
+        hdr.width = width;
+        hdr.height = height;
+        valid = valid && reader.ReadArray(hdr.cols, size_t(width) * height * 3) &&
+                reader.ReadArray(hdr.marginalDistData, size_t(height)) &&
+                reader.ReadArray(hdr.conditionalDistData, size_t(width) * height);
+    }
+
+    scene->gpuBVH = new GLSLPathTracer::GPUBVH();
+    int32_t numNodes = 0;
+    valid = valid && reader.Read(numNodes) && numNodes > 0;
+    scene->gpuBVH->numNodes = numNodes;
+    valid = valid && reader.ReadArray(scene->gpuBVH->gpuNodes, size_t(numNodes)) &&
+            reader.ReadVector(scene->gpuBVH->bvhTriangleIndices);
+
+    if (!valid)
+    {
+        delete scene;
+        return nullptr;
+    }
+    return scene;
+}
+
+static size_t GetGeometrySize(const GLSLPathTracer::Scene* scene)
+{
+    return sizeof(GLSLPathTracer::GPUBVHNode) * scene->gpuBVH->numNodes +
+           sizeof(GLSLPathTracer::TriIndexData) * scene->gpuBVH->bvhTriangleIndices.size() +
+           sizeof(GLSLPathTracer::TriangleData) * scene->triangleIndices.size() +
+           sizeof(GLSLPathTracer::VertexData) * scene->vertexData.size() +
+           sizeof(GLSLPathTracer::NormalTexData) * scene->normalTexData.size() +
+           sizeof(GLSLPathTracer::MaterialData) * scene->materialData.size() +
+           sizeof(GLSLPathTracer::LightData) * scene->lightData.size();
+}
+
+static size_t GetTextureSize(const GLSLPathTracer::Scene* scene)
+{
+    const GLSLPathTracer::TexData& texData = scene->texData;
+    const HDRLoaderResult& hdr = scene->hdrLoaderRes;
+    size_t hdrTexelSize = sizeof(float) * 3 + (hdr.conditionalDistData ? sizeof(glm::vec2) : 0);
+    return size_t(texData.albedoTextureSize.x) * texData.albedoTextureSize.y * texData.albedoTexCount * 3 +
+           size_t(texData.metallicRoughnessTextureSize.x) * texData.metallicRoughnessTextureSize.y *
+               texData.metallicRoughnessTexCount * 3 +
+           size_t(texData.normalTextureSize.x) * texData.normalTextureSize.y * texData.normalTexCount * 3 +
+           (hdr.cols ? size_t(hdr.width) * hdr.height * hdrTexelSize : 0);
+}
+
+RTSceneCache::RTSceneCache() : mBudget(1024 * 1024 * 1024), mBytes(0)
+{
+}
+
+std::shared_ptr<GLSLPathTracer::Scene> RTSceneCache::GetScene(const std::string& filepath)
+{
+    uint64_t key;
+    {
+        MappedFile file;
+        if (!file.Open(filepath.c_str()))
+            return nullptr;
+        key = GetSceneKey(file);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mCacheAccess);
+        auto iter = mScenes.find(filepath);
+        if (iter != mScenes.end())
+        {
+            Entry& entry = iter->second;
+            if (entry.mKey == key)
+            {
+                mLRU.splice(mLRU.begin(), mLRU, entry.mLRU);
+                entry.mPending = true;
+                return entry.mScene;
+            }
+            // scene or one of its files changed on disk. Stages still using it keep their reference
+            mBytes -= entry.mSize;
+            mLRU.erase(entry.mLRU);
+            mScenes.erase(iter);
+        }
+    }
+
+    // loading and building the BVH are the slow parts, don't block the other scenes
+    GLSLPathTracer::Scene* scene = ReadCache(filepath, key);
+    if (scene)
+    {
+        Log("Scene %s read from cache\n", filepath.c_str());
+    }
+    else
+    {
+        scene = GLSLPathTracer::LoadScene(filepath);
+        if (!scene)
+        {
+            Log("Unable to load scene\n");
+            return nullptr;
+        }
+        Log("Scene Loaded\n\n");
+        scene->buildBVH();
+        WriteCache(scene, key);
+    }
+
+    size_t geometrySize = GetGeometrySize(scene);
+    size_t textureSize = GetTextureSize(scene);
+    Log("Triangles: %d\n", int(scene->triangleIndices.size()));
+    Log("Triangle Indices: %d\n", int(scene->gpuBVH->bvhTriangleIndices.size()));
+    Log("Vertices: %d\n", int(scene->vertexData.size()));
+    Log("GPU Memory used for BVH and scene data: %d MB\n", int(geometrySize / 1048576));
+    Log("GPU Memory used for Textures: %d MB\n", int(textureSize / 1048576));
+    Log("Total GPU Memory used: %d MB\n", int((geometrySize + textureSize) / 1048576));
+
+    std::shared_ptr<GLSLPathTracer::Scene> sharedScene(scene);
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    auto iter = mScenes.find(filepath);
+    if (iter != mScenes.end())
+    {
+        Entry& entry = iter->second;
+        if (entry.mKey == key)
+        {
+            // loaded concurrently by another job
+            mLRU.splice(mLRU.begin(), mLRU, entry.mLRU);
+            entry.mPending = true;
+            return entry.mScene;
+        }
+        mBytes -= entry.mSize;
+        mLRU.erase(entry.mLRU);
+        mScenes.erase(iter);
+    }
+    Entry& entry = mScenes[filepath];
+    entry.mScene = sharedScene;
+    entry.mKey = key;
+    entry.mSize = geometrySize + textureSize;
+    entry.mPending = true;
+    entry.mLRU = mLRU.insert(mLRU.begin(), filepath);
+    mBytes += entry.mSize;
+    EvictToBudget();
+    return sharedScene;
+}
+
+std::shared_ptr<GLSLPathTracer::Scene> RTSceneCache::Find(const void* scene)
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    for (auto& item : mScenes)
+    {
+        Entry& entry = item.second;
+        if (entry.mScene.get() == scene)
+        {
+            entry.mPending = false;
+            return entry.mScene;
+        }
+    }
+    return nullptr;
+}
+
+void RTSceneCache::EvictToBudget()
+{
+    auto iter = mLRU.end();
+    while (mBytes > mBudget && iter != mLRU.begin())
+    {
+        --iter;
+        auto sceneIter = mScenes.find(*iter);
+        const Entry& entry = sceneIter->second;
+        if (entry.mPending || entry.mScene.use_count() > 1)
+            continue;
+        mBytes -= entry.mSize;
+        mScenes.erase(sceneIter);
+        iter = mLRU.erase(iter);
+    }
+}
+
+void RTSceneCache::SetBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    mBudget = budget;
+    EvictToBudget();
+}
+
+void RTSceneCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mCacheAccess);
+    mScenes.clear();
+    mLRU.clear();
+    mBytes = 0;
+}
@@ -0,0 +1,77 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#pragma once
+#include <string>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+namespace GLSLPathTracer
+{
+    class Scene;
+}
+
+// Path tracer scenes with their BVH. Scenes are kept in memory and saved in a binary cache file
+// so opening a scene again skips parsing, texture decoding and the BVH build.
+// Entries are validated against the scene file content and the stamps of the files it references.
+struct RTSceneCache
+{
+    RTSceneCache();
+
+    // memory, then cache file, then scene file. returns nullptr if the scene can't be loaded
+    std::shared_ptr<GLSLPathTracer::Scene> GetScene(const std::string& filepath);
+    // shared reference of a scene returned by GetScene. Scenes cross the C API as raw pointers
+    std::shared_ptr<GLSLPathTracer::Scene> Find(const void* scene);
+    // only scenes not referenced by a stage are evicted
+    void SetBudget(size_t budget);
+    size_t GetBudget() const
+    {
+        return mBudget;
+    }
+    void Clear();
+
+protected:
+    struct Entry
+    {
+        std::shared_ptr<GLSLPathTracer::Scene> mScene;
+        uint64_t mKey;
+        size_t mSize;
+        // returned by GetScene and not yet registered with Find. Kept until then
+        bool mPending;
+        std::list<std::string>::iterator mLRU;
+    };
+    void EvictToBudget();
+
+    std::map<std::string, Entry> mScenes;
+    std::list<std::string> mLRU; // most recently used first
+    std::mutex mCacheAccess;
+    size_t mBudget;
+    size_t mBytes;
+};
+extern RTSceneCache gRTSceneCache;
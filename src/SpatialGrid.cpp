@@ -0,0 +1,151 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "Platform.h"
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <math.h>
+
+// keeps memory bounded when a few nodes are far away from the others
+static const int MaxCellCount = 64 * 1024;
+
+SpatialGrid::SpatialGrid(float cellSize)
+    : mCellSize(cellSize), mInvCellSize(1.f / cellSize), mOrigin(0.f, 0.f), mWidth(0), mHeight(0), mCurrentStamp(0)
+{
+}
+
+void SpatialGrid::Clear()
+{
+    mRects.clear();
+    mCellStart.clear();
+    mCellItems.clear();
+    mQueryStamp.clear();
+    mWidth = mHeight = 0;
+}
+
+void SpatialGrid::GetCellRange(const ImRect& rect, int& minX, int& minY, int& maxX, int& maxY) const
+{
+    // clamp before the int conversion, query rectangles can be far outside the grid
+    const float lastX = float(mWidth - 1);
+    const float lastY = float(mHeight - 1);
+    minX = int(ImClamp(floorf((rect.Min.x - mOrigin.x) * mInvCellSize), 0.f, lastX));
+    minY = int(ImClamp(floorf((rect.Min.y - mOrigin.y) * mInvCellSize), 0.f, lastY));
+    maxX = int(ImClamp(floorf((rect.Max.x - mOrigin.x) * mInvCellSize), 0.f, lastX));
+    maxY = int(ImClamp(floorf((rect.Max.y - mOrigin.y) * mInvCellSize), 0.f, lastY));
+}
+
+void SpatialGrid::Build(const std::vector<ImRect>& rects)
+{
+    Clear();
+    if (rects.empty())
+        return;
+
+    mRects = rects;
+    mQueryStamp.resize(rects.size(), 0);
+    mCurrentStamp = 0;
+
+    // empty rectangles (Min > Max) are kept for their index but never returned
+    ImRect bounds;
+    for (auto& rect : rects)
+        bounds.Add(rect);
+    if (bounds.Min.x > bounds.Max.x || bounds.Min.y > bounds.Max.y)
+        return;
+
+    float cellSize = mCellSize;
+    ImVec2 boundsSize = bounds.GetSize();
+    while ((floorf(boundsSize.x / cellSize) + 1.f) * (floorf(boundsSize.y / cellSize) + 1.f) > float(MaxCellCount))
+        cellSize *= 2.f;
+    mInvCellSize = 1.f / cellSize;
+    mOrigin = bounds.Min;
+    mWidth = int(boundsSize.x * mInvCellSize) + 1;
+    mHeight = int(boundsSize.y * mInvCellSize) + 1;
+
+    // count then fill, items stay sorted by index in each cell
+    mCellStart.assign(mWidth * mHeight + 1, 0);
+    for (auto& rect : mRects)
+    {
+        if (rect.Min.x > rect.Max.x || rect.Min.y > rect.Max.y)
+            continue;
+        int minX, minY, maxX, maxY;
+        GetCellRange(rect, minX, minY, maxX, maxY);
+        for (int y = minY; y <= maxY; y++)
+        {
+            for (int x = minX; x <= maxX; x++)
+                mCellStart[y * mWidth + x + 1]++;
+        }
+    }
+    for (size_t i = 1; i < mCellStart.size(); i++)
+        mCellStart[i] += mCellStart[i - 1];
+
+    mCellItems.resize(mCellStart.back());
+    std::vector<int> cellFill(mCellStart.begin(), mCellStart.end() - 1);
+    for (int i = 0; i < int(mRects.size()); i++)
+    {
+        if (mRects[i].Min.x > mRects[i].Max.x || mRects[i].Min.y > mRects[i].Max.y)
+            continue;
+        int minX, minY, maxX, maxY;
+        GetCellRange(mRects[i], minX, minY, maxX, maxY);
+        for (int y = minY; y <= maxY; y++)
+        {
+            for (int x = minX; x <= maxX; x++)
+                mCellItems[cellFill[y * mWidth + x]++] = i;
+        }
+    }
+}
+
+void SpatialGrid::Query(const ImRect& rect, std::vector<int>& result) const
+{
+    result.clear();
+    if (!mWidth || !mHeight)
+        return;
+
+    // stamps avoid returning a rectangle spanning several cells more than once
+    if (!++mCurrentStamp)
+    {
+        std::fill(mQueryStamp.begin(), mQueryStamp.end(), 0);
+        mCurrentStamp = 1;
+    }
+
+    int minX, minY, maxX, maxY;
+    GetCellRange(rect, minX, minY, maxX, maxY);
+    for (int y = minY; y <= maxY; y++)
+    {
+        for (int x = minX; x <= maxX; x++)
+        {
+            const int cell = y * mWidth + x;
+            for (int item = mCellStart[cell]; item < mCellStart[cell + 1]; item++)
+            {
+                const int index = mCellItems[item];
+                if (mQueryStamp[index] == mCurrentStamp)
+                    continue;
+                mQueryStamp[index] = mCurrentStamp;
+                if (mRects[index].Overlaps(rect))
+                    result.push_back(index);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
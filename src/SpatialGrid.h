@@ -0,0 +1,62 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "imgui.h"
+#include "imgui_internal.h"
+
+// Uniform grid over rectangles, used by the node graph to only process what is visible or under the mouse.
+// Rectangles are stored as cell ranges in a compact array, the grid is rebuilt when the rectangles change.
+struct SpatialGrid
+{
+    SpatialGrid(float cellSize = 256.f);
+
+    void Clear();
+    void Build(const std::vector<ImRect>& rects);
+    // indices of the rectangles overlapping rect, ascending
+    void Query(const ImRect& rect, std::vector<int>& result) const;
+
+    size_t GetCount() const
+    {
+        return mRects.size();
+    }
+
+protected:
+    void GetCellRange(const ImRect& rect, int& minX, int& minY, int& maxX, int& maxY) const;
+
+    float mCellSize;
+    float mInvCellSize;
+    ImVec2 mOrigin;
+    int mWidth, mHeight;
+    std::vector<ImRect> mRects;
+    // mCellStart[cell] to mCellStart[cell + 1] in mCellItems
+    std::vector<int> mCellStart;
+    std::vector<int> mCellItems;
+    mutable std::vector<uint32_t> mQueryStamp;
+    mutable uint32_t mCurrentStamp;
+};
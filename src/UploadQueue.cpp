@@ -0,0 +1,453 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#include "Platform.h"
+#include "UploadQueue.h"
+#include "Utils.h"
+#include "ImageOps.h"
+#include <algorithm>
+#include <stdint.h>
+
+extern TaskScheduler g_TS;
+UploadQueue gUploadQueue;
+
+// WebGL has no buffer mapping, rows are sent from the image bits
+#ifdef __EMSCRIPTEN__
+#define UPLOAD_PIXEL_BUFFERS 0
+#else
+#define UPLOAD_PIXEL_BUFFERS 1
+#endif
+
+// pixel buffers are mapped for the next frames up to this many frame budgets
+static const size_t MapAheadFrames = 4;
+// released pixel buffers kept for the next uploads
+static const size_t MaxFreePixelBuffers = 4;
+
+// texels copied to a mapped pixel buffer by the task threads, in blocks
+struct UploadQueue::CopyTask : TaskSet
+{
+    static const size_t BlockSize = 256 * 1024;
+
+    CopyTask(unsigned char* destination, const unsigned char* source, size_t size)
+        : TaskSet(uint32_t((size + BlockSize - 1) / BlockSize))
+        , mDestination(destination)
+        , mSource(source)
+        , mSize(size)
+    {
+    }
+    virtual void ExecuteRange(TaskSetPartition range, uint32_t threadnum)
+    {
+        size_t begin = range.start * BlockSize;
+        size_t end = std::min(range.end * BlockSize, mSize);
+        memcpy(mDestination + begin, mSource + begin, end - begin);
+    }
+
+    unsigned char* mDestination;
+    const unsigned char* mSource;
+    size_t mSize;
+};
+
+static size_t GetUploadSize(const Image& image)
+{
+    return ImageOps::GetImageSize(image.mWidth, image.mHeight, image.mFormat, image.mNumMips, image.mNumFaces);
+}
+
+UploadQueue::UploadQueue()
+    : mPendingBytes(0), mByteBudget(16 * 1024 * 1024), mTimeBudget(4.f), mMainThread(std::this_thread::get_id())
+{
+}
+
+UploadQueue::~UploadQueue()
+{
+}
+
+bool UploadQueue::IsMainThread() const
+{
+    return std::this_thread::get_id() == mMainThread;
+}
+
+void UploadQueue::Add(unsigned int texture,
+                      int cubeFace,
+                      const Image& image,
+                      std::function<void(unsigned int texture)> onUploaded)
+{
+    if (image.mDataSize < GetUploadSize(image))
+    {
+        Log("Upload of an image without all its texels is skipped.\n");
+        return;
+    }
+    Add(texture, cubeFace, image, image.GetBits(), nullptr, onUploaded);
+}
+
+void UploadQueue::Add(unsigned int texture,
+                      int cubeFace,
+                      const Image& layout,
+                      const unsigned char* bits,
+                      std::shared_ptr<void> owner,
+                      std::function<void(unsigned int texture)> onUploaded)
+{
+    if (!texture || !bits)
+    {
+        Log("Upload of an image without all its texels is skipped.\n");
+        return;
+    }
+    Entry entry;
+    entry.mTexture = texture;
+    entry.mCubeFace = cubeFace;
+    entry.mImage = layout;
+    entry.mBits = bits;
+    entry.mBitsOwner = owner;
+#ifndef GL_BGR
+    // the GLES 3 storage of 16 bits images is half float, it can't be specified with unsigned shorts
+    if (layout.mFormat == TextureFormat::RGB16 || layout.mFormat == TextureFormat::RGBA16)
+    {
+        Image source(layout);
+        if (bits != layout.GetBits())
+        {
+            source.SetBits((unsigned char*)bits, GetUploadSize(layout));
+        }
+        int format = (layout.mFormat == TextureFormat::RGB16) ? TextureFormat::RGB16F : TextureFormat::RGBA16F;
+        ImageOps::Convert(&source, &entry.mImage, format);
+        entry.mBits = entry.mImage.GetBits();
+        entry.mBitsOwner.reset();
+    }
+#endif
+    entry.mOnUploaded = onUploaded;
+    entry.mFace = entry.mMip = entry.mRow = 0;
+    entry.mOffset = 0;
+    entry.mbStarted = false;
+    entry.mPixelBuffer = 0;
+
+    if (!IsMainThread())
+    {
+        // synchronous evaluations on the builder thread
+        size_t bytes = 0;
+        Send(entry, bytes, SIZE_MAX, Clock::time_point::max());
+        if (onUploaded)
+        {
+            onUploaded(texture);
+        }
+        return;
+    }
+
+    // the new image replaces the one not uploaded yet
+    for (auto iter = mEntries.begin(); iter != mEntries.end();)
+    {
+        if (iter->mTexture == texture && iter->mCubeFace == cubeFace)
+        {
+            Release(*iter);
+            iter = mEntries.erase(iter);
+            continue;
+        }
+        ++iter;
+    }
+    mEntries.push_back(std::move(entry));
+}
+
+void UploadQueue::StartCopy(Entry& entry)
+{
+    entry.mbStarted = true;
+#if UPLOAD_PIXEL_BUFFERS
+    size_t size = GetUploadSize(entry.mImage);
+    unsigned int pixelBuffer;
+    if (mFreePixelBuffers.empty())
+    {
+        glGenBuffers(1, &pixelBuffer);
+    }
+    else
+    {
+        pixelBuffer = mFreePixelBuffers.back();
+        mFreePixelBuffers.pop_back();
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+    // new storage each time, the previous upload from this buffer may still be in flight
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!mapped)
+    {
+        glDeleteBuffers(1, &pixelBuffer);
+        return;
+    }
+    entry.mPixelBuffer = pixelBuffer;
+    mPendingBytes += size;
+    entry.mCopy.reset(new CopyTask((unsigned char*)mapped, entry.mBits, size));
+    g_TS.AddTaskSetToPipe(entry.mCopy.get());
+#endif
+}
+
+bool UploadQueue::IsReady(Entry& entry)
+{
+    if (!entry.mbStarted)
+    {
+        return false;
+    }
+#if UPLOAD_PIXEL_BUFFERS
+    if (entry.mCopy)
+    {
+        if (g_TS.GetNumTaskThreads() <= 1)
+        {
+            // no task thread to do the copy
+            g_TS.WaitforTaskSet(entry.mCopy.get());
+        }
+        else if (!entry.mCopy->GetIsComplete())
+        {
+            return false;
+        }
+        entry.mCopy.reset();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.mPixelBuffer);
+        bool valid = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!valid)
+        {
+            // content lost with a display mode change
+            Release(entry);
+        }
+    }
+#endif
+    return true;
+}
+
+bool UploadQueue::Send(Entry& entry, size_t& bytes, size_t byteBudget, Clock::time_point endTime)
+{
+    const Image& image = entry.mImage;
+    bool isCube = entry.mCubeFace != -1 || image.mNumFaces == 6;
+    unsigned int textureType = isCube ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    unsigned int texelSize = textureFormatSize[image.mFormat];
+
+    glBindTexture(textureType, entry.mTexture);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.mPixelBuffer);
+    // image rows are not padded
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    while (entry.mFace < image.mNumFaces && bytes < byteBudget && Clock::now() < endTime)
+    {
+        int width = std::max(image.mWidth >> entry.mMip, 1);
+        int height = std::max(image.mHeight >> entry.mMip, 1);
+        size_t rowSize = size_t(width) * texelSize;
+        size_t budgetRows = (byteBudget - bytes) / rowSize;
+        if (!budgetRows)
+        {
+            // a row bigger than the budget is sent alone so big levels make progress
+            if (bytes)
+            {
+                break;
+            }
+            budgetRows = 1;
+        }
+        int rowCount = int(std::min(size_t(height - entry.mRow), budgetRows));
+        unsigned int target = GL_TEXTURE_2D;
+        if (isCube)
+        {
+            target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + ((entry.mCubeFace != -1) ? entry.mCubeFace : entry.mFace);
+        }
+        // offset in the bound pixel buffer or address in the image
+        const void* pixels =
+            entry.mPixelBuffer ? (const void*)uintptr_t(entry.mOffset) : entry.mBits + entry.mOffset;
+        glTexSubImage2D(target,
+                        entry.mMip,
+                        0,
+                        entry.mRow,
+                        width,
+                        rowCount,
+                        glInputFormats[image.mFormat],
+                        glInputTypes[image.mFormat],
+                        pixels);
+
+        entry.mOffset += rowCount * rowSize;
+        bytes += rowCount * rowSize;
+        entry.mRow += rowCount;
+        if (entry.mRow == height)
+        {
+            entry.mRow = 0;
+            if (++entry.mMip == image.mNumMips)
+            {
+                entry.mMip = 0;
+                entry.mFace++;
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(textureType, 0);
+    return entry.mFace == image.mNumFaces;
+}
+
+void UploadQueue::Release(Entry& entry)
+{
+    if (!entry.mPixelBuffer)
+    {
+        return;
+    }
+#if UPLOAD_PIXEL_BUFFERS
+    if (entry.mCopy)
+    {
+        g_TS.WaitforTaskSet(entry.mCopy.get());
+        entry.mCopy.reset();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.mPixelBuffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+#endif
+    size_t size = GetUploadSize(entry.mImage);
+    mPendingBytes -= size;
+    // memory of buffers bigger than a frame budget isn't kept for later
+    if (size <= mByteBudget && mFreePixelBuffers.size() < MaxFreePixelBuffers)
+    {
+        mFreePixelBuffers.push_back(entry.mPixelBuffer);
+    }
+    else
+    {
+        glDeleteBuffers(1, &entry.mPixelBuffer);
+    }
+    entry.mPixelBuffer = 0;
+}
+
+std::list<UploadQueue::Entry>::iterator UploadQueue::Finish(std::list<Entry>::iterator entry,
+                                                            UploadedCallbacks& uploaded)
+{
+    if (entry->mOnUploaded)
+    {
+        uploaded.push_back(std::make_pair(std::move(entry->mOnUploaded), entry->mTexture));
+    }
+    Release(*entry);
+    return mEntries.erase(entry);
+}
+
+void UploadQueue::Run()
+{
+    Clock::time_point endTime = Clock::now() + std::chrono::microseconds(int64_t(mTimeBudget * 1000.f));
+
+    // texels of the next uploads are copied by the task threads while this frame sends the ready ones
+    for (auto& entry : mEntries)
+    {
+        if (entry.mbStarted)
+        {
+            continue;
+        }
+        if (mPendingBytes && mPendingBytes + GetUploadSize(entry.mImage) > mByteBudget * MapAheadFrames)
+        {
+            break;
+        }
+        StartCopy(entry);
+    }
+
+    UploadedCallbacks uploaded;
+    size_t bytes = 0;
+    for (auto iter = mEntries.begin(); iter != mEntries.end() && bytes < mByteBudget && Clock::now() < endTime;)
+    {
+        if (!IsReady(*iter))
+        {
+            ++iter;
+            continue;
+        }
+        if (!Send(*iter, bytes, mByteBudget, endTime))
+        {
+            break;
+        }
+        iter = Finish(iter, uploaded);
+    }
+    for (auto& callback : uploaded)
+    {
+        callback.first(callback.second);
+    }
+}
+
+void UploadQueue::Flush(unsigned int texture)
+{
+    if (!IsMainThread())
+    {
+        return;
+    }
+    UploadedCallbacks uploaded;
+    for (auto iter = mEntries.begin(); iter != mEntries.end();)
+    {
+        if (texture && iter->mTexture != texture)
+        {
+            ++iter;
+            continue;
+        }
+        if (iter->mbStarted)
+        {
+#if UPLOAD_PIXEL_BUFFERS
+            if (iter->mCopy)
+            {
+                g_TS.WaitforTaskSet(iter->mCopy.get());
+            }
+#endif
+            IsReady(*iter);
+        }
+        else
+        {
+            // no copy to a pixel buffer for an upload needed now
+            iter->mbStarted = true;
+        }
+        size_t bytes = 0;
+        Send(*iter, bytes, SIZE_MAX, Clock::time_point::max());
+        iter = Finish(iter, uploaded);
+    }
+    for (auto& callback : uploaded)
+    {
+        callback.first(callback.second);
+    }
+}
+
+void UploadQueue::Cancel(unsigned int texture)
+{
+    if (!texture || !IsMainThread())
+    {
+        return;
+    }
+    for (auto iter = mEntries.begin(); iter != mEntries.end();)
+    {
+        if (iter->mTexture == texture)
+        {
+            Release(*iter);
+            iter = mEntries.erase(iter);
+            continue;
+        }
+        ++iter;
+    }
+}
+
+void UploadQueue::SetBudget(size_t bytesPerFrame, float millisecondsPerFrame)
+{
+    mByteBudget = std::max(bytesPerFrame, size_t(1));
+    mTimeBudget = millisecondsPerFrame;
+}
+
+void UploadQueue::Clear()
+{
+    for (auto& entry : mEntries)
+    {
+        Release(entry);
+    }
+    mEntries.clear();
+    if (!mFreePixelBuffers.empty())
+    {
+        glDeleteBuffers(GLsizei(mFreePixelBuffers.size()), mFreePixelBuffers.data());
+        mFreePixelBuffers.clear();
+    }
+}
@@ -0,0 +1,109 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+//
+// Copyright(c) 2019 Cedric Guillemet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#pragma once
+#include <list>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include "Bitmap.h"
+
+// Texture uploads spread over frames. Images are queued with their destination texture, their texels are copied by
+// the task threads into mapped pixel buffers and the main thread sends them with glTexSubImage2D within a per frame
+// budget of bytes and time. Textures get their storage when the upload is queued (see TexStorage).
+// The queue belongs to the main thread: other threads have their own GL context and upload immediately.
+struct UploadQueue
+{
+    UploadQueue();
+    ~UploadQueue();
+
+    // texels of all the mips (and faces) of image are sent to texture, cubeFace -1 for 2D textures and whole cubemaps.
+    // image bits are shared until uploaded. onUploaded is called on the main thread once the texture has them
+    void Add(unsigned int texture,
+             int cubeFace,
+             const Image& image,
+             std::function<void(unsigned int texture)> onUploaded = nullptr);
+    // texels laid out like image but not in an image buffer, owner keeps them alive until they are sent
+    void Add(unsigned int texture,
+             int cubeFace,
+             const Image& layout,
+             const unsigned char* bits,
+             std::shared_ptr<void> owner,
+             std::function<void(unsigned int texture)> onUploaded = nullptr);
+    // once per frame
+    void Run();
+    // pending uploads to texture are done before returning, 0 for all of them
+    void Flush(unsigned int texture = 0);
+    // uploads to a texture about to be deleted are dropped without calling onUploaded
+    void Cancel(unsigned int texture);
+    void SetBudget(size_t bytesPerFrame, float millisecondsPerFrame);
+    // drops everything and releases the pixel buffers, before the GL context is destroyed
+    void Clear();
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+    struct CopyTask;
+    struct Entry
+    {
+        unsigned int mTexture;
+        int mCubeFace;
+        Image mImage;
+        const unsigned char* mBits;
+        std::shared_ptr<void> mBitsOwner;
+        std::function<void(unsigned int texture)> mOnUploaded;
+        // next rows to send
+        int mFace;
+        int mMip;
+        int mRow;
+        size_t mOffset;
+        // texels are in the pixel buffer or the copy is running. No pixel buffer: rows are sent from the image bits
+        bool mbStarted;
+        unsigned int mPixelBuffer;
+        std::unique_ptr<CopyTask> mCopy;
+    };
+    typedef std::vector<std::pair<std::function<void(unsigned int texture)>, unsigned int>> UploadedCallbacks;
+
+    bool IsMainThread() const;
+    void StartCopy(Entry& entry);
+    // false while the copy to the pixel buffer is running
+    bool IsReady(Entry& entry);
+    // returns true once the last row is sent
+    bool Send(Entry& entry, size_t& bytes, size_t byteBudget, Clock::time_point endTime);
+    void Release(Entry& entry);
+    // removes the sent entry, its callback is called by the caller once the queue is consistent
+    std::list<Entry>::iterator Finish(std::list<Entry>::iterator entry, UploadedCallbacks& uploaded);
+
+    std::list<Entry> mEntries;
+    std::vector<unsigned int> mFreePixelBuffers;
+    size_t mPendingBytes; // in pixel buffers
+    size_t mByteBudget;
+    float mTimeBudget;
+    std::thread::id mMainThread;
+};
+
+extern UploadQueue gUploadQueue;
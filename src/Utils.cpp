@@ -26,9 +26,13 @@
 #include "Platform.h"
 #include "Platform.h"
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 #include "Utils.h"
 #include "EvaluationStages.h"
 #include "tinydir.h"
+#include <sys/stat.h>
 
 void TexParam(TextureID MinFilter, TextureID MagFilter, TextureID WrapS, TextureID WrapT, TextureID texMode)
 {
@@ -38,6 +42,36 @@ void TexParam(TextureID MinFilter, TextureID MagFilter, TextureID WrapS, Texture
     glTexParameteri(texMode, GL_TEXTURE_WRAP_T, WrapT);
 }
 
+void TexStorage(TextureID target, int levels, TextureID internalFormat, int width, int height)
+{
+#ifndef __EMSCRIPTEN__
+    // GL 4.2 or ARB_texture_storage
+    if (!glTexStorage2D)
+    {
+        bool isDepth = internalFormat == GL_DEPTH_COMPONENT24;
+        int faceCount = (target == GL_TEXTURE_CUBE_MAP) ? 6 : 1;
+        for (int level = 0; level < levels; level++)
+        {
+            for (int face = 0; face < faceCount; face++)
+            {
+                glTexImage2D((faceCount == 6) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target,
+                             level,
+                             internalFormat,
+                             std::max(width >> level, 1),
+                             std::max(height >> level, 1),
+                             0,
+                             isDepth ? GL_DEPTH_COMPONENT : GL_RGBA,
+                             isDepth ? GL_FLOAT : GL_UNSIGNED_BYTE,
+                             NULL);
+            }
+        }
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        return;
+    }
+#endif
+    glTexStorage2D(target, levels, internalFormat, width, height);
+}
+
 std::string ReplaceAll(std::string str, const std::string& from, const std::string& to)
 {
     size_t start_pos = 0;
@@ -533,6 +567,292 @@ std::string GetGroup(const std::string& name)
     return "";
 }
 
+namespace BufferPool
+{
+    // blocks start with a 16 bytes header so the returned memory keeps malloc alignment
+    struct Header
+    {
+        size_t mCapacity;
+        uint32_t mSizeClass;
+        uint32_t mPad;
+    };
+    static_assert(sizeof(Header) == 16, "BufferPool header must be 16 bytes");
+
+    static const uint32_t MinClassShift = 8;
+    static const uint32_t SizeClassCount = 96;
+    static const uint32_t Unpooled = 0xFFFFFFFF;
+
+    struct FreeList
+    {
+        std::mutex mMutex;
+        std::vector<Header*> mBlocks;
+    };
+    static FreeList gFreeLists[SizeClassCount];
+    static std::atomic<size_t> gRetainedBytes(0);
+    static std::atomic<size_t> gRetainedBudget(256 * 1024 * 1024);
+
+    static uint32_t SizeClass(size_t size)
+    {
+        if (size <= (size_t(1) << MinClassShift))
+            return 0;
+        uint32_t exponent = 0;
+        while ((size - 1) >> (exponent + 1))
+            exponent++;
+        size_t base = size_t(1) << exponent;
+        size_t quarter = base / 4;
+        uint32_t sub = uint32_t((size - base + quarter - 1) / quarter);
+        if (sub == 4)
+        {
+            exponent++;
+            sub = 0;
+        }
+        uint32_t sizeClass = (exponent - MinClassShift) * 4 + sub;
+        return (sizeClass < SizeClassCount) ? sizeClass : Unpooled;
+    }
+
+    static size_t ClassCapacity(uint32_t sizeClass)
+    {
+        size_t base = size_t(1) << (sizeClass / 4 + MinClassShift);
+        return base + (base / 4) * (sizeClass % 4);
+    }
+
+    void* Allocate(size_t size)
+    {
+        uint32_t sizeClass = SizeClass(size);
+        size_t capacity = (sizeClass == Unpooled) ? size : ClassCapacity(sizeClass);
+        Header* header = NULL;
+        if (sizeClass != Unpooled)
+        {
+            FreeList& freeList = gFreeLists[sizeClass];
+            std::lock_guard<std::mutex> lock(freeList.mMutex);
+            if (!freeList.mBlocks.empty())
+            {
+                header = freeList.mBlocks.back();
+                freeList.mBlocks.pop_back();
+                gRetainedBytes -= capacity;
+            }
+        }
+        if (!header)
+        {
+            header = (Header*)malloc(sizeof(Header) + capacity);
+            if (!header)
+                return NULL;
+            header->mCapacity = capacity;
+            header->mSizeClass = sizeClass;
+        }
+        return header + 1;
+    }
+
+    void Free(void* ptr)
+    {
+        if (!ptr)
+            return;
+        Header* header = ((Header*)ptr) - 1;
+        if (header->mSizeClass != Unpooled &&
+            gRetainedBytes.fetch_add(header->mCapacity) + header->mCapacity <= gRetainedBudget)
+        {
+            FreeList& freeList = gFreeLists[header->mSizeClass];
+            std::lock_guard<std::mutex> lock(freeList.mMutex);
+            freeList.mBlocks.push_back(header);
+            return;
+        }
+        if (header->mSizeClass != Unpooled)
+            gRetainedBytes -= header->mCapacity;
+        free(header);
+    }
+
+    size_t Capacity(const void* ptr)
+    {
+        return ptr ? (((const Header*)ptr) - 1)->mCapacity : 0;
+    }
+
+    void SetRetainedBudget(size_t budget)
+    {
+        gRetainedBudget = budget;
+        if (gRetainedBytes > budget)
+            Trim();
+    }
+
+    void Trim()
+    {
+        for (auto& freeList : gFreeLists)
+        {
+            std::lock_guard<std::mutex> lock(freeList.mMutex);
+            for (auto header : freeList.mBlocks)
+            {
+                gRetainedBytes -= header->mCapacity;
+                free(header);
+            }
+            freeList.mBlocks.clear();
+        }
+    }
+} // namespace BufferPool
+
+uint64_t Hash(const void* data, size_t size, uint64_t hash)
+{
+    const uint64_t prime = 0x100000001B3ULL;
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash;
+}
+
+static void WriteVarint(std::vector<unsigned char>& buffer, size_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((unsigned char)value);
+}
+
+static size_t ReadVarint(const std::vector<unsigned char>& buffer, size_t& position)
+{
+    size_t value = 0;
+    for (int shift = 0; position < buffer.size(); shift += 7)
+    {
+        unsigned char byte = buffer[position++];
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+void EncodeDelta(const std::vector<unsigned char>& before,
+                 const std::vector<unsigned char>& after,
+                 std::vector<unsigned char>& delta)
+{
+    assert(before.size() == after.size());
+    delta.clear();
+    const size_t size = before.size();
+    size_t i = 0;
+    while (i < size)
+    {
+        const size_t zeroStart = i;
+        while (i < size && before[i] == after[i])
+            i++;
+        if (i == size)
+            break;
+
+        // short zero runs, like in the middle of a float, stay in the literal
+        const size_t literalStart = i;
+        while (i < size)
+        {
+            if (before[i] == after[i] && i + 2 < size && before[i + 1] == after[i + 1] &&
+                before[i + 2] == after[i + 2])
+                break;
+            i++;
+        }
+        // a literal can only end on a difference
+        size_t literalEnd = i;
+        while (before[literalEnd - 1] == after[literalEnd - 1])
+            literalEnd--;
+
+        WriteVarint(delta, literalStart - zeroStart);
+        WriteVarint(delta, literalEnd - literalStart);
+        for (size_t j = literalStart; j < literalEnd; j++)
+            delta.push_back(before[j] ^ after[j]);
+        i = literalEnd;
+    }
+}
+
+void ApplyDelta(std::vector<unsigned char>& block, const std::vector<unsigned char>& delta)
+{
+    size_t position = 0;
+    size_t blockPosition = 0;
+    while (position < delta.size())
+    {
+        blockPosition += ReadVarint(delta, position);
+        size_t literalCount = ReadVarint(delta, position);
+        for (size_t i = 0; i < literalCount && blockPosition < block.size() && position < delta.size(); i++)
+            block[blockPosition++] ^= delta[position++];
+    }
+}
+
+bool GetFileStamp(const std::string& filepath, int64_t& fileTime, int64_t& fileSize)
+{
+    struct stat fileStat;
+    if (stat(filepath.c_str(), &fileStat))
+        return false;
+    fileTime = int64_t(fileStat.st_mtime);
+    fileSize = int64_t(fileStat.st_size);
+    return true;
+}
+
+MappedFile::MappedFile() : mData(NULL), mSize(0)
+{
+#ifdef WIN32
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+#endif
+}
+
+bool MappedFile::Open(const char* filename)
+{
+#ifdef WIN32
+    mFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    mMapping = NULL;
+    if (GetFileSizeEx(mFile, &fileSize) && fileSize.QuadPart)
+    {
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mMapping)
+    {
+        mData = (const unsigned char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+        mSize = size_t(fileSize.QuadPart);
+    }
+    if (!mData)
+    {
+        Close();
+        return false;
+    }
+    return true;
+#else
+    FILE* fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    mBuffer.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    mSize = fread(mBuffer.data(), 1, mBuffer.size(), fp);
+    fclose(fp);
+    mData = mBuffer.data();
+    return mSize != 0;
+#endif
+}
+
+void MappedFile::Close()
+{
+#ifdef WIN32
+    if (mData)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+    mMapping = NULL;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    mBuffer.clear();
+#endif
+    mData = NULL;
+    mSize = 0;
+}
+
 std::string GetName(const std::string& name)
 {
     for (int i = int(name.length()) - 1; i >= 0; i--)
@@ -28,11 +28,14 @@
 #include <float.h>
 #include <vector>
 #include <math.h>
+#include <stdint.h>
 
 void TagTime(const char* tagInfo);
 
 typedef unsigned int TextureID;
 static const int SemUV0 = 0;
+// per instance world transform, one vec4 column per location
+static const int SemInstanceTransform = 4;
 
 class FullScreenTriangle
 {
@@ -54,6 +57,9 @@ protected:
 
 
 void TexParam(TextureID MinFilter, TextureID MagFilter, TextureID WrapS, TextureID WrapT, TextureID texMode);
+// immutable storage for all the levels (and faces) of a texture. internalFormat must be sized.
+// Drivers without glTexStorage2D get the levels allocated one by one
+void TexStorage(TextureID target, int levels, TextureID internalFormat, int width, int height);
 
 std::string ReplaceAll(std::string str, const std::string& from, const std::string& to);
 
@@ -75,6 +81,54 @@ inline int align(int value, int alignment)
     return (value + alignment - 1) & ~(alignment - 1);
 }
 
+// Size class pool for transient buffers (image texels, job payloads).
+// Sizes are rounded up to 4 classes per power of 2 and freed blocks are kept for reuse
+// up to a retained bytes budget instead of going back to the heap.
+namespace BufferPool
+{
+    void* Allocate(size_t size);
+    void Free(void* ptr);
+    // usable bytes of an allocated block
+    size_t Capacity(const void* ptr);
+    void SetRetainedBudget(size_t budget);
+    // release all retained blocks
+    void Trim();
+} // namespace BufferPool
+
+// 64 bits FNV-1a on 8 bytes words, only used to identify file contents
+uint64_t Hash(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL);
+// XOR of 2 blocks of the same size, run length encoded as (zero count, literal count, literal bytes) with varint
+// counts. Trailing zeros are implicit. Applying the delta to one block gives the other.
+void EncodeDelta(const std::vector<unsigned char>& before,
+                 const std::vector<unsigned char>& after,
+                 std::vector<unsigned char>& delta);
+void ApplyDelta(std::vector<unsigned char>& block, const std::vector<unsigned char>& delta);
+// modification time and size on disk. returns false when the file can't be found
+bool GetFileStamp(const std::string& filepath, int64_t& fileTime, int64_t& fileSize);
+
+// File mapped in memory. Files are opened once, readers access the mapping directly
+struct MappedFile
+{
+    MappedFile();
+    ~MappedFile()
+    {
+        Close();
+    }
+    bool Open(const char* filename);
+    void Close();
+
+    const unsigned char* mData;
+    size_t mSize;
+
+protected:
+#ifdef WIN32
+    void* mFile;
+    void* mMapping;
+#else
+    std::vector<unsigned char> mBuffer;
+#endif
+};
+
 struct Mat4x4;
 
 struct iVec2
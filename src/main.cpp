@@ -23,6 +23,7 @@
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "Evaluators.h"
+#include "UploadQueue.h"
 #include "Loader.h"
 #include "UI.h"
 #include "imMouseState.h"
@@ -279,6 +280,7 @@ int main(int, char**)
     }
     imogen.ValidateCurrentMaterial(library);
 
+    gUploadQueue.Clear();
     g_TS.WaitforAllAndShutdown();
 
     // save lib after all TS thread done in case a job adds something to the library (ie, thumbnail, paint 2D/3D)
@@ -351,6 +353,7 @@ void main_loop(void* arg)
         glDisable(GL_DEPTH_TEST);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         g_TS.RunPinnedTasks();
+        gUploadQueue.Run();
     };
 
     renderImogenFrame(false);